@@ -11,9 +11,23 @@ LOCAL_CFLAGS := -D__GXX_EXPERIMENTAL_CXX0X__
 LOCAL_LDLIBS := -llog -ljnigraphics
 LOCAL_SRC_FILES := libseg.cc \
 									 ../../src/api.cc \
+									 ../../src/async.cc \
+									 ../../src/c_api.cc \
+									 ../../src/color_model.cc \
+									 ../../src/contour.cc \
+									 ../../src/encoding.cc \
 									 ../../src/geodesic.cc \
+									 ../../src/image.cc \
 									 ../../src/kde.cc \
 									 ../../src/matting.cc \
+									 ../../src/pyramid.cc \
+									 ../../src/recording.cc \
+									 ../../src/results.cc \
+									 ../../src/session.cc \
+									 ../../src/stats.cc \
+									 ../../src/stroke.cc \
+									 ../../src/superpixel.cc \
+									 ../../src/trace.cc \
 									 ../../src/third_party/miniglog/glog/logging.cc
 include $(BUILD_SHARED_LIBRARY)
 
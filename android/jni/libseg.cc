@@ -3,13 +3,92 @@
 
 #include <glog/logging.h>
 #include <android/bitmap.h>
-#include "api.h"
+#include "libseg_c.h"
+
+// The JNI glue only goes through the C API (libseg_c.h). The bitmaps are
+// passed to it as strided planes, without any intermediate copy.
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_net_fhtagn_libseg_SimpleMatter_hello(JNIEnv* env, jclass) {
 	return env->NewStringUTF("Hello from JNI");
 }
 
+// Throw a java exception for a failed call, returning true, or return false.
+// The message is the one of libseg_last_error unless given
+static bool ThrowIfFailed(JNIEnv* env, libseg_status status,
+                          const char* message=NULL) {
+  if (status == LIBSEG_OK) {
+    return false;
+  }
+  const char* cls = (status == LIBSEG_ERROR_INVALID_ARGUMENT)
+      ? "java/lang/IllegalArgumentException"
+      : "java/lang/RuntimeException";
+  env->ThrowNew(env->FindClass(cls), message ? message : libseg_last_error());
+  return true;
+}
+
+// A locked bitmap, unlocked when this goes out of scope
+class LockedBitmap {
+ public:
+  LockedBitmap(JNIEnv* env, jobject bitmap)
+    : env_(env), bitmap_(bitmap), pixels_(NULL), locked_(false) {
+    memset(&info_, 0, sizeof(info_));
+    locked_ = AndroidBitmap_getInfo(env, bitmap, &info_)
+                  == ANDROID_BITMAP_RESULT_SUCCESS
+              && AndroidBitmap_lockPixels(env, bitmap, &pixels_)
+                  == ANDROID_BITMAP_RESULT_SUCCESS;
+  }
+  ~LockedBitmap() {
+    if (locked_) {
+      AndroidBitmap_unlockPixels(env_, bitmap_);
+    }
+  }
+
+  // LIBSEG_ERROR_INVALID_ARGUMENT if the bitmap couldn't be locked (e.g.
+  // it is not a bitmap or has been recycled), in which case nothing else
+  // must be used
+  libseg_status status() const {
+    return locked_ ? LIBSEG_OK : LIBSEG_ERROR_INVALID_ARGUMENT;
+  }
+
+  const AndroidBitmapInfo& info() const { return info_; }
+
+  // Channel c of the bitmap as a plane. For RGBA_8888 bitmaps, 0 is red and
+  // 3 alpha
+  libseg_plane Channel(int c) const {
+    libseg_plane p;
+    const bool rgba = info_.format == ANDROID_BITMAP_FORMAT_RGBA_8888;
+    p.data = (uint8_t*)pixels_ + (rgba ? c : 0);
+    p.width = info_.width;
+    p.height = info_.height;
+    p.row_stride = info_.stride;
+    p.pixel_stride = rgba ? 4 : 1;
+    return p;
+  }
+
+ private:
+  JNIEnv* env_;
+  jobject bitmap_;
+  AndroidBitmapInfo info_;
+  void* pixels_;
+  bool locked_;
+};
+
+// Check that bitmap is locked and has format fmt, throwing an exception
+// otherwise
+static bool CheckFormat(JNIEnv* env, const LockedBitmap& bitmap,
+                        AndroidBitmapFormat fmt, const char* message) {
+  if (ThrowIfFailed(env, bitmap.status(), "Can't lock the bitmap")) {
+    return false;
+  }
+  if (bitmap.info().format == fmt) {
+    return true;
+  }
+  env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"),
+                message);
+  return false;
+}
+
 extern "C" JNIEXPORT jlong JNICALL
 Java_net_fhtagn_libseg_SimpleMatter_nativeNew(
     JNIEnv* env,
@@ -17,32 +96,21 @@ Java_net_fhtagn_libseg_SimpleMatter_nativeNew(
     jobject bitmap_image) {
   // TODO RGB => Lab conversion
   // http://www.easyrgb.com/index.php?X=MATH
-  AndroidBitmapInfo bm_info;
-  AndroidBitmap_getInfo(env, bitmap_image, &bm_info);
-  CHECK_EQ(bm_info.format, ANDROID_BITMAP_FORMAT_RGBA_8888)
-    << "Need ARGB_8888 format";
-
-  char* pixels;
-  AndroidBitmap_lockPixels(env, bitmap_image, (void**)&pixels);
-
-  // TODO: SimpleMatter shouldn't make an internal copy
-  const int W = bm_info.width;
-  const int H = bm_info.height;
-  std::unique_ptr<uint8_t[]> r(new uint8_t[W*H]);
-  std::unique_ptr<uint8_t[]> g(new uint8_t[W*H]);
-  std::unique_ptr<uint8_t[]> b(new uint8_t[W*H]);
-
-  for (int i = 0; i < H; ++i) {
-    for (int j = 0; j < W; ++j) {
-      r[i*W + j] = pixels[i*W*4 + j*4];
-      g[i*W + j] = pixels[i*W*4 + j*4 + 1];
-      b[i*W + j] = pixels[i*W*4 + j*4 + 2];
-    }
+  LockedBitmap image(env, bitmap_image);
+  if (!CheckFormat(env, image, ANDROID_BITMAP_FORMAT_RGBA_8888,
+                   "Need ARGB_8888 format")) {
+    return 0;
   }
-
-  SimpleMatter* m = new SimpleMatter(r.get(), g.get(), b.get(), W, H);
-
-  AndroidBitmap_unlockPixels(env, bitmap_image);
+  const libseg_plane r = image.Channel(0);
+  const libseg_plane g = image.Channel(1);
+  const libseg_plane b = image.Channel(2);
+  libseg_matter* m = NULL;
+  if (ThrowIfFailed(env, libseg_matter_new(LIBSEG_SIMPLE_MATTER, &r, &g, &b,
+                                           &m))) {
+    return 0;
+  }
+  // So that the mask can be read while an update is running
+  libseg_matter_set_publish_results(m, 1);
 
   LOG(INFO) << "Created native matter : " << m;
   return (jlong)m;
@@ -54,18 +122,9 @@ Java_net_fhtagn_libseg_SimpleMatter_nativeDestroy(
     JNIEnv* env,
     jclass,
     jlong obj) {
-  SimpleMatter* m = (SimpleMatter*)obj;
+  libseg_matter* m = (libseg_matter*)obj;
   LOG(INFO) << "Destroying native matter : " << m;
-  delete m;
-}
-
-void CheckMaskBitmap(JNIEnv* env, jobject bitmap, int expectedW, int expectedH,
-                     AndroidBitmapFormat fmt=ANDROID_BITMAP_FORMAT_RGBA_8888) {
-  AndroidBitmapInfo bm_info;
-  AndroidBitmap_getInfo(env, bitmap, &bm_info);
-  CHECK_EQ(bm_info.format, fmt) << "Wrong format";
-  CHECK_EQ(bm_info.width, expectedW);
-  CHECK_EQ(bm_info.height, expectedH);
+  libseg_matter_free(m);
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -75,33 +134,19 @@ Java_net_fhtagn_libseg_SimpleMatter_nativeUpdateMasks(
     jlong obj,
     jobject bitmap_bgmask,
     jobject bitmap_fgmask) {
-  SimpleMatter* m = (SimpleMatter*)obj;
-  CheckMaskBitmap(env, bitmap_fgmask, m->GetWidth(), m->GetHeight());
-  CheckMaskBitmap(env, bitmap_bgmask, m->GetWidth(), m->GetHeight());
-
-  uint8_t* bg_pix;
-  uint8_t* fg_pix;
-  AndroidBitmap_lockPixels(env, bitmap_fgmask, (void**)&fg_pix);
-  AndroidBitmap_lockPixels(env, bitmap_bgmask, (void**)&bg_pix);
-
-  const int W = m->GetWidth();
-  const int H = m->GetHeight();
-
-  // TODO: Avoid copy
-  std::unique_ptr<uint8_t[]> fg(new uint8_t[W*H]);
-  std::unique_ptr<uint8_t[]> bg(new uint8_t[W*H]);
-  for (int i = 0; i < H; ++i) {
-    for (int j = 0; j < W; ++j) {
-      // Only consider alpha
-      fg[i*W + j] = fg_pix[i*W*4 + j*4 + 3];
-      bg[i*W + j] = bg_pix[i*W*4 + j*4 + 3];
-    }
+  libseg_matter* m = (libseg_matter*)obj;
+  LockedBitmap fg(env, bitmap_fgmask);
+  LockedBitmap bg(env, bitmap_bgmask);
+  if (!CheckFormat(env, fg, ANDROID_BITMAP_FORMAT_RGBA_8888,
+                   "Need ARGB_8888 format")
+      || !CheckFormat(env, bg, ANDROID_BITMAP_FORMAT_RGBA_8888,
+                      "Need ARGB_8888 format")) {
+    return;
   }
-
-  m->UpdateMasks(bg.get(), fg.get());
-
-  AndroidBitmap_unlockPixels(env, bitmap_bgmask);
-  AndroidBitmap_unlockPixels(env, bitmap_fgmask);
+  // Only consider alpha
+  const libseg_plane bg_alpha = bg.Channel(3);
+  const libseg_plane fg_alpha = fg.Channel(3);
+  ThrowIfFailed(env, libseg_matter_update_masks(m, &bg_alpha, &fg_alpha));
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -110,13 +155,37 @@ Java_net_fhtagn_libseg_SimpleMatter_nativeGetForegroundMask(
     jclass,
     jlong obj,
     jobject bitmap_mask) {
-  SimpleMatter* m = (SimpleMatter*)obj;
-  CheckMaskBitmap(env, bitmap_mask, m->GetWidth(), m->GetHeight(),
-                  ANDROID_BITMAP_FORMAT_A_8);
-  uint8_t* pixels;
-  AndroidBitmap_lockPixels(env, bitmap_mask, (void**)&pixels);
-
-  m->GetForegroundMask(pixels);
+  libseg_matter* m = (libseg_matter*)obj;
+  LockedBitmap mask(env, bitmap_mask);
+  if (!CheckFormat(env, mask, ANDROID_BITMAP_FORMAT_A_8,
+                   "Need ALPHA_8 format")) {
+    return;
+  }
+  const libseg_plane out = mask.Channel(0);
+  ThrowIfFailed(env, libseg_matter_get_mask(m, &out));
+}
 
-  AndroidBitmap_unlockPixels(env, bitmap_mask);
+extern "C" JNIEXPORT void JNICALL
+Java_net_fhtagn_libseg_SimpleMatter_nativeGetStats(
+    JNIEnv* env,
+    jclass,
+    jlong obj,
+    jdoubleArray values) {
+  libseg_matter* m = (libseg_matter*)obj;
+  libseg_stats stats;
+  if (ThrowIfFailed(env, libseg_matter_get_stats(m, &stats))) {
+    return;
+  }
+  // Same order as the MatterStats java class fields
+  const jdouble v[] = {
+    stats.kde_ms, stats.pdf_ms, stats.likelihood_ms, stats.geodesic_ms,
+    stats.mask_ms, stats.total_ms,
+    (jdouble)stats.kde_calls, (jdouble)stats.kde_samples,
+    (jdouble)stats.geodesic_pushes, (jdouble)stats.geodesic_pops,
+    (jdouble)stats.geodesic_stale_pops, (jdouble)stats.geodesic_relaxations,
+    (jdouble)stats.mask_rows_changed,
+  };
+  const jsize n = sizeof(v) / sizeof(v[0]);
+  CHECK_EQ(env->GetArrayLength(values), n);
+  env->SetDoubleArrayRegion(values, 0, n, v);
 }
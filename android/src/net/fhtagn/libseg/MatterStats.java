@@ -0,0 +1,53 @@
+package net.fhtagn.libseg;
+
+// Per-stage timings and counters of the last matter update. See stats.h on
+// the C++ side for the meaning of each field. All zeros if libseg was built
+// with LIBSEG_NO_STATS
+public class MatterStats {
+    // Wall-clock times, in milliseconds
+    public double kdeMs;
+    public double pdfMs;
+    public double likelihoodMs;
+    public double geodesicMs;
+    public double maskMs;
+    public double totalMs;
+
+    public long kdeCalls;
+    public long kdeSamples;
+    public long geodesicPushes;
+    public long geodesicPops;
+    public long geodesicStalePops;
+    public long geodesicRelaxations;
+    public long maskRowsChanged;
+
+    // Number of values in the array filled by the native side, in the order
+    // of the fields above
+    static final int NUM_VALUES = 13;
+
+    MatterStats(double[] values) {
+        kdeMs = values[0];
+        pdfMs = values[1];
+        likelihoodMs = values[2];
+        geodesicMs = values[3];
+        maskMs = values[4];
+        totalMs = values[5];
+        kdeCalls = (long)values[6];
+        kdeSamples = (long)values[7];
+        geodesicPushes = (long)values[8];
+        geodesicPops = (long)values[9];
+        geodesicStalePops = (long)values[10];
+        geodesicRelaxations = (long)values[11];
+        maskRowsChanged = (long)values[12];
+    }
+
+    @Override
+    public String toString() {
+        return String.format("total %.1fms (kde %.1fms, pdf %.1fms, "
+                             + "likelihood %.1fms, geodesic %.1fms, "
+                             + "mask %.1fms), %d kde samples, %d pops "
+                             + "(%d stale), %d relaxations",
+                             totalMs, kdeMs, pdfMs, likelihoodMs, geodesicMs,
+                             maskMs, kdeSamples, geodesicPops,
+                             geodesicStalePops, geodesicRelaxations);
+    }
+}
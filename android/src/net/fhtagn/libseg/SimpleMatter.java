@@ -9,7 +9,9 @@ public class SimpleMatter {
     // The image being matted. Do NOT modify this directly
     public Bitmap image;
     
-    // TODO: We need to handle locking somewhat
+    // updateMatter calls are serialized. getForegroundMask can be called
+    // from any thread, even while updateMatter is running : it gets the mask
+    // of the last completed update without waiting for the running one
     
     // The client application should directly modify the bitmaps here and then
     // call updateMatter() to redo the matting 
@@ -44,6 +46,19 @@ public class SimpleMatter {
         nativeUpdateMasks(nativeMatter, bgScribbles, fgScribbles);
         nativeGetForegroundMask(nativeMatter, finalMask);
     }
+
+    // Copy the mask of the last completed update to mask (an ALPHA_8 bitmap
+    // of the image size)
+    public void getForegroundMask(Bitmap mask) {
+        nativeGetForegroundMask(nativeMatter, mask);
+    }
+
+    // Timings and counters of the last updateMatter
+    public synchronized MatterStats getStats() {
+        double[] values = new double[MatterStats.NUM_VALUES];
+        nativeGetStats(nativeMatter, values);
+        return new MatterStats(values);
+    }
     
     // TODO: JNI methods have to be private ?
     static native String hello();
@@ -52,8 +67,11 @@ public class SimpleMatter {
     static native long nativeNew(Bitmap image);
     static native void nativeDestroy(long obj);
     static native void nativeUpdateMasks(long obj, Bitmap bgmask, Bitmap fgmask);
-    // Get the foreground mask resulting from the matting
+    // Get the foreground mask resulting from the last completed matting.
+    // Doesn't wait for a running update
     static native void nativeGetForegroundMask(long obj, Bitmap mask);
+    // Fill values with the MatterStats fields, see MatterStats(double[])
+    static native void nativeGetStats(long obj, double[] values);
    
     static {
         System.loadLibrary("gnustl_shared");
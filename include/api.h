@@ -3,16 +3,65 @@
 
 #include <memory>
 #include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
 #include <string.h>
 
+#include "color_model.h"
+#include "contour.h"
+#include "image.h"
+#include "recording.h"
+#include "results.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "stroke.h"
+#include "superpixel.h"
 #include "utils.h"
+#include "workspace.h"
+
+class GeodesicPropagation;
+
+// Deleter for the W*H planes of a matter, which are either allocated by the
+// matter or borrowed from a memory-mapped session file (see
+// InteractiveMatter::LoadSession), in which case they are not freed here
+template<class T>
+struct PlaneDeleter {
+  PlaneDeleter(bool owned=true) : owned(owned) {}
+  void operator()(T* p) const {
+    if (owned) {
+      delete[] p;
+    }
+  }
+  bool owned;
+};
+
+template<class T>
+using Plane = std::unique_ptr<T[], PlaneDeleter<T>>;
 
 class Matter {
  public:
   Matter(uint8_t* lab_l, uint8_t* lab_a,
          uint8_t* lab_b, int W, int H);
+  // A matter on a shared image (see image.h), without copying it
+  explicit Matter(const std::shared_ptr<const LabImage>& image);
   virtual ~Matter();
 
+  // Background precomputation. The work that only depends on the image and
+  // on the mode of the matter runs on a background thread : initializing the
+  // planes (started by the constructor), the preview matter of
+  // SetPreviewFactor and the superpixels of SetSuperpixelSize. Creating a
+  // matter and setting its mode then return right away, and that work
+  // overlaps with the user's first stroke instead of adding to the latency of
+  // the first update. The other methods wait for it, so it is transparent to
+  // callers, but the first of them may block for whatever is left.
+  //
+  // The returned future becomes ready once the matter is. Waiting on it is
+  // optional, e.g. to show a busy indicator.
+  std::shared_future<void> Ready() const { return ready_; }
+
   // Fill mask with the foreground mask resulting from the matting.
   // 255 indicates foreground pixels, 0 background.
   void GetForegroundMask(uint8_t* mask);
@@ -23,20 +72,256 @@ class Matter {
   void GetForegroundDist(double* out);
   void GetBackgroundDist(double* out);
 
-  int GetWidth() { return W; }
-  int GetHeight() { return H; }
+  // Same as GetForegroundMask, but packed to 1 bit per pixel or run-length
+  // encoded (see encoding.h for the formats). bits must hold
+  // PackedMaskStride(W)*H bytes.
+  void GetForegroundMaskBits(uint8_t* bits) const;
+  void GetForegroundMaskRLE(std::vector<uint32_t>* runs) const;
+
+  // Read-only views of the current results (W*H row-major, same content as
+  // the Get* above), without any copy.
+  // The pointers stay the same for the whole lifetime of the matter, but
+  // what they point to is only consistent until the next call that modifies
+  // the matter (adding or removing scribbles, UpdateMasks, Undo, ...). Do not
+  // read them concurrently with such a call.
+  const uint8_t* ForegroundMaskView() const {
+    WaitReady();
+    return final_mask.get();
+  }
+  const double* ForegroundLikelihoodView() const {
+    WaitReady();
+    return fg_likelihood.get();
+  }
+  const double* BackgroundLikelihoodView() const {
+    WaitReady();
+    return bg_likelihood.get();
+  }
+  const double* ForegroundDistView() const {
+    WaitReady();
+    return fg_dist.get();
+  }
+  const double* BackgroundDistView() const {
+    WaitReady();
+    return bg_dist.get();
+  }
+
+  int GetWidth() const { return W; }
+  int GetHeight() const { return H; }
+
+  // The image, to create other matters sharing it
+  std::shared_ptr<const LabImage> GetImage() const { return image_; }
+
+  // Change tracking. The matter keeps track of the pixels whose label differs
+  // from what it was at the last ClearChanges (or at construction, when the
+  // mask is all background), so that a client mirroring the mask only has to
+  // transfer and redraw those after an update. A pixel that flipped and then
+  // flipped back in between is not reported.
+  // Only the rows touched by the updates are scanned to compute the changes.
+  bool HasChanges() const;
+
+  // The changed pixels as maximal runs, sorted by row then x
+  void GetChangedSpans(std::vector<RowSpan>* spans) const;
+
+  // Rectangles covering all the changed pixels. Spans on consecutive rows
+  // that overlap horizontally are merged in the same rectangle.
+  void GetDirtyRects(std::vector<Rect>* rects) const;
+
+  // W*H mask with 255 for the changed pixels, 0 elsewhere. XOR-ing it to the
+  // mask as of the last ClearChanges gives the current mask.
+  void GetDeltaMask(uint8_t* delta) const;
+
+  // Start tracking changes from the current mask
+  void ClearChanges();
+
+  // Vector contours of the foreground mask (see ContourTracer), simplified
+  // with a Douglas-Peucker tolerance in pixels.
+  // The boundary is maintained across calls, only the rows touched by the
+  // updates since the last call are synced, so the cost is proportional to
+  // the size of the changes plus the length of the boundary.
+  void GetContours(double tolerance, std::vector<Contour>* contours);
+
+  // Multi-resolution mode. With factor > 1, an update first runs the whole
+  // pipeline (KDE, likelihoods, geodesic distances) on the image downsampled
+  // by factor, with the scribbles mapped to it. The resulting mask is
+  // upsampled with a joint bilateral filter guided by the full resolution
+  // image : this is the preview, at which point the preview callback is
+  // called. Then the full resolution color models and likelihoods are
+  // computed and the geodesic distances are only recomputed in the band
+  // around the boundary where the preview is uncertain, the rest of the
+  // image keeping the upsampled distances.
+  // 1 (the default) disables it.
+  virtual void SetPreviewFactor(int factor);
+  int GetPreviewFactor() const { return preview_factor_; }
+
+  // Called from within updates (so from the thread doing them) as soon as
+  // the preview mask is available through the getters and views
+  void SetPreviewCallback(const std::function<void()>& on_preview);
+
+  // Superpixel mode. The image is over-segmented once into SLIC superpixels
+  // of about region_size pixels of side, which are cached in the matter. The
+  // geodesic distances are then computed on their adjacency graph, each
+  // superpixel having the mean likelihood of its pixels, and projected back
+  // to the pixels. So the labels follow the superpixels boundaries and an
+  // update only runs Dijkstra on a graph of about W*H/region_size^2 nodes.
+  // This is best called right after construction, as it only affects the
+  // following updates. 0 (the default) disables it.
+  // This can't be combined with the preview mode, and the time-bounded
+  // InteractiveMatter::AddScribble runs to completion in this mode.
+  virtual void SetSuperpixelSize(int region_size, double compactness=10);
+  int GetSuperpixelSize() const { return superpixel_size_; }
+  int NumSuperpixels() const;
+
+  // Per-stage timings and counters of the last update (UpdateMasks,
+  // AddScribble(s), ContinueUpdate or RemoveScribble), see stats.h. All zeros
+  // when built with LIBSEG_NO_STATS.
+  void GetStats(MatterStats* stats) const { *stats = stats_; }
+
+  // Results publication for concurrent readers. When enabled, the matter
+  // publishes an immutable copy of its results (see results.h) at the end of
+  // each call that modifies them, and when the preview of an update is
+  // available. Any number of threads can then call LatestResults while the
+  // matter is being updated : they get the results of the last completed
+  // update without blocking it, while the Get* and *View methods must not be
+  // used concurrently with an update.
+  // Publishing costs a copy of the planes per update. Enabling it publishes
+  // the current results right away. It is disabled by default, and must not
+  // be toggled while other threads call LatestResults.
+  void SetPublishResults(bool enable);
+
+  // The latest published results, NULL if publication is disabled. Can be
+  // called from any thread, including during an update.
+  std::shared_ptr<const Results> LatestResults() const {
+    return publisher_ ? publisher_->Latest() : NULL;
+  }
+
+  // Use ws as the scratch memory of the updates (see workspace.h) instead of
+  // the matter's own. ws must outlive the matter, or be replaced before it is
+  // destroyed. NULL reverts to the matter's own workspace.
+  void SetWorkspace(Workspace* ws);
+
+  // Approximate heap memory held by the matter, in bytes : its planes and
+  // change tracking, its own workspace, its preview matter and, for an
+  // InteractiveMatter, its scribbles, undo history and scribble cache. The
+  // image is not counted, as it can be shared (see image.h). The planes of a
+  // memory-mapped session are counted in full, even though only the pages
+  // that have been touched are resident.
+  virtual size_t MemoryUsage() const;
 
  protected:
+  // A matter without planes, for InteractiveMatter::LoadSession to fill in.
+  // It must set the planes and channels and then call ClearChanges.
+  Matter(int W, int H);
+
+  // Wait for the background precomputation. Called first by the methods that
+  // use the planes, the preview matter or the superpixels.
+  void WaitReady() const { ready_.wait(); }
+
+  // Run task on a background thread (shared by all the matters), after the
+  // previous ones. ready_ is then ready once it is done.
+  void Precompute(const std::function<void()>& task);
+
+  // Recompute final_mask from the distance maps, keeping track of the rows
+  // where the labels changed
+  void UpdateFinalMask();
+
+  // To call after final_mask has been modified by other means than
+  // UpdateFinalMask
+  void MarkAllRowsDirty();
+
+  // The matter the previews are computed with, on the downsampled image
+  virtual Matter* NewPreview(const std::shared_ptr<const LabImage>& image)
+      = 0;
+
+  // Upsample the mask and distances of preview_ to final_mask and
+  // fg_dist/bg_dist, compute band_ and call the preview callback
+  void UpsamplePreview();
+
+  // Geodesic distance to sources over height, on the pixels or on the
+  // superpixel graph depending on the mode
+  bool DistanceMap(const std::vector<Point2i>& sources, const double* height,
+                   double* dists, const CancelFlag* cancel=NULL) const;
+  // Only the scribbles with s.background == background are sources
+  bool DistanceMap(const std::vector<Scribble>& scribbles, bool background,
+                   const double* height, double* dists,
+                   const CancelFlag* cancel=NULL) const;
+
+  // Recompute fg_dist and bg_dist in band_ from the current likelihoods and
+  // the given sources, then the final mask
+  void RefineBand(const std::vector<Point2i>& fg_sources,
+                  const std::vector<Point2i>& bg_sources);
+
   int W, H;
-  std::unique_ptr<uint8_t[]> lab_l, lab_a, lab_b;
+  std::shared_ptr<const LabImage> image_;
   // TODO: We do not actually need the pdf for each pixel of the image. Use
   // a simple lookup table of pixel intensity to pdf instead
-  std::unique_ptr<double[]> fg_pdf, bg_pdf;
-  std::unique_ptr<double[]> fg_likelihood, bg_likelihood;
-  std::unique_ptr<double[]> fg_dist, bg_dist;
-  std::unique_ptr<uint8_t[]> final_mask;
+  Plane<double> fg_pdf, bg_pdf;
+  Plane<double> fg_likelihood, bg_likelihood;
+  Plane<double> fg_dist, bg_dist;
+  Plane<uint8_t> final_mask;
+  // Keeps the borrowed planes alive, if any
+  std::shared_ptr<const void> storage_;
+
+  // The planes of image_
+  const uint8_t* channels[3];
+
+  int preview_factor_;
+  std::unique_ptr<Matter> preview_;
+  // Pixels refined at full resolution after a preview
+  std::unique_ptr<uint8_t[]> band_;
+
+  int superpixel_size_;
+  double superpixel_compactness_;
+  // Set by a background task, see Ready
+  std::shared_ptr<const SuperpixelGraph> superpixels_;
+
+  MatterStats stats_;
+
+  // Held by the methods that modify the results. The results are published
+  // when the outermost one ends
+  class UpdateScope {
+   public:
+    explicit UpdateScope(Matter* matter);
+    ~UpdateScope();
+
+   private:
+    Matter* matter_;
+  };
+
+  // Publish the current results, if enabled
+  void PublishResults();
+
+  // Scratch memory of the updates, either own_workspace_ or the one given to
+  // SetWorkspace
+  Workspace* workspace_;
+
+ private:
+  std::unique_ptr<Workspace> own_workspace_;
+
+  // NULL unless publication is enabled. Set before any reader can call
+  // LatestResults
+  std::unique_ptr<ResultsPublisher> publisher_;
+  int update_depth_;
 
-  uint8_t* channels[3];
+  // Copy a row of the final mask, keeping track of the changes
+  void CommitMaskRow(int y, const uint8_t* row);
+
+  // Mask as of the last ClearChanges and rows where final_mask might differ
+  // from it
+  std::unique_ptr<uint8_t[]> changes_ref_;
+  std::vector<bool> dirty_rows_;
+
+  // Created by the first GetContours call, along with the rows touched since
+  // the last one
+  std::unique_ptr<ContourTracer> contour_tracer_;
+  std::vector<bool> contour_rows_;
+
+  std::function<void()> on_preview_;
+
+  // See Ready
+  std::shared_future<void> ready_;
+
+  // A future that is already ready
+  static std::shared_future<void> ReadyFuture();
 };
 
 // A simpler API that doesn't have the notion of scribbles ordering, but just
@@ -47,9 +332,92 @@ class SimpleMatter : public Matter {
   // a W*H array stored in row-major order
   // Matter makes an internal copy of the image
   SimpleMatter(uint8_t* lab_l, uint8_t* lab_a, uint8_t* lab_b, int W, int H);
+  // On a shared image, see image.h
+  explicit SimpleMatter(const std::shared_ptr<const LabImage>& image);
   virtual ~SimpleMatter();
 
+  // The masks are compared with the ones of the previous call, and only what
+  // they affect is recomputed :
+  // - the color model of a class is only estimated again if its mask changed
+  //   (and never if it was imported, see SetColorModel)
+  // - nothing is done if none of the masks or models changed
+  // - if the color models are unchanged and a mask only grew, its distance
+  //   map is warm-started : the new pixels are propagated from the existing
+  //   distances instead of recomputing the whole map
   void UpdateMasks(uint8_t* bg_mask, uint8_t* fg_mask);
+
+  // By default, the color model of a class is estimated again whenever its
+  // mask changes, so that the results are the same as those of a fresh
+  // matter. With a threshold t > 0, a mask that only grew keeps its color
+  // model until it has more than (1 + t) times the pixels the model was
+  // estimated with. Small additions then only cost a warm-started geodesic
+  // pass, at the price of a slightly stale model.
+  void SetModelRefitThreshold(double threshold);
+
+  // Export the color model of the background or foreground class, as used
+  // by the last UpdateMasks (estimated from the mask or imported). The model
+  // has no channels before the first update.
+  void GetColorModel(bool background, ColorModel* model) const;
+
+  // Import a color model (see color_model.h), e.g. one exported from the
+  // matter of another image with the same colors. The class then keeps this
+  // model instead of estimating it from its mask, and the next UpdateMasks
+  // only computes the likelihoods and the distance maps. The mask of the
+  // class still gives the geodesic sources, so a few seed scribbles are
+  // enough. model must be valid (IsValidColorModel).
+  void SetColorModel(bool background, const ColorModel& model);
+
+  // Go back to estimating the model of the class from its mask
+  void ClearColorModel(bool background);
+
+  void SetPreviewFactor(int factor);
+  void SetSuperpixelSize(int region_size, double compactness=10);
+
+  size_t MemoryUsage() const;
+
+ protected:
+  Matter* NewPreview(const std::shared_ptr<const LabImage>& image);
+
+ private:
+  // A class as of the last UpdateMasks
+  struct ClassState {
+    ClassState() : count(0), model_count(0), imported(false),
+                   model_changed(false) {}
+    // 1 for the pixels of the mask, empty before the first update
+    std::vector<uint8_t> mask;
+    size_t count;
+    // count when the color model was last estimated
+    size_t model_count;
+    ColorModel model;
+    // model was given to SetColorModel
+    bool imported;
+    // model was imported or cleared since the last update
+    bool model_changed;
+  };
+
+  enum MaskChange {
+    MASK_UNCHANGED,
+    // Only gained pixels
+    MASK_GROWN,
+    MASK_CHANGED
+  };
+
+  // Compare mask with state, update state to it and set added to the pixels
+  // that were not in the previous mask
+  MaskChange DiffMask(const uint8_t* mask, ClassState* state,
+                      std::vector<Point2i>* added) const;
+
+  bool NeedsRefit(MaskChange change, const ClassState& state) const;
+
+  // pdf from the imported model of the class, or from a model estimated
+  // from mask
+  void UpdateColorModel(const uint8_t* mask, ClassState* state, double* pdf);
+
+  // Forget the previous masks, so that the next update recomputes everything
+  void ResetMaskState();
+
+  ClassState bg_state_, fg_state_;
+  double refit_threshold_;
 };
 
 // Contains the current state of the matting
@@ -63,6 +431,8 @@ class InteractiveMatter : public Matter {
   // Matter makes an internal copy of the image
   InteractiveMatter(uint8_t* lab_l, uint8_t* lab_a,
                     uint8_t* lab_b, int W, int H);
+  // On a shared image, see image.h
+  explicit InteractiveMatter(const std::shared_ptr<const LabImage>& image);
   virtual ~InteractiveMatter();
 
 
@@ -75,15 +445,312 @@ class InteractiveMatter : public Matter {
   // scribbles but in different order might result in different result.
   void AddScribble(const Scribble& s);
 
+  // Add a brush stroke (see stroke.h) as a scribble. The stroke is rasterized
+  // once, clipped to the image and without duplicate pixels. Its pixels that
+  // are already covered by a scribble of the other class are dropped : a
+  // pixel keeps the class it was first scribbled with (RemoveScribble or Undo
+  // can change that).
+  // Returns the number of pixels of the added scribble (0 if nothing was
+  // left, in which case nothing is added). If nconflicts is not NULL, it is
+  // set to the number of pixels dropped because of a conflict.
+  size_t AddStroke(const Stroke& stroke, size_t* nconflicts=NULL);
+
+  // Add several scribbles at once. Runs of consecutive scribbles of the same
+  // class are coalesced into a single update (one KDE and one geodesic pass
+  // for the whole run) instead of one update per scribble.
+  //
+  // If cancel gets set while a run is being computed, the run is abandoned at
+  // the next safe checkpoint and the matter is left as it was before that
+  // run. Returns the number of scribbles of ss that have been processed,
+  // which is less than ss.size() only if the update was cancelled.
+  size_t AddScribbles(const std::vector<Scribble>& ss,
+                      const CancelFlag* cancel=NULL);
+
+  // Time-bounded version of AddScribble. The scribble is queued and the
+  // queued scribbles are processed for at most budget_ms milliseconds.
+  // Returns true if everything has been processed.
+  //
+  // Only the geodesic propagation is bounded (KDE and likelihoods are much
+  // cheaper and always run to completion). When the budget is spent, the mask
+  // is updated for the pixels whose new distance is already final, the other
+  // pixels keep their previous label. The propagation state is kept, so a
+  // follow-up call to ContinueUpdate picks up where this one stopped.
+  bool AddScribble(const Scribble& s, double budget_ms);
+
+  // Continue processing the queued scribbles for at most budget_ms
+  // milliseconds. Returns true if everything has been processed.
+  bool ContinueUpdate(double budget_ms);
+
+  // True if some scribbles queued by the time-bounded API are not fully
+  // processed yet
+  bool HasPendingUpdate() const {
+    return propagation_ || !pending_.empty();
+  }
+
+  // Number of scribbles in the matter, including the ones being processed by
+  // a pending time-bounded update
   int NumScribbles() {
     return scribbles.size();
   }
 
+  // Enable undo/redo, keeping at most n undo levels. n = 0 (the default)
+  // disables it.
+  // The matter state is snapshotted after each update using copy-on-write
+  // tiles, so the current state is fully copied once, and then each level
+  // only costs memory for the tiles its update actually changed.
+  void SetMaxUndoLevels(int n);
+
+  bool CanUndo() const {
+    return history_pos_ > 0;
+  }
+
+  bool CanRedo() const {
+    return history_pos_ + 1 < history_.size();
+  }
+
+  // Go back to the state before the last update. An update is one
+  // AddScribble, or one run of coalesced scribbles (see AddScribbles).
+  // Returns false if there is nothing to undo.
+  // Pending time-bounded updates are completed first.
+  bool Undo();
+
+  // Re-apply the last undone update. Returns false if there is nothing to
+  // redo. Any new scribble discards the updates that can be redone.
+  bool Redo();
+
+  // Memory used by the undo/redo snapshots, in bytes
+  size_t UndoMemoryUsage() const;
+
+  // Remove the index-th scribble (in the order they were added). Returns
+  // false if there is no such scribble.
+  //
+  // The color model of the scribble's class is re-estimated. With the
+  // scribble cache enabled (see SetScribbleCacheSize), the distance map of
+  // the class is then fixed incrementally : only the pixels whose closest
+  // source was the removed scribble are recomputed, by min-combining the
+  // cached fields of the other scribbles. Otherwise (or if some fields have
+  // been evicted), the distance map of the class is recomputed from all its
+  // remaining scribbles, ignoring their ordering.
+  //
+  // This discards the undo/redo history.
+  bool RemoveScribble(size_t index);
+
+  // Enable the cache of per-scribble distance fields used by RemoveScribble,
+  // using at most max_bytes for the fields. 0 (the default) disables it.
+  //
+  // The cache holds, for each update (one scribble or one run of coalesced
+  // scribbles), the geodesic distance to that update's scribbles alone. It
+  // doesn't change the results of the updates, but each update then costs an
+  // extra propagation from its own scribbles to compute its field. When the
+  // cache is full, the oldest fields are evicted.
+  void SetScribbleCacheSize(size_t max_bytes);
+
+  // Memory used by the cached distance fields, in bytes
+  size_t ScribbleCacheUsage() const;
+
+  // Save the state of the matter (image, scribbles, color models,
+  // likelihoods, distances and mask) to a session file, see session.h for
+  // the format. Queued time-bounded scribbles are processed first. The undo
+  // history, the scribble cache and the preview and superpixel modes are not
+  // saved. Returns false on I/O errors.
+  bool SaveSession(const std::string& path);
+
+  // Resume a matter saved by SaveSession, or return NULL if the file can't
+  // be read or is not a valid session. With map, the file is mmap-ed
+  // (privately, so the file is never modified) and the planes are used in
+  // place, without any parsing or recomputation : pages are only read from
+  // disk when touched, and copied when modified. Otherwise the planes are
+  // read into memory.
+  static InteractiveMatter* LoadSession(const std::string& path,
+                                        bool map=true);
+
+  size_t MemoryUsage() const;
+
+  // See Matter::SetPreviewFactor. This can only be changed before the first
+  // scribble. In this mode :
+  // - the time-bounded AddScribble runs to completion (the preview is what
+  //   gives fast feedback)
+  // - the scribble cache is used by the preview matter only, RemoveScribble
+  //   is always followed by a full resolution band refinement
+  void SetPreviewFactor(int factor);
+
+  // See Matter::SetSuperpixelSize. This can't change while recording.
+  void SetSuperpixelSize(int region_size, double compactness=10);
+
+  // Session recording, for benchmarks and bug reports (see recording.h).
+  // From StartRecording on, the calls that modify the matter are recorded
+  // along with the time each took, until StopRecording hands the recording
+  // over. image is stored as is, to find the image back when replaying.
+  // Recording must start before the first scribble, and the preview,
+  // superpixel and scribble cache modes must not change while recording.
+  void StartRecording(const std::string& image);
+  bool IsRecording() const { return recording_ != nullptr; }
+
+  // Complete the queued time-bounded scribbles, store the final mask in the
+  // recording and move it to recording. Returns false if not recording.
+  bool StopRecording(SessionRecording* recording);
+
+ protected:
+  Matter* NewPreview(const std::shared_ptr<const LabImage>& image);
+
  private:
+  // For LoadSession
+  InteractiveMatter(int W, int H);
+
+  // The scribbles added by one update. groups_ has one entry per update,
+  // their scribbles are consecutive in scribbles
+  struct ScribbleGroup {
+    bool background;
+    size_t nscribbles;
+    // Increasing update sequence number
+    int seq;
+    // Distance to this group's scribbles alone, when cached
+    std::shared_ptr<const std::vector<float>> field;
+  };
+  // Everything an update modifies. The pdfs and likelihoods are not kept,
+  // as they are recomputed from the color models on restore
+  struct State {
+    TileSnapshot<double> fg_dist, bg_dist;
+    TileSnapshot<uint8_t> final_mask;
+    std::vector<std::vector<double>> bg_probs, fg_probs;
+    bool bg_scribbled, fg_scribbled;
+    size_t nscribbles;
+    std::vector<ScribbleGroup> groups;
+    // Only captured when the scribble cache is enabled
+    TileSnapshot<float> fg_cmin, bg_cmin;
+    TileSnapshot<int32_t> fg_last, bg_last;
+  };
+
+  // Snapshot the current state after an update (if undo is enabled)
+  void PushHistory();
+
+  // Restore history_[pos]
+  void RestoreHistory(size_t pos);
+
+  // Clear the undo/redo history, keeping only the current state
+  void ResetHistory();
+
+  // Start a new group for the scribbles from scribbles[first] onwards
+  void PushGroup(bool background, size_t first);
+
+  // Sources for the propagation of an update : all the scribbles of the
+  // class
+  void GatherSources(bool background, std::vector<Point2i>* sources) const;
+
+  // With the cache enabled, compute the field of the last group (using
+  // newdist_ as scratch) and add it to the min-combination of the class
+  void CacheGroupField(bool background);
+
+  // Evict the oldest fields until the cache fits in cache_max_bytes_
+  void EnforceCacheSize();
+
+  InteractiveMatter* Preview() const {
+    return static_cast<InteractiveMatter*>(preview_.get());
+  }
+
+  // AddScribbles on the n scribbles at ss
+  size_t AddScribbles(const Scribble* ss, size_t n, const CancelFlag* cancel);
+
+  // Preview mode version of AddScribbles
+  size_t AddScribblesWithPreview(const Scribble* ss, size_t n,
+                                 const CancelFlag* cancel);
+
+  // Upsample the preview and refine it, once the preview matter and the full
+  // resolution color models are up to date
+  void FinishPreviewUpdate();
+
+  bool CacheEnabled() const {
+    return cache_max_bytes_ > 0;
+  }
+
+  // Recompute the fg and bg likelihoods from the current color models
+  void UpdateLikelihoods();
+
+  // Re-estimate the color model of the given class from the scribbles and
+  // update the pdf and likelihoods. Returns false (without modifying
+  // anything) if cancelled
+  bool UpdateColorModel(bool background, const CancelFlag* cancel);
+
+  // Copy newdist_ to the distance map of the given class for pixels that
+  // belong to the other class in region (the mask before the update), then
+  // update final_mask.
+  // Only the pixels with newdist_ <= max_dist are copied. max_dist is the
+  // max double for the final commit of an update.
+  void CommitDistances(bool background, const uint8_t* region,
+                       double max_dist);
+
+  // Process the pending time-bounded updates until deadline
+  bool ProcessPending(const std::chrono::steady_clock::time_point& deadline);
+
+  // Held by the public methods that modify the matter. When recording, the
+  // outermost one records its call as an event when it ends, so that e.g.
+  // the AddScribble of AddStroke is not recorded on its own
+  class RecordScope {
+   public:
+    RecordScope(InteractiveMatter* matter, RecordedEvent::Op op,
+                uint32_t arg=0);
+    ~RecordScope();
+
+    // The scribbles of a kScribbles event. Events without scribbles are not
+    // recorded
+    void SetScribbles(const Scribble* ss, size_t n);
+
+   private:
+    InteractiveMatter* matter_;
+    bool outermost_;
+    RecordedEvent event_;
+    std::chrono::steady_clock::time_point start_;
+    // record_runs_ms_ when the scope started
+    double runs_ms_;
+  };
+
   // Initially false, true when at least one scribble has been added to bg/fg
   bool bg_scribbled_, fg_scribbled_;
 
   std::vector<Scribble> scribbles;
+
+  // Per-channel color densities estimated from the bg/fg scribbles. Empty
+  // until the first scribble of the corresponding class
+  std::vector<std::vector<double>> bg_probs_, fg_probs_;
+
+  // Scratch distance map for the scribble class being updated
+  std::unique_ptr<double[]> newdist_;
+
+  // State of the time-bounded updates. pending_ contains the scribbles that
+  // have been queued but not started yet. When propagation_ is set, an update
+  // for the propagation_background_ class is in progress, propagating in
+  // newdist_. region_ is the mask from before that update
+  std::deque<Scribble> pending_;
+  std::unique_ptr<GeodesicPropagation> propagation_;
+  bool propagation_background_;
+  std::unique_ptr<uint8_t[]> region_;
+
+  // Undo/redo. history_[history_pos_] is the current state, the states before
+  // it can be undone, the ones after it redone. undone_ holds the scribbles
+  // of the undone updates, the next one to redo at the back
+  int max_undo_levels_;
+  std::deque<State> history_;
+  size_t history_pos_;
+  std::vector<Scribble> undone_;
+
+  std::vector<ScribbleGroup> groups_;
+  int next_seq_;
+
+  // Scribble cache. For each class, cmin is the min-combination of all its
+  // fields (including evicted ones), last is the seq of the last update that
+  // wrote the pixel's distance (-1 if none)
+  size_t cache_max_bytes_;
+  std::unique_ptr<float[]> fg_cmin_, bg_cmin_;
+  std::unique_ptr<int32_t[]> fg_last_, bg_last_;
+
+  // NULL unless recording. record_run_ is the index of the event of the run
+  // being processed by the time-bounded updates, record_runs_ms_ the time
+  // recorded for all the runs, which is not counted again in the events of
+  // the calls that processed them
+  std::unique_ptr<SessionRecording> recording_;
+  int record_depth_;
+  size_t record_run_;
+  double record_runs_ms_;
 };
 
 #endif
@@ -0,0 +1,114 @@
+#ifndef _LIBMATTING_ASYNC_H_
+#define _LIBMATTING_ASYNC_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "api.h"
+
+// Wraps an InteractiveMatter and runs its updates on a background worker
+// thread so that the caller (typically an UI thread) never blocks on the
+// matting.
+//
+// - Scribbles that are queued while the worker is busy are coalesced into a
+//   single update (see InteractiveMatter::AddScribbles)
+// - When a new scribble arrives while an update is in flight, the in-flight
+//   update is cancelled at its next safe checkpoint and restarted together
+//   with the new scribble, because its result would be stale anyway
+// - The ready callback is called (from the worker thread) each time a new
+//   mask is available
+// - The results of each update are published for concurrent readers (see
+//   LatestResults). All the result accessors read the published results,
+//   so they never wait for the in-flight update
+class AsyncInteractiveMatter {
+ public:
+  // Called with the number of scribbles the new mask accounts for
+  typedef std::function<void(int)> ReadyCallback;
+
+  // Same arguments as InteractiveMatter
+  AsyncInteractiveMatter(uint8_t* lab_l, uint8_t* lab_a,
+                         uint8_t* lab_b, int W, int H,
+                         const ReadyCallback& on_ready=ReadyCallback());
+  // On a shared image, see image.h
+  explicit AsyncInteractiveMatter(
+      const std::shared_ptr<const LabImage>& image,
+      const ReadyCallback& on_ready=ReadyCallback());
+  // Cancels any in-flight update and joins the worker
+  ~AsyncInteractiveMatter();
+
+  // Queue a scribble and return immediately
+  void AddScribble(const Scribble& s);
+
+  // Rasterize a brush stroke (see StrokeToScribble) and queue it. Unlike
+  // InteractiveMatter::AddStroke, this doesn't wait for the queued scribbles
+  // to check for conflicts with them, so pixels scribbled with both classes
+  // are kept in both.
+  void AddStroke(const Stroke& stroke);
+
+  // Block until all queued scribbles have been processed
+  void Wait();
+
+  // Number of scribbles accounted for in the current mask
+  int NumScribbles();
+
+  // Number of scribbles queued or being processed
+  int NumPending();
+
+  // The results of the last completed update (see Matter::LatestResults).
+  // This is the way to read the results : they can be used in place, without
+  // copies, for as long as they are held, and they are consistent with each
+  // other.
+  std::shared_ptr<const Results> LatestResults() const {
+    return matter_.LatestResults();
+  }
+
+  // Same as the Matter getters, copying from LatestResults
+  void GetForegroundMask(uint8_t* mask);
+  void GetForegroundLikelihood(double* out);
+  void GetBackgroundLikelihood(double* out);
+  void GetForegroundDist(double* out);
+  void GetBackgroundDist(double* out);
+
+  // Get the spans of the mask of LatestResults that changed since the last
+  // call (or since the construction, when the mask was all background), as
+  // maximal runs sorted by row then x, and start tracking from that mask
+  void TakeChangedSpans(std::vector<RowSpan>* spans);
+
+  int GetWidth() { return W; }
+  int GetHeight() { return H; }
+
+ private:
+  void Run();
+
+  const int W, H;
+  ReadyCallback on_ready_;
+
+  // Only used by the worker once it is started, the other threads read the
+  // published results
+  InteractiveMatter matter_;
+
+  // Protects spans_ref_, the results as of the last TakeChangedSpans
+  std::mutex spans_mutex_;
+  std::shared_ptr<const Results> spans_ref_;
+
+  // Protects everything below
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  // Scribbles waiting to be processed, including the in-flight ones
+  std::deque<Scribble> queue_;
+  // Number of scribbles at the front of queue_ the worker is processing
+  size_t in_flight_;
+  // Number of times in a row the in-flight update got cancelled
+  int ncancelled_;
+  // Number of scribbles accounted for in the current mask
+  int nscribbles_;
+  bool stop_;
+  CancelFlag cancel_;
+
+  std::thread worker_;
+};
+
+#endif
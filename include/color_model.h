@@ -0,0 +1,41 @@
+#ifndef _LIBMATTING_COLOR_MODEL_H_
+#define _LIBMATTING_COLOR_MODEL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The color model of a class (foreground or background) : for each of the 3
+// channels of the lab image, the density of each of the 256 channel values,
+// as estimated by ColorChannelKDE.
+//
+// A model only depends on the colors of the scribbled pixels, not on the
+// image they were taken from. So a model learned on one image can be
+// imported in the matters of other images showing the same object and
+// background colors (photo bursts, product variants...), which then only
+// need a few seed scribbles (see SimpleMatter::SetColorModel).
+static const int kColorModelValues = 256;
+
+struct ColorModel {
+  // probs[c][v] is the density of value v in channel c
+  std::vector<std::vector<double>> probs;
+};
+
+// 3 channels of kColorModelValues finite, non-negative values
+bool IsValidColorModel(const ColorModel& model);
+
+// Binary encoding of a model : an 8 bytes magic, a uint32_t version, a
+// uint32_t byte order marker and the 3*kColorModelValues densities as
+// doubles. Like the session files, values are in the byte order of the
+// machine that encoded the model, and DecodeColorModel rejects the other
+// byte order.
+void EncodeColorModel(const ColorModel& model, std::vector<uint8_t>* bytes);
+
+// Returns false, leaving model untouched, if bytes is not a valid encoding
+bool DecodeColorModel(const uint8_t* bytes, size_t size, ColorModel* model);
+
+// Same as the above, to and from a file
+bool SaveColorModel(const ColorModel& model, const std::string& path);
+bool LoadColorModel(const std::string& path, ColorModel* model);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _LIBMATTING_CONTOUR_H_
+#define _LIBMATTING_CONTOUR_H_
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "utils.h"
+
+// A closed polygon following the boundary between foreground and background
+// pixels. Vertices are pixel corners : (x, y) is the top-left corner of
+// pixel (x, y), so a single foreground pixel at (0, 0) has the contour
+// (0,0) (1,0) (1,1) (0,1).
+// Foreground is always on the right side of the path (in image coordinates,
+// y going down) so outer contours are clockwise on screen and holes
+// counterclockwise. This works as is with an even-odd or nonzero fill rule.
+struct Contour {
+  bool hole;
+  std::vector<Point2i> points;
+};
+
+// Simplify a closed polygon with Douglas-Peucker : vertices that are within
+// tolerance (in pixels) of the simplified polygon are dropped.
+void SimplifyContour(const std::vector<Point2i>& points, double tolerance,
+                     std::vector<Point2i>* simplified);
+
+// Keeps the boundary of a W*H mask as a set of oriented crack edges (the
+// sides of pixels that separate foreground from background), so that
+//
+// - syncing it with a mask only costs work for the pixels that changed
+//   (given a hint of the rows that might have changed)
+// - tracing the contours only costs work proportional to the boundary length
+//
+// Foreground is 4-connected : two foreground pixels that only touch by a
+// corner belong to different contours.
+class ContourTracer {
+ public:
+  // Starts with an all-background mask
+  ContourTracer(int W, int H);
+
+  // Sync with mask. If rows is not NULL, only the rows y with (*rows)[y] set
+  // are looked at, the others must not have changed since the last Update.
+  void Update(const uint8_t* mask, const std::vector<bool>* rows=NULL);
+
+  // Trace all the contours of the current mask, each simplified with
+  // SimplifyContour(tolerance). A tolerance of 0 only removes the vertices
+  // in the middle of straight segments.
+  void GetContours(double tolerance, std::vector<Contour>* contours) const;
+
+  int GetWidth() const { return W; }
+  int GetHeight() const { return H; }
+
+ private:
+  bool IsForeground(int x, int y) const;
+  // Recompute the 4 edges around pixel (x, y)
+  void UpdatePixelEdges(int x, int y);
+  void SetEdge(int vertex, int dir, bool on);
+
+  int W, H;
+  // Foreground flags of the mask as of the last Update
+  std::vector<uint8_t> mask_;
+  // For each of the (W+1)*(H+1) pixel corners, bit d is set if there is an
+  // edge leaving the corner in direction d (see contour.cc)
+  std::vector<uint8_t> edges_;
+  // Corners that have at least one edge leaving them
+  std::unordered_set<int> active_;
+};
+
+#endif
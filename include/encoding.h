@@ -0,0 +1,37 @@
+#ifndef _LIBMATTING_ENCODING_H_
+#define _LIBMATTING_ENCODING_H_
+
+#include <cstdint>
+#include <vector>
+
+// Compact encodings of a W*H row-major mask (0 for background, anything else
+// for foreground), to hand results over to a display or over the wire
+// without shipping one byte per pixel.
+
+// 1-bit packed bitmap. Each row starts on a byte boundary and uses
+// PackedMaskStride(W) bytes. The first pixel of a row is the most significant
+// bit of its first byte. Padding bits are 0.
+inline int PackedMaskStride(int W) {
+  return (W + 7) / 8;
+}
+
+// bits must hold PackedMaskStride(W)*H bytes
+void PackMaskBits(const uint8_t* mask, int W, int H, uint8_t* bits);
+
+// Inverse of PackMaskBits. Foreground pixels are set to 255
+void UnpackMaskBits(const uint8_t* bits, int W, int H, uint8_t* mask);
+
+// Run-length encoding of each row. Rows are encoded one after the other, each
+// as alternating run lengths that sum to W, starting with a background run
+// (which is 0 if the row starts with a foreground pixel). So a row with k
+// label changes takes k+1 runs, an uniform background row a single run.
+// runs is cleared first.
+void EncodeMaskRLE(const uint8_t* mask, int W, int H,
+                   std::vector<uint32_t>* runs);
+
+// Inverse of EncodeMaskRLE. Foreground pixels are set to 255. Returns false
+// if runs is not a valid encoding of a W*H mask.
+bool DecodeMaskRLE(const std::vector<uint32_t>& runs, int W, int H,
+                   uint8_t* mask);
+
+#endif
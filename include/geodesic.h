@@ -1,20 +1,35 @@
 #ifndef _GEODESIC_H_
 #define _GEODESIC_H_
 
+#include <chrono>
 #include <cstdint>
+#include <utility>
+#include <vector>
+
 #include "utils.h"
 
 // Functions to compute geodesic distance between image pixels and user
 // scribbles as per section 3.1.2 (fig.5) of Bai09
 
+// Scratch memory of a propagation (its priority queue). Passing the same one
+// to successive propagations reuses its memory
+struct GeodesicScratch {
+  std::vector<std::pair<int, double>> heap;
+};
+
 // For a W*H image (4-connected graph) given as a heightmap, compute, for each
 // pixel, the minimum geodesic distance to the closest source
 // This is described in section 3.1.2 (fig. 5) of Bai09
-void GeodesicDistanceMap(const std::vector<Point2i>& sources,
+//
+// The propagation polls cancel periodically and returns false (leaving dists
+// partially computed) if it got set. Returns true once all distances are final
+bool GeodesicDistanceMap(const std::vector<Point2i>& sources,
                          const double* height,
                          int W,
                          int H,
-                         double* dists);
+                         double* dists,
+                         const CancelFlag* cancel=NULL,
+                         GeodesicScratch* scratch=NULL);
 
 void GeodesicDistanceMap(const uint8_t* source_mask,
                          const double* height,
@@ -22,11 +37,83 @@ void GeodesicDistanceMap(const uint8_t* source_mask,
                          int H,
                          double* dists);
 
-void GeodesicDistanceMap(const std::vector<Scribble>& scribbles,
+// Only scribbles with s.background == background are used as sources
+bool GeodesicDistanceMap(const std::vector<Scribble>& scribbles,
                          bool background,
                          const double* height,
                          int W,
                          int H,
-                         double* dists);
+                         double* dists,
+                         const CancelFlag* cancel=NULL);
+
+// Resumable version of GeodesicDistanceMap. The propagation state (the
+// priority queue) is kept between calls to Run, so a long propagation can be
+// spread over several calls, each bounded in time.
+class GeodesicPropagation {
+ public:
+  // height and dists are W*H arrays owned by the caller. They must outlive
+  // the propagation. dists is where the distances are computed.
+  // If scratch is not NULL, the priority queue is kept in it. It must then
+  // outlive the propagation and not be used by another one in the meantime
+  GeodesicPropagation(const double* height, int W, int H, double* dists,
+                      GeodesicScratch* scratch=NULL);
+  GeodesicPropagation(const GeodesicPropagation&) = delete;
+  GeodesicPropagation& operator=(const GeodesicPropagation&) = delete;
+
+  // Set all distances to infinity, except for sources which are set to 0
+  void Init(const std::vector<Point2i>& sources);
+
+  // Same as above, using the pixels of the scribbles with
+  // s.background == background as sources
+  void Init(const std::vector<Scribble>& scribbles, bool background);
+
+  // Only propagate inside region (pixels where it is non-zero). The
+  // distances outside of region are left untouched and act as boundary
+  // conditions : region pixels are reset to infinity, except for the sources
+  // that lie in region (set to 0), and the propagation starts from both the
+  // sources and the pixels that border region.
+  void InitInRegion(const std::vector<Point2i>& sources,
+                    const uint8_t* region);
+
+  // Warm start : keep the current distances and add sources (set to 0). If
+  // the distances are those of some previous sources with the same height,
+  // Run then computes the distances to the union of the previous and new
+  // sources, only visiting the pixels that got closer.
+  void AddSources(const std::vector<Point2i>& sources);
+
+  // Propagate until all distances are final (returns true) or until cancel
+  // gets set or deadline is reached (returns false). In the latter case, Run
+  // can be called again to continue where it stopped.
+  bool Run(const CancelFlag* cancel=NULL,
+           const std::chrono::steady_clock::time_point& deadline=
+             std::chrono::steady_clock::time_point::max());
+
+  bool Done() const { return Q_->empty(); }
+
+  // Lower bound on the distance of the pixels that are not settled yet. A
+  // pixel i with dists[i] <= Frontier() has its final distance.
+  double Frontier() const;
+
+ private:
+  typedef std::pair<int, double> PriorityEntry;
+  struct EntryCompare {
+    bool operator()(const PriorityEntry& e1, const PriorityEntry& e2) const {
+      return e1.second > e2.second;
+    }
+  };
+
+  // The priority queue is a binary heap in *Q_, the same as
+  // std::priority_queue but on storage that can outlive the propagation
+  void Push(int i, double dist);
+  void Pop();
+
+  const double* height_;
+  int W, H;
+  double* dists_;
+  // NULL unless initialized with InitInRegion
+  const uint8_t* region_;
+  std::vector<PriorityEntry> own_heap_;
+  std::vector<PriorityEntry>* Q_;
+};
 
 #endif
@@ -0,0 +1,87 @@
+#ifndef _LIBMATTING_IMAGE_H_
+#define _LIBMATTING_IMAGE_H_
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "superpixel.h"
+
+// The part of a matter that only depends on the image : its lab planes and
+// the data derived from them (the downsampled planes of the preview mode and
+// the superpixels). A LabImage is immutable and shared, through a
+// shared_ptr, by all the matters created for it, e.g. the sessions of
+// several annotators working on the same image. Each matter then only holds
+// the state that depends on its scribbles.
+//
+// The derived data is computed by the first matter that asks for it and
+// cached for the others, which wait for it if it is being computed. Only the
+// last parameters asked for are cached. This is thread-safe, so matters
+// updated from different threads can share an image, and a computation
+// doesn't block the requests for other data.
+class LabImage {
+ public:
+  // An image with a copy of the W*H lab planes
+  static std::shared_ptr<const LabImage> Create(const uint8_t* lab_l,
+                                                const uint8_t* lab_a,
+                                                const uint8_t* lab_b,
+                                                int W, int H);
+
+  // An image using the planes in place. storage keeps them alive (e.g. a
+  // memory-mapped file) and they must not change while the image exists.
+  static std::shared_ptr<const LabImage> Borrow(
+      const uint8_t* lab_l, const uint8_t* lab_a, const uint8_t* lab_b,
+      int W, int H, const std::shared_ptr<const void>& storage);
+
+  LabImage(const LabImage&) = delete;
+  LabImage& operator=(const LabImage&) = delete;
+
+  int GetWidth() const { return W; }
+  int GetHeight() const { return H; }
+
+  // The L, a and b planes
+  const uint8_t* const* Channels() const { return channels_; }
+
+  // The image downsampled by factor (see DownsampleChannel), for the preview
+  // mode. Cached for the last factor.
+  std::shared_ptr<const LabImage> Downsampled(int factor) const;
+
+  // SLIC superpixels of the image (see ComputeSLIC). Cached for the last
+  // parameters.
+  std::shared_ptr<const SuperpixelGraph> Superpixels(int region_size,
+                                                     double compactness) const;
+
+ private:
+  LabImage(int W, int H);
+
+  int W, H;
+  // The planes, when owned, and whatever keeps them alive otherwise
+  std::vector<uint8_t> planes_;
+  std::shared_ptr<const void> storage_;
+  const uint8_t* channels_[3];
+
+  // Derived data for key, ready once computed
+  template<class Key, class T>
+  struct Cached {
+    Key key;
+    std::shared_future<std::shared_ptr<const T>> value;
+  };
+
+  // The value of cache for key, computing it with compute (outside of
+  // mutex_) if it isn't the cached one. If compute throws, the callers
+  // waiting for it get the exception and nothing is cached.
+  template<class Key, class T>
+  std::shared_ptr<const T> GetCached(
+      Cached<Key, T>* cache, const Key& key,
+      const std::function<std::shared_ptr<const T>()>& compute) const;
+
+  mutable std::mutex mutex_;
+  mutable Cached<int, LabImage> downsampled_;
+  mutable Cached<std::pair<int, double>, SuperpixelGraph> superpixels_;
+};
+
+#endif
@@ -37,17 +37,29 @@ void FastUnivariateKDE(const std::vector<double>& xis,
                        std::vector<double>* target_prob,
                        double epsilon=1e-2);
 
+// Scratch memory of the KDE functions. Passing the same one to successive
+// calls reuses its memory, so that they don't allocate once target_prob and
+// the scratch have grown to their size.
+struct KDEScratch {
+  std::vector<double> window;
+  std::vector<double> filtered;
+};
+
 // Helper function to compute KDE on a single color channel for values of
 // x in the [0, 255] interval.
 // So, target_prob will have 256 entries containing the probability for each
 // 8bit color value.
 // (Optionally) A median filter is also applied to smooth the probabilities
+//
+// As the samples are 8 bit values, the estimate is computed exactly from
+// their histogram instead of going through FastUnivariateKDE.
 void ColorChannelKDE(const uint8_t* data,
                      const uint8_t* mask,
                      int W,
                      int H,
                      bool median_filter,
-                     std::vector<double>* target_prob);
+                     std::vector<double>* target_prob,
+                     KDEScratch* scratch=NULL);
 
 // Same as above, but uses a list of scribbles instead of a mask. Only
 // scribbles with s.background == background are considered.
@@ -57,10 +69,35 @@ void ColorChannelKDE(const uint8_t* data,
                      int W,
                      int H,
                      bool median_filter,
-                     std::vector<double>* target_prob);
+                     std::vector<double>* target_prob,
+                     KDEScratch* scratch=NULL);
 
 void ColorChannelKDE(const std::vector<double>& xi,
                      bool median_filter,
                      std::vector<double>* target_prob);
 
+// Reference version of ColorChannelKDE, going through the generic
+// UnivariateKDE with one kernel per sample. This is what the other modes are
+// evaluated against (see unix/tools/evaluate.cc)
+void ExactColorChannelKDE(const uint8_t* data,
+                          const uint8_t* mask,
+                          int W,
+                          int H,
+                          bool median_filter,
+                          std::vector<double>* target_prob);
+
+// Runs ColorChannelKDE on each of the 3 channels, storing the per-channel
+// probabilities in probs (which will have 3 entries).
+// Returns false (leaving probs in an unspecified state) if cancel got set
+// before all channels were estimated.
+bool ColorChannelsKDE(const uint8_t* const* channels,
+                      const std::vector<Scribble>& scribbles,
+                      bool background,
+                      int W,
+                      int H,
+                      bool median_filter,
+                      std::vector<std::vector<double>>* probs,
+                      const CancelFlag* cancel=NULL,
+                      KDEScratch* scratch=NULL);
+
 #endif
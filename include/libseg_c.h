@@ -0,0 +1,199 @@
+#ifndef _LIBMATTING_LIBSEG_C_H_
+#define _LIBMATTING_LIBSEG_C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C API, for bindings from other languages (ctypes, cgo, JNI, ...).
+//
+// - Matters are opaque handles, created by libseg_matter_new and destroyed
+//   by libseg_matter_free.
+// - All the buffers are owned by the caller and described by a libseg_plane,
+//   with arbitrary row and pixel strides, so that e.g. a NumPy array, a
+//   channel of an interleaved RGBA bitmap or a region of a larger image can
+//   be passed as is. Results are written directly to the caller's buffers.
+// - Functions never abort on invalid input : they return a status, and
+//   libseg_last_error gives a description of the last error of the calling
+//   thread.
+//
+// The API is versioned by LIBSEG_C_API_VERSION. Existing functions and
+// structs keep their signature and layout within a version, new ones might
+// be added.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIBSEG_C_API_VERSION 1
+
+// Version of the library, to compare with LIBSEG_C_API_VERSION when loading
+// it dynamically
+int libseg_api_version(void);
+
+typedef enum {
+  LIBSEG_OK = 0,
+  // NULL pointer, wrong size or stride, out of range value...
+  LIBSEG_ERROR_INVALID_ARGUMENT = 1,
+  // The operation doesn't apply to this matter type or its current mode
+  LIBSEG_ERROR_INVALID_OPERATION = 2,
+  LIBSEG_ERROR_OUT_OF_MEMORY = 3,
+  LIBSEG_ERROR_INTERNAL = 4
+} libseg_status;
+
+// Static description of a status
+const char* libseg_status_string(libseg_status status);
+
+// Description of the last error that occurred in the calling thread, "" if
+// none. Valid until the next call from this thread.
+const char* libseg_last_error(void);
+
+// A width*height plane. Pixel (x, y) is at
+//   (char*)data + y*row_stride + x*pixel_stride
+// A pixel_stride of 0 means packed pixels (the size of the element type of
+// the plane). Strides are in bytes and can be negative.
+typedef struct {
+  void* data;
+  int width;
+  int height;
+  ptrdiff_t row_stride;
+  ptrdiff_t pixel_stride;
+} libseg_plane;
+
+// An image that several matters can share (see image.h), e.g. the sessions
+// of several annotators on the same image : the planes and the data derived
+// from them are then only stored once. Created from the L, a and b planes
+// (uint8_t each, all of the same size), which are copied.
+typedef struct libseg_image libseg_image;
+
+libseg_status libseg_image_new(const libseg_plane* lab_l,
+                               const libseg_plane* lab_a,
+                               const libseg_plane* lab_b,
+                               libseg_image** image);
+
+// The matters created from the image keep it alive, so it can be freed at
+// any time. NULL is ignored.
+void libseg_image_free(libseg_image* image);
+
+typedef struct libseg_matter libseg_matter;
+
+typedef enum {
+  // SimpleMatter : scribbles given as two masks (libseg_matter_update_masks)
+  LIBSEG_SIMPLE_MATTER = 0,
+  // InteractiveMatter : ordered scribbles (libseg_matter_add_scribble)
+  LIBSEG_INTERACTIVE_MATTER = 1
+} libseg_matter_type;
+
+// Create a matter for the image given by its L, a and b planes (uint8_t
+// each, all of the same size). The image is copied in the matter.
+libseg_status libseg_matter_new(libseg_matter_type type,
+                                const libseg_plane* lab_l,
+                                const libseg_plane* lab_a,
+                                const libseg_plane* lab_b,
+                                libseg_matter** matter);
+
+// Same as above, on an image shared with other matters (see below)
+libseg_status libseg_matter_new_from_image(libseg_matter_type type,
+                                           const libseg_image* image,
+                                           libseg_matter** matter);
+
+// NULL is ignored
+void libseg_matter_free(libseg_matter* matter);
+
+libseg_status libseg_matter_get_size(const libseg_matter* matter,
+                                     int* width, int* height);
+
+// See Matter::SetPreviewFactor and Matter::SetSuperpixelSize. The two modes
+// can't be combined, and an interactive matter can't change its preview
+// factor once it has scribbles.
+libseg_status libseg_matter_set_preview_factor(libseg_matter* matter,
+                                               int factor);
+libseg_status libseg_matter_set_superpixel_size(libseg_matter* matter,
+                                                int region_size,
+                                                double compactness);
+
+// See Matter::SetPublishResults. When enabled, the getters below read the
+// results of the last completed update, and can be called from any thread
+// while another one updates the matter.
+libseg_status libseg_matter_set_publish_results(libseg_matter* matter,
+                                                int enable);
+
+// Simple matter only. bg_mask and fg_mask are uint8_t planes of the image
+// size, non-zero for the scribbled pixels.
+libseg_status libseg_matter_update_masks(libseg_matter* matter,
+                                         const libseg_plane* bg_mask,
+                                         const libseg_plane* fg_mask);
+
+// Simple matter only. Color models (see color_model.h) as
+// LIBSEG_COLOR_MODEL_SIZE doubles : the densities of the 256 values of the
+// L channel, then of a, then of b.
+#define LIBSEG_COLOR_MODEL_SIZE (3*256)
+
+// Export the model of a class as used by the last update. Fails with
+// LIBSEG_ERROR_INVALID_OPERATION before the first update.
+libseg_status libseg_matter_get_color_model(const libseg_matter* matter,
+                                            int background,
+                                            double* probs,
+                                            size_t nprobs);
+
+// Import the model of a class, which is then used instead of estimating it
+// from the mask (see SimpleMatter::SetColorModel). NULL probs goes back to
+// estimating it.
+libseg_status libseg_matter_set_color_model(libseg_matter* matter,
+                                            int background,
+                                            const double* probs,
+                                            size_t nprobs);
+
+// Interactive matter only. Add a scribble made of the npoints pixels whose
+// coordinates are xy[2*i], xy[2*i + 1]. They must be in the image.
+libseg_status libseg_matter_add_scribble(libseg_matter* matter,
+                                         int background,
+                                         const int32_t* xy,
+                                         size_t npoints);
+
+// Interactive matter only. Add a brush stroke (see stroke.h) through the
+// npoints points of xy. If not NULL, nconflicts is set to the number of
+// pixels dropped because they are scribbled with the other class.
+libseg_status libseg_matter_add_stroke(libseg_matter* matter,
+                                       int background,
+                                       int radius,
+                                       const int32_t* xy,
+                                       size_t npoints,
+                                       size_t* nconflicts);
+
+// Results, to caller planes of the image size. The mask is uint8_t (255 for
+// foreground, 0 for background), likelihoods and distances are double.
+// background selects the background (non-zero) or foreground class.
+libseg_status libseg_matter_get_mask(const libseg_matter* matter,
+                                     const libseg_plane* mask);
+libseg_status libseg_matter_get_likelihood(const libseg_matter* matter,
+                                           int background,
+                                           const libseg_plane* likelihood);
+libseg_status libseg_matter_get_dist(const libseg_matter* matter,
+                                     int background,
+                                     const libseg_plane* dist);
+
+// Timings and counters of the last update, see MatterStats in stats.h
+typedef struct {
+  double kde_ms;
+  double pdf_ms;
+  double likelihood_ms;
+  double geodesic_ms;
+  double mask_ms;
+  double total_ms;
+  uint64_t kde_calls;
+  uint64_t kde_samples;
+  uint64_t geodesic_pushes;
+  uint64_t geodesic_pops;
+  uint64_t geodesic_stale_pops;
+  uint64_t geodesic_relaxations;
+  uint64_t mask_rows_changed;
+} libseg_stats;
+
+libseg_status libseg_matter_get_stats(const libseg_matter* matter,
+                                      libseg_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _LIBMATTING_PYRAMID_H_
+#define _LIBMATTING_PYRAMID_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Helpers to run the matting on a downsampled image and bring the result back
+// to full resolution (see Matter::SetPreviewFactor).
+//
+// A pixel (x, y) of the full resolution image maps to the pixel
+// (x / factor, y / factor) of the downsampled one, which is
+// DownsampledSize(W, factor) * DownsampledSize(H, factor).
+
+inline int DownsampledSize(int size, int factor) {
+  return (size + factor - 1) / factor;
+}
+
+// Box filter, each output pixel is the mean of the (up to) factor*factor
+// input pixels mapping to it
+void DownsampleChannel(const uint8_t* in, int W, int H, int factor,
+                       uint8_t* out);
+
+// An output pixel is set (255) if any of the input pixels mapping to it is,
+// so that thin scribbles are not lost
+void DownsampleMask(const uint8_t* in, int W, int H, int factor,
+                    uint8_t* out);
+
+// Map the scribble pixels to the downsampled image, without duplicates
+void DownsampleScribble(const Scribble& in, int factor, Scribble* out);
+
+// Nearest neighbor upsampling of a Wl*Hl plane to W*H
+void UpsampleNearest(const double* in, int Wl, int Hl, int W, int H,
+                     int factor, double* out);
+
+// Joint bilateral upsampling of a low resolution mask, guided by the full
+// resolution image : each pixel gets the weighted vote of the low resolution
+// pixels around it, weighted by their spatial distance and by how close their
+// (downsampled) color is to the pixel's color, so the upsampled boundary
+// snaps to the image edges instead of being blocky.
+//
+// band is set (1) for the pixels whose label is uncertain because the low
+// resolution pixels around them don't all agree, 0 elsewhere. Those are
+// within about 2*factor pixels of the boundary.
+void JointBilateralUpsampleMask(const uint8_t* low_mask,
+                                const uint8_t* const* low_channels,
+                                int Wl, int Hl,
+                                const uint8_t* const* channels,
+                                int W, int H, int factor,
+                                double sigma_color,
+                                uint8_t* mask,
+                                uint8_t* band);
+
+#endif
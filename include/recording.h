@@ -0,0 +1,109 @@
+#ifndef _LIBMATTING_RECORDING_H_
+#define _LIBMATTING_RECORDING_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "utils.h"
+
+class InteractiveMatter;
+
+// Recording of an interactive session (see InteractiveMatter::StartRecording)
+// : a reference to the image, the modes of the matter and the ordered calls
+// that modified it, with the time each took and the final mask. Replaying it
+// on the same image reruns exactly the same updates, so that latency issues
+// that depend on the stroke sequence can be reproduced, and real sessions
+// collected into a regression corpus (see unix/tools/segment_replay.cc).
+struct RecordedEvent {
+  enum Op {
+    // AddScribble, AddScribbles or AddStroke (as the rasterized scribble).
+    // Scribbles added by one AddScribbles call are one event, so that they
+    // are coalesced the same way when replayed. Scribbles queued by the
+    // time-bounded AddScribble are recorded as the runs they are processed
+    // in, with the time spent on each run over all the calls
+    kScribbles = 1,
+    kUndo = 2,
+    kRedo = 3,
+    // RemoveScribble(arg)
+    kRemoveScribble = 4,
+    // SetMaxUndoLevels(arg)
+    kSetMaxUndoLevels = 5,
+  };
+
+  RecordedEvent() : op(kScribbles), arg(0), ms(0) {}
+
+  Op op;
+  std::vector<Scribble> scribbles;
+  uint32_t arg;
+  // Time the call took when it was recorded, without the runs of queued
+  // scribbles it processed first, which are events of their own
+  double ms;
+};
+
+struct SessionRecording {
+  SessionRecording()
+    : W(0), H(0), image_checksum(0), preview_factor(1), superpixel_size(0),
+      superpixel_compactness(0), max_undo_levels(0), scribble_cache_size(0) {}
+
+  // Whatever identifies the image for the replay, e.g. its path
+  std::string image;
+  int W, H;
+  // ImageChecksum of the image
+  uint64_t image_checksum;
+
+  // Modes of the matter when the recording started
+  int preview_factor;
+  int superpixel_size;
+  double superpixel_compactness;
+  int max_undo_levels;
+  uint64_t scribble_cache_size;
+
+  std::vector<RecordedEvent> events;
+
+  // The mask at the end of the recording, run-length encoded (see
+  // EncodeMaskRLE)
+  std::vector<uint32_t> final_mask;
+};
+
+// FNV-1a hash of the lab planes, to check that a recording is replayed on
+// the image it was recorded on
+uint64_t ImageChecksum(const LabImage& image);
+
+// Binary encoding of a recording : an 8 bytes magic, a uint32_t version and
+// a uint32_t byte order marker, then the fields and the events. The scribble
+// pixels and the mask runs are stored as variable length integers, the
+// pixels as deltas from the previous one, so that a stroke takes about 2
+// bytes per pixel. Like the session files, the numbers that are not
+// variable length integers are in the byte order of the machine that
+// encoded the recording, and DecodeRecording rejects the other byte order.
+void EncodeRecording(const SessionRecording& recording,
+                     std::vector<uint8_t>* bytes);
+
+// Returns false, leaving recording untouched, if bytes is not a valid
+// encoding
+bool DecodeRecording(const uint8_t* bytes, size_t size,
+                     SessionRecording* recording);
+
+// Same as the above, to and from a file
+bool SaveRecording(const SessionRecording& recording,
+                   const std::string& path);
+bool LoadRecording(const std::string& path, SessionRecording* recording);
+
+// A matter to replay recording on image, with the recorded modes. Returns
+// NULL and sets error if the image is not the recorded one.
+std::unique_ptr<InteractiveMatter> NewReplayMatter(
+    const SessionRecording& recording,
+    const std::shared_ptr<const LabImage>& image,
+    std::string* error);
+
+// Replay the events of recording on matter, as created by NewReplayMatter.
+// The time-bounded AddScribble calls are replayed as synchronous ones. If
+// event_ms is not NULL, it is set to the time each event took.
+void ReplayRecording(const SessionRecording& recording,
+                     InteractiveMatter* matter,
+                     std::vector<double>* event_ms);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _LIBMATTING_RESULTS_H_
+#define _LIBMATTING_RESULTS_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// An immutable copy of the results of a matter after an update, as
+// published by Matter (see Matter::SetPublishResults). The planes are W*H
+// row-major, with the same content as the Matter getters.
+struct Results {
+  Results() : W(0), H(0), version(0) {}
+
+  int W, H;
+  // Incremented by each publication, so a reader can tell whether the
+  // results changed since the last ones it got
+  uint64_t version;
+  std::vector<uint8_t> mask;
+  std::vector<double> fg_likelihood, bg_likelihood;
+  std::vector<double> fg_dist, bg_dist;
+};
+
+// Single-writer publication of Results to any number of reader threads.
+//
+// The writer fills a Results object nobody else can see and then swaps it in
+// as the latest one. Readers get a reference-counted pointer to the latest
+// results, which stays valid and unchanged for as long as they hold it. So a
+// reader never waits for an update to finish and the writer never waits for
+// the readers to be done with older results. The swap and the copy of the
+// pointer use std::atomic_store/atomic_load, which are not lock-free with
+// libstdc++ : they hold a lock, but only for the copy of the pointer.
+//
+// Published results are recycled once the readers have released them, so
+// publishing doesn't allocate in the steady state, unless readers hold on to
+// many old results. The last holder of a result (reader or writer) hands it
+// back to a pool under a mutex, which orders its reads of the result before
+// the writer overwrites it. Results that don't fit in the pool are freed
+// after releasing the mutex. The pool outlives the publisher if readers
+// still hold results when it is destroyed.
+class ResultsPublisher {
+ public:
+  ResultsPublisher();
+
+  // The latest published results, NULL before the first publication. Can be
+  // called from any thread.
+  std::shared_ptr<const Results> Latest() const;
+
+  // Writer only. Results to fill for the next Publish : either recycled from
+  // an earlier publication nobody holds anymore (with its old content) or
+  // new.
+  std::shared_ptr<Results> Acquire();
+
+  // Writer only. Make r (from Acquire) the latest results, setting its
+  // version.
+  void Publish(const std::shared_ptr<Results>& r);
+
+ private:
+  // Results released by all their holders
+  struct Pool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Results>> free;
+  };
+
+  std::shared_ptr<const Results> latest_;
+  uint64_t version_;
+  // Shared with the deleters of the results handed out by Acquire
+  std::shared_ptr<Pool> pool_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _LIBMATTING_SESSION_H_
+#define _LIBMATTING_SESSION_H_
+
+#include <cstdint>
+
+// Binary format of the session files written by
+// InteractiveMatter::SaveSession.
+//
+// The file starts with a SessionHeader, followed by the sections listed in
+// its section table. Each section starts at a multiple of
+// kSessionAlignment, so that the W*H planes can be used in place from a
+// memory-mapped file. All values are in the byte order of the machine that
+// wrote the file (byte_order tells which one) and files with a different
+// byte order are rejected.
+//
+// Compatibility : a reader accepts any version up to kSessionVersion and
+// looks sections up by id, ignoring the ids it doesn't know. So new sections
+// can be added without changing the version, the version is only bumped when
+// the content of an existing section changes.
+
+static const char kSessionMagic[8] = {'L', 'S', 'E', 'G', 'S', 'E', 'S', 'S'};
+static const uint32_t kSessionVersion = 1;
+static const uint32_t kSessionByteOrder = 0x01020304;
+static const uint64_t kSessionAlignment = 4096;
+
+enum SessionSectionId {
+  // W*H uint8_t planes
+  kSectionLabL = 1,
+  kSectionLabA = 2,
+  kSectionLabB = 3,
+  kSectionFinalMask = 4,
+  // W*H double planes
+  kSectionFgPdf = 10,
+  kSectionBgPdf = 11,
+  kSectionFgLikelihood = 12,
+  kSectionBgLikelihood = 13,
+  kSectionFgDist = 14,
+  kSectionBgDist = 15,
+  // Fg then bg color model, each as a uint32_t number of channels followed,
+  // for each channel, by a uint32_t number of values and the values as
+  // doubles
+  kSectionColorModels = 20,
+  // uint32_t number of scribbles followed, for each, by a uint32_t
+  // background flag, a uint32_t number of pixels and the pixels as int32_t
+  // x, y pairs
+  kSectionScribbles = 21,
+  // uint32_t number of groups followed, for each, by uint32_t background
+  // flag, uint32_t number of scribbles and int32_t sequence number
+  kSectionGroups = 22,
+};
+
+struct SessionSection {
+  uint32_t id;
+  uint32_t reserved;
+  // From the start of the file, in bytes
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct SessionHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t W, H;
+  // Bit 0 : a fg scribble has been processed, bit 1 : a bg one
+  uint32_t flags;
+  int32_t next_seq;
+  uint32_t nsections;
+  uint32_t reserved;
+  // Followed by nsections SessionSection
+};
+
+#endif
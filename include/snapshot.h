@@ -0,0 +1,123 @@
+#ifndef _LIBMATTING_SNAPSHOT_H_
+#define _LIBMATTING_SNAPSHOT_H_
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <string.h>
+#include <vector>
+
+// Copy-on-write snapshot of a W*H row-major plane.
+//
+// The plane is split in square tiles. When capturing a snapshot, each tile
+// is compared with the same tile of a previous snapshot and shared with it if
+// it didn't change. So a sequence of snapshots of a plane that changes
+// locally only costs memory for the tiles that actually changed.
+template<class T>
+class TileSnapshot {
+ public:
+  static const int kTileSize = 64;
+
+  TileSnapshot() : W(0), H(0), ntx(0), nty(0) {}
+
+  // Capture data. Tiles identical to those of prev (which can be NULL, and
+  // should be a snapshot of a plane of the same size) are shared with it.
+  void Capture(const T* data, int W, int H, const TileSnapshot* prev) {
+    this->W = W;
+    this->H = H;
+    ntx = (W + kTileSize - 1) / kTileSize;
+    nty = (H + kTileSize - 1) / kTileSize;
+    tiles_.assign(ntx*nty, TilePtr());
+    for (int ty = 0; ty < nty; ++ty) {
+      for (int tx = 0; tx < ntx; ++tx) {
+        const int t = ty*ntx + tx;
+        if (prev && prev->tiles_.size() == tiles_.size()
+            && TileEquals(*prev->tiles_[t], data, tx, ty)) {
+          tiles_[t] = prev->tiles_[t];
+        } else {
+          tiles_[t] = CopyTile(data, tx, ty);
+        }
+      }
+    }
+  }
+
+  // Copy the snapshot back to data. current can be a snapshot of what data
+  // contains right now (or NULL), in which case only the tiles that are not
+  // shared with current are copied
+  void Restore(T* data, const TileSnapshot* current) const {
+    for (int ty = 0; ty < nty; ++ty) {
+      for (int tx = 0; tx < ntx; ++tx) {
+        const int t = ty*ntx + tx;
+        if (current && current->tiles_.size() == tiles_.size()
+            && current->tiles_[t] == tiles_[t]) {
+          continue;
+        }
+        const T* tile = tiles_[t]->data();
+        const int tw = TileWidth(tx);
+        const int th = TileHeight(ty);
+        for (int y = 0; y < th; ++y) {
+          memcpy(data + (ty*kTileSize + y)*W + tx*kTileSize, tile + y*tw,
+                 sizeof(T)*tw);
+        }
+      }
+    }
+  }
+
+  // Returns the size of the tiles not yet in seen, and add them to seen. This
+  // is used to compute the memory used by a set of snapshots sharing tiles
+  size_t CountBytes(std::set<const void*>* seen) const {
+    size_t bytes = 0;
+    for (const TilePtr& tile : tiles_) {
+      if (seen->insert(tile.get()).second) {
+        bytes += sizeof(T)*tile->size();
+      }
+    }
+    return bytes;
+  }
+
+ private:
+  typedef std::shared_ptr<const std::vector<T>> TilePtr;
+
+  int TileWidth(int tx) const {
+    return std::min(kTileSize, W - tx*kTileSize);
+  }
+
+  int TileHeight(int ty) const {
+    return std::min(kTileSize, H - ty*kTileSize);
+  }
+
+  bool TileEquals(const std::vector<T>& tile, const T* data,
+                  int tx, int ty) const {
+    const int tw = TileWidth(tx);
+    const int th = TileHeight(ty);
+    for (int y = 0; y < th; ++y) {
+      if (memcmp(tile.data() + y*tw,
+                 data + (ty*kTileSize + y)*W + tx*kTileSize,
+                 sizeof(T)*tw) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  TilePtr CopyTile(const T* data, int tx, int ty) const {
+    const int tw = TileWidth(tx);
+    const int th = TileHeight(ty);
+    std::shared_ptr<std::vector<T>> tile(new std::vector<T>(tw*th));
+    for (int y = 0; y < th; ++y) {
+      memcpy(tile->data() + y*tw, data + (ty*kTileSize + y)*W + tx*kTileSize,
+             sizeof(T)*tw);
+    }
+    return tile;
+  }
+
+  int W, H;
+  // Number of tiles in x and y
+  int ntx, nty;
+  std::vector<TilePtr> tiles_;
+};
+
+template<class T>
+const int TileSnapshot<T>::kTileSize;
+
+#endif
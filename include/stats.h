@@ -0,0 +1,129 @@
+#ifndef _LIBMATTING_STATS_H_
+#define _LIBMATTING_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+
+// Per-stage timings and counters of the last update of a Matter (see
+// Matter::GetStats).
+//
+// Building with -DLIBSEG_NO_STATS removes the instrumentation completely : no
+// clock is read and no counter is maintained. GetStats then always returns
+// zeros.
+struct MatterStats {
+  MatterStats() { Reset(); }
+
+  void Reset() { *this = MatterStats(0); }
+
+  // Wall-clock time of each stage, in milliseconds. Stages are timed where
+  // they run, so time spent in a preview matter is included
+  double kde_ms;
+  // Evaluating the color models on the image (P(c_x | M))
+  double pdf_ms;
+  double likelihood_ms;
+  double geodesic_ms;
+  // Final mask, including the tracking of changed rows
+  double mask_ms;
+  // Whole update, including the bookkeeping that isn't part of a stage
+  double total_ms;
+
+  // Number of calls to ColorChannelKDE and total number of samples it got
+  uint64_t kde_calls;
+  uint64_t kde_samples;
+
+  // Priority queue operations of the geodesic propagation. A stale pop is
+  // a node that was pushed again with a shorter distance since. Relaxations
+  // count the neighbors whose distance got lowered
+  uint64_t geodesic_pushes;
+  uint64_t geodesic_pops;
+  uint64_t geodesic_stale_pops;
+  uint64_t geodesic_relaxations;
+
+  // Rows of the final mask that changed
+  uint64_t mask_rows_changed;
+
+ private:
+  explicit MatterStats(int)
+    : kde_ms(0), pdf_ms(0), likelihood_ms(0), geodesic_ms(0), mask_ms(0),
+      total_ms(0), kde_calls(0), kde_samples(0), geodesic_pushes(0),
+      geodesic_pops(0), geodesic_stale_pops(0), geodesic_relaxations(0),
+      mask_rows_changed(0) {}
+};
+
+#ifndef LIBSEG_NO_STATS
+
+namespace stats {
+
+// The stats being collected by the calling thread, NULL if none
+MatterStats* Current();
+
+// Collect the stats of the current thread in stats for the lifetime of the
+// collector. Nested collectors are no-ops, so the outermost update owns the
+// stats (e.g. the ones of a preview matter go to the full resolution matter)
+class ScopedCollector {
+ public:
+  explicit ScopedCollector(MatterStats* stats);
+  ~ScopedCollector();
+
+ private:
+  MatterStats* stats_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Adds the time until it is destroyed to a field of the current stats
+class StageTimer {
+ public:
+  explicit StageTimer(double MatterStats::*field)
+    : stats_(Current()), field_(field) {
+    if (stats_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~StageTimer() {
+    if (stats_) {
+      stats_->*field_ += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start_).count();
+    }
+  }
+
+ private:
+  MatterStats* stats_;
+  double MatterStats::*field_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+inline void Count(uint64_t MatterStats::*field, uint64_t n) {
+  MatterStats* stats = Current();
+  if (stats) {
+    stats->*field += n;
+  }
+}
+
+}  // namespace stats
+
+#define LIBSEG_STATS_CAT2(a, b) a##b
+#define LIBSEG_STATS_CAT(a, b) LIBSEG_STATS_CAT2(a, b)
+
+// Time the rest of the enclosing scope as the given MatterStats field
+#define LIBSEG_STAGE_TIMER(field) \
+  stats::StageTimer LIBSEG_STATS_CAT(stage_timer_, __LINE__)( \
+      &MatterStats::field)
+#define LIBSEG_COLLECT_STATS(stats_ptr) \
+  stats::ScopedCollector LIBSEG_STATS_CAT(stats_collector_, __LINE__)( \
+      stats_ptr)
+#define LIBSEG_COUNT(field, n) stats::Count(&MatterStats::field, n)
+// Statement that only exists in instrumented builds, for local counters in
+// hot loops
+#define LIBSEG_STATS(statement) statement
+
+#else
+
+#define LIBSEG_STAGE_TIMER(field)
+#define LIBSEG_COLLECT_STATS(stats_ptr)
+#define LIBSEG_COUNT(field, n)
+#define LIBSEG_STATS(statement)
+
+#endif
+
+#endif
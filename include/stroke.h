@@ -0,0 +1,53 @@
+#ifndef _LIBMATTING_STROKE_H_
+#define _LIBMATTING_STROKE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// A brush stroke : the polyline through points drawn with a round brush of
+// the given radius (in pixels). A single point is a disc, a radius of 0 (or
+// less) a one pixel wide line.
+//
+// This is what a drawing UI naturally produces, and it is much more compact
+// than the pixels of the brush circles stamped along the way, which overlap
+// heavily. The stroke is rasterized once into a deduplicated set of pixels.
+struct Stroke {
+  Stroke() : background(false), radius(0) {}
+
+  bool background;
+  int radius;
+  std::vector<Point2i> points;
+};
+
+// Rasterize the stroke into the spans of the pixels whose center is within
+// radius of the polyline, clipped to the W*H image. The spans are disjoint
+// and sorted by row then x. spans is cleared first.
+void RasterizeStroke(const Stroke& stroke, int W, int H,
+                     std::vector<RowSpan>* spans);
+
+// Total number of pixels in spans
+size_t SpansArea(const std::vector<RowSpan>& spans);
+
+// Remove from spans (as produced by RasterizeStroke) the pixels of the
+// scribbles with s.background == background. Returns the number of pixels
+// removed.
+size_t RemoveScribbledPixels(const std::vector<Scribble>& scribbles,
+                             bool background,
+                             std::vector<RowSpan>* spans);
+
+// Append the pixels of spans to pixels, in the spans order
+void SpansToPixels(const std::vector<RowSpan>& spans,
+                   std::vector<Point2i>* pixels);
+
+// Rasterize stroke to a scribble of the same class, each pixel appearing
+// once. s->pixels is cleared first.
+void StrokeToScribble(const Stroke& stroke, int W, int H, Scribble* s);
+
+// Remove the duplicate and out of the W*H image pixels of s, for scribbles
+// that are not built from a Stroke. The pixels end up sorted by row then x.
+void DeduplicateScribble(int W, int H, Scribble* s);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _LIBMATTING_SUPERPIXEL_H_
+#define _LIBMATTING_SUPERPIXEL_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Over-segmentation of an image in superpixels and their region adjacency
+// graph.
+struct SuperpixelGraph {
+  int W, H;
+  // Superpixel of each pixel, W*H, in [0, NumNodes())
+  std::vector<int32_t> labels;
+  // Number of pixels of each superpixel
+  std::vector<int> sizes;
+  // Neighbors of node i are adjacency[offsets[i]..offsets[i+1]]
+  std::vector<int> offsets;
+  std::vector<int> adjacency;
+
+  int NumNodes() const { return (int)sizes.size(); }
+};
+
+// SLIC superpixels [Achanta12] on a lab image. region_size is the
+// approximate superpixel side in pixels, compactness weights the spatial
+// distance against the color distance (higher gives more regular
+// superpixels). Every superpixel is 4-connected.
+void ComputeSLIC(const uint8_t* const* channels, int W, int H,
+                 int region_size, double compactness,
+                 SuperpixelGraph* graph);
+
+// Mean of the W*H values over each superpixel
+void SuperpixelMeans(const SuperpixelGraph& graph, const double* values,
+                     std::vector<double>* means);
+
+// Geodesic distance on the graph, where an edge costs the absolute difference
+// of the heights of its nodes. Same as GeodesicDistanceMap, but on the
+// superpixels containing the sources, and the node distances are projected
+// back to the W*H dists.
+bool GraphGeodesicDistanceMap(const SuperpixelGraph& graph,
+                              const std::vector<Point2i>& sources,
+                              const std::vector<double>& height,
+                              double* dists,
+                              const CancelFlag* cancel=NULL);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _LIBMATTING_TRACE_H_
+#define _LIBMATTING_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+// Timeline tracing of the pipeline, exported in the Chrome trace_event JSON
+// format (open it in Perfetto or chrome://tracing).
+//
+// Each pipeline stage and each scribble update records a complete event
+// (begin and duration) when it ends. Events go to a buffer owned by the
+// recording thread, so recording takes no lock. A thread buffer holds a
+// fixed number of events, the ones that don't fit are dropped (and counted).
+// The buffer of a thread that exits is reused by the next thread that
+// records.
+//
+// Tracing is off by default, in which case a traced scope costs a single
+// relaxed atomic load. Building with -DLIBSEG_NO_TRACE removes it entirely.
+namespace trace {
+
+// Start recording, dropping the events of the previous recording
+void Start();
+void Stop();
+
+namespace internal {
+extern std::atomic<bool> enabled;
+// Microseconds since the first recording started
+double NowMicros();
+void RecordComplete(const char* name, double start_us, double end_us);
+}
+
+inline bool IsEnabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Name of the calling thread in the trace. name is copied
+void SetThreadName(const std::string& name);
+
+// Write the events recorded so far. This can be called while other threads
+// are recording, events that are not complete yet are just not included.
+void WriteJSON(std::ostream& out);
+bool WriteJSON(const std::string& filename);
+
+// Number of events that didn't fit in their thread buffer
+size_t NumDropped();
+
+// Record name (a string literal, only the pointer is kept) as an instant
+// event
+void Instant(const char* name);
+
+// Records a complete event spanning its lifetime. name must be a string
+// literal.
+class Scope {
+ public:
+  explicit Scope(const char* name)
+    : name_(IsEnabled() ? name : NULL), start_us_(0) {
+    if (name_) {
+      start_us_ = internal::NowMicros();
+    }
+  }
+
+  ~Scope() {
+    if (name_) {
+      internal::RecordComplete(name_, start_us_, internal::NowMicros());
+    }
+  }
+
+ private:
+
+  const char* name_;
+  double start_us_;
+};
+
+}  // namespace trace
+
+#ifndef LIBSEG_NO_TRACE
+
+#define LIBSEG_TRACE_CAT2(a, b) a##b
+#define LIBSEG_TRACE_CAT(a, b) LIBSEG_TRACE_CAT2(a, b)
+#define LIBSEG_TRACE_SCOPE(name) \
+  trace::Scope LIBSEG_TRACE_CAT(trace_scope_, __LINE__)(name)
+#define LIBSEG_TRACE_INSTANT(name) \
+  do { \
+    if (trace::IsEnabled()) { \
+      trace::Instant(name); \
+    } \
+  } while (0)
+
+#else
+
+#define LIBSEG_TRACE_SCOPE(name)
+#define LIBSEG_TRACE_INSTANT(name) do {} while (0)
+
+#endif
+
+#endif
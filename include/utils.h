@@ -1,6 +1,9 @@
 #ifndef _LIBMATTING_UTILS_H_
 #define _LIBMATTING_UTILS_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 struct Point2i {
@@ -8,12 +11,32 @@ struct Point2i {
   int x, y;
 };
 
+// Pixels [x0, x1) of row y
+struct RowSpan {
+  RowSpan(int y, int x0, int x1) : y(y), x0(x0), x1(x1) {}
+  int y, x0, x1;
+};
+
+struct Rect {
+  Rect(int x, int y, int width, int height)
+    : x(x), y(y), width(width), height(height) {}
+  int x, y, width, height;
+};
+
 // A user-provided drawing that is either foreground or background
 struct Scribble {
   bool background;
   std::vector<Point2i> pixels;
 };
 
+// Cooperative cancellation flag. Long running stages (KDE, geodesic
+// propagation) poll it at safe points and bail out early when it is set.
+// A NULL flag is never set.
+typedef std::atomic<bool> CancelFlag;
+
+inline bool IsCancelled(const CancelFlag* cancel) {
+  return cancel != NULL && cancel->load(std::memory_order_relaxed);
+}
 
 template<class T>
 bool IsNaN(T t) {
@@ -0,0 +1,34 @@
+#ifndef _LIBMATTING_WORKSPACE_H_
+#define _LIBMATTING_WORKSPACE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "geodesic.h"
+#include "kde.h"
+#include "utils.h"
+
+// Scratch memory of the matter updates. The buffers grow to what the updates
+// need and are then reused, so that once warmed up by a first update,
+// SimpleMatter::UpdateMasks and InteractiveMatter::AddScribble(s) don't
+// perform any heap allocation, except for storing the new scribbles. The
+// preview and superpixel modes, the time-bounded AddScribble, the scribble
+// cache and the undo history still allocate.
+//
+// A matter owns one by default. A caller can also provide its own (see
+// Matter::SetWorkspace), to share it between matters that are updated from
+// the same thread, one at a time.
+struct Workspace {
+  KDEScratch kde;
+  GeodesicScratch geodesic;
+  // Per channel color probabilities being estimated, and the previous ones
+  // of InteractiveMatter for rolling back a cancelled update
+  std::vector<std::vector<double>> probs;
+  std::vector<std::vector<double>> prev_probs;
+  // Geodesic sources
+  std::vector<Point2i> sources, fg_sources, bg_sources;
+  // A row of the final mask
+  std::vector<uint8_t> row;
+};
+
+#endif
@@ -1,150 +1,1635 @@
 #include "api.h"
 
+#include "encoding.h"
 #include "kde.h"
 #include "geodesic.h"
 #include "matting.h"
+#include "pyramid.h"
+#include "superpixel.h"
+#include "trace.h"
 
 #include <glog/logging.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <limits>
+#include <mutex>
+#include <set>
+#include <thread>
 
 using namespace std;
 
+namespace {
+
+// The workers running the precomputations of all the matters, so that
+// creating a matter doesn't start a thread. Tasks are started in the order
+// they are posted, so a task can wait for the ones posted before it (as the
+// precomputations of a matter do) without deadlocking the pool.
+class PrecomputePool {
+ public:
+  static PrecomputePool& Get() {
+    // Never destroyed, the workers run until the process exits
+    static PrecomputePool* pool = new PrecomputePool(
+        max(1u, min(4u, thread::hardware_concurrency())));
+    return *pool;
+  }
+
+  void Post(const function<void()>& task) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      tasks_.push_back(task);
+    }
+    posted_.notify_one();
+  }
+
+ private:
+  explicit PrecomputePool(unsigned nworkers) {
+    for (unsigned i = 0; i < nworkers; ++i) {
+      thread(&PrecomputePool::Work, this).detach();
+    }
+  }
+
+  void Work() {
+    while (true) {
+      function<void()> task;
+      {
+        unique_lock<mutex> lock(mutex_);
+        posted_.wait(lock, [this] { return !tasks_.empty(); });
+        task.swap(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  mutex mutex_;
+  condition_variable posted_;
+  deque<function<void()>> tasks_;
+};
+
+}  // namespace
+
 Matter::Matter(uint8_t* l, uint8_t* a, uint8_t* b, int W, int H)
-  : W(W), H(H),
-    lab_l(new uint8_t[W*H]),
-    lab_a(new uint8_t[W*H]),
-    lab_b(new uint8_t[W*H]),
+  : Matter(LabImage::Create(l, a, b, W, H)) {
+}
+
+Matter::Matter(const shared_ptr<const LabImage>& image)
+  : W(image->GetWidth()), H(image->GetHeight()),
+    image_(image),
     fg_pdf(new double[W*H]),
     bg_pdf(new double[W*H]),
     fg_likelihood(new double[W*H]),
     bg_likelihood(new double[W*H]),
     fg_dist(new double[W*H]),
     bg_dist(new double[W*H]),
-    final_mask(new uint8_t[W*H]) {
-  memcpy(lab_l.get(), l, sizeof(uint8_t)*W*H);
-  memcpy(lab_a.get(), a, sizeof(uint8_t)*W*H);
-  memcpy(lab_b.get(), b, sizeof(uint8_t)*W*H);
-
-  for (int i = 0; i < W*H; ++i) {
-    final_mask[i] = 0;
-    fg_dist[i] = numeric_limits<double>::max();
-    bg_dist[i] = numeric_limits<double>::max();
+    final_mask(new uint8_t[W*H]),
+    preview_factor_(1),
+    superpixel_size_(0),
+    superpixel_compactness_(0),
+    workspace_(NULL),
+    own_workspace_(new Workspace),
+    update_depth_(0),
+    changes_ref_(new uint8_t[W*H]),
+    dirty_rows_(H, false),
+    contour_rows_(H, false),
+    ready_(ReadyFuture()) {
+  for (int c = 0; c < 3; ++c) {
+    channels[c] = image_->Channels()[c];
   }
+  workspace_ = own_workspace_.get();
+  // Writing the planes is about as long as the first update of the pixel
+  // pipeline (and all of it on large images)
+  Precompute([this] {
+    LIBSEG_TRACE_SCOPE("Matter::InitPlanes");
+    for (int i = 0; i < W*H; ++i) {
+      final_mask[i] = 0;
+      changes_ref_[i] = 0;
+      fg_pdf[i] = bg_pdf[i] = 0;
+      fg_likelihood[i] = bg_likelihood[i] = 0;
+      fg_dist[i] = numeric_limits<double>::max();
+      bg_dist[i] = numeric_limits<double>::max();
+    }
+  });
+}
 
-  channels[0] = lab_l.get();
-  channels[1] = lab_a.get();
-  channels[2] = lab_b.get();
+Matter::Matter(int W, int H)
+  : W(W), H(H),
+    preview_factor_(1),
+    superpixel_size_(0),
+    superpixel_compactness_(0),
+    workspace_(NULL),
+    own_workspace_(new Workspace),
+    update_depth_(0),
+    changes_ref_(new uint8_t[W*H]),
+    dirty_rows_(H, true),
+    contour_rows_(H, false),
+    ready_(ReadyFuture()) {
+  channels[0] = channels[1] = channels[2] = NULL;
+  workspace_ = own_workspace_.get();
 }
 
-Matter::~Matter() {}
+Matter::~Matter() {
+  // The background tasks use the matter
+  WaitReady();
+}
+
+shared_future<void> Matter::ReadyFuture() {
+  promise<void> ready;
+  ready.set_value();
+  return ready.get_future().share();
+}
+
+void Matter::Precompute(const function<void()>& task) {
+  const shared_future<void> previous = ready_;
+  const shared_ptr<promise<void>> done(new promise<void>);
+  ready_ = done->get_future().share();
+  PrecomputePool::Get().Post([previous, task, done] {
+    previous.wait();
+    task();
+    done->set_value();
+  });
+}
 
 void Matter::GetForegroundLikelihood(double* out) {
+  WaitReady();
   memcpy(out, fg_likelihood.get(), sizeof(double)*W*H);
 }
 
 void Matter::GetBackgroundLikelihood(double* out) {
+  WaitReady();
   memcpy(out, bg_likelihood.get(), sizeof(double)*W*H);
 }
 
 void Matter::GetForegroundDist(double* out) {
+  WaitReady();
   memcpy(out, fg_dist.get(), sizeof(double)*W*H);
 }
 
 void Matter::GetBackgroundDist(double* out) {
+  WaitReady();
   memcpy(out, bg_dist.get(), sizeof(double)*W*H);
 }
 
 void Matter::GetForegroundMask(uint8_t* outmask) {
+  WaitReady();
   memcpy(outmask, final_mask.get(), sizeof(uint8_t)*W*H);
 }
 
+void Matter::GetForegroundMaskBits(uint8_t* bits) const {
+  WaitReady();
+  PackMaskBits(final_mask.get(), W, H, bits);
+}
+
+void Matter::GetForegroundMaskRLE(vector<uint32_t>* runs) const {
+  WaitReady();
+  EncodeMaskRLE(final_mask.get(), W, H, runs);
+}
+
+void Matter::CommitMaskRow(int y, const uint8_t* row) {
+  uint8_t* mask_row = final_mask.get() + y*W;
+  if (memcmp(row, mask_row, W) != 0) {
+    memcpy(mask_row, row, W);
+    LIBSEG_COUNT(mask_rows_changed, 1);
+    dirty_rows_[y] = true;
+    contour_rows_[y] = true;
+  }
+}
+
+void Matter::UpdateFinalMask() {
+  LIBSEG_STAGE_TIMER(mask_ms);
+  LIBSEG_TRACE_SCOPE("Matter::UpdateFinalMask");
+  vector<uint8_t>& row = workspace_->row;
+  row.resize(W);
+  for (int y = 0; y < H; ++y) {
+    FinalForegroundMask(fg_dist.get() + y*W, bg_dist.get() + y*W, W, 1,
+                        row.data());
+    CommitMaskRow(y, row.data());
+  }
+}
+
+void Matter::MarkAllRowsDirty() {
+  dirty_rows_.assign(H, true);
+  contour_rows_.assign(H, true);
+}
+
+bool Matter::HasChanges() const {
+  WaitReady();
+  for (int y = 0; y < H; ++y) {
+    if (dirty_rows_[y] && memcmp(final_mask.get() + y*W,
+                                 changes_ref_.get() + y*W, W) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Matter::GetChangedSpans(vector<RowSpan>* spans) const {
+  WaitReady();
+  spans->clear();
+  for (int y = 0; y < H; ++y) {
+    if (!dirty_rows_[y]) {
+      continue;
+    }
+    const uint8_t* mask_row = final_mask.get() + y*W;
+    const uint8_t* ref_row = changes_ref_.get() + y*W;
+    int x = 0;
+    while (x < W) {
+      if (mask_row[x] == ref_row[x]) {
+        ++x;
+        continue;
+      }
+      const int x0 = x;
+      while (x < W && mask_row[x] != ref_row[x]) {
+        ++x;
+      }
+      spans->push_back(RowSpan(y, x0, x));
+    }
+  }
+}
+
+void Matter::GetDirtyRects(vector<Rect>* rects) const {
+  WaitReady();
+  vector<RowSpan> spans;
+  GetChangedSpans(&spans);
+  rects->clear();
+  // Indices in rects of the rectangles that reach the previous row
+  vector<size_t> open, still_open;
+  int y = -1;
+  for (const RowSpan& span : spans) {
+    if (span.y != y) {
+      // Only the rectangles extended to the previous row can grow further
+      if (span.y != y + 1) {
+        still_open.clear();
+      }
+      open.swap(still_open);
+      still_open.clear();
+      y = span.y;
+    }
+    // Merge with a rectangle overlapping the span on the previous row
+    Rect* merged = NULL;
+    for (size_t i : open) {
+      Rect& r = (*rects)[i];
+      if (span.x0 < r.x + r.width && r.x < span.x1) {
+        merged = &r;
+        break;
+      }
+    }
+    if (merged == NULL) {
+      rects->push_back(Rect(span.x0, y, span.x1 - span.x0, 1));
+      still_open.push_back(rects->size() - 1);
+      continue;
+    }
+    const int x1 = max(merged->x + merged->width, span.x1);
+    merged->x = min(merged->x, span.x0);
+    merged->width = x1 - merged->x;
+    merged->height = y - merged->y + 1;
+    const size_t i = merged - rects->data();
+    if (find(still_open.begin(), still_open.end(), i) == still_open.end()) {
+      still_open.push_back(i);
+    }
+  }
+}
+
+void Matter::GetDeltaMask(uint8_t* delta) const {
+  WaitReady();
+  for (int y = 0; y < H; ++y) {
+    const uint8_t* mask_row = final_mask.get() + y*W;
+    const uint8_t* ref_row = changes_ref_.get() + y*W;
+    uint8_t* delta_row = delta + y*W;
+    if (!dirty_rows_[y]) {
+      memset(delta_row, 0, W);
+      continue;
+    }
+    for (int x = 0; x < W; ++x) {
+      delta_row[x] = (mask_row[x] != ref_row[x]) ? 255 : 0;
+    }
+  }
+}
+
+void Matter::ClearChanges() {
+  WaitReady();
+  for (int y = 0; y < H; ++y) {
+    if (dirty_rows_[y]) {
+      memcpy(changes_ref_.get() + y*W, final_mask.get() + y*W, W);
+      dirty_rows_[y] = false;
+    }
+  }
+}
+
+void Matter::GetContours(double tolerance, vector<Contour>* contours) {
+  WaitReady();
+  if (!contour_tracer_) {
+    contour_tracer_.reset(new ContourTracer(W, H));
+    contour_tracer_->Update(final_mask.get());
+  } else {
+    contour_tracer_->Update(final_mask.get(), &contour_rows_);
+  }
+  contour_rows_.assign(H, false);
+  contour_tracer_->GetContours(tolerance, contours);
+}
+
+void Matter::SetPreviewFactor(int factor) {
+  CHECK_GE(factor, 1);
+  CHECK(factor == 1 || superpixel_size_ == 0)
+    << "The preview and superpixel modes can't be combined";
+  preview_factor_ = factor;
+  if (factor == 1) {
+    preview_.reset();
+    band_.reset();
+    return;
+  }
+  preview_.reset(NewPreview(image_->Downsampled(factor)));
+  band_.reset(new uint8_t[W*H]);
+  // The matter is ready once its preview is
+  const shared_future<void> preview_ready = preview_->ready_;
+  Precompute([preview_ready] { preview_ready.wait(); });
+}
+
+Matter::UpdateScope::UpdateScope(Matter* matter) : matter_(matter) {
+  matter_->WaitReady();
+  ++matter_->update_depth_;
+}
+
+Matter::UpdateScope::~UpdateScope() {
+  if (--matter_->update_depth_ == 0) {
+    matter_->PublishResults();
+  }
+}
+
+void Matter::SetPublishResults(bool enable) {
+  if (!enable) {
+    publisher_.reset();
+  } else if (!publisher_) {
+    WaitReady();
+    publisher_.reset(new ResultsPublisher);
+    PublishResults();
+  }
+}
+
+void Matter::PublishResults() {
+  if (!publisher_) {
+    return;
+  }
+  LIBSEG_TRACE_SCOPE("Matter::PublishResults");
+  shared_ptr<Results> r = publisher_->Acquire();
+  const int N = W*H;
+  r->W = W;
+  r->H = H;
+  r->mask.assign(final_mask.get(), final_mask.get() + N);
+  r->fg_likelihood.assign(fg_likelihood.get(), fg_likelihood.get() + N);
+  r->bg_likelihood.assign(bg_likelihood.get(), bg_likelihood.get() + N);
+  r->fg_dist.assign(fg_dist.get(), fg_dist.get() + N);
+  r->bg_dist.assign(bg_dist.get(), bg_dist.get() + N);
+  publisher_->Publish(r);
+}
+
+void Matter::SetWorkspace(Workspace* ws) {
+  workspace_ = ws ? ws : own_workspace_.get();
+}
+
+template<class T>
+static size_t VectorBytes(const vector<T>& v) {
+  return sizeof(T)*v.capacity();
+}
+
+static size_t ProbsBytes(const vector<vector<double>>& probs) {
+  size_t bytes = VectorBytes(probs);
+  for (const vector<double>& p : probs) {
+    bytes += VectorBytes(p);
+  }
+  return bytes;
+}
+
+static size_t ScribblesBytes(const vector<Scribble>& scribbles) {
+  size_t bytes = VectorBytes(scribbles);
+  for (const Scribble& s : scribbles) {
+    bytes += VectorBytes(s.pixels);
+  }
+  return bytes;
+}
+
+size_t Matter::MemoryUsage() const {
+  const size_t npixels = (size_t)W*H;
+  // The pdf, likelihood and distance planes, then final_mask and
+  // changes_ref_
+  size_t bytes = 6*sizeof(double)*npixels + 2*npixels;
+  if (band_) {
+    bytes += npixels;
+  }
+  if (preview_) {
+    bytes += preview_->MemoryUsage();
+  }
+  if (own_workspace_) {
+    const Workspace& ws = *own_workspace_;
+    bytes += VectorBytes(ws.kde.window) + VectorBytes(ws.kde.filtered)
+        + VectorBytes(ws.geodesic.heap) + ProbsBytes(ws.probs)
+        + ProbsBytes(ws.prev_probs) + VectorBytes(ws.sources)
+        + VectorBytes(ws.fg_sources) + VectorBytes(ws.bg_sources)
+        + VectorBytes(ws.row);
+  }
+  return bytes;
+}
+
+void Matter::SetSuperpixelSize(int region_size, double compactness) {
+  CHECK_GE(region_size, 0);
+  if (region_size == 0) {
+    WaitReady();
+    superpixel_size_ = 0;
+    superpixel_compactness_ = 0;
+    superpixels_.reset();
+    return;
+  }
+  CHECK_EQ(1, preview_factor_)
+    << "The preview and superpixel modes can't be combined";
+  superpixel_size_ = region_size;
+  superpixel_compactness_ = compactness;
+  Precompute([this, region_size, compactness] {
+    superpixels_ = image_->Superpixels(region_size, compactness);
+  });
+}
+
+int Matter::NumSuperpixels() const {
+  WaitReady();
+  return superpixels_ ? superpixels_->NumNodes() : 0;
+}
+
+bool Matter::DistanceMap(const vector<Point2i>& sources,
+                         const double* height,
+                         double* dists,
+                         const CancelFlag* cancel) const {
+  if (!superpixels_) {
+    return GeodesicDistanceMap(sources, height, W, H, dists, cancel,
+                               &workspace_->geodesic);
+  }
+  vector<double> node_height;
+  SuperpixelMeans(*superpixels_, height, &node_height);
+  return GraphGeodesicDistanceMap(*superpixels_, sources, node_height, dists,
+                                  cancel);
+}
+
+bool Matter::DistanceMap(const vector<Scribble>& scribbles,
+                         bool background,
+                         const double* height,
+                         double* dists,
+                         const CancelFlag* cancel) const {
+  vector<Point2i>& sources = workspace_->sources;
+  sources.clear();
+  for (const Scribble& s : scribbles) {
+    if (s.background == background) {
+      sources.insert(sources.end(), s.pixels.begin(), s.pixels.end());
+    }
+  }
+  return DistanceMap(sources, height, dists, cancel);
+}
+
+void Matter::SetPreviewCallback(const function<void()>& on_preview) {
+  on_preview_ = on_preview;
+}
+
+// Color range of the joint bilateral upsampling, in lab units
+static const double kPreviewSigmaColor = 10;
+
+void Matter::UpsamplePreview() {
+  LIBSEG_TRACE_SCOPE("Matter::UpsamplePreview");
+  const Matter& preview = *preview_;
+  vector<uint8_t> mask(W*H);
+  JointBilateralUpsampleMask(preview.final_mask.get(), preview.channels,
+                             preview.W, preview.H, channels, W, H,
+                             preview_factor_, kPreviewSigmaColor,
+                             mask.data(), band_.get());
+  for (int y = 0; y < H; ++y) {
+    CommitMaskRow(y, mask.data() + y*W);
+  }
+  UpsampleNearest(preview.fg_dist.get(), preview.W, preview.H, W, H,
+                  preview_factor_, fg_dist.get());
+  UpsampleNearest(preview.bg_dist.get(), preview.W, preview.H, W, H,
+                  preview_factor_, bg_dist.get());
+  PublishResults();
+  if (on_preview_) {
+    on_preview_();
+  }
+}
+
+void Matter::RefineBand(const vector<Point2i>& fg_sources,
+                        const vector<Point2i>& bg_sources) {
+  LIBSEG_TRACE_SCOPE("Matter::RefineBand");
+  {
+    GeodesicPropagation fg_propagation(fg_likelihood.get(), W, H,
+                                       fg_dist.get(), &workspace_->geodesic);
+    fg_propagation.InitInRegion(fg_sources, band_.get());
+    fg_propagation.Run();
+  }
+  GeodesicPropagation bg_propagation(bg_likelihood.get(), W, H, bg_dist.get(),
+                                     &workspace_->geodesic);
+  bg_propagation.InitInRegion(bg_sources, band_.get());
+  bg_propagation.Run();
+  UpdateFinalMask();
+}
+
 SimpleMatter::SimpleMatter(uint8_t* l, uint8_t* a, uint8_t* b,
                            int W, int H)
-  : Matter(l, a, b, W, H) {
+  : SimpleMatter(LabImage::Create(l, a, b, W, H)) {
+}
+
+SimpleMatter::SimpleMatter(const shared_ptr<const LabImage>& image)
+  : Matter(image),
+    refit_threshold_(0) {
 }
 
 SimpleMatter::~SimpleMatter() {}
 
+void SimpleMatter::SetModelRefitThreshold(double threshold) {
+  CHECK_GE(threshold, 0);
+  refit_threshold_ = threshold;
+}
+
+void SimpleMatter::SetPreviewFactor(int factor) {
+  Matter::SetPreviewFactor(factor);
+  ResetMaskState();
+  // The new preview matter uses the same imported models
+  if (preview_) {
+    SimpleMatter* preview = static_cast<SimpleMatter*>(preview_.get());
+    if (bg_state_.imported) {
+      preview->SetColorModel(true, bg_state_.model);
+    }
+    if (fg_state_.imported) {
+      preview->SetColorModel(false, fg_state_.model);
+    }
+  }
+}
+
+void SimpleMatter::SetSuperpixelSize(int region_size, double compactness) {
+  Matter::SetSuperpixelSize(region_size, compactness);
+  ResetMaskState();
+}
+
+size_t SimpleMatter::MemoryUsage() const {
+  size_t bytes = Matter::MemoryUsage();
+  for (const ClassState* state : {&bg_state_, &fg_state_}) {
+    bytes += VectorBytes(state->mask) + ProbsBytes(state->model.probs);
+  }
+  return bytes;
+}
+
+void SimpleMatter::ResetMaskState() {
+  for (ClassState* state : {&bg_state_, &fg_state_}) {
+    state->mask.clear();
+    state->count = 0;
+    state->model_count = 0;
+  }
+}
+
+void SimpleMatter::GetColorModel(bool background, ColorModel* model) const {
+  *model = (background ? bg_state_ : fg_state_).model;
+}
+
+void SimpleMatter::SetColorModel(bool background, const ColorModel& model) {
+  CHECK(IsValidColorModel(model));
+  ClassState& state = background ? bg_state_ : fg_state_;
+  state.model = model;
+  state.imported = true;
+  state.model_changed = true;
+  if (preview_) {
+    static_cast<SimpleMatter*>(preview_.get())->SetColorModel(background,
+                                                              model);
+  }
+}
+
+void SimpleMatter::ClearColorModel(bool background) {
+  ClassState& state = background ? bg_state_ : fg_state_;
+  if (state.imported) {
+    state.imported = false;
+    state.model_changed = true;
+  }
+  if (preview_) {
+    static_cast<SimpleMatter*>(preview_.get())->ClearColorModel(background);
+  }
+}
+
+Matter* SimpleMatter::NewPreview(const shared_ptr<const LabImage>& image) {
+  return new SimpleMatter(image);
+}
+
+static void MaskPixels(const uint8_t* mask, int W, int H,
+                       vector<Point2i>* pixels) {
+  pixels->clear();
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      if (mask[y*W + x]) {
+        pixels->push_back(Point2i(x, y));
+      }
+    }
+  }
+}
+
 void SimpleMatter::UpdateMasks(uint8_t* bg_mask, uint8_t* fg_mask) {
+  LIBSEG_COLLECT_STATS(&stats_);
+  UpdateScope update(this);
+  LIBSEG_TRACE_SCOPE("SimpleMatter::UpdateMasks");
+  if (preview_) {
+    const int Wl = DownsampledSize(W, preview_factor_);
+    const int Hl = DownsampledSize(H, preview_factor_);
+    vector<uint8_t> low_bg(Wl*Hl), low_fg(Wl*Hl);
+    DownsampleMask(bg_mask, W, H, preview_factor_, low_bg.data());
+    DownsampleMask(fg_mask, W, H, preview_factor_, low_fg.data());
+    static_cast<SimpleMatter*>(preview_.get())->UpdateMasks(low_bg.data(),
+                                                            low_fg.data());
+    UpsamplePreview();
+
+    UpdateColorModel(bg_mask, &bg_state_, bg_pdf.get());
+    UpdateColorModel(fg_mask, &fg_state_, fg_pdf.get());
+    ForegroundLikelihood(fg_pdf.get(), bg_pdf.get(), H, W,
+                         fg_likelihood.get());
+    ForegroundLikelihood(bg_pdf.get(), fg_pdf.get(), H, W,
+                         bg_likelihood.get());
+
+    vector<Point2i> fg_sources, bg_sources;
+    MaskPixels(fg_mask, W, H, &fg_sources);
+    MaskPixels(bg_mask, W, H, &bg_sources);
+    RefineBand(fg_sources, bg_sources);
+    return;
+  }
+
+  // What changed since the last update. The sources are first the pixels
+  // added to each mask
+  vector<Point2i>& fg_sources = workspace_->fg_sources;
+  vector<Point2i>& bg_sources = workspace_->bg_sources;
+  const MaskChange bg_change = DiffMask(bg_mask, &bg_state_, &bg_sources);
+  const MaskChange fg_change = DiffMask(fg_mask, &fg_state_, &fg_sources);
+
   // Update PDFs
-  ImageColorPDF(channels, bg_mask, W, H, bg_pdf.get());
-  ImageColorPDF(channels, fg_mask, W, H, fg_pdf.get());
+  const bool bg_refit = NeedsRefit(bg_change, bg_state_);
+  const bool fg_refit = NeedsRefit(fg_change, fg_state_);
+  if (!bg_refit && !fg_refit && bg_change == MASK_UNCHANGED
+      && fg_change == MASK_UNCHANGED) {
+    return;
+  }
+  if (bg_refit) {
+    UpdateColorModel(bg_mask, &bg_state_, bg_pdf.get());
+  }
+  if (fg_refit) {
+    UpdateColorModel(fg_mask, &fg_state_, fg_pdf.get());
+  }
 
-  // Update likelihoods
-  ForegroundLikelihood(fg_pdf.get(), bg_pdf.get(), H, W, fg_likelihood.get());
-  ForegroundLikelihood(bg_pdf.get(), fg_pdf.get(), H, W, bg_likelihood.get());
+  if (bg_refit || fg_refit) {
+    // Update likelihoods. Both depend on both models
+    ForegroundLikelihood(fg_pdf.get(), bg_pdf.get(), H, W,
+                         fg_likelihood.get());
+    ForegroundLikelihood(bg_pdf.get(), fg_pdf.get(), H, W,
+                         bg_likelihood.get());
 
-  // Update distance maps
-  GeodesicDistanceMap(bg_mask, bg_likelihood.get(), W, H, bg_dist.get());
-  GeodesicDistanceMap(fg_mask, fg_likelihood.get(), W, H, fg_dist.get());
+    // The heights changed, so the distance maps have to be recomputed
+    MaskPixels(fg_mask, W, H, &fg_sources);
+    MaskPixels(bg_mask, W, H, &bg_sources);
+    DistanceMap(bg_sources, bg_likelihood.get(), bg_dist.get());
+    DistanceMap(fg_sources, fg_likelihood.get(), fg_dist.get());
+  } else {
+    // Same heights. A mask that only grew has its new pixels propagated
+    // from the current distances. Others (only with an imported model) are
+    // recomputed
+    const uint8_t* masks[2] = {bg_mask, fg_mask};
+    const MaskChange changes[2] = {bg_change, fg_change};
+    vector<Point2i>* sources[2] = {&bg_sources, &fg_sources};
+    double* likelihoods[2] = {bg_likelihood.get(), fg_likelihood.get()};
+    double* dists[2] = {bg_dist.get(), fg_dist.get()};
+    for (int c = 0; c < 2; ++c) {
+      if (changes[c] == MASK_UNCHANGED) {
+        continue;
+      }
+      if (changes[c] == MASK_CHANGED || superpixels_) {
+        MaskPixels(masks[c], W, H, sources[c]);
+        DistanceMap(*sources[c], likelihoods[c], dists[c]);
+        continue;
+      }
+      GeodesicPropagation propagation(likelihoods[c], W, H, dists[c],
+                                      &workspace_->geodesic);
+      propagation.AddSources(*sources[c]);
+      propagation.Run();
+    }
+  }
 
   // Compute final mask
-  FinalForegroundMask(fg_dist.get(), bg_dist.get(), W, H, final_mask.get());
+  UpdateFinalMask();
+}
+
+SimpleMatter::MaskChange SimpleMatter::DiffMask(const uint8_t* mask,
+                                                ClassState* state,
+                                                vector<Point2i>* added) const {
+  added->clear();
+  const int N = W*H;
+  if (state->mask.empty()) {
+    state->mask.assign(N, 0);
+    MaskPixels(mask, W, H, added);
+    for (const Point2i& p : *added) {
+      state->mask[p.y*W + p.x] = 1;
+    }
+    state->count = added->size();
+    return MASK_CHANGED;
+  }
+  bool removed = false;
+  uint8_t* prev = state->mask.data();
+  for (int i = 0; i < N; ++i) {
+    const uint8_t cur = mask[i] ? 1 : 0;
+    if (cur == prev[i]) {
+      continue;
+    }
+    if (cur) {
+      added->push_back(Point2i(i % W, i / W));
+      ++state->count;
+    } else {
+      removed = true;
+      --state->count;
+    }
+    prev[i] = cur;
+  }
+  if (removed) {
+    return MASK_CHANGED;
+  }
+  return added->empty() ? MASK_UNCHANGED : MASK_GROWN;
+}
+
+bool SimpleMatter::NeedsRefit(MaskChange change,
+                              const ClassState& state) const {
+  if (state.model_changed) {
+    return true;
+  }
+  if (state.imported) {
+    // Doesn't depend on the mask
+    return false;
+  }
+  switch (change) {
+    case MASK_UNCHANGED:
+      return false;
+    case MASK_GROWN:
+      return state.count > state.model_count * (1 + refit_threshold_);
+    case MASK_CHANGED:
+      return true;
+  }
+  return true;
+}
+
+void SimpleMatter::UpdateColorModel(const uint8_t* mask, ClassState* state,
+                                    double* pdf) {
+  state->model_changed = false;
+  if (!state->imported) {
+    // Same as ImageColorPDF(channels, mask, ...), but with the
+    // probabilities kept in the state
+    vector<vector<double>>& probs = state->model.probs;
+    probs.resize(3);
+    for (int i = 0; i < 3; ++i) {
+      ColorChannelKDE(channels[i], mask, W, H, true, &probs[i],
+                      &workspace_->kde);
+    }
+    state->model_count = state->count;
+  }
+  ImageColorPDF(channels, state->model.probs, W, H, pdf);
 }
 
 InteractiveMatter::InteractiveMatter(uint8_t* l, uint8_t* a, uint8_t* b,
                                      int W, int H)
-  : Matter(l, a, b, W, H),
+  : InteractiveMatter(LabImage::Create(l, a, b, W, H)) {
+}
+
+InteractiveMatter::InteractiveMatter(const shared_ptr<const LabImage>& image)
+  : Matter(image),
     bg_scribbled_(false),
-    fg_scribbled_(false) {
+    fg_scribbled_(false),
+    newdist_(new double[W*H]),
+    max_undo_levels_(0),
+    history_pos_(0),
+    next_seq_(0),
+    cache_max_bytes_(0),
+    record_depth_(0),
+    record_run_(0),
+    record_runs_ms_(0) {
+}
+
+InteractiveMatter::InteractiveMatter(int W, int H)
+  : Matter(W, H),
+    bg_scribbled_(false),
+    fg_scribbled_(false),
+    newdist_(new double[W*H]),
+    max_undo_levels_(0),
+    history_pos_(0),
+    next_seq_(0),
+    cache_max_bytes_(0),
+    record_depth_(0),
+    record_run_(0),
+    record_runs_ms_(0) {
 }
 
 InteractiveMatter::~InteractiveMatter() {}
 
 void InteractiveMatter::AddScribble(const Scribble& s) {
+  RecordScope record(this, RecordedEvent::kScribbles);
+  record.SetScribbles(&s, 1);
+  AddScribbles(&s, 1, NULL);
+}
+
+size_t InteractiveMatter::AddStroke(const Stroke& stroke,
+                                    size_t* nconflicts) {
+  RecordScope record(this, RecordedEvent::kScribbles);
+  // The conflicts are checked against all the scribbles, so the queued ones
+  // have to be added first
+  ProcessPending(chrono::steady_clock::time_point::max());
+  vector<RowSpan> spans;
+  RasterizeStroke(stroke, W, H, &spans);
+  const size_t nremoved = RemoveScribbledPixels(scribbles, !stroke.background,
+                                                &spans);
+  if (nconflicts) {
+    *nconflicts = nremoved;
+  }
+  if (spans.empty()) {
+    return 0;
+  }
+  Scribble s;
+  s.background = stroke.background;
+  SpansToPixels(spans, &s.pixels);
+  record.SetScribbles(&s, 1);
+  AddScribble(s);
+  return s.pixels.size();
+}
+
+void InteractiveMatter::UpdateLikelihoods() {
+  ForegroundLikelihood(fg_pdf.get(), bg_pdf.get(), H, W, fg_likelihood.get());
+  ForegroundLikelihood(bg_pdf.get(), fg_pdf.get(), H, W, bg_likelihood.get());
+}
+
+bool InteractiveMatter::UpdateColorModel(bool background,
+                                         const CancelFlag* cancel) {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::UpdateColorModel");
+  vector<vector<double>>& new_probs = workspace_->probs;
+  if (!ColorChannelsKDE(channels, scribbles, background, W, H, true,
+                        &new_probs, cancel, &workspace_->kde)) {
+    return false;
+  }
+  vector<vector<double>>& probs = background ? bg_probs_ : fg_probs_;
+  probs.swap(new_probs);
+  ImageColorPDF(channels, probs, W, H,
+                background ? bg_pdf.get() : fg_pdf.get());
+  UpdateLikelihoods();
+  return true;
+}
+
+// Cached fields are stored as float to halve their memory usage
+static float DistToField(double d) {
+  return (d >= numeric_limits<float>::max()) ? numeric_limits<float>::max()
+                                             : (float)d;
+}
+
+static double FieldToDist(float f) {
+  return (f == numeric_limits<float>::max()) ? numeric_limits<double>::max()
+                                             : f;
+}
+
+void InteractiveMatter::CommitDistances(bool background,
+                                        const uint8_t* region,
+                                        double max_dist) {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::CommitDistances");
+  double* dist = background ? bg_dist.get() : fg_dist.get();
+  const bool scribbled = background ? bg_scribbled_ : fg_scribbled_;
+  // A bg scribble only interferes with what's currently fg and inversely
+  const uint8_t other = background ? 255 : 0;
+  const double* newdist = newdist_.get();
+
+  if (max_dist == numeric_limits<double>::max()) {
+    if (!scribbled) { // special case for first scribble
+      memcpy(dist, newdist, sizeof(double)*W*H);
+    } else {
+      MaskedCopy<double, uint8_t>(newdist, region, other, W*H, dist);
+    }
+    if (CacheEnabled()) {
+      CacheGroupField(background);
+      int32_t* last = background ? bg_last_.get() : fg_last_.get();
+      const int32_t seq = groups_.back().seq;
+      for (int i = 0; i < W*H; ++i) {
+        if (!scribbled || region[i] == other) {
+          last[i] = seq;
+        }
+      }
+    }
+  } else {
+    // Partial update, only copy the settled pixels
+    for (int i = 0; i < W*H; ++i) {
+      if (newdist[i] <= max_dist && (!scribbled || region[i] == other)) {
+        dist[i] = newdist[i];
+      }
+    }
+  }
+
+  UpdateFinalMask();
+}
+
+size_t InteractiveMatter::AddScribbles(const vector<Scribble>& ss,
+                                       const CancelFlag* cancel) {
+  RecordScope record(this, RecordedEvent::kScribbles);
+  const size_t n = AddScribbles(ss.data(), ss.size(), cancel);
+  record.SetScribbles(ss.data(), n);
+  return n;
+}
+
+size_t InteractiveMatter::AddScribbles(const Scribble* ss, size_t n,
+                                       const CancelFlag* cancel) {
+  LIBSEG_COLLECT_STATS(&stats_);
+  UpdateScope update(this);
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::AddScribbles");
+  // Scribbles queued by the time-bounded API come first
+  ProcessPending(chrono::steady_clock::time_point::max());
+  if (preview_) {
+    return AddScribblesWithPreview(ss, n, cancel);
+  }
+
+  size_t next = 0;
+  while (next < n) {
+    // Gather the run of consecutive scribbles of the same class
+    const bool background = ss[next].background;
+    const size_t nprev = scribbles.size();
+    size_t end = next;
+    for (; end < n && ss[end].background == background; ++end) {
+      if (ss[end].pixels.size() == 0) {
+        LOG(WARNING) << "Ignoring empty scribble";
+        continue;
+      }
+      scribbles.push_back(ss[end]);
+    }
+    if (scribbles.size() == nprev) {
+      next = end;
+      continue;
+    }
+    PushGroup(background, nprev);
+
+    // 1. Update bg or fg pdf (depending on scribble's background attribute)
+    //    and fg AND bg likelihood.
+    //    Nothing has been modified yet if this gets cancelled.
+    vector<vector<double>>& prev_probs = workspace_->prev_probs;
+    prev_probs = background ? bg_probs_ : fg_probs_;
+    if (!UpdateColorModel(background, cancel)) {
+      scribbles.erase(scribbles.begin() + nprev, scribbles.end());
+      groups_.pop_back();
+      return next;
+    }
+
+    // 2. Update fg or bg distance map, but only for pixels within the
+    //    fg (if bg scribble) or bg (if fg scribble).
+    const double* likelihood = background ? bg_likelihood.get()
+                                          : fg_likelihood.get();
+    vector<Point2i>& sources = workspace_->sources;
+    sources.clear();
+    GatherSources(background, &sources);
+    if (!DistanceMap(sources, likelihood, newdist_.get(), cancel)) {
+      // Roll back the pdf and likelihoods to the previous color model
+      scribbles.erase(scribbles.begin() + nprev, scribbles.end());
+      groups_.pop_back();
+      // A class without color model has a null pdf (see RestoreHistory)
+      vector<vector<double>>& probs = background ? bg_probs_ : fg_probs_;
+      double* pdf = background ? bg_pdf.get() : fg_pdf.get();
+      probs.swap(prev_probs);
+      if (probs.empty()) {
+        fill(pdf, pdf + W*H, 0.0);
+      } else {
+        ImageColorPDF(channels, probs, W, H, pdf);
+      }
+      UpdateLikelihoods();
+      return next;
+    }
+
+    // 3. Compute final mask
+    CommitDistances(background, final_mask.get(),
+                    numeric_limits<double>::max());
+    (background ? bg_scribbled_ : fg_scribbled_) = true;
+    PushHistory();
+    next = end;
+  }
+  return next;
+}
+
+static chrono::steady_clock::time_point DeadlineFromBudget(double budget_ms) {
+  return chrono::steady_clock::now()
+       + chrono::duration_cast<chrono::steady_clock::duration>(
+           chrono::duration<double, milli>(budget_ms));
+}
+
+bool InteractiveMatter::AddScribble(const Scribble& s, double budget_ms) {
+  LIBSEG_COLLECT_STATS(&stats_);
+  UpdateScope update(this);
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::AddScribble(budget)");
+  if (preview_ || superpixels_) {
+    AddScribble(s);
+    return true;
+  }
+  const auto deadline = DeadlineFromBudget(budget_ms);
   if (s.pixels.size() == 0) {
     LOG(WARNING) << "Ignoring empty scribble";
-    return;
+  } else {
+    pending_.push_back(s);
+  }
+  return ProcessPending(deadline);
+}
+
+bool InteractiveMatter::ContinueUpdate(double budget_ms) {
+  LIBSEG_COLLECT_STATS(&stats_);
+  UpdateScope update(this);
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::ContinueUpdate");
+  return ProcessPending(DeadlineFromBudget(budget_ms));
+}
+
+bool InteractiveMatter::ProcessPending(
+    const chrono::steady_clock::time_point& deadline) {
+  // Always make some progress, even with an already expired deadline
+  bool first = true;
+  while (true) {
+    const auto start = chrono::steady_clock::now();
+    if (!propagation_) {
+      if (pending_.empty()) {
+        return true;
+      }
+      if (!first && chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      // Start the update for the run of scribbles of the same class at the
+      // front of the queue
+      const bool background = pending_.front().background;
+      const size_t nprev = scribbles.size();
+      while (!pending_.empty() && pending_.front().background == background) {
+        scribbles.push_back(pending_.front());
+        pending_.pop_front();
+      }
+      PushGroup(background, nprev);
+      if (recording_) {
+        RecordedEvent event;
+        event.scribbles.assign(scribbles.begin() + nprev, scribbles.end());
+        record_run_ = recording_->events.size();
+        recording_->events.push_back(event);
+      }
+      UpdateColorModel(background, NULL);
+
+      if (!region_) {
+        region_.reset(new uint8_t[W*H]);
+      }
+      memcpy(region_.get(), final_mask.get(), sizeof(uint8_t)*W*H);
+
+      const double* likelihood = background ? bg_likelihood.get()
+                                            : fg_likelihood.get();
+      propagation_.reset(new GeodesicPropagation(likelihood, W, H,
+                                                 newdist_.get()));
+      vector<Point2i> sources;
+      GatherSources(background, &sources);
+      propagation_->Init(sources);
+      propagation_background_ = background;
+    }
+
+    const bool done = propagation_->Run(NULL, deadline);
+    if (!done) {
+      // Out of time, publish the pixels that are already settled
+      CommitDistances(propagation_background_, region_.get(),
+                      propagation_->Frontier());
+    } else {
+      CommitDistances(propagation_background_, region_.get(),
+                      numeric_limits<double>::max());
+      (propagation_background_ ? bg_scribbled_ : fg_scribbled_) = true;
+      propagation_.reset();
+      PushHistory();
+    }
+    if (recording_) {
+      const double ms = chrono::duration<double, milli>(
+          chrono::steady_clock::now() - start).count();
+      recording_->events[record_run_].ms += ms;
+      record_runs_ms_ += ms;
+    }
+    if (!done) {
+      return false;
+    }
+    first = false;
   }
-  scribbles.push_back(s);
+}
 
-  // 1. Update bg or fg pdf (depending on scribble's background attribute)
-  if (s.background) {
-    //cout << "Updating bg pdf" << endl;
-    ImageColorPDF(channels, scribbles, true, W, H, bg_pdf.get());
+void InteractiveMatter::SetMaxUndoLevels(int n) {
+  RecordScope record(this, RecordedEvent::kSetMaxUndoLevels, n);
+  WaitReady();
+  CHECK_GE(n, 0);
+  ProcessPending(chrono::steady_clock::time_point::max());
+  max_undo_levels_ = n;
+  if (preview_) {
+    Preview()->SetMaxUndoLevels(n);
+  }
+  if (n == 0) {
+    ResetHistory();
+  } else if (history_.empty()) {
+    // Snapshot of the current state, which is the first one we can go back to
+    PushHistory();
   } else {
-    //cout << "Updating fg pdf" << endl;
-    ImageColorPDF(channels, scribbles, false, W, H, fg_pdf.get());
+    // Drop what could be redone first, so the current state is kept
+    while (history_.size() > (size_t)max_undo_levels_ + 1 &&
+           history_pos_ + 1 < history_.size()) {
+      history_.pop_back();
+    }
+    const size_t redo = history_.back().nscribbles - scribbles.size();
+    undone_.erase(undone_.begin(), undone_.end() - redo);
+    while (history_.size() > (size_t)max_undo_levels_ + 1) {
+      history_.pop_front();
+      --history_pos_;
+    }
+  }
+}
+
+void InteractiveMatter::PushHistory() {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::PushHistory");
+  if (max_undo_levels_ == 0) {
+    return;
   }
+  // A new update discards what could be redone
+  if (!history_.empty()) {
+    history_.erase(history_.begin() + history_pos_ + 1, history_.end());
+  }
+  undone_.clear();
 
-  // 2. Update fg AND bg likelihood
-  ForegroundLikelihood(fg_pdf.get(), bg_pdf.get(), H, W, fg_likelihood.get());
-  ForegroundLikelihood(bg_pdf.get(), fg_pdf.get(), H, W, bg_likelihood.get());
+  // deque::push_back doesn't invalidate references, so prev stays valid
+  const State* prev = history_.empty() ? NULL : &history_.back();
+  history_.push_back(State());
+  State& state = history_.back();
+  state.fg_dist.Capture(fg_dist.get(), W, H, prev ? &prev->fg_dist : NULL);
+  state.bg_dist.Capture(bg_dist.get(), W, H, prev ? &prev->bg_dist : NULL);
+  state.final_mask.Capture(final_mask.get(), W, H,
+                           prev ? &prev->final_mask : NULL);
+  state.bg_probs = bg_probs_;
+  state.fg_probs = fg_probs_;
+  state.bg_scribbled = bg_scribbled_;
+  state.fg_scribbled = fg_scribbled_;
+  state.nscribbles = scribbles.size();
+  state.groups = groups_;
+  if (CacheEnabled()) {
+    state.fg_cmin.Capture(fg_cmin_.get(), W, H, prev ? &prev->fg_cmin : NULL);
+    state.bg_cmin.Capture(bg_cmin_.get(), W, H, prev ? &prev->bg_cmin : NULL);
+    state.fg_last.Capture(fg_last_.get(), W, H, prev ? &prev->fg_last : NULL);
+    state.bg_last.Capture(bg_last_.get(), W, H, prev ? &prev->bg_last : NULL);
+  }
 
-#if 1
-  // 3. Update fg or bg distance map, but only for pixels within the
-  //    fg (if bg scribble) or bg (if fg scribble).
-  unique_ptr<double> newdist(new double[W*H]);
-  if (s.background) {
-    GeodesicDistanceMap(scribbles, true, bg_likelihood.get(), W, H,
-                        newdist.get());
-    if (!bg_scribbled_) { // special case for first scribble
-      memcpy(bg_dist.get(), newdist.get(), sizeof(double)*W*H);
-      bg_scribbled_ = true;
+  while (history_.size() > (size_t)max_undo_levels_ + 1) {
+    history_.pop_front();
+  }
+  history_pos_ = history_.size() - 1;
+}
+
+void InteractiveMatter::RestoreHistory(size_t pos) {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::RestoreHistory");
+  const State& from = history_[history_pos_];
+  const State& to = history_[pos];
+  // The planes currently contain from, so only the tiles that differ between
+  // the two states need to be copied
+  to.fg_dist.Restore(fg_dist.get(), &from.fg_dist);
+  to.bg_dist.Restore(bg_dist.get(), &from.bg_dist);
+  to.final_mask.Restore(final_mask.get(), &from.final_mask);
+  MarkAllRowsDirty();
+  bg_probs_ = to.bg_probs;
+  fg_probs_ = to.fg_probs;
+  // A class without color model has a null pdf
+  for (int c = 0; c < 2; ++c) {
+    const vector<vector<double>>& probs = c ? bg_probs_ : fg_probs_;
+    double* pdf = c ? bg_pdf.get() : fg_pdf.get();
+    if (probs.empty()) {
+      fill(pdf, pdf + W*H, 0.0);
     } else {
-      MaskedCopy<double, uint8_t>(newdist.get(), final_mask.get(), 255,
-                                  W*H, bg_dist.get());
+      ImageColorPDF(channels, probs, W, H, pdf);
+    }
+  }
+  UpdateLikelihoods();
+  bg_scribbled_ = to.bg_scribbled;
+  fg_scribbled_ = to.fg_scribbled;
+  groups_ = to.groups;
+  if (CacheEnabled()) {
+    to.fg_cmin.Restore(fg_cmin_.get(), &from.fg_cmin);
+    to.bg_cmin.Restore(bg_cmin_.get(), &from.bg_cmin);
+    to.fg_last.Restore(fg_last_.get(), &from.fg_last);
+    to.bg_last.Restore(bg_last_.get(), &from.bg_last);
+  }
+
+  while (scribbles.size() > to.nscribbles) {
+    undone_.push_back(scribbles.back());
+    scribbles.pop_back();
+  }
+  while (scribbles.size() < to.nscribbles) {
+    scribbles.push_back(undone_.back());
+    undone_.pop_back();
+  }
+  history_pos_ = pos;
+}
+
+void InteractiveMatter::ResetHistory() {
+  history_.clear();
+  history_pos_ = 0;
+  undone_.clear();
+  PushHistory();
+}
+
+bool InteractiveMatter::Undo() {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::Undo");
+  UpdateScope update(this);
+  RecordScope record(this, RecordedEvent::kUndo);
+  ProcessPending(chrono::steady_clock::time_point::max());
+  if (!CanUndo()) {
+    return false;
+  }
+  RestoreHistory(history_pos_ - 1);
+  if (preview_) {
+    Preview()->Undo();
+  }
+  return true;
+}
+
+bool InteractiveMatter::Redo() {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::Redo");
+  UpdateScope update(this);
+  RecordScope record(this, RecordedEvent::kRedo);
+  ProcessPending(chrono::steady_clock::time_point::max());
+  if (!CanRedo()) {
+    return false;
+  }
+  RestoreHistory(history_pos_ + 1);
+  if (preview_) {
+    Preview()->Redo();
+  }
+  return true;
+}
+
+size_t InteractiveMatter::UndoMemoryUsage() const {
+  set<const void*> seen;
+  size_t bytes = 0;
+  for (const State& state : history_) {
+    bytes += state.fg_dist.CountBytes(&seen);
+    bytes += state.bg_dist.CountBytes(&seen);
+    bytes += state.final_mask.CountBytes(&seen);
+  }
+  return bytes;
+}
+
+void InteractiveMatter::PushGroup(bool background, size_t first) {
+  ScribbleGroup group;
+  group.background = background;
+  group.nscribbles = scribbles.size() - first;
+  group.seq = next_seq_++;
+  groups_.push_back(group);
+}
+
+void InteractiveMatter::GatherSources(bool background,
+                                      vector<Point2i>* sources) const {
+  for (size_t i = 0; i < scribbles.size(); ++i) {
+    if (scribbles[i].background == background) {
+      sources->insert(sources->end(), scribbles[i].pixels.begin(),
+                      scribbles[i].pixels.end());
+    }
+  }
+}
+
+void InteractiveMatter::CacheGroupField(bool background) {
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::CacheGroupField");
+  // The scribbles of the last group are the last ones
+  vector<Point2i>& sources = workspace_->sources;
+  sources.clear();
+  for (size_t i = scribbles.size() - groups_.back().nscribbles;
+       i < scribbles.size(); ++i) {
+    sources.insert(sources.end(), scribbles[i].pixels.begin(),
+                   scribbles[i].pixels.end());
+  }
+  double* newdist = newdist_.get();
+  DistanceMap(sources, background ? bg_likelihood.get()
+                                  : fg_likelihood.get(), newdist);
+  float* cmin = background ? bg_cmin_.get() : fg_cmin_.get();
+  shared_ptr<vector<float>> field(new vector<float>(W*H));
+  for (int i = 0; i < W*H; ++i) {
+    (*field)[i] = DistToField(newdist[i]);
+    cmin[i] = min(cmin[i], (*field)[i]);
+  }
+  groups_.back().field = field;
+  EnforceCacheSize();
+}
+
+void InteractiveMatter::EnforceCacheSize() {
+  size_t bytes = ScribbleCacheUsage();
+  for (ScribbleGroup& group : groups_) {
+    if (bytes <= cache_max_bytes_) {
+      break;
+    }
+    if (group.field) {
+      bytes -= sizeof(float)*group.field->size();
+      group.field.reset();
+    }
+  }
+}
+
+size_t InteractiveMatter::ScribbleCacheUsage() const {
+  size_t bytes = 0;
+  for (const ScribbleGroup& group : groups_) {
+    if (group.field) {
+      bytes += sizeof(float)*group.field->size();
+    }
+  }
+  return bytes;
+}
+
+size_t InteractiveMatter::MemoryUsage() const {
+  const size_t npixels = (size_t)W*H;
+  size_t bytes = Matter::MemoryUsage() + ScribblesBytes(scribbles)
+      + ScribblesBytes(undone_) + ProbsBytes(bg_probs_) + ProbsBytes(fg_probs_)
+      + UndoMemoryUsage() + ScribbleCacheUsage();
+  for (const Scribble& s : pending_) {
+    bytes += sizeof(Scribble) + VectorBytes(s.pixels);
+  }
+  if (newdist_) {
+    bytes += sizeof(double)*npixels;
+  }
+  if (region_) {
+    bytes += npixels;
+  }
+  if (CacheEnabled()) {
+    bytes += 2*(sizeof(float) + sizeof(int32_t))*npixels;
+  }
+  return bytes;
+}
+
+void InteractiveMatter::SetScribbleCacheSize(size_t max_bytes) {
+  CHECK(!recording_) << "The scribble cache can't change while recording";
+  WaitReady();
+  ProcessPending(chrono::steady_clock::time_point::max());
+  if (preview_) {
+    Preview()->SetScribbleCacheSize(max_bytes);
+    return;
+  }
+  const bool was_enabled = CacheEnabled();
+  cache_max_bytes_ = max_bytes;
+  if (!CacheEnabled()) {
+    fg_cmin_.reset();
+    bg_cmin_.reset();
+    fg_last_.reset();
+    bg_last_.reset();
+    for (ScribbleGroup& group : groups_) {
+      group.field.reset();
+    }
+  } else if (!was_enabled) {
+    // The fields of the existing scribbles are not known, so start with the
+    // distance to all of them and consider the pixels last written by the
+    // last update of their class
+    fg_cmin_.reset(new float[W*H]);
+    bg_cmin_.reset(new float[W*H]);
+    fg_last_.reset(new int32_t[W*H]);
+    bg_last_.reset(new int32_t[W*H]);
+    for (int c = 0; c < 2; ++c) {
+      const bool background = (c == 1);
+      float* cmin = background ? bg_cmin_.get() : fg_cmin_.get();
+      int32_t* last = background ? bg_last_.get() : fg_last_.get();
+      int32_t last_seq = -1;
+      for (const ScribbleGroup& group : groups_) {
+        if (group.background == background) {
+          last_seq = group.seq;
+        }
+      }
+      if (last_seq >= 0) {
+        DistanceMap(scribbles, background,
+                    background ? bg_likelihood.get() : fg_likelihood.get(),
+                    newdist_.get());
+      }
+      for (int i = 0; i < W*H; ++i) {
+        cmin[i] = (last_seq >= 0) ? DistToField(newdist_[i])
+                                  : numeric_limits<float>::max();
+        last[i] = last_seq;
+      }
+    }
+  }
+  EnforceCacheSize();
+  // The history snapshots don't have the same content with and without cache
+  if (was_enabled != CacheEnabled()) {
+    ResetHistory();
+  }
+}
+
+bool InteractiveMatter::RemoveScribble(size_t index) {
+  LIBSEG_COLLECT_STATS(&stats_);
+  UpdateScope update(this);
+  LIBSEG_TRACE_SCOPE("InteractiveMatter::RemoveScribble");
+  RecordScope record(this, RecordedEvent::kRemoveScribble, index);
+  ProcessPending(chrono::steady_clock::time_point::max());
+  if (index >= scribbles.size()) {
+    return false;
+  }
+  if (preview_) {
+    CHECK(Preview()->RemoveScribble(index));
+    const bool background = scribbles[index].background;
+    scribbles.erase(scribbles.begin() + index);
+    groups_ = Preview()->groups_;
+    UpdateColorModel(background, NULL);
+    FinishPreviewUpdate();
+    ResetHistory();
+    return true;
+  }
+
+  // Find the group of the scribble
+  size_t gi = 0;
+  for (size_t first = 0; gi < groups_.size(); ++gi) {
+    if (index < first + groups_[gi].nscribbles) {
+      break;
+    }
+    first += groups_[gi].nscribbles;
+  }
+  CHECK_LT(gi, groups_.size());
+  const bool background = groups_[gi].background;
+  const int32_t seq = groups_[gi].seq;
+  const shared_ptr<const vector<float>> old_field = groups_[gi].field;
+
+  scribbles.erase(scribbles.begin() + index);
+  const bool removed = (--groups_[gi].nscribbles == 0);
+  if (removed) {
+    groups_.erase(groups_.begin() + gi);
+  }
+
+  // 1. Color model and likelihoods
+  UpdateColorModel(background, NULL);
+
+  double* dist = background ? bg_dist.get() : fg_dist.get();
+  const double* likelihood = background ? bg_likelihood.get()
+                                        : fg_likelihood.get();
+
+  // The remaining groups of the class, and whether they all have a field
+  vector<const ScribbleGroup*> class_groups;
+  bool all_cached = CacheEnabled() && old_field;
+  size_t first = 0;
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    const ScribbleGroup& group = groups_[i];
+    if (group.background == background) {
+      if (!removed && i == gi && all_cached) {
+        // The group lost a scribble, recompute its field
+        vector<Point2i> sources;
+        for (size_t j = first; j < first + group.nscribbles; ++j) {
+          sources.insert(sources.end(), scribbles[j].pixels.begin(),
+                         scribbles[j].pixels.end());
+        }
+        DistanceMap(sources, likelihood, newdist_.get());
+        shared_ptr<vector<float>> field(new vector<float>(W*H));
+        for (int k = 0; k < W*H; ++k) {
+          (*field)[k] = DistToField(newdist_[k]);
+        }
+        groups_[i].field = field;
+      }
+      class_groups.push_back(&group);
+      all_cached = all_cached && group.field;
+    }
+    first += group.nscribbles;
+  }
+
+  // 2. Distance map of the class
+  if (class_groups.empty()) {
+    for (int i = 0; i < W*H; ++i) {
+      dist[i] = numeric_limits<double>::max();
+    }
+    (background ? bg_scribbled_ : fg_scribbled_) = false;
+    if (CacheEnabled()) {
+      float* cmin = background ? bg_cmin_.get() : fg_cmin_.get();
+      int32_t* last = background ? bg_last_.get() : fg_last_.get();
+      for (int i = 0; i < W*H; ++i) {
+        cmin[i] = numeric_limits<float>::max();
+        last[i] = -1;
+      }
+    }
+  } else if (all_cached) {
+    // Incremental : only the pixels written by the update of the removed
+    // scribble or a later one can change, since the later updates propagated
+    // from it too. They all get the min-combination of the fields of the
+    // updates up to the one that last wrote them (see CommitDistances)
+    float* cmin = background ? bg_cmin_.get() : fg_cmin_.get();
+    int32_t* last = background ? bg_last_.get() : fg_last_.get();
+    // When the group is gone, pixels it wrote fall back to the previous
+    // update of the class, or to the next one if it was the first
+    int32_t prev_seq = -1, next_seq = -1;
+    for (const ScribbleGroup* group : class_groups) {
+      if (group->seq < seq) {
+        prev_seq = group->seq;
+      } else if (next_seq < 0) {
+        next_seq = group->seq;
+      }
+    }
+    const int32_t fallback_seq = (prev_seq >= 0) ? prev_seq : next_seq;
+    for (int i = 0; i < W*H; ++i) {
+      const float old = (*old_field)[i];
+      if (old <= cmin[i]) {
+        float m = numeric_limits<float>::max();
+        for (const ScribbleGroup* group : class_groups) {
+          m = min(m, (*group->field)[i]);
+        }
+        cmin[i] = m;
+      }
+      if (last[i] < seq) {
+        continue;
+      }
+      if (removed && last[i] == seq) {
+        last[i] = fallback_seq;
+      }
+      float m = numeric_limits<float>::max();
+      for (const ScribbleGroup* group : class_groups) {
+        if (group->seq <= last[i]) {
+          m = min(m, (*group->field)[i]);
+        }
+      }
+      dist[i] = FieldToDist(m);
     }
   } else {
-    GeodesicDistanceMap(scribbles, false, fg_likelihood.get(), W, H,
-                        newdist.get());
-    if (!fg_scribbled_) { // special case for first scribble
-      memcpy(fg_dist.get(), newdist.get(), sizeof(double)*W*H);
-      fg_scribbled_ = true;
-    } else {
-      MaskedCopy<double, uint8_t>(newdist.get(), final_mask.get(), 0,
-                                  W*H, fg_dist.get());
+    // Full recompute from the remaining scribbles of the class
+    DistanceMap(scribbles, background, likelihood, dist);
+    if (CacheEnabled()) {
+      // The fields of this class don't match the distance map anymore
+      float* cmin = background ? bg_cmin_.get() : fg_cmin_.get();
+      int32_t* last = background ? bg_last_.get() : fg_last_.get();
+      for (int i = 0; i < W*H; ++i) {
+        cmin[i] = DistToField(dist[i]);
+        last[i] = class_groups.back()->seq;
+      }
+      for (ScribbleGroup& group : groups_) {
+        if (group.background == background) {
+          group.field.reset();
+        }
+      }
+    }
+  }
+
+  // 3. Final mask
+  UpdateFinalMask();
+  ResetHistory();
+  return true;
+}
+
+void InteractiveMatter::SetPreviewFactor(int factor) {
+  CHECK(!recording_) << "The preview factor can't change while recording";
+  ProcessPending(chrono::steady_clock::time_point::max());
+  CHECK(scribbles.empty()) << "The preview factor can't change after the "
+                           << "first scribble";
+  const size_t cache_max_bytes = preview_ ? Preview()->cache_max_bytes_
+                                         : cache_max_bytes_;
+  SetScribbleCacheSize(0);
+  Matter::SetPreviewFactor(factor);
+  if (preview_) {
+    Preview()->SetMaxUndoLevels(max_undo_levels_);
+  }
+  SetScribbleCacheSize(cache_max_bytes);
+}
 
+void InteractiveMatter::SetSuperpixelSize(int region_size,
+                                          double compactness) {
+  CHECK(!recording_) << "The superpixel size can't change while recording";
+  Matter::SetSuperpixelSize(region_size, compactness);
+}
+
+Matter* InteractiveMatter::NewPreview(
+    const shared_ptr<const LabImage>& image) {
+  return new InteractiveMatter(image);
+}
+
+size_t InteractiveMatter::AddScribblesWithPreview(const Scribble* ss,
+                                                  size_t n,
+                                                  const CancelFlag* cancel) {
+  // One run of scribbles of the same class at a time, so that each run is an
+  // undo level of both matters, as without preview
+  size_t next = 0;
+  while (next < n) {
+    const bool background = ss[next].background;
+    size_t end = next;
+    while (end < n && ss[end].background == background) {
+      ++end;
+    }
+    vector<Scribble> low(end - next);
+    for (size_t i = next; i < end; ++i) {
+      DownsampleScribble(ss[i], preview_factor_, &low[i - next]);
+    }
+    const size_t nprocessed = Preview()->AddScribbles(low, cancel);
+    if (nprocessed < low.size()) {
+      // Cancelled, the preview matter is left as it was before the run
+      return next;
     }
+
+    // Mirror what the preview matter did (it skips the same empty scribbles)
+    const size_t nprev = scribbles.size();
+    for (size_t i = next; i < end; ++i) {
+      if (ss[i].pixels.size() > 0) {
+        scribbles.push_back(ss[i]);
+      }
+    }
+    next = end;
+    if (scribbles.size() == nprev) {
+      continue;
+    }
+    groups_ = Preview()->groups_;
+    next_seq_ = Preview()->next_seq_;
+    UpdateColorModel(background, NULL);
+    FinishPreviewUpdate();
+    PushHistory();
   }
-#else
-  // 3. (alternative) Update everything
-  GeodesicDistanceMap(scribbles, true, bg_likelihood.get(), W, H,
-                      bg_dist.get());
-  GeodesicDistanceMap(scribbles, false, fg_likelihood.get(), W, H,
-                      fg_dist.get());
-#endif
+  return next;
+}
 
-  // 4. Compute final mask
-  FinalForegroundMask(fg_dist.get(), bg_dist.get(), W, H, final_mask.get());
+void InteractiveMatter::FinishPreviewUpdate() {
+  fg_scribbled_ = Preview()->fg_scribbled_;
+  bg_scribbled_ = Preview()->bg_scribbled_;
+  UpsamplePreview();
+  vector<Point2i> fg_sources, bg_sources;
+  for (const Scribble& s : scribbles) {
+    vector<Point2i>& sources = s.background ? bg_sources : fg_sources;
+    sources.insert(sources.end(), s.pixels.begin(), s.pixels.end());
+  }
+  RefineBand(fg_sources, bg_sources);
 }
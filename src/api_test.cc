@@ -0,0 +1,859 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "api.h"
+#include "async.h"
+#include "encoding.h"
+#include "geodesic.h"
+#include "test_images.h"
+
+using namespace std;
+
+namespace {
+
+TEST_F(TwoHalvesTest, InteractiveMatterSegmentsHalves) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  ASSERT_EQ(2, matter.NumScribbles());
+
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      ASSERT_EQ((x < W/2) ? 255 : 0, mask[y*W + x])
+        << "at (" << x << ", " << y << ")";
+    }
+  }
+}
+
+TEST_F(TwoHalvesTest, ResultViewsAndEncodings) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  const uint8_t* view = matter.ForegroundMaskView();
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  // Views are stable across updates
+  EXPECT_EQ(view, matter.ForegroundMaskView());
+
+  vector<uint8_t> mask(W*H), decoded(W*H);
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(mask, vector<uint8_t>(view, view + W*H));
+  vector<double> dist(W*H);
+  matter.GetBackgroundDist(dist.data());
+  EXPECT_EQ(dist, vector<double>(matter.BackgroundDistView(),
+                                 matter.BackgroundDistView() + W*H));
+
+  vector<uint8_t> bits(PackedMaskStride(W)*H);
+  matter.GetForegroundMaskBits(bits.data());
+  UnpackMaskBits(bits.data(), W, H, decoded.data());
+  EXPECT_EQ(mask, decoded);
+
+  // Two halves, so one fg run and one bg run per row
+  vector<uint32_t> runs;
+  matter.GetForegroundMaskRLE(&runs);
+  EXPECT_EQ(3u*H, runs.size());
+  ASSERT_TRUE(DecodeMaskRLE(runs, W, H, decoded.data()));
+  EXPECT_EQ(mask, decoded);
+}
+
+TEST_F(TwoHalvesTest, ChangeTracking) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  EXPECT_FALSE(matter.HasChanges());
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+
+  // From all background to the left half in foreground
+  ASSERT_TRUE(matter.HasChanges());
+  vector<RowSpan> spans;
+  matter.GetChangedSpans(&spans);
+  ASSERT_EQ((size_t)H, spans.size());
+  for (int y = 0; y < H; ++y) {
+    EXPECT_EQ(y, spans[y].y);
+    EXPECT_EQ(0, spans[y].x0);
+    EXPECT_EQ(W/2, spans[y].x1);
+  }
+  vector<Rect> rects;
+  matter.GetDirtyRects(&rects);
+  ASSERT_EQ(1u, rects.size());
+  EXPECT_EQ(0, rects[0].x);
+  EXPECT_EQ(0, rects[0].y);
+  EXPECT_EQ(W/2, rects[0].width);
+  EXPECT_EQ(H, rects[0].height);
+
+  matter.ClearChanges();
+  EXPECT_FALSE(matter.HasChanges());
+  vector<uint8_t> before(W*H), after(W*H), delta(W*H);
+  matter.GetForegroundMask(before.data());
+
+  // A local correction only reports the pixels that flipped
+  matter.AddScribble(Line(W/2 + 2, false));
+  matter.GetForegroundMask(after.data());
+  matter.GetDeltaMask(delta.data());
+  int nchanged = 0;
+  for (int i = 0; i < W*H; ++i) {
+    EXPECT_EQ(after[i], before[i] ^ delta[i]);
+    nchanged += (delta[i] != 0);
+  }
+  matter.GetChangedSpans(&spans);
+  int nspan_pixels = 0;
+  for (const RowSpan& span : spans) {
+    nspan_pixels += span.x1 - span.x0;
+  }
+  EXPECT_EQ(nchanged, nspan_pixels);
+  matter.GetDirtyRects(&rects);
+  for (const RowSpan& span : spans) {
+    bool covered = false;
+    for (const Rect& r : rects) {
+      covered = covered || (span.y >= r.y && span.y < r.y + r.height
+                            && span.x0 >= r.x && span.x1 <= r.x + r.width);
+    }
+    EXPECT_TRUE(covered) << "row " << span.y;
+  }
+}
+
+TEST_F(TwoHalvesTest, Contours) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  vector<Contour> contours;
+  matter.GetContours(0, &contours);
+  EXPECT_TRUE(contours.empty());
+
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  matter.GetContours(0, &contours);
+  ASSERT_EQ(1u, contours.size());
+  EXPECT_FALSE(contours[0].hole);
+  EXPECT_EQ(4u, contours[0].points.size());
+}
+
+TEST_F(TwoHalvesTest, PreviewRefinesToFullResolution) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  // 3 doesn't divide W/2, so the boundary falls inside a downsampled pixel
+  matter.SetPreviewFactor(3);
+  matter.SetMaxUndoLevels(5);
+  int npreviews = 0;
+  matter.SetPreviewCallback([&npreviews]() { ++npreviews; });
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  EXPECT_EQ(2, npreviews);
+
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      ASSERT_EQ((x < W/2) ? 255 : 0, mask[y*W + x])
+        << "at (" << x << ", " << y << ")";
+    }
+  }
+
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_EQ(1, matter.NumScribbles());
+  ASSERT_TRUE(matter.Redo());
+  ASSERT_TRUE(matter.RemoveScribble(1));
+  EXPECT_EQ(1, matter.NumScribbles());
+}
+
+TEST_F(TwoHalvesTest, PreviewUndoRedo) {
+  InteractiveMatter preview(l.data(), a.data(), b.data(), W, H);
+  preview.SetPreviewFactor(2);
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  vector<uint8_t> expected(W*H), mask(W*H);
+  auto check = [&]() {
+    EXPECT_EQ(matter.NumScribbles(), preview.NumScribbles());
+    matter.GetForegroundMask(expected.data());
+    preview.GetForegroundMask(mask.data());
+    EXPECT_EQ(expected, mask);
+  };
+  for (InteractiveMatter* m : {&preview, &matter}) {
+    m->SetMaxUndoLevels(5);
+    // Two runs, so two undo levels
+    m->AddScribbles({Line(5, false), Line(W - 5, true)});
+    ASSERT_TRUE(m->Undo());
+    ASSERT_TRUE(m->Undo());
+    EXPECT_FALSE(m->CanUndo());
+    // Without the fg scribble, nothing is foreground
+    m->AddScribble(Line(W - 8, true));
+  }
+  check();
+  for (InteractiveMatter* m : {&preview, &matter}) {
+    m->AddScribbles({Line(5, false), Line(8, false), Line(W - 5, true)});
+    ASSERT_TRUE(m->Undo());
+  }
+  check();
+  for (InteractiveMatter* m : {&preview, &matter}) {
+    ASSERT_TRUE(m->Redo());
+    m->AddScribble(Line(12, false));
+    ASSERT_TRUE(m->Undo());
+    ASSERT_TRUE(m->Undo());
+    m->AddScribble(Line(10, false));
+  }
+  check();
+}
+
+TEST_F(TwoHalvesTest, SimpleMatterPreview) {
+  SimpleMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetPreviewFactor(3);
+  vector<uint8_t> fg(W*H, 0), bg(W*H, 0);
+  for (const Point2i& p : Line(5, false).pixels) {
+    fg[p.y*W + p.x] = 255;
+  }
+  for (const Point2i& p : Line(W - 5, true).pixels) {
+    bg[p.y*W + p.x] = 255;
+  }
+  matter.UpdateMasks(bg.data(), fg.data());
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      ASSERT_EQ((x < W/2) ? 255 : 0, mask[y*W + x])
+        << "at (" << x << ", " << y << ")";
+    }
+  }
+}
+
+// Mask, likelihoods and distances of a fresh matter given bg and fg
+struct SimpleResults {
+  SimpleResults(Matter* m, int N)
+    : mask(N), fg_likelihood(N), fg_dist(N), bg_dist(N) {
+    m->GetForegroundMask(mask.data());
+    m->GetForegroundLikelihood(fg_likelihood.data());
+    m->GetForegroundDist(fg_dist.data());
+    m->GetBackgroundDist(bg_dist.data());
+  }
+
+  vector<uint8_t> mask;
+  vector<double> fg_likelihood, fg_dist, bg_dist;
+};
+
+TEST_F(TwoHalvesTest, SimpleMatterIncrementalUpdates) {
+  SimpleMatter matter(l.data(), a.data(), b.data(), W, H);
+  vector<uint8_t> fg(W*H, 0), bg(W*H, 0);
+  fg[10*W + 5] = bg[10*W + W - 5] = 1;
+
+  // Grow fg, nothing, then move a bg pixel : the results are always those
+  // of a fresh matter
+  for (int step = 0; step < 4; ++step) {
+    if (step == 1) {
+      fg[11*W + 5] = fg[20*W + 30] = 255;
+    } else if (step == 3) {
+      bg[10*W + W - 5] = 0;
+      bg[25*W + 2] = 1;
+    }
+    matter.UpdateMasks(bg.data(), fg.data());
+    SimpleMatter fresh(l.data(), a.data(), b.data(), W, H);
+    fresh.UpdateMasks(bg.data(), fg.data());
+
+    const SimpleResults expected(&fresh, W*H);
+    const SimpleResults actual(&matter, W*H);
+    EXPECT_EQ(expected.mask, actual.mask) << "step " << step;
+    EXPECT_EQ(expected.fg_dist, actual.fg_dist) << "step " << step;
+    EXPECT_EQ(expected.bg_dist, actual.bg_dist) << "step " << step;
+#ifndef LIBSEG_NO_STATS
+    MatterStats stats;
+    matter.GetStats(&stats);
+    // Only the models of the classes whose mask changed are estimated
+    const uint64_t nkde[] = {6, 3, 0, 3};
+    EXPECT_EQ(nkde[step], stats.kde_calls) << "step " << step;
+#endif
+  }
+}
+
+TEST_F(TwoHalvesTest, SimpleMatterWarmStart) {
+  SimpleMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetModelRefitThreshold(1);
+  vector<uint8_t> fg(W*H, 0), bg(W*H, 0);
+  fg[10*W + 5] = fg[11*W + 5] = 1;
+  bg[10*W + W - 5] = 1;
+  matter.UpdateMasks(bg.data(), fg.data());
+  const SimpleResults before(&matter, W*H);
+
+  // Doubling the fg pixels keeps the model, the distances are those to all
+  // the fg pixels over the unchanged likelihood
+  fg[20*W + 30] = fg[2*W + 2] = 1;
+  matter.UpdateMasks(bg.data(), fg.data());
+  const SimpleResults after(&matter, W*H);
+  EXPECT_EQ(before.fg_likelihood, after.fg_likelihood);
+  EXPECT_EQ(before.bg_dist, after.bg_dist);
+  vector<Point2i> sources{Point2i(5, 10), Point2i(5, 11), Point2i(30, 20),
+                          Point2i(2, 2)};
+  vector<double> expected(W*H);
+  GeodesicDistanceMap(sources, before.fg_likelihood.data(), W, H,
+                      expected.data());
+  EXPECT_EQ(expected, after.fg_dist);
+  EXPECT_EQ(0, after.fg_dist[20*W + 30]);
+
+  // One more pixel is over the threshold
+  fg[3*W + 2] = 1;
+  matter.UpdateMasks(bg.data(), fg.data());
+  const SimpleResults refit(&matter, W*H);
+  EXPECT_NE(before.fg_likelihood, refit.fg_likelihood);
+}
+
+TEST_F(TwoHalvesTest, ImportedColorModels) {
+  vector<uint8_t> fg(W*H, 0), bg(W*H, 0);
+  for (const Point2i& p : Line(5, false).pixels) {
+    fg[p.y*W + p.x] = 255;
+  }
+  for (const Point2i& p : Line(W - 5, true).pixels) {
+    bg[p.y*W + p.x] = 255;
+  }
+  SimpleMatter source(l.data(), a.data(), b.data(), W, H);
+  ColorModel fg_model, bg_model;
+  source.GetColorModel(false, &fg_model);
+  EXPECT_TRUE(fg_model.probs.empty());
+  source.UpdateMasks(bg.data(), fg.data());
+  source.GetColorModel(false, &fg_model);
+  source.GetColorModel(true, &bg_model);
+  ASSERT_TRUE(IsValidColorModel(fg_model));
+  ASSERT_TRUE(IsValidColorModel(bg_model));
+  const SimpleResults expected(&source, W*H);
+
+  // With the models, a single seed pixel per class is enough
+  SimpleMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetColorModel(false, fg_model);
+  matter.SetColorModel(true, bg_model);
+  vector<uint8_t> fg_seed(W*H, 0), bg_seed(W*H, 0);
+  fg_seed[15*W + 3] = bg_seed[15*W + W - 3] = 1;
+  matter.UpdateMasks(bg_seed.data(), fg_seed.data());
+  const SimpleResults actual(&matter, W*H);
+  EXPECT_EQ(expected.fg_likelihood, actual.fg_likelihood);
+  EXPECT_EQ(expected.mask, actual.mask);
+#ifndef LIBSEG_NO_STATS
+  MatterStats stats;
+  matter.GetStats(&stats);
+  EXPECT_EQ(0u, stats.kde_calls);
+#endif
+  ColorModel exported;
+  matter.GetColorModel(false, &exported);
+  EXPECT_EQ(fg_model.probs, exported.probs);
+
+  // Back to the models of the seeds
+  matter.ClearColorModel(false);
+  matter.ClearColorModel(true);
+  matter.UpdateMasks(bg_seed.data(), fg_seed.data());
+  matter.GetColorModel(false, &exported);
+  EXPECT_NE(fg_model.probs, exported.probs);
+
+  // Also used by the preview and the full resolution refinement
+  SimpleMatter preview(l.data(), a.data(), b.data(), W, H);
+  preview.SetColorModel(false, fg_model);
+  preview.SetColorModel(true, bg_model);
+  preview.SetPreviewFactor(2);
+  preview.UpdateMasks(bg_seed.data(), fg_seed.data());
+  const SimpleResults refined(&preview, W*H);
+  EXPECT_EQ(expected.fg_likelihood, refined.fg_likelihood);
+}
+
+TEST_F(TwoHalvesTest, SharedImage) {
+  shared_ptr<const LabImage> image =
+      LabImage::Create(l.data(), a.data(), b.data(), W, H);
+  InteractiveMatter first(image);
+  InteractiveMatter second(first.GetImage());
+  InteractiveMatter alone(l.data(), a.data(), b.data(), W, H);
+  EXPECT_EQ(image, second.GetImage());
+  for (InteractiveMatter* m : {&first, &second, &alone}) {
+    m->SetPreviewFactor(2);
+  }
+  EXPECT_EQ(3, image.use_count());
+  // The preview image is shared too : cached in image, used by the two
+  // preview matters and the returned pointer
+  EXPECT_EQ(4, image->Downsampled(2).use_count());
+
+  // The sessions are independent
+  first.AddScribble(Line(5, false));
+  first.AddScribble(Line(W - 5, true));
+  alone.AddScribble(Line(5, false));
+  alone.AddScribble(Line(W - 5, true));
+  second.AddScribble(Line(W - 5, false));
+  vector<uint8_t> mask(W*H), expected(W*H), other(W*H);
+  first.GetForegroundMask(mask.data());
+  alone.GetForegroundMask(expected.data());
+  second.GetForegroundMask(other.data());
+  EXPECT_EQ(expected, mask);
+  EXPECT_NE(mask, other);
+}
+
+TEST_F(TwoHalvesTest, BackgroundPrecomputation) {
+  InteractiveMatter waited(l.data(), a.data(), b.data(), W, H);
+  shared_future<void> ready = waited.Ready();
+  ASSERT_TRUE(ready.valid());
+  ready.wait();
+  for (int i = 0; i < W*H; ++i) {
+    ASSERT_EQ(0, waited.ForegroundMaskView()[i]);
+    ASSERT_EQ(numeric_limits<double>::max(), waited.ForegroundDistView()[i]);
+  }
+  waited.AddScribble(Line(5, false));
+  waited.AddScribble(Line(W - 5, true));
+
+  // Used right away, the methods wait for the precomputation
+  InteractiveMatter immediate(l.data(), a.data(), b.data(), W, H);
+  immediate.AddScribble(Line(5, false));
+  immediate.AddScribble(Line(W - 5, true));
+  vector<uint8_t> expected(W*H), mask(W*H);
+  waited.GetForegroundMask(expected.data());
+  immediate.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+
+  // The modes are set right away, their data is computed in the background
+  InteractiveMatter superpixels(l.data(), a.data(), b.data(), W, H);
+  superpixels.SetSuperpixelSize(4);
+  EXPECT_EQ(4, superpixels.GetSuperpixelSize());
+  EXPECT_GT(superpixels.NumSuperpixels(), 0);
+  EXPECT_EQ(future_status::ready,
+            superpixels.Ready().wait_for(chrono::seconds(0)));
+  InteractiveMatter previewed(l.data(), a.data(), b.data(), W, H);
+  previewed.SetPreviewFactor(2);
+  previewed.AddScribble(Line(5, false));
+  previewed.AddScribble(Line(W - 5, true));
+  previewed.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+
+  // Destroyed before the precomputation is done
+  InteractiveMatter discarded(l.data(), a.data(), b.data(), W, H);
+  discarded.SetSuperpixelSize(4);
+}
+
+TEST_F(TwoHalvesTest, MemoryUsage) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  // At least the 6 double planes, and not the image
+  const size_t planes = 6*sizeof(double)*W*H;
+  const size_t initial = matter.MemoryUsage();
+  EXPECT_GE(initial, planes);
+  EXPECT_LT(initial, planes + 3*sizeof(double)*W*H);
+
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  const size_t scribbled = matter.MemoryUsage();
+  EXPECT_GT(scribbled, initial);
+
+  matter.SetMaxUndoLevels(4);
+  matter.AddScribble(Line(W/2 + 2, false));
+  EXPECT_GE(matter.MemoryUsage(), scribbled + matter.UndoMemoryUsage());
+  matter.SetScribbleCacheSize(1 << 20);
+  EXPECT_GE(matter.MemoryUsage(), scribbled + matter.UndoMemoryUsage()
+            + matter.ScribbleCacheUsage());
+
+  // The preview matter is counted
+  InteractiveMatter previewed(l.data(), a.data(), b.data(), W, H);
+  previewed.SetPreviewFactor(2);
+  EXPECT_GT(previewed.MemoryUsage(), initial);
+}
+
+TEST_F(TwoHalvesTest, SuperpixelMode) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetSuperpixelSize(8);
+  EXPECT_GT(matter.NumSuperpixels(), 0);
+  // The time-bounded version runs to completion in this mode
+  EXPECT_TRUE(matter.AddScribble(Line(5, false), 0));
+  matter.AddScribble(Line(W - 5, true));
+
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      ASSERT_EQ((x < W/2) ? 255 : 0, mask[y*W + x])
+        << "at (" << x << ", " << y << ")";
+    }
+  }
+}
+
+#ifndef LIBSEG_NO_STATS
+TEST_F(TwoHalvesTest, StatsOfLastUpdate) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.AddScribble(Line(5, false));
+  const int npixels = H - 10;
+
+  MatterStats stats;
+  matter.GetStats(&stats);
+  // One KDE per channel on the scribble pixels
+  EXPECT_EQ(3u, stats.kde_calls);
+  EXPECT_EQ(3u*npixels, stats.kde_samples);
+  // The propagation drains its queue and reaches every pixel
+  EXPECT_EQ(stats.geodesic_pushes, stats.geodesic_pops);
+  EXPECT_EQ((uint64_t)(W*H - npixels), stats.geodesic_relaxations -
+            stats.geodesic_stale_pops);
+  EXPECT_GT(stats.mask_rows_changed, 0u);
+  EXPECT_GE(stats.total_ms, stats.kde_ms + stats.geodesic_ms);
+
+  // Stats are reset by each update
+  matter.AddScribble(Line(W - 5, true));
+  MatterStats stats2;
+  matter.GetStats(&stats2);
+  EXPECT_EQ(3u, stats2.kde_calls);
+
+  SimpleMatter simple(l.data(), a.data(), b.data(), W, H);
+  vector<uint8_t> fg(W*H, 0), bg(W*H, 0);
+  fg[0] = bg[W*H - 1] = 255;
+  simple.UpdateMasks(bg.data(), fg.data());
+  simple.GetStats(&stats);
+  EXPECT_EQ(6u, stats.kde_calls);
+  EXPECT_EQ(6u, stats.kde_samples);
+  EXPECT_EQ(stats.geodesic_pushes, stats.geodesic_pops);
+}
+#endif
+
+TEST_F(TwoHalvesTest, AddScribblesCancelled) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  CancelFlag cancel(true);
+  vector<Scribble> ss{Line(5, false), Line(W - 5, true)};
+  EXPECT_EQ(0u, matter.AddScribbles(ss, &cancel));
+  EXPECT_EQ(0, matter.NumScribbles());
+}
+
+// The views of a matter, to check that nothing changed
+static vector<vector<double>> Views(const InteractiveMatter& matter) {
+  const int n = matter.GetWidth()*matter.GetHeight();
+  const uint8_t* mask = matter.ForegroundMaskView();
+  return {vector<double>(mask, mask + n),
+          vector<double>(matter.ForegroundLikelihoodView(),
+                         matter.ForegroundLikelihoodView() + n),
+          vector<double>(matter.BackgroundLikelihoodView(),
+                         matter.BackgroundLikelihoodView() + n),
+          vector<double>(matter.ForegroundDistView(),
+                         matter.ForegroundDistView() + n),
+          vector<double>(matter.BackgroundDistView(),
+                         matter.BackgroundDistView() + n)};
+}
+
+TEST(InteractiveMatterTest, CancelFirstScribbleOfClass) {
+  // Large enough for the distance map to take most of the update, so that
+  // the cancellation lands there rather than in the color model
+  const int W = 400, H = 300;
+  vector<uint8_t> l(W*H), a(W*H, 128), b(W*H, 128);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      l[y*W + x] = ((x < W/2) ? 90 : 130) + (x*7 + y*13) % 61;
+    }
+  }
+  Scribble fg, bg;
+  fg.background = false;
+  bg.background = true;
+  for (int y = 10; y < 20; ++y) {
+    fg.pixels.push_back(Point2i(10, y));
+    bg.pixels.push_back(Point2i(W - 10, y));
+  }
+
+  InteractiveMatter timed(l.data(), a.data(), b.data(), W, H);
+  timed.AddScribble(fg);
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  timed.AddScribble(bg);
+  const chrono::steady_clock::duration full =
+      chrono::steady_clock::now() - start;
+
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.AddScribble(fg);
+  const vector<vector<double>> before = Views(matter);
+  CancelFlag cancel(false);
+  future<void> canceller = async(launch::async, [&cancel, full]() {
+    this_thread::sleep_for(full/2);
+    cancel = true;
+  });
+  const size_t n = matter.AddScribbles(vector<Scribble>{bg}, &cancel);
+  canceller.wait();
+  if (n == 0) {
+    // As if the scribble had never been added
+    EXPECT_EQ(1, matter.NumScribbles());
+    EXPECT_TRUE(before == Views(matter));
+  }
+  // And the next update starts from there
+  matter.AddScribble(bg);
+  EXPECT_TRUE(Views(timed) == Views(matter));
+}
+
+TEST_F(TwoHalvesTest, TimeBoundedConvergesToSynchronous) {
+  InteractiveMatter sync(l.data(), a.data(), b.data(), W, H);
+  InteractiveMatter bounded(l.data(), a.data(), b.data(), W, H);
+  sync.AddScribble(Line(5, false));
+  sync.AddScribble(Line(W - 5, true));
+
+  bool done = bounded.AddScribble(Line(5, false), 0);
+  done = bounded.AddScribble(Line(W - 5, true), 0);
+  while (!done) {
+    done = bounded.ContinueUpdate(0);
+  }
+  EXPECT_FALSE(bounded.HasPendingUpdate());
+  EXPECT_EQ(2, bounded.NumScribbles());
+
+  vector<uint8_t> expected(W*H), mask(W*H);
+  sync.GetForegroundMask(expected.data());
+  bounded.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+}
+
+TEST_F(TwoHalvesTest, UndoRedo) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetMaxUndoLevels(10);
+  EXPECT_FALSE(matter.CanUndo());
+
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  vector<uint8_t> two(W*H), mask(W*H);
+  matter.GetForegroundMask(two.data());
+  // The likelihoods are recomputed from the color models when restoring
+  vector<double> two_fg(W*H), two_bg(W*H), likelihood(W*H);
+  matter.GetForegroundLikelihood(two_fg.data());
+  matter.GetBackgroundLikelihood(two_bg.data());
+  matter.AddScribble(Line(W/2 + 2, false));
+  const vector<uint8_t> zeros(W*H, 0);
+
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_EQ(2, matter.NumScribbles());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(two, mask);
+  matter.GetForegroundLikelihood(likelihood.data());
+  EXPECT_EQ(two_fg, likelihood);
+  matter.GetBackgroundLikelihood(likelihood.data());
+  EXPECT_EQ(two_bg, likelihood);
+
+  ASSERT_TRUE(matter.Undo());
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_FALSE(matter.Undo());
+  EXPECT_EQ(0, matter.NumScribbles());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(zeros, mask);
+
+  ASSERT_TRUE(matter.Redo());
+  ASSERT_TRUE(matter.Redo());
+  EXPECT_EQ(2, matter.NumScribbles());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(two, mask);
+  matter.GetForegroundLikelihood(likelihood.data());
+  EXPECT_EQ(two_fg, likelihood);
+
+  // A new scribble discards the redo
+  matter.AddScribble(Line(8, false));
+  EXPECT_FALSE(matter.CanRedo());
+  EXPECT_EQ(3, matter.NumScribbles());
+}
+
+TEST_F(TwoHalvesTest, ShrinkUndoLevelsAfterUndo) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetMaxUndoLevels(10);
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  vector<uint8_t> one(W*H), mask(W*H);
+  matter.Undo();
+  matter.GetForegroundMask(one.data());
+  matter.AddScribble(Line(W - 5, true));
+  matter.AddScribble(Line(W/2 + 2, false));
+  ASSERT_TRUE(matter.Undo());
+  ASSERT_TRUE(matter.Undo());
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_FALSE(matter.CanUndo());
+
+  // The current state is kept and the redo is dropped from the end
+  matter.SetMaxUndoLevels(1);
+  EXPECT_FALSE(matter.CanUndo());
+  ASSERT_TRUE(matter.Redo());
+  EXPECT_EQ(1, matter.NumScribbles());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(one, mask);
+  EXPECT_FALSE(matter.CanRedo());
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_EQ(0, matter.NumScribbles());
+  EXPECT_FALSE(matter.CanUndo());
+
+  // Further scribbles still work with what is left
+  matter.AddScribble(Line(W - 5, true));
+  EXPECT_EQ(1, matter.NumScribbles());
+  ASSERT_TRUE(matter.Undo());
+  EXPECT_EQ(0, matter.NumScribbles());
+}
+
+// Remove the last of three scribbles and compare with a matter that never
+// had it
+static void CheckRemoveScribble(const uint8_t* l, const uint8_t* a,
+                                const uint8_t* b, int W, int H,
+                                const vector<Scribble>& ss,
+                                size_t cache_bytes) {
+  InteractiveMatter expected(const_cast<uint8_t*>(l), const_cast<uint8_t*>(a),
+                             const_cast<uint8_t*>(b), W, H);
+  InteractiveMatter matter(const_cast<uint8_t*>(l), const_cast<uint8_t*>(a),
+                           const_cast<uint8_t*>(b), W, H);
+  matter.SetScribbleCacheSize(cache_bytes);
+  for (size_t i = 0; i < ss.size(); ++i) {
+    matter.AddScribble(ss[i]);
+    if (i + 1 < ss.size()) {
+      expected.AddScribble(ss[i]);
+    }
+  }
+  EXPECT_LE(matter.ScribbleCacheUsage(), cache_bytes);
+  EXPECT_FALSE(matter.RemoveScribble(ss.size()));
+  ASSERT_TRUE(matter.RemoveScribble(ss.size() - 1));
+  EXPECT_EQ((int)ss.size() - 1, matter.NumScribbles());
+
+  vector<uint8_t> expected_mask(W*H), mask(W*H);
+  expected.GetForegroundMask(expected_mask.data());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected_mask, mask);
+}
+
+TEST_F(TwoHalvesTest, RemoveScribble) {
+  // A fg scribble on the bright half that we then remove
+  const vector<Scribble> ss{Line(5, false), Line(W - 5, true),
+                            Line(W - 8, false)};
+  // Without cache, everything cached, and a cache that can only hold one field
+  CheckRemoveScribble(l.data(), a.data(), b.data(), W, H, ss, 0);
+  CheckRemoveScribble(l.data(), a.data(), b.data(), W, H, ss, 1 << 20);
+  CheckRemoveScribble(l.data(), a.data(), b.data(), W, H, ss,
+                      sizeof(float)*W*H);
+}
+
+// Replay the same scribbles with and without the scribble cache
+static void CheckCacheKeepsResults(const uint8_t* l, const uint8_t* a,
+                                   const uint8_t* b, int W, int H,
+                                   const vector<Scribble>& ss,
+                                   size_t cache_bytes) {
+  InteractiveMatter expected(const_cast<uint8_t*>(l), const_cast<uint8_t*>(a),
+                             const_cast<uint8_t*>(b), W, H);
+  InteractiveMatter matter(const_cast<uint8_t*>(l), const_cast<uint8_t*>(a),
+                           const_cast<uint8_t*>(b), W, H);
+  matter.SetScribbleCacheSize(cache_bytes);
+  for (InteractiveMatter* m : {&expected, &matter}) {
+    m->AddScribble(ss[0]);
+    m->AddScribble(ss[1]);
+    m->AddScribbles({ss[2], ss[3], ss[4]});
+    // Time-bounded, committing partial updates
+    bool done = m->AddScribble(ss[5], 0);
+    done = m->AddScribble(ss[6], 0);
+    while (!done) {
+      done = m->ContinueUpdate(0);
+    }
+  }
+  EXPECT_GT(matter.ScribbleCacheUsage(), 0u);
+  EXPECT_LE(matter.ScribbleCacheUsage(), cache_bytes);
+
+  vector<uint8_t> expected_mask(W*H), mask(W*H);
+  expected.GetForegroundMask(expected_mask.data());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected_mask, mask);
+  vector<double> expected_dist(W*H), dist(W*H);
+  expected.GetForegroundDist(expected_dist.data());
+  matter.GetForegroundDist(dist.data());
+  EXPECT_EQ(expected_dist, dist);
+  expected.GetBackgroundDist(expected_dist.data());
+  matter.GetBackgroundDist(dist.data());
+  EXPECT_EQ(expected_dist, dist);
+}
+
+TEST_F(TwoHalvesTest, ScribbleCacheKeepsResults) {
+  // Textured halves, so that the color models and the distances change
+  // with each scribble of a class
+  vector<uint8_t> tl(l);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      tl[y*W + x] += (x*7 + y*13) % 31;
+    }
+  }
+  const vector<Scribble> ss{Line(5, false), Line(W - 5, true),
+                            Line(W - 8, false), Line(12, false),
+                            Line(W - 12, true), Line(W - 15, true),
+                            Line(8, false)};
+  CheckCacheKeepsResults(tl.data(), a.data(), b.data(), W, H, ss, 1 << 20);
+  CheckCacheKeepsResults(tl.data(), a.data(), b.data(), W, H, ss,
+                         sizeof(float)*W*H);
+}
+
+TEST_F(TwoHalvesTest, RemoveScribbleMatchesReplay) {
+  // Textured halves with overlapping colors, so that the likelihoods are not
+  // all 0 or 1 and the nearest source of a pixel depends on the distances
+  vector<uint8_t> tl(W*H);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      tl[y*W + x] = ((x < W/2) ? 90 : 130) + (x*7 + y*13) % 61;
+    }
+  }
+  // Removing the last scribble gives back the color models, and so the
+  // likelihoods, of the matter that never had it
+  InteractiveMatter expected(tl.data(), a.data(), b.data(), W, H);
+  InteractiveMatter matter(tl.data(), a.data(), b.data(), W, H);
+  matter.SetScribbleCacheSize(1 << 20);
+  const vector<Scribble> ss{Line(5, false), Line(W - 5, true),
+                            Line(12, false)};
+  for (size_t i = 0; i < ss.size(); ++i) {
+    matter.AddScribble(ss[i]);
+    if (i + 1 < ss.size()) {
+      expected.AddScribble(ss[i]);
+    }
+  }
+  ASSERT_TRUE(matter.RemoveScribble(2));
+
+  vector<double> expected_dist(W*H), dist(W*H);
+  expected.GetForegroundDist(expected_dist.data());
+  matter.GetForegroundDist(dist.data());
+  for (int i = 0; i < W*H; ++i) {
+    // The cached fields are floats
+    ASSERT_NEAR(expected_dist[i], dist[i], 1e-5*expected_dist[i]) << i;
+  }
+  vector<uint8_t> expected_mask(W*H), mask(W*H);
+  expected.GetForegroundMask(expected_mask.data());
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected_mask, mask);
+}
+
+TEST_F(TwoHalvesTest, RemoveLastScribbleOfClass) {
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.SetScribbleCacheSize(1 << 20);
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  ASSERT_TRUE(matter.RemoveScribble(1));
+  ASSERT_TRUE(matter.RemoveScribble(0));
+  EXPECT_EQ(0, matter.NumScribbles());
+  EXPECT_EQ(0u, matter.ScribbleCacheUsage());
+
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(vector<uint8_t>(W*H, 0), mask);
+}
+
+TEST_F(TwoHalvesTest, AsyncMatchesSynchronous) {
+  InteractiveMatter sync(l.data(), a.data(), b.data(), W, H);
+  int nready = 0;
+  AsyncInteractiveMatter async(l.data(), a.data(), b.data(), W, H,
+                               [&nready](int) { ++nready; });
+  const vector<Scribble> ss{Line(5, false), Line(W - 5, true),
+                            Line(W - 8, true)};
+  for (const Scribble& s : ss) {
+    sync.AddScribble(s);
+    async.AddScribble(s);
+  }
+  async.Wait();
+  EXPECT_EQ(0, async.NumPending());
+  EXPECT_EQ(3, async.NumScribbles());
+  EXPECT_GE(nready, 1);
+
+  vector<uint8_t> expected(W*H), mask(W*H);
+  sync.GetForegroundMask(expected.data());
+  async.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+}
+
+TEST_F(TwoHalvesTest, AsyncChangedSpans) {
+  AsyncInteractiveMatter async(l.data(), a.data(), b.data(), W, H);
+  vector<RowSpan> spans;
+  async.TakeChangedSpans(&spans);
+  EXPECT_TRUE(spans.empty());
+
+  async.AddScribble(Line(5, false));
+  async.AddScribble(Line(W - 5, true));
+  async.Wait();
+  const shared_ptr<const Results> r = async.LatestResults();
+  vector<uint8_t> mask(W*H, 0);
+  async.TakeChangedSpans(&spans);
+  ASSERT_FALSE(spans.empty());
+  for (const RowSpan& span : spans) {
+    for (int x = span.x0; x < span.x1; ++x) {
+      mask[span.y*W + x] = 255;
+    }
+  }
+  EXPECT_EQ(r->mask, mask);
+
+  async.TakeChangedSpans(&spans);
+  EXPECT_TRUE(spans.empty());
+}
+
+}
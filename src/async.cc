@@ -0,0 +1,172 @@
+#include "async.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+// After that many cancellations in a row, the in-flight update is allowed to
+// complete. Otherwise, an user scribbling continuously would never see any
+// result
+static const int kMaxConsecutiveCancels = 2;
+
+AsyncInteractiveMatter::AsyncInteractiveMatter(uint8_t* l, uint8_t* a,
+                                               uint8_t* b, int W, int H,
+                                               const ReadyCallback& on_ready)
+  : AsyncInteractiveMatter(LabImage::Create(l, a, b, W, H), on_ready) {
+}
+
+AsyncInteractiveMatter::AsyncInteractiveMatter(
+    const shared_ptr<const LabImage>& image,
+    const ReadyCallback& on_ready)
+  : W(image->GetWidth()), H(image->GetHeight()),
+    on_ready_(on_ready),
+    matter_(image),
+    in_flight_(0),
+    ncancelled_(0),
+    nscribbles_(0),
+    stop_(false),
+    cancel_(false) {
+  matter_.SetPublishResults(true);
+  worker_ = thread(&AsyncInteractiveMatter::Run, this);
+}
+
+AsyncInteractiveMatter::~AsyncInteractiveMatter() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+    cancel_ = true;
+    cond_.notify_all();
+  }
+  worker_.join();
+}
+
+void AsyncInteractiveMatter::AddScribble(const Scribble& s) {
+  lock_guard<mutex> lock(mutex_);
+  queue_.push_back(s);
+  LIBSEG_TRACE_INSTANT("AsyncInteractiveMatter::ScribbleQueued");
+  // The in-flight result is stale now, restart it with the new scribble
+  if (in_flight_ > 0 && ncancelled_ < kMaxConsecutiveCancels) {
+    LIBSEG_TRACE_INSTANT("AsyncInteractiveMatter::Cancel");
+    cancel_ = true;
+  }
+  cond_.notify_all();
+}
+
+void AsyncInteractiveMatter::AddStroke(const Stroke& stroke) {
+  // Rasterized on the calling thread, the matter might be busy
+  Scribble s;
+  StrokeToScribble(stroke, W, H, &s);
+  if (!s.pixels.empty()) {
+    AddScribble(s);
+  }
+}
+
+void AsyncInteractiveMatter::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return queue_.empty(); });
+}
+
+int AsyncInteractiveMatter::NumScribbles() {
+  lock_guard<mutex> lock(mutex_);
+  return nscribbles_;
+}
+
+int AsyncInteractiveMatter::NumPending() {
+  lock_guard<mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void AsyncInteractiveMatter::GetForegroundMask(uint8_t* mask) {
+  const shared_ptr<const Results> r = LatestResults();
+  copy(r->mask.begin(), r->mask.end(), mask);
+}
+
+void AsyncInteractiveMatter::GetForegroundLikelihood(double* out) {
+  const shared_ptr<const Results> r = LatestResults();
+  copy(r->fg_likelihood.begin(), r->fg_likelihood.end(), out);
+}
+
+void AsyncInteractiveMatter::GetBackgroundLikelihood(double* out) {
+  const shared_ptr<const Results> r = LatestResults();
+  copy(r->bg_likelihood.begin(), r->bg_likelihood.end(), out);
+}
+
+void AsyncInteractiveMatter::GetForegroundDist(double* out) {
+  const shared_ptr<const Results> r = LatestResults();
+  copy(r->fg_dist.begin(), r->fg_dist.end(), out);
+}
+
+void AsyncInteractiveMatter::GetBackgroundDist(double* out) {
+  const shared_ptr<const Results> r = LatestResults();
+  copy(r->bg_dist.begin(), r->bg_dist.end(), out);
+}
+
+void AsyncInteractiveMatter::TakeChangedSpans(vector<RowSpan>* spans) {
+  const shared_ptr<const Results> r = LatestResults();
+  lock_guard<mutex> lock(spans_mutex_);
+  spans->clear();
+  for (int y = 0; y < H; ++y) {
+    const uint8_t* row = r->mask.data() + y*W;
+    const uint8_t* ref = spans_ref_ ? spans_ref_->mask.data() + y*W : NULL;
+    int x = 0;
+    while (x < W) {
+      if (row[x] == (ref ? ref[x] : 0)) {
+        ++x;
+        continue;
+      }
+      const int x0 = x;
+      while (x < W && row[x] != (ref ? ref[x] : 0)) {
+        ++x;
+      }
+      spans->push_back(RowSpan(y, x0, x));
+    }
+  }
+  spans_ref_ = r;
+}
+
+void AsyncInteractiveMatter::Run() {
+#ifndef LIBSEG_NO_TRACE
+  trace::SetThreadName("libseg worker");
+#endif
+  unique_lock<mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    // Take everything that is queued, AddScribbles will coalesce it
+    const vector<Scribble> batch(queue_.begin(), queue_.end());
+    in_flight_ = batch.size();
+    cancel_ = false;
+    lock.unlock();
+
+    size_t nprocessed;
+    int nscribbles;
+    {
+      LIBSEG_TRACE_SCOPE("AsyncInteractiveMatter::Update");
+      nprocessed = matter_.AddScribbles(batch, &cancel_);
+      nscribbles = matter_.NumScribbles();
+    }
+
+    lock.lock();
+    const bool changed = nscribbles != nscribbles_;
+    nscribbles_ = nscribbles;
+    if (changed && on_ready_) {
+      // Called before the queue is updated so that Wait() only returns once
+      // the callback has seen the final mask
+      lock.unlock();
+      on_ready_(nscribbles);
+      lock.lock();
+    }
+
+    // Cancelled scribbles stay at the front of the queue and will be
+    // coalesced with the ones that arrived in the meantime
+    queue_.erase(queue_.begin(), queue_.begin() + nprocessed);
+    in_flight_ = 0;
+    ncancelled_ = (nprocessed < batch.size()) ? ncancelled_ + 1 : 0;
+    cond_.notify_all();
+  }
+}
@@ -0,0 +1,558 @@
+#include "libseg_c.h"
+
+#include <string.h>
+#include <exception>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "api.h"
+
+using namespace std;
+
+struct libseg_image {
+  shared_ptr<const LabImage> image;
+};
+
+struct libseg_matter {
+  libseg_matter_type type;
+  unique_ptr<Matter> matter;
+  // Contiguous copies of the scribble masks that are not given contiguous
+  vector<uint8_t> bg_mask, fg_mask;
+
+  SimpleMatter* simple() {
+    return static_cast<SimpleMatter*>(matter.get());
+  }
+  InteractiveMatter* interactive() {
+    return static_cast<InteractiveMatter*>(matter.get());
+  }
+};
+
+static_assert(LIBSEG_COLOR_MODEL_SIZE == 3*kColorModelValues,
+              "The C API color models have kColorModelValues per channel");
+
+static thread_local string last_error;
+
+static libseg_status Fail(libseg_status status, const string& message) {
+  last_error = message;
+  return status;
+}
+
+// Run f, turning exceptions into statuses
+template<class F>
+static libseg_status Guarded(F f) {
+  try {
+    return f();
+  } catch (const bad_alloc&) {
+    return Fail(LIBSEG_ERROR_OUT_OF_MEMORY, "Out of memory");
+  } catch (const exception& e) {
+    return Fail(LIBSEG_ERROR_INTERNAL, e.what());
+  } catch (...) {
+    return Fail(LIBSEG_ERROR_INTERNAL, "Unknown exception");
+  }
+}
+
+#define RETURN_IF_NULL(p) \
+  do { \
+    if ((p) == NULL) { \
+      return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, #p " is NULL"); \
+    } \
+  } while (0)
+
+template<class T>
+static ptrdiff_t PixelStride(const libseg_plane& p) {
+  return p.pixel_stride == 0 ? (ptrdiff_t)sizeof(T) : p.pixel_stride;
+}
+
+template<class T>
+static bool IsContiguous(const libseg_plane& p) {
+  return PixelStride<T>(p) == (ptrdiff_t)sizeof(T)
+      && p.row_stride == (ptrdiff_t)sizeof(T)*p.width;
+}
+
+static libseg_status CheckPlane(const libseg_plane* p, const char* name,
+                                int W, int H) {
+  if (p == NULL || p->data == NULL) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, string(name) + " is NULL");
+  }
+  if (p->width != W || p->height != H) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                string(name) + " is " + to_string(p->width) + "x"
+                + to_string(p->height) + ", expected " + to_string(W) + "x"
+                + to_string(H));
+  }
+  return LIBSEG_OK;
+}
+
+// Copy the plane p to the W*H row-major array out
+template<class T>
+static void ReadPlane(const libseg_plane& p, T* out) {
+  const ptrdiff_t pixel_stride = PixelStride<T>(p);
+  for (int y = 0; y < p.height; ++y) {
+    const char* row = (const char*)p.data + y*p.row_stride;
+    T* out_row = out + y*p.width;
+    if (pixel_stride == (ptrdiff_t)sizeof(T)) {
+      memcpy(out_row, row, sizeof(T)*p.width);
+      continue;
+    }
+    for (int x = 0; x < p.width; ++x) {
+      memcpy(out_row + x, row + x*pixel_stride, sizeof(T));
+    }
+  }
+}
+
+// Copy the W*H row-major array in to the plane p
+template<class T>
+static void WritePlane(const T* in, const libseg_plane& p) {
+  const ptrdiff_t pixel_stride = PixelStride<T>(p);
+  for (int y = 0; y < p.height; ++y) {
+    char* row = (char*)p.data + y*p.row_stride;
+    const T* in_row = in + y*p.width;
+    if (pixel_stride == (ptrdiff_t)sizeof(T)) {
+      memcpy(row, in_row, sizeof(T)*p.width);
+      continue;
+    }
+    for (int x = 0; x < p.width; ++x) {
+      memcpy(row + x*pixel_stride, in_row + x, sizeof(T));
+    }
+  }
+}
+
+// The plane as a contiguous W*H array : p's data itself if possible,
+// otherwise a copy in buffer
+static uint8_t* ContiguousPlane(const libseg_plane& p,
+                                vector<uint8_t>* buffer) {
+  if (IsContiguous<uint8_t>(p)) {
+    return (uint8_t*)p.data;
+  }
+  buffer->resize(p.width*p.height);
+  ReadPlane<uint8_t>(p, buffer->data());
+  return buffer->data();
+}
+
+static libseg_status CheckType(const libseg_matter* m,
+                               libseg_matter_type type) {
+  RETURN_IF_NULL(m);
+  if (m->type != type) {
+    return Fail(LIBSEG_ERROR_INVALID_OPERATION,
+                type == LIBSEG_SIMPLE_MATTER ? "Not a simple matter"
+                                             : "Not an interactive matter");
+  }
+  return LIBSEG_OK;
+}
+
+static libseg_status CheckPoints(const int32_t* xy, size_t npoints, int W,
+                                 int H, bool in_image) {
+  if (npoints > 0 && xy == NULL) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "xy is NULL");
+  }
+  if (!in_image) {
+    return LIBSEG_OK;
+  }
+  for (size_t i = 0; i < npoints; ++i) {
+    if (xy[2*i] < 0 || xy[2*i] >= W || xy[2*i + 1] < 0 || xy[2*i + 1] >= H) {
+      return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                  "Point " + to_string(i) + " is out of the image");
+    }
+  }
+  return LIBSEG_OK;
+}
+
+static void ToPoints(const int32_t* xy, size_t npoints,
+                     vector<Point2i>* points) {
+  points->reserve(npoints);
+  for (size_t i = 0; i < npoints; ++i) {
+    points->push_back(Point2i(xy[2*i], xy[2*i + 1]));
+  }
+}
+
+// Write a result plane, from the latest published results if publication is
+// enabled, from the matter otherwise
+template<class T>
+static libseg_status GetResult(const libseg_matter* matter,
+                               const libseg_plane* out,
+                               const char* name,
+                               const T* (Matter::*view)() const,
+                               const vector<T> Results::*published) {
+  RETURN_IF_NULL(matter);
+  const Matter& m = *matter->matter;
+  libseg_status status = CheckPlane(out, name, m.GetWidth(), m.GetHeight());
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  shared_ptr<const Results> results = m.LatestResults();
+  if (results) {
+    WritePlane<T>((results.get()->*published).data(), *out);
+  } else {
+    WritePlane<T>((m.*view)(), *out);
+  }
+  return LIBSEG_OK;
+}
+
+// Check the planes and create an image with a copy of them
+static libseg_status NewLabImage(const libseg_plane* lab_l,
+                                 const libseg_plane* lab_a,
+                                 const libseg_plane* lab_b,
+                                 shared_ptr<const LabImage>* image) {
+  RETURN_IF_NULL(lab_l);
+  const int W = lab_l->width;
+  const int H = lab_l->height;
+  if (W <= 0 || H <= 0) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "Empty image");
+  }
+  libseg_status status;
+  if ((status = CheckPlane(lab_l, "lab_l", W, H)) != LIBSEG_OK
+      || (status = CheckPlane(lab_a, "lab_a", W, H)) != LIBSEG_OK
+      || (status = CheckPlane(lab_b, "lab_b", W, H)) != LIBSEG_OK) {
+    return status;
+  }
+  return Guarded([&] {
+    vector<uint8_t> buffers[3];
+    const libseg_plane* planes[3] = {lab_l, lab_a, lab_b};
+    uint8_t* channels[3];
+    for (int c = 0; c < 3; ++c) {
+      channels[c] = ContiguousPlane(*planes[c], &buffers[c]);
+    }
+    *image = LabImage::Create(channels[0], channels[1], channels[2], W, H);
+    return LIBSEG_OK;
+  });
+}
+
+static libseg_status NewMatter(libseg_matter_type type,
+                               const shared_ptr<const LabImage>& image,
+                               libseg_matter** matter) {
+  return Guarded([&] {
+    unique_ptr<libseg_matter> m(new libseg_matter);
+    m->type = type;
+    if (type == LIBSEG_SIMPLE_MATTER) {
+      m->matter.reset(new SimpleMatter(image));
+    } else {
+      m->matter.reset(new InteractiveMatter(image));
+    }
+    *matter = m.release();
+    return LIBSEG_OK;
+  });
+}
+
+extern "C" {
+
+int libseg_api_version(void) {
+  return LIBSEG_C_API_VERSION;
+}
+
+const char* libseg_status_string(libseg_status status) {
+  switch (status) {
+    case LIBSEG_OK: return "OK";
+    case LIBSEG_ERROR_INVALID_ARGUMENT: return "Invalid argument";
+    case LIBSEG_ERROR_INVALID_OPERATION: return "Invalid operation";
+    case LIBSEG_ERROR_OUT_OF_MEMORY: return "Out of memory";
+    case LIBSEG_ERROR_INTERNAL: return "Internal error";
+  }
+  return "Unknown status";
+}
+
+const char* libseg_last_error(void) {
+  return last_error.c_str();
+}
+
+libseg_status libseg_image_new(const libseg_plane* lab_l,
+                               const libseg_plane* lab_a,
+                               const libseg_plane* lab_b,
+                               libseg_image** image) {
+  RETURN_IF_NULL(image);
+  *image = NULL;
+  shared_ptr<const LabImage> lab;
+  const libseg_status status = NewLabImage(lab_l, lab_a, lab_b, &lab);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  return Guarded([&] {
+    *image = new libseg_image;
+    (*image)->image = lab;
+    return LIBSEG_OK;
+  });
+}
+
+void libseg_image_free(libseg_image* image) {
+  delete image;
+}
+
+libseg_status libseg_matter_new(libseg_matter_type type,
+                                const libseg_plane* lab_l,
+                                const libseg_plane* lab_a,
+                                const libseg_plane* lab_b,
+                                libseg_matter** matter) {
+  RETURN_IF_NULL(matter);
+  *matter = NULL;
+  if (type != LIBSEG_SIMPLE_MATTER && type != LIBSEG_INTERACTIVE_MATTER) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "Unknown matter type");
+  }
+  shared_ptr<const LabImage> image;
+  const libseg_status status = NewLabImage(lab_l, lab_a, lab_b, &image);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  return NewMatter(type, image, matter);
+}
+
+libseg_status libseg_matter_new_from_image(libseg_matter_type type,
+                                           const libseg_image* image,
+                                           libseg_matter** matter) {
+  RETURN_IF_NULL(matter);
+  *matter = NULL;
+  if (type != LIBSEG_SIMPLE_MATTER && type != LIBSEG_INTERACTIVE_MATTER) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "Unknown matter type");
+  }
+  RETURN_IF_NULL(image);
+  return NewMatter(type, image->image, matter);
+}
+
+void libseg_matter_free(libseg_matter* matter) {
+  delete matter;
+}
+
+libseg_status libseg_matter_get_size(const libseg_matter* matter,
+                                     int* width, int* height) {
+  RETURN_IF_NULL(matter);
+  RETURN_IF_NULL(width);
+  RETURN_IF_NULL(height);
+  *width = matter->matter->GetWidth();
+  *height = matter->matter->GetHeight();
+  return LIBSEG_OK;
+}
+
+libseg_status libseg_matter_set_preview_factor(libseg_matter* matter,
+                                               int factor) {
+  RETURN_IF_NULL(matter);
+  if (factor < 1) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "The factor must be >= 1");
+  }
+  if (factor > 1 && matter->matter->GetSuperpixelSize() > 0) {
+    return Fail(LIBSEG_ERROR_INVALID_OPERATION,
+                "The preview and superpixel modes can't be combined");
+  }
+  if (matter->type == LIBSEG_INTERACTIVE_MATTER
+      && matter->interactive()->NumScribbles() > 0) {
+    return Fail(LIBSEG_ERROR_INVALID_OPERATION,
+                "The preview factor can't change after the first scribble");
+  }
+  return Guarded([&] {
+    matter->matter->SetPreviewFactor(factor);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_set_superpixel_size(libseg_matter* matter,
+                                                int region_size,
+                                                double compactness) {
+  RETURN_IF_NULL(matter);
+  if (region_size < 0 || !(compactness > 0)) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                "region_size must be >= 0 and compactness > 0");
+  }
+  if (region_size > 0 && matter->matter->GetPreviewFactor() != 1) {
+    return Fail(LIBSEG_ERROR_INVALID_OPERATION,
+                "The preview and superpixel modes can't be combined");
+  }
+  return Guarded([&] {
+    matter->matter->SetSuperpixelSize(region_size, compactness);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_set_publish_results(libseg_matter* matter,
+                                                int enable) {
+  RETURN_IF_NULL(matter);
+  return Guarded([&] {
+    matter->matter->SetPublishResults(enable != 0);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_update_masks(libseg_matter* matter,
+                                         const libseg_plane* bg_mask,
+                                         const libseg_plane* fg_mask) {
+  libseg_status status = CheckType(matter, LIBSEG_SIMPLE_MATTER);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  const int W = matter->matter->GetWidth();
+  const int H = matter->matter->GetHeight();
+  if ((status = CheckPlane(bg_mask, "bg_mask", W, H)) != LIBSEG_OK
+      || (status = CheckPlane(fg_mask, "fg_mask", W, H)) != LIBSEG_OK) {
+    return status;
+  }
+  return Guarded([&] {
+    matter->simple()->UpdateMasks(ContiguousPlane(*bg_mask, &matter->bg_mask),
+                                  ContiguousPlane(*fg_mask, &matter->fg_mask));
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_get_color_model(const libseg_matter* matter,
+                                            int background,
+                                            double* probs,
+                                            size_t nprobs) {
+  libseg_status status = CheckType(matter, LIBSEG_SIMPLE_MATTER);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  RETURN_IF_NULL(probs);
+  if (nprobs != LIBSEG_COLOR_MODEL_SIZE) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                "nprobs is " + to_string(nprobs) + ", expected "
+                + to_string(LIBSEG_COLOR_MODEL_SIZE));
+  }
+  return Guarded([&] {
+    ColorModel model;
+    static_cast<const SimpleMatter*>(matter->matter.get())->GetColorModel(
+        background != 0, &model);
+    if (!IsValidColorModel(model)) {
+      return Fail(LIBSEG_ERROR_INVALID_OPERATION,
+                  "The color model hasn't been computed yet");
+    }
+    for (int c = 0; c < 3; ++c) {
+      memcpy(probs + c*kColorModelValues, model.probs[c].data(),
+             kColorModelValues*sizeof(double));
+    }
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_set_color_model(libseg_matter* matter,
+                                            int background,
+                                            const double* probs,
+                                            size_t nprobs) {
+  libseg_status status = CheckType(matter, LIBSEG_SIMPLE_MATTER);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  if (probs == NULL) {
+    return Guarded([&] {
+      matter->simple()->ClearColorModel(background != 0);
+      return LIBSEG_OK;
+    });
+  }
+  if (nprobs != LIBSEG_COLOR_MODEL_SIZE) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                "nprobs is " + to_string(nprobs) + ", expected "
+                + to_string(LIBSEG_COLOR_MODEL_SIZE));
+  }
+  return Guarded([&] {
+    ColorModel model;
+    for (int c = 0; c < 3; ++c) {
+      model.probs.push_back(vector<double>(probs + c*kColorModelValues,
+                                           probs + (c + 1)*kColorModelValues));
+    }
+    if (!IsValidColorModel(model)) {
+      return Fail(LIBSEG_ERROR_INVALID_ARGUMENT,
+                  "probs has negative or non-finite values");
+    }
+    matter->simple()->SetColorModel(background != 0, model);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_add_scribble(libseg_matter* matter,
+                                         int background,
+                                         const int32_t* xy,
+                                         size_t npoints) {
+  libseg_status status = CheckType(matter, LIBSEG_INTERACTIVE_MATTER);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  const int W = matter->matter->GetWidth();
+  const int H = matter->matter->GetHeight();
+  if ((status = CheckPoints(xy, npoints, W, H, true)) != LIBSEG_OK) {
+    return status;
+  }
+  return Guarded([&] {
+    Scribble s;
+    s.background = background != 0;
+    ToPoints(xy, npoints, &s.pixels);
+    matter->interactive()->AddScribble(s);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_add_stroke(libseg_matter* matter,
+                                       int background,
+                                       int radius,
+                                       const int32_t* xy,
+                                       size_t npoints,
+                                       size_t* nconflicts) {
+  libseg_status status = CheckType(matter, LIBSEG_INTERACTIVE_MATTER);
+  if (status != LIBSEG_OK) {
+    return status;
+  }
+  if (radius < 0) {
+    return Fail(LIBSEG_ERROR_INVALID_ARGUMENT, "radius must be >= 0");
+  }
+  // Strokes are clipped to the image
+  if ((status = CheckPoints(xy, npoints, 0, 0, false)) != LIBSEG_OK) {
+    return status;
+  }
+  return Guarded([&] {
+    Stroke stroke;
+    stroke.background = background != 0;
+    stroke.radius = radius;
+    ToPoints(xy, npoints, &stroke.points);
+    matter->interactive()->AddStroke(stroke, nconflicts);
+    return LIBSEG_OK;
+  });
+}
+
+libseg_status libseg_matter_get_mask(const libseg_matter* matter,
+                                     const libseg_plane* mask) {
+  return GetResult<uint8_t>(matter, mask, "mask",
+                            &Matter::ForegroundMaskView, &Results::mask);
+}
+
+libseg_status libseg_matter_get_likelihood(const libseg_matter* matter,
+                                           int background,
+                                           const libseg_plane* likelihood) {
+  if (background) {
+    return GetResult<double>(matter, likelihood, "likelihood",
+                             &Matter::BackgroundLikelihoodView,
+                             &Results::bg_likelihood);
+  }
+  return GetResult<double>(matter, likelihood, "likelihood",
+                           &Matter::ForegroundLikelihoodView,
+                           &Results::fg_likelihood);
+}
+
+libseg_status libseg_matter_get_dist(const libseg_matter* matter,
+                                     int background,
+                                     const libseg_plane* dist) {
+  if (background) {
+    return GetResult<double>(matter, dist, "dist",
+                             &Matter::BackgroundDistView, &Results::bg_dist);
+  }
+  return GetResult<double>(matter, dist, "dist",
+                           &Matter::ForegroundDistView, &Results::fg_dist);
+}
+
+libseg_status libseg_matter_get_stats(const libseg_matter* matter,
+                                      libseg_stats* stats) {
+  RETURN_IF_NULL(matter);
+  RETURN_IF_NULL(stats);
+  MatterStats s;
+  matter->matter->GetStats(&s);
+  stats->kde_ms = s.kde_ms;
+  stats->pdf_ms = s.pdf_ms;
+  stats->likelihood_ms = s.likelihood_ms;
+  stats->geodesic_ms = s.geodesic_ms;
+  stats->mask_ms = s.mask_ms;
+  stats->total_ms = s.total_ms;
+  stats->kde_calls = s.kde_calls;
+  stats->kde_samples = s.kde_samples;
+  stats->geodesic_pushes = s.geodesic_pushes;
+  stats->geodesic_pops = s.geodesic_pops;
+  stats->geodesic_stale_pops = s.geodesic_stale_pops;
+  stats->geodesic_relaxations = s.geodesic_relaxations;
+  stats->mask_rows_changed = s.mask_rows_changed;
+  return LIBSEG_OK;
+}
+
+}  // extern "C"
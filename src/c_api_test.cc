@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <string>
+#include <vector>
+
+#include "api.h"
+#include "libseg_c.h"
+#include "test_images.h"
+
+using namespace std;
+
+namespace {
+
+const int W = TwoHalvesImage::W, H = TwoHalvesImage::H;
+
+libseg_plane Plane(void* data, ptrdiff_t row_stride,
+                   ptrdiff_t pixel_stride=0) {
+  libseg_plane p;
+  p.data = data;
+  p.width = W;
+  p.height = H;
+  p.row_stride = row_stride;
+  p.pixel_stride = pixel_stride;
+  return p;
+}
+
+// The two halves image, also stored interleaved (4 bytes per pixel, the 4th
+// unused) like an RGBA bitmap
+struct TestImage : public TwoHalvesImage {
+  TestImage() : rgba(W*H*4, 0) {
+    for (int i = 0; i < W*H; ++i) {
+      rgba[4*i] = l[i];
+      rgba[4*i + 1] = a[i];
+      rgba[4*i + 2] = b[i];
+    }
+  }
+
+  // Planes of the interleaved image
+  libseg_plane Channel(int c) {
+    return Plane(rgba.data() + c, 4*W, 4);
+  }
+
+  vector<uint8_t> rgba;
+};
+
+libseg_matter* NewMatter(libseg_matter_type type, TestImage* img) {
+  const libseg_plane l = img->Channel(0);
+  const libseg_plane a = img->Channel(1);
+  const libseg_plane b = img->Channel(2);
+  libseg_matter* m = NULL;
+  EXPECT_EQ(LIBSEG_OK, libseg_matter_new(type, &l, &a, &b, &m));
+  return m;
+}
+
+TEST(CAPI, Version) {
+  EXPECT_EQ(LIBSEG_C_API_VERSION, libseg_api_version());
+  EXPECT_STREQ("OK", libseg_status_string(LIBSEG_OK));
+}
+
+TEST(CAPI, InvalidArgumentsAreReported) {
+  TestImage img;
+  libseg_matter* m = NULL;
+  const libseg_plane l = img.Channel(0);
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_new(LIBSEG_SIMPLE_MATTER, &l, NULL, &l, &m));
+  EXPECT_TRUE(m == NULL);
+  EXPECT_EQ("lab_a is NULL", string(libseg_last_error()));
+
+  libseg_plane small = img.Channel(1);
+  small.width = W - 1;
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_new(LIBSEG_SIMPLE_MATTER, &l, &small, &l, &m));
+  EXPECT_EQ("lab_a is 39x30, expected 40x30", string(libseg_last_error()));
+
+  m = NewMatter(LIBSEG_INTERACTIVE_MATTER, &img);
+  ASSERT_TRUE(m != NULL);
+  const int32_t outside[] = {3, 4, W, 0};
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_add_scribble(m, 1, outside, 2));
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_add_stroke(m, 1, -1, outside, 2, NULL));
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_set_preview_factor(m, 0));
+  // Not a simple matter
+  vector<uint8_t> mask(W*H, 0);
+  const libseg_plane mask_plane = Plane(mask.data(), W);
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_OPERATION,
+            libseg_matter_update_masks(m, &mask_plane, &mask_plane));
+
+  // The modes can't be combined
+  EXPECT_EQ(LIBSEG_OK, libseg_matter_set_superpixel_size(m, 4, 10));
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_OPERATION,
+            libseg_matter_set_preview_factor(m, 2));
+  libseg_matter_free(m);
+  libseg_matter_free(NULL);
+}
+
+TEST(CAPI, SimpleMatterMatchesCppAPI) {
+  TestImage img;
+  vector<uint8_t> bg(W*H, 0), fg(W*H, 0);
+  for (int y = 0; y < H; ++y) {
+    bg[y*W + 1] = 1;
+    fg[y*W + W - 2] = 1;
+  }
+  SimpleMatter reference(img.l.data(), img.a.data(), img.b.data(), W, H);
+  reference.UpdateMasks(bg.data(), fg.data());
+  vector<uint8_t> expected_mask(W*H);
+  reference.GetForegroundMask(expected_mask.data());
+  vector<double> expected_dist(W*H);
+  reference.GetBackgroundDist(expected_dist.data());
+
+  libseg_matter* m = NewMatter(LIBSEG_SIMPLE_MATTER, &img);
+  ASSERT_TRUE(m != NULL);
+  int w, h;
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_size(m, &w, &h));
+  EXPECT_EQ(W, w);
+  EXPECT_EQ(H, h);
+
+  // The bg mask given as the alpha channel of an interleaved buffer
+  vector<uint8_t> bg_rgba(W*H*4, 0);
+  for (int i = 0; i < W*H; ++i) {
+    bg_rgba[4*i + 3] = bg[i];
+  }
+  const libseg_plane bg_plane = Plane(bg_rgba.data() + 3, 4*W, 4);
+  const libseg_plane fg_plane = Plane(fg.data(), W);
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_update_masks(m, &bg_plane, &fg_plane));
+
+  vector<uint8_t> mask(W*H);
+  const libseg_plane mask_plane = Plane(mask.data(), W);
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_mask(m, &mask_plane));
+  EXPECT_EQ(expected_mask, mask);
+
+  // Padded rows
+  const int stride = W + 3;
+  vector<double> dist(stride*H, -1);
+  const libseg_plane dist_plane = Plane(dist.data(), stride*sizeof(double));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_dist(m, 1, &dist_plane));
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      EXPECT_EQ(expected_dist[y*W + x], dist[y*stride + x]);
+    }
+    EXPECT_EQ(-1, dist[y*stride + W]);
+  }
+
+  // Same results through the published ones
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_set_publish_results(m, 1));
+  vector<uint8_t> published(W*H);
+  const libseg_plane published_plane = Plane(published.data(), W);
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_mask(m, &published_plane));
+  EXPECT_EQ(expected_mask, published);
+
+  libseg_stats stats;
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_stats(m, &stats));
+  libseg_matter_free(m);
+}
+
+TEST(CAPI, ColorModels) {
+  TestImage img;
+  vector<uint8_t> bg(W*H, 0), fg(W*H, 0);
+  for (int y = 0; y < H; ++y) {
+    bg[y*W + 1] = 1;
+    fg[y*W + W - 2] = 1;
+  }
+  const libseg_plane bg_plane = Plane(bg.data(), W);
+  const libseg_plane fg_plane = Plane(fg.data(), W);
+  libseg_matter* source = NewMatter(LIBSEG_SIMPLE_MATTER, &img);
+  ASSERT_TRUE(source != NULL);
+  vector<double> fg_model(LIBSEG_COLOR_MODEL_SIZE);
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_OPERATION,
+            libseg_matter_get_color_model(source, 0, fg_model.data(),
+                                          fg_model.size()));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_update_masks(source, &bg_plane,
+                                                  &fg_plane));
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_get_color_model(source, 0, fg_model.data(), 10));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_color_model(
+      source, 0, fg_model.data(), fg_model.size()));
+  libseg_matter_free(source);
+
+  libseg_matter* m = NewMatter(LIBSEG_SIMPLE_MATTER, &img);
+  ASSERT_TRUE(m != NULL);
+  vector<double> invalid(fg_model);
+  invalid[3] = -1;
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_matter_set_color_model(m, 0, invalid.data(),
+                                          invalid.size()));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_set_color_model(m, 0, fg_model.data(),
+                                                     fg_model.size()));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_update_masks(m, &bg_plane, &fg_plane));
+  vector<double> exported(LIBSEG_COLOR_MODEL_SIZE);
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_color_model(
+      m, 0, exported.data(), exported.size()));
+  EXPECT_EQ(fg_model, exported);
+  EXPECT_EQ(LIBSEG_OK, libseg_matter_set_color_model(m, 0, NULL, 0));
+  libseg_matter_free(m);
+}
+
+TEST(CAPI, SharedImage) {
+  TestImage img;
+  const libseg_plane l = img.Channel(0);
+  const libseg_plane a = img.Channel(1);
+  const libseg_plane b = img.Channel(2);
+  libseg_image* image = NULL;
+  EXPECT_EQ(LIBSEG_ERROR_INVALID_ARGUMENT,
+            libseg_image_new(&l, &a, NULL, &image));
+  ASSERT_EQ(LIBSEG_OK, libseg_image_new(&l, &a, &b, &image));
+  libseg_matter* m1 = NULL;
+  libseg_matter* m2 = NULL;
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_new_from_image(LIBSEG_SIMPLE_MATTER,
+                                                    image, &m1));
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_new_from_image(LIBSEG_INTERACTIVE_MATTER,
+                                                    image, &m2));
+  // The matters keep the image alive
+  libseg_image_free(image);
+  int w, h;
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_size(m2, &w, &h));
+  EXPECT_EQ(W, w);
+  const int32_t fg[] = {W - 3, 2, W - 3, H - 3};
+  EXPECT_EQ(LIBSEG_OK, libseg_matter_add_stroke(m2, 0, 1, fg, 2, NULL));
+  libseg_matter_free(m1);
+  libseg_matter_free(m2);
+}
+
+TEST(CAPI, InteractiveMatter) {
+  TestImage img;
+  libseg_matter* m = NewMatter(LIBSEG_INTERACTIVE_MATTER, &img);
+  ASSERT_TRUE(m != NULL);
+
+  const int32_t fg[] = {W - 3, 2, W - 3, H - 3};
+  size_t nconflicts = 1;
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_add_stroke(m, 0, 1, fg, 2, &nconflicts));
+  EXPECT_EQ(0u, nconflicts);
+  const int32_t bg[] = {1, 1, 2, 1, 1, 2};
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_add_scribble(m, 1, bg, 3));
+
+  vector<uint8_t> mask(W*H);
+  const libseg_plane mask_plane = Plane(mask.data(), W);
+  ASSERT_EQ(LIBSEG_OK, libseg_matter_get_mask(m, &mask_plane));
+  EXPECT_EQ(255, mask[(H/2)*W + W - 3]);
+  EXPECT_EQ(0, mask[1*W + 1]);
+  libseg_matter_free(m);
+}
+
+}
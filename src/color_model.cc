@@ -0,0 +1,98 @@
+#include "color_model.h"
+
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+
+#include <glog/logging.h>
+
+using namespace std;
+
+static const char kColorModelMagic[8] = {'L', 'S', 'E', 'G', 'C', 'M', 'O',
+                                         'D'};
+static const uint32_t kColorModelVersion = 1;
+static const uint32_t kColorModelByteOrder = 0x01020304;
+static const size_t kColorModelHeaderSize = 16;
+static const size_t kColorModelSize =
+    kColorModelHeaderSize + 3*kColorModelValues*sizeof(double);
+
+bool IsValidColorModel(const ColorModel& model) {
+  if (model.probs.size() != 3) {
+    return false;
+  }
+  for (const vector<double>& channel : model.probs) {
+    if (channel.size() != (size_t)kColorModelValues) {
+      return false;
+    }
+    for (double p : channel) {
+      if (!std::isfinite(p) || p < 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void EncodeColorModel(const ColorModel& model, vector<uint8_t>* bytes) {
+  CHECK(IsValidColorModel(model));
+  bytes->resize(kColorModelSize);
+  uint8_t* p = bytes->data();
+  memcpy(p, kColorModelMagic, sizeof(kColorModelMagic));
+  memcpy(p + 8, &kColorModelVersion, sizeof(uint32_t));
+  memcpy(p + 12, &kColorModelByteOrder, sizeof(uint32_t));
+  p += kColorModelHeaderSize;
+  for (const vector<double>& channel : model.probs) {
+    memcpy(p, channel.data(), kColorModelValues*sizeof(double));
+    p += kColorModelValues*sizeof(double);
+  }
+}
+
+bool DecodeColorModel(const uint8_t* bytes, size_t size, ColorModel* model) {
+  if (size != kColorModelSize
+      || memcmp(bytes, kColorModelMagic, sizeof(kColorModelMagic)) != 0) {
+    return false;
+  }
+  uint32_t version, byte_order;
+  memcpy(&version, bytes + 8, sizeof(uint32_t));
+  memcpy(&byte_order, bytes + 12, sizeof(uint32_t));
+  if (version != kColorModelVersion || byte_order != kColorModelByteOrder) {
+    return false;
+  }
+  ColorModel decoded;
+  decoded.probs.resize(3);
+  const uint8_t* p = bytes + kColorModelHeaderSize;
+  for (vector<double>& channel : decoded.probs) {
+    channel.resize(kColorModelValues);
+    memcpy(channel.data(), p, kColorModelValues*sizeof(double));
+    p += kColorModelValues*sizeof(double);
+  }
+  if (!IsValidColorModel(decoded)) {
+    return false;
+  }
+  model->probs.swap(decoded.probs);
+  return true;
+}
+
+bool SaveColorModel(const ColorModel& model, const string& path) {
+  vector<uint8_t> bytes;
+  EncodeColorModel(model, &bytes);
+  ofstream out(path.c_str(), ios::binary);
+  out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  if (!out) {
+    LOG(ERROR) << "Failed to write " << path;
+    return false;
+  }
+  return true;
+}
+
+bool LoadColorModel(const string& path, ColorModel* model) {
+  ifstream in(path.c_str(), ios::binary);
+  const vector<uint8_t> bytes((istreambuf_iterator<char>(in)),
+                              istreambuf_iterator<char>());
+  if (!DecodeColorModel(bytes.data(), bytes.size(), model)) {
+    LOG(ERROR) << path << " is not a valid color model";
+    return false;
+  }
+  return true;
+}
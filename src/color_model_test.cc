@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cmath>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "color_model.h"
+
+using namespace std;
+
+namespace {
+
+ColorModel TestModel() {
+  ColorModel model;
+  model.probs.resize(3);
+  for (int c = 0; c < 3; ++c) {
+    for (int v = 0; v < kColorModelValues; ++v) {
+      model.probs[c].push_back((c + 1) * v / 1000.0);
+    }
+  }
+  return model;
+}
+
+TEST(ColorModel, Validity) {
+  ColorModel model = TestModel();
+  EXPECT_TRUE(IsValidColorModel(model));
+  EXPECT_FALSE(IsValidColorModel(ColorModel()));
+
+  model.probs[1][3] = -1;
+  EXPECT_FALSE(IsValidColorModel(model));
+  model.probs[1][3] = NAN;
+  EXPECT_FALSE(IsValidColorModel(model));
+  model.probs[1].pop_back();
+  EXPECT_FALSE(IsValidColorModel(model));
+}
+
+TEST(ColorModel, EncodeDecode) {
+  const ColorModel model = TestModel();
+  vector<uint8_t> bytes;
+  EncodeColorModel(model, &bytes);
+
+  ColorModel decoded;
+  ASSERT_TRUE(DecodeColorModel(bytes.data(), bytes.size(), &decoded));
+  EXPECT_EQ(model.probs, decoded.probs);
+
+  // Truncated, wrong magic, wrong version
+  ColorModel untouched;
+  EXPECT_FALSE(DecodeColorModel(bytes.data(), bytes.size() - 1, &untouched));
+  vector<uint8_t> corrupted(bytes);
+  corrupted[0] = 'X';
+  EXPECT_FALSE(DecodeColorModel(corrupted.data(), corrupted.size(),
+                                &untouched));
+  corrupted = bytes;
+  corrupted[8] += 1;
+  EXPECT_FALSE(DecodeColorModel(corrupted.data(), corrupted.size(),
+                                &untouched));
+  EXPECT_TRUE(untouched.probs.empty());
+}
+
+TEST(ColorModel, SaveLoad) {
+  char path[] = "/tmp/libseg_color_model_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  const ColorModel model = TestModel();
+  ASSERT_TRUE(SaveColorModel(model, path));
+  ColorModel loaded;
+  ASSERT_TRUE(LoadColorModel(path, &loaded));
+  EXPECT_EQ(model.probs, loaded.probs);
+  unlink(path);
+
+  EXPECT_FALSE(LoadColorModel(path, &loaded));
+}
+
+}
@@ -0,0 +1,200 @@
+#include "contour.h"
+
+#include <cmath>
+#include <glog/logging.h>
+#include <unordered_map>
+
+using namespace std;
+
+// Directions : right, down, left, up. Turning right is d + 1
+static const int kDX[4] = {1, 0, -1, 0};
+static const int kDY[4] = {0, 1, 0, -1};
+
+static double SegmentDistance(const Point2i& p, const Point2i& a,
+                              const Point2i& b) {
+  const double dx = b.x - a.x;
+  const double dy = b.y - a.y;
+  const double len2 = dx*dx + dy*dy;
+  double t = 0;
+  if (len2 > 0) {
+    t = ((p.x - a.x)*dx + (p.y - a.y)*dy) / len2;
+    t = max(0.0, min(1.0, t));
+  }
+  const double ex = a.x + t*dx - p.x;
+  const double ey = a.y + t*dy - p.y;
+  return sqrt(ex*ex + ey*ey);
+}
+
+// Douglas-Peucker on points[first..last], appending the kept points in
+// ]first, last] to out
+static void DouglasPeucker(const vector<Point2i>& points, size_t first,
+                           size_t last, double tolerance,
+                           vector<Point2i>* out) {
+  double max_dist = -1;
+  size_t farthest = first;
+  for (size_t i = first + 1; i < last; ++i) {
+    const double d = SegmentDistance(points[i], points[first], points[last]);
+    if (d > max_dist) {
+      max_dist = d;
+      farthest = i;
+    }
+  }
+  if (max_dist > tolerance) {
+    DouglasPeucker(points, first, farthest, tolerance, out);
+    DouglasPeucker(points, farthest, last, tolerance, out);
+  } else {
+    out->push_back(points[last]);
+  }
+}
+
+void SimplifyContour(const vector<Point2i>& points, double tolerance,
+                     vector<Point2i>* simplified) {
+  simplified->clear();
+  if (points.size() <= 3) {
+    *simplified = points;
+    return;
+  }
+  // Split the closed polygon in two chains at the first point and the point
+  // the farthest from it, and simplify each of them
+  size_t farthest = 0;
+  double max_dist = -1;
+  for (size_t i = 1; i < points.size(); ++i) {
+    const double dx = points[i].x - points[0].x;
+    const double dy = points[i].y - points[0].y;
+    if (dx*dx + dy*dy > max_dist) {
+      max_dist = dx*dx + dy*dy;
+      farthest = i;
+    }
+  }
+  vector<Point2i> closed(points);
+  closed.push_back(points[0]);
+  simplified->push_back(points[0]);
+  DouglasPeucker(closed, 0, farthest, tolerance, simplified);
+  DouglasPeucker(closed, farthest, closed.size() - 1, tolerance, simplified);
+  // The last point is points[0] again
+  simplified->pop_back();
+}
+
+ContourTracer::ContourTracer(int W, int H)
+  : W(W), H(H),
+    mask_(W*H, 0),
+    edges_((W + 1)*(H + 1), 0) {
+}
+
+bool ContourTracer::IsForeground(int x, int y) const {
+  if (x < 0 || x >= W || y < 0 || y >= H) {
+    return false;
+  }
+  return mask_[y*W + x] != 0;
+}
+
+void ContourTracer::SetEdge(int vertex, int dir, bool on) {
+  if (on) {
+    edges_[vertex] |= 1 << dir;
+    active_.insert(vertex);
+  } else if (edges_[vertex] & (1 << dir)) {
+    edges_[vertex] &= ~(1 << dir);
+    if (edges_[vertex] == 0) {
+      active_.erase(vertex);
+    }
+  }
+}
+
+void ContourTracer::UpdatePixelEdges(int x, int y) {
+  const int V = W + 1;
+  const int tl = y*V + x;
+  const int tr = tl + 1;
+  const int bl = tl + V;
+  const int br = bl + 1;
+  const bool fg = IsForeground(x, y);
+  // For each side, the edge that exists if this pixel is the foreground one
+  // and the edge if the neighbor is, so that foreground is on the right
+  const bool top = IsForeground(x, y - 1);
+  SetEdge(tl, 0, fg && !top);
+  SetEdge(tr, 2, !fg && top);
+  const bool right = IsForeground(x + 1, y);
+  SetEdge(tr, 1, fg && !right);
+  SetEdge(br, 3, !fg && right);
+  const bool bottom = IsForeground(x, y + 1);
+  SetEdge(br, 2, fg && !bottom);
+  SetEdge(bl, 0, !fg && bottom);
+  const bool left = IsForeground(x - 1, y);
+  SetEdge(bl, 3, fg && !left);
+  SetEdge(tl, 1, !fg && left);
+}
+
+void ContourTracer::Update(const uint8_t* mask, const vector<bool>* rows) {
+  for (int y = 0; y < H; ++y) {
+    if (rows && !(*rows)[y]) {
+      continue;
+    }
+    for (int x = 0; x < W; ++x) {
+      const uint8_t fg = mask[y*W + x] ? 1 : 0;
+      if (fg != mask_[y*W + x]) {
+        mask_[y*W + x] = fg;
+        UpdatePixelEdges(x, y);
+      }
+    }
+  }
+}
+
+// Direction to leave corner v by after arriving in direction dir, given the
+// edges leaving v
+static int NextDirection(uint8_t out, int dir) {
+  // At a saddle corner, prefer turning right so that diagonal foreground
+  // pixels are not connected
+  const int candidates[3] = {(dir + 1) % 4, dir, (dir + 3) % 4};
+  for (int d : candidates) {
+    if (out & (1 << d)) {
+      return d;
+    }
+  }
+  return -1;
+}
+
+void ContourTracer::GetContours(double tolerance,
+                                vector<Contour>* contours) const {
+  contours->clear();
+  const int V = W + 1;
+  // Edges not traced yet
+  unordered_map<int, uint8_t> remaining;
+  for (int v : active_) {
+    remaining[v] = edges_[v];
+  }
+
+  vector<Point2i> points;
+  for (auto& start : remaining) {
+    while (start.second != 0) {
+      // Start with any edge of that corner
+      const int v0 = start.first;
+      int dir0 = 0;
+      while (!(start.second & (1 << dir0))) {
+        ++dir0;
+      }
+      int v = v0;
+      int dir = dir0;
+      points.clear();
+      long long area2 = 0;
+      while (true) {
+        remaining.find(v)->second &= ~(1 << dir);
+        const int x = v % V, y = v / V;
+        v += kDY[dir]*V + kDX[dir];
+        const int nx = v % V, ny = v / V;
+        area2 += (long long)x*ny - (long long)nx*y;
+        const int next = NextDirection(edges_[v], dir);
+        CHECK_GE(next, 0) << "open contour";
+        if (next != dir) {
+          points.push_back(Point2i(nx, ny));
+        }
+        if (v == v0 && next == dir0) {
+          break;
+        }
+        dir = next;
+      }
+      contours->push_back(Contour());
+      Contour& contour = contours->back();
+      contour.hole = area2 < 0;
+      SimplifyContour(points, tolerance, &contour.points);
+    }
+  }
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <vector>
+
+#include "contour.h"
+
+using namespace std;
+
+namespace {
+
+// Contour points as (x, y) pairs, starting at the smallest one so that
+// contours can be compared regardless of where tracing started
+vector<pair<int, int>> Canonical(const Contour& c) {
+  vector<pair<int, int>> pts;
+  for (const Point2i& p : c.points) {
+    pts.push_back(make_pair(p.x, p.y));
+  }
+  rotate(pts.begin(), min_element(pts.begin(), pts.end()), pts.end());
+  return pts;
+}
+
+vector<vector<pair<int, int>>> AllCanonical(const vector<Contour>& cs) {
+  vector<vector<pair<int, int>>> all;
+  for (const Contour& c : cs) {
+    all.push_back(Canonical(c));
+  }
+  sort(all.begin(), all.end());
+  return all;
+}
+
+TEST(ContourTracer, SinglePixel) {
+  const int W = 3, H = 3;
+  vector<uint8_t> mask(W*H, 0);
+  mask[1*W + 1] = 255;
+  ContourTracer tracer(W, H);
+  tracer.Update(mask.data());
+  vector<Contour> contours;
+  tracer.GetContours(0, &contours);
+  ASSERT_EQ(1u, contours.size());
+  EXPECT_FALSE(contours[0].hole);
+  const vector<pair<int, int>> expected{{1, 1}, {2, 1}, {2, 2}, {1, 2}};
+  EXPECT_EQ(expected, Canonical(contours[0]));
+}
+
+TEST(ContourTracer, HoleAndDiagonals) {
+  // A 5x5 square with a 1 pixel hole, and two pixels touching by a corner
+  const int W = 10, H = 7;
+  vector<uint8_t> mask(W*H, 0);
+  for (int y = 1; y < 6; ++y) {
+    for (int x = 1; x < 6; ++x) {
+      mask[y*W + x] = (x == 3 && y == 3) ? 0 : 255;
+    }
+  }
+  mask[1*W + 7] = 255;
+  mask[2*W + 8] = 255;
+
+  ContourTracer tracer(W, H);
+  tracer.Update(mask.data());
+  vector<Contour> contours;
+  tracer.GetContours(0, &contours);
+  ASSERT_EQ(4u, contours.size());
+  int nholes = 0;
+  for (const Contour& c : contours) {
+    EXPECT_EQ(4u, c.points.size());
+    nholes += c.hole;
+  }
+  EXPECT_EQ(1, nholes);
+}
+
+TEST(ContourTracer, IncrementalMatchesFull) {
+  const int W = 30, H = 20;
+  vector<uint8_t> mask(W*H, 0);
+  ContourTracer incremental(W, H);
+  incremental.Update(mask.data());
+  // Grow and carve a few blobs, telling the tracer which rows changed
+  for (int step = 0; step < 6; ++step) {
+    vector<bool> rows(H, false);
+    const int cx = 5 + 4*step, cy = 5 + (step % 3)*4, r = 3 + step % 2;
+    for (int y = max(0, cy - r); y <= min(H - 1, cy + r); ++y) {
+      for (int x = max(0, cx - r); x <= min(W - 1, cx + r); ++x) {
+        if ((x - cx)*(x - cx) + (y - cy)*(y - cy) <= r*r) {
+          mask[y*W + x] = (step % 3 == 2) ? 0 : 255;
+          rows[y] = true;
+        }
+      }
+    }
+    incremental.Update(mask.data(), &rows);
+
+    ContourTracer full(W, H);
+    full.Update(mask.data());
+    vector<Contour> a, b;
+    incremental.GetContours(0, &a);
+    full.GetContours(0, &b);
+    EXPECT_EQ(AllCanonical(b), AllCanonical(a)) << "step " << step;
+  }
+}
+
+TEST(SimplifyContour, Disk) {
+  const int W = 60, H = 60;
+  vector<uint8_t> mask(W*H, 0);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      if ((x - 30)*(x - 30) + (y - 30)*(y - 30) < 20*20) {
+        mask[y*W + x] = 255;
+      }
+    }
+  }
+  ContourTracer tracer(W, H);
+  tracer.Update(mask.data());
+  vector<Contour> exact, simplified;
+  tracer.GetContours(0, &exact);
+  tracer.GetContours(1.5, &simplified);
+  ASSERT_EQ(1u, exact.size());
+  ASSERT_EQ(1u, simplified.size());
+  EXPECT_LT(simplified[0].points.size(), exact[0].points.size() / 2);
+  EXPECT_GE(simplified[0].points.size(), 8u);
+}
+
+}
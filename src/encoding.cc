@@ -0,0 +1,69 @@
+#include "encoding.h"
+
+#include <string.h>
+
+using namespace std;
+
+void PackMaskBits(const uint8_t* mask, int W, int H, uint8_t* bits) {
+  const int stride = PackedMaskStride(W);
+  memset(bits, 0, stride*H);
+  for (int y = 0; y < H; ++y) {
+    const uint8_t* row = mask + y*W;
+    uint8_t* out = bits + y*stride;
+    for (int x = 0; x < W; ++x) {
+      if (row[x]) {
+        out[x >> 3] |= 0x80 >> (x & 7);
+      }
+    }
+  }
+}
+
+void UnpackMaskBits(const uint8_t* bits, int W, int H, uint8_t* mask) {
+  const int stride = PackedMaskStride(W);
+  for (int y = 0; y < H; ++y) {
+    const uint8_t* in = bits + y*stride;
+    uint8_t* row = mask + y*W;
+    for (int x = 0; x < W; ++x) {
+      row[x] = (in[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+    }
+  }
+}
+
+void EncodeMaskRLE(const uint8_t* mask, int W, int H,
+                   vector<uint32_t>* runs) {
+  runs->clear();
+  for (int y = 0; y < H; ++y) {
+    const uint8_t* row = mask + y*W;
+    bool fg = false;
+    uint32_t len = 0;
+    for (int x = 0; x < W; ++x) {
+      if ((row[x] != 0) != fg) {
+        runs->push_back(len);
+        fg = !fg;
+        len = 0;
+      }
+      ++len;
+    }
+    runs->push_back(len);
+  }
+}
+
+bool DecodeMaskRLE(const vector<uint32_t>& runs, int W, int H,
+                   uint8_t* mask) {
+  size_t r = 0;
+  for (int y = 0; y < H; ++y) {
+    uint8_t* row = mask + y*W;
+    bool fg = false;
+    int x = 0;
+    // A row always has at least one run, even if W is 0
+    do {
+      if (r >= runs.size() || runs[r] > (uint32_t)(W - x)) {
+        return false;
+      }
+      memset(row + x, fg ? 255 : 0, runs[r]);
+      x += runs[r++];
+      fg = !fg;
+    } while (x < W);
+  }
+  return r == runs.size();
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+
+#include "encoding.h"
+
+using namespace std;
+using ::testing::ElementsAre;
+
+namespace {
+
+// A W*H mask with a foreground disk
+vector<uint8_t> DiskMask(int W, int H) {
+  vector<uint8_t> mask(W*H, 0);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      const int dx = x - W/2, dy = y - H/2;
+      if (dx*dx + dy*dy < (H/3)*(H/3)) {
+        mask[y*W + x] = 255;
+      }
+    }
+  }
+  return mask;
+}
+
+TEST(PackMaskBits, RoundTrip) {
+  // 13 is not a multiple of 8, so rows are padded
+  const int W = 13, H = 11;
+  const vector<uint8_t> mask = DiskMask(W, H);
+  vector<uint8_t> bits(PackedMaskStride(W)*H);
+  PackMaskBits(mask.data(), W, H, bits.data());
+  EXPECT_EQ(2, PackedMaskStride(W));
+
+  vector<uint8_t> out(W*H, 42);
+  UnpackMaskBits(bits.data(), W, H, out.data());
+  EXPECT_EQ(mask, out);
+}
+
+TEST(PackMaskBits, BitOrder) {
+  const uint8_t mask[10] = {255, 0, 0, 0, 0, 0, 0, 1, 0, 255};
+  uint8_t bits[2];
+  PackMaskBits(mask, 10, 1, bits);
+  EXPECT_EQ(0x81, bits[0]);
+  EXPECT_EQ(0x40, bits[1]);
+}
+
+TEST(MaskRLE, Runs) {
+  const uint8_t mask[12] = {0, 0, 255, 255, 255, 0,
+                            255, 255, 255, 255, 255, 255};
+  vector<uint32_t> runs;
+  EncodeMaskRLE(mask, 6, 2, &runs);
+  EXPECT_THAT(runs, ElementsAre(2, 3, 1, 0, 6));
+}
+
+TEST(MaskRLE, RoundTrip) {
+  const int W = 37, H = 29;
+  const vector<uint8_t> mask = DiskMask(W, H);
+  vector<uint32_t> runs;
+  EncodeMaskRLE(mask.data(), W, H, &runs);
+  // At most 3 runs per row for a disk
+  EXPECT_LE(runs.size(), 3u*H);
+
+  vector<uint8_t> out(W*H, 42);
+  ASSERT_TRUE(DecodeMaskRLE(runs, W, H, out.data()));
+  EXPECT_EQ(mask, out);
+
+  // Rows that don't sum to W
+  runs.push_back(1);
+  EXPECT_FALSE(DecodeMaskRLE(runs, W, H, out.data()));
+  runs.pop_back();
+  runs[0] += 1;
+  EXPECT_FALSE(DecodeMaskRLE(runs, W, H, out.data()));
+}
+
+}
@@ -2,11 +2,15 @@
 
 #include <queue>
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <iostream>
 #include <string.h>
 #include <unordered_map>
 
+#include "stats.h"
+#include "trace.h"
+
 using namespace std;
 
 void GeodesicDistanceMap(const uint8_t* source_mask,
@@ -24,25 +28,56 @@ void GeodesicDistanceMap(const uint8_t* source_mask,
   GeodesicDistanceMap(points, height, W, H, dists);
 }
 
-void GeodesicDistanceMap(const std::vector<Scribble>& scribbles,
+bool GeodesicDistanceMap(const std::vector<Scribble>& scribbles,
                          bool background,
                          const double* height,
                          int W, int H,
-                         double* dists) {
+                         double* dists,
+                         const CancelFlag* cancel) {
   vector<Point2i> points;
   for (const Scribble& s : scribbles) {
     if (s.background == background) {
       points.insert(points.end(), s.pixels.begin(), s.pixels.end());
     }
   }
-  GeodesicDistanceMap(points, height, W, H, dists);
+  return GeodesicDistanceMap(points, height, W, H, dists, cancel);
 }
 
-void GeodesicDistanceMap(const std::vector<Point2i>& sources,
+// Number of nodes popped between two polls of the cancel flag and deadline
+static const int kCheckInterval = 4096;
+
+bool GeodesicDistanceMap(const std::vector<Point2i>& sources,
                          const double* height,
                          int W,
                          int H,
-                         double* dists) {
+                         double* dists,
+                         const CancelFlag* cancel,
+                         GeodesicScratch* scratch) {
+  GeodesicPropagation propagation(height, W, H, dists, scratch);
+  propagation.Init(sources);
+  return propagation.Run(cancel);
+}
+
+GeodesicPropagation::GeodesicPropagation(const double* height,
+                                         int W, int H,
+                                         double* dists,
+                                         GeodesicScratch* scratch)
+  : height_(height), W(W), H(H), dists_(dists), region_(NULL),
+    Q_(scratch ? &scratch->heap : &own_heap_) {
+  Q_->clear();
+}
+
+void GeodesicPropagation::Push(int i, double dist) {
+  Q_->push_back(make_pair(i, dist));
+  push_heap(Q_->begin(), Q_->end(), EntryCompare());
+}
+
+void GeodesicPropagation::Pop() {
+  pop_heap(Q_->begin(), Q_->end(), EntryCompare());
+  Q_->pop_back();
+}
+
+void GeodesicPropagation::Init(const std::vector<Point2i>& sources) {
   // The algorithm is actually equivalent to running Dijkstra once for each
   // source and then keeping the minimum distance.
   // This is similar to "SHORTEST-PATH FOREST WITH TOPOLOGICAL ORDERING"
@@ -57,34 +92,125 @@ void GeodesicDistanceMap(const std::vector<Point2i>& sources,
   //   4. remove current node from visited
   //   5. pick the node with the smallest distance from the unvisited node as
   //      the new current
+  //
+  // Init does 1. and 2., Run does the rest
+  LIBSEG_STAGE_TIMER(geodesic_ms);
+  LIBSEG_TRACE_SCOPE("GeodesicPropagation::Init");
   const int N = W*H;
-  // priority queue
-  typedef pair<int, double> PriorityEntry;
-  auto comp = [](const PriorityEntry& e1, const PriorityEntry& e2) {
-    return e1.second > e2.second;
-  };
-  priority_queue<PriorityEntry, vector<PriorityEntry>, decltype(comp)> Q(comp);
+  Q_->clear();
+  region_ = NULL;
 
   for (int i = 0; i < N; ++i) {
-    dists[i] = numeric_limits<double>::max();
+    dists_[i] = numeric_limits<double>::max();
   }
 
   for (const Point2i& p : sources) {
     const int i = W*p.y + p.x;
-    dists[i] = 0;
-    Q.push(make_pair(i, 0));
+    dists_[i] = 0;
+    Push(i, 0);
   }
+  LIBSEG_COUNT(geodesic_pushes, sources.size());
+}
+
+void GeodesicPropagation::Init(const std::vector<Scribble>& scribbles,
+                               bool background) {
+  vector<Point2i> points;
+  for (const Scribble& s : scribbles) {
+    if (s.background == background) {
+      points.insert(points.end(), s.pixels.begin(), s.pixels.end());
+    }
+  }
+  Init(points);
+}
+
+void GeodesicPropagation::InitInRegion(const std::vector<Point2i>& sources,
+                                       const uint8_t* region) {
+  LIBSEG_STAGE_TIMER(geodesic_ms);
+  LIBSEG_TRACE_SCOPE("GeodesicPropagation::InitInRegion");
+  Q_->clear();
+  region_ = region;
+  for (int i = 0; i < W*H; ++i) {
+    if (region[i]) {
+      dists_[i] = numeric_limits<double>::max();
+    }
+  }
+  for (const Point2i& p : sources) {
+    const int i = W*p.y + p.x;
+    if (region[i]) {
+      dists_[i] = 0;
+      Push(i, 0);
+    }
+  }
+  // The pixels just outside region are fixed sources with their current
+  // distance. Run only relaxes their neighbors that are in region
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      const int i = y*W + x;
+      if (region[i] || dists_[i] == numeric_limits<double>::max()) {
+        continue;
+      }
+      if ((x > 0 && region[i - 1]) || (x < W - 1 && region[i + 1])
+          || (y > 0 && region[i - W]) || (y < H - 1 && region[i + W])) {
+        Push(i, dists_[i]);
+      }
+    }
+  }
+  LIBSEG_COUNT(geodesic_pushes, Q_->size());
+}
+
+void GeodesicPropagation::AddSources(const std::vector<Point2i>& sources) {
+  LIBSEG_TRACE_SCOPE("GeodesicPropagation::AddSources");
+  Q_->clear();
+  region_ = NULL;
+  for (const Point2i& p : sources) {
+    const int i = W*p.y + p.x;
+    if (dists_[i] > 0) {
+      dists_[i] = 0;
+      Push(i, 0);
+    }
+  }
+  LIBSEG_COUNT(geodesic_pushes, Q_->size());
+}
+
+double GeodesicPropagation::Frontier() const {
+  return Q_->empty() ? numeric_limits<double>::max() : Q_->front().second;
+}
+
+bool GeodesicPropagation::Run(const CancelFlag* cancel,
+                              const chrono::steady_clock::time_point& deadline) {
+  LIBSEG_STAGE_TIMER(geodesic_ms);
+  LIBSEG_TRACE_SCOPE("GeodesicPropagation::Run");
+  const bool has_deadline = deadline != chrono::steady_clock::time_point::max();
+  double* dists = dists_;
+  const double* height = height_;
 
   //dx dy pairs for neighborhood exploration
   const int dx[4] = {-1, 0, 1,  0};
   const int dy[4] = { 0, 1, 0, -1};
 
+  // Counted locally and added to the stats once done
+  LIBSEG_STATS(uint64_t npops = 0);
+  LIBSEG_STATS(uint64_t nstale = 0);
+  LIBSEG_STATS(uint64_t nrelaxed = 0);
+
   // main loop
-  while(!Q.empty()) {
-    int u = Q.top().first;
+  bool done = true;
+  int npopped = 0;
+  while(!Q_->empty()) {
+    if (++npopped == kCheckInterval) {
+      npopped = 0;
+      if (IsCancelled(cancel) ||
+          (has_deadline && chrono::steady_clock::now() >= deadline)) {
+        done = false;
+        break;
+      }
+    }
+    int u = Q_->front().first;
     const int ux = u % W;
     const int uy = u / W;
-    Q.pop();
+    LIBSEG_STATS(++npops);
+    LIBSEG_STATS(nstale += (Q_->front().second > dists[u]));
+    Pop();
     // explore neighbors
     for (int i = 0; i < 4; ++i) {
       const int vx = ux + dx[i];
@@ -93,14 +219,23 @@ void GeodesicDistanceMap(const std::vector<Point2i>& sources,
         continue;
       }
       const int v = vy*W + vx;
+      if (region_ && !region_[v]) {
+        continue;
+      }
       const double w = fabs(height[v] - height[u]);
 
       if ((dists[u] + w) < dists[v]) { // we found a shortest path to v
         dists[v] = dists[u] + w;
+        LIBSEG_STATS(++nrelaxed);
         // TODO: should UPDATE existing v (instead of duplicating)
-        Q.push(make_pair(v, dists[v]));
+        Push(v, dists[v]);
       }
     }
   }
+  LIBSEG_COUNT(geodesic_pops, npops);
+  LIBSEG_COUNT(geodesic_stale_pops, nstale);
+  LIBSEG_COUNT(geodesic_relaxations, nrelaxed);
+  // Each relaxation pushes the neighbor
+  LIBSEG_COUNT(geodesic_pushes, nrelaxed);
+  return done;
 }
-
@@ -43,5 +43,61 @@ TEST(GeodesicDistanceMap, Simple) {
   }
 }
 
+TEST(GeodesicPropagation, ResumeMatchesOneShot) {
+  const int W = 200;
+  const int H = 150;
+  vector<double> height(W*H);
+  for (int i = 0; i < W*H; ++i) {
+    height[i] = ((i * 7919) % 101) / 100.0;
+  }
+  const vector<Point2i> sources{Point2i(3, 4), Point2i(150, 100)};
+
+  vector<double> expected(W*H);
+  GeodesicDistanceMap(sources, height.data(), W, H, expected.data());
+
+  // A deadline in the past stops the propagation at each check
+  vector<double> dists(W*H);
+  GeodesicPropagation propagation(height.data(), W, H, dists.data());
+  propagation.Init(sources);
+  const auto past = chrono::steady_clock::now();
+  int nruns = 1;
+  while (!propagation.Run(NULL, past)) {
+    // Settled pixels already have their final distance
+    const double frontier = propagation.Frontier();
+    for (int i = 0; i < W*H; ++i) {
+      if (dists[i] <= frontier) {
+        ASSERT_EQ(expected[i], dists[i]) << "at " << i;
+      }
+    }
+    ++nruns;
+  }
+  EXPECT_GT(nruns, 1);
+  EXPECT_TRUE(propagation.Done());
+  EXPECT_EQ(expected, dists);
+}
+
+
+TEST(GeodesicPropagation, AddSourcesMatchesUnion) {
+  const int W = 120;
+  const int H = 80;
+  vector<double> height(W*H);
+  for (int i = 0; i < W*H; ++i) {
+    height[i] = ((i * 7919) % 101) / 100.0;
+  }
+  const vector<Point2i> first{Point2i(3, 4), Point2i(100, 70)};
+  const vector<Point2i> added{Point2i(60, 10), Point2i(3, 4)};
+  vector<Point2i> all(first);
+  all.insert(all.end(), added.begin(), added.end());
+
+  vector<double> expected(W*H);
+  GeodesicDistanceMap(all, height.data(), W, H, expected.data());
+
+  vector<double> dists(W*H);
+  GeodesicDistanceMap(first, height.data(), W, H, dists.data());
+  GeodesicPropagation propagation(height.data(), W, H, dists.data());
+  propagation.AddSources(added);
+  EXPECT_TRUE(propagation.Run());
+  EXPECT_EQ(expected, dists);
+}
 
 }
@@ -0,0 +1,110 @@
+#include "image.h"
+
+#include <string.h>
+#include <exception>
+
+#include <glog/logging.h>
+
+#include "pyramid.h"
+#include "trace.h"
+
+using namespace std;
+
+LabImage::LabImage(int W, int H) : W(W), H(H) {
+  CHECK_GT(W, 0);
+  CHECK_GT(H, 0);
+  channels_[0] = channels_[1] = channels_[2] = NULL;
+}
+
+shared_ptr<const LabImage> LabImage::Create(const uint8_t* l,
+                                            const uint8_t* a,
+                                            const uint8_t* b,
+                                            int W, int H) {
+  shared_ptr<LabImage> image(new LabImage(W, H));
+  const int N = W*H;
+  image->planes_.resize(3*N);
+  const uint8_t* in[3] = {l, a, b};
+  for (int c = 0; c < 3; ++c) {
+    memcpy(image->planes_.data() + c*N, in[c], N);
+    image->channels_[c] = image->planes_.data() + c*N;
+  }
+  return image;
+}
+
+shared_ptr<const LabImage> LabImage::Borrow(
+    const uint8_t* l, const uint8_t* a, const uint8_t* b, int W, int H,
+    const shared_ptr<const void>& storage) {
+  shared_ptr<LabImage> image(new LabImage(W, H));
+  image->storage_ = storage;
+  image->channels_[0] = l;
+  image->channels_[1] = a;
+  image->channels_[2] = b;
+  return image;
+}
+
+template<class Key, class T>
+shared_ptr<const T> LabImage::GetCached(
+    Cached<Key, T>* cache, const Key& key,
+    const function<shared_ptr<const T>()>& compute) const {
+  shared_future<shared_ptr<const T>> value;
+  promise<shared_ptr<const T>> computed;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (cache->value.valid() && cache->key == key) {
+      value = cache->value;
+    } else {
+      // The callers already waiting for the previous value still get it
+      cache->key = key;
+      cache->value = computed.get_future().share();
+    }
+  }
+  if (value.valid()) {
+    return value.get();
+  }
+  shared_ptr<const T> result;
+  try {
+    result = compute();
+  } catch (...) {
+    // The waiters get the exception, but the next caller tries again
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (cache->key == key) {
+        cache->value = shared_future<shared_ptr<const T>>();
+      }
+    }
+    computed.set_exception(current_exception());
+    throw;
+  }
+  computed.set_value(result);
+  return result;
+}
+
+shared_ptr<const LabImage> LabImage::Downsampled(int factor) const {
+  CHECK_GE(factor, 1);
+  return GetCached<int, LabImage>(&downsampled_, factor, [this, factor] {
+    LIBSEG_TRACE_SCOPE("LabImage::Downsampled");
+    const int Wl = DownsampledSize(W, factor);
+    const int Hl = DownsampledSize(H, factor);
+    shared_ptr<LabImage> image(new LabImage(Wl, Hl));
+    image->planes_.resize(3*Wl*Hl);
+    for (int c = 0; c < 3; ++c) {
+      uint8_t* out = image->planes_.data() + c*Wl*Hl;
+      DownsampleChannel(channels_[c], W, H, factor, out);
+      image->channels_[c] = out;
+    }
+    return shared_ptr<const LabImage>(image);
+  });
+}
+
+shared_ptr<const SuperpixelGraph> LabImage::Superpixels(
+    int region_size, double compactness) const {
+  CHECK_GT(region_size, 0);
+  return GetCached<pair<int, double>, SuperpixelGraph>(
+      &superpixels_, make_pair(region_size, compactness),
+      [this, region_size, compactness] {
+        LIBSEG_TRACE_SCOPE("LabImage::Superpixels");
+        shared_ptr<SuperpixelGraph> graph(new SuperpixelGraph);
+        ComputeSLIC(channels_, W, H, region_size, compactness, graph.get());
+        return shared_ptr<const SuperpixelGraph>(graph);
+      });
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "image.h"
+#include "pyramid.h"
+
+using namespace std;
+
+namespace {
+
+struct TestPlanes {
+  enum { W = 30, H = 20 };
+
+  TestPlanes() : l(W*H), a(W*H), b(W*H) {
+    for (int i = 0; i < W*H; ++i) {
+      l[i] = (uint8_t)(i % 251);
+      a[i] = (uint8_t)(128 + i % 7);
+      b[i] = (uint8_t)(100 + (i / W) % 13);
+    }
+  }
+
+  shared_ptr<const LabImage> Create() const {
+    return LabImage::Create(l.data(), a.data(), b.data(), W, H);
+  }
+
+  vector<uint8_t> l, a, b;
+};
+
+TEST(LabImage, CopiesPlanes) {
+  TestPlanes planes;
+  shared_ptr<const LabImage> image = planes.Create();
+  EXPECT_EQ(TestPlanes::W, image->GetWidth());
+  EXPECT_EQ(TestPlanes::H, image->GetHeight());
+  const int N = TestPlanes::W*TestPlanes::H;
+  planes.l[0] = 17;
+  EXPECT_EQ(vector<uint8_t>(planes.a.begin(), planes.a.end()),
+            vector<uint8_t>(image->Channels()[1], image->Channels()[1] + N));
+  EXPECT_EQ(0, image->Channels()[0][0]);
+}
+
+TEST(LabImage, BorrowKeepsStorageAlive) {
+  TestPlanes planes;
+  shared_ptr<TestPlanes> storage(new TestPlanes);
+  shared_ptr<const LabImage> image = LabImage::Borrow(
+      storage->l.data(), storage->a.data(), storage->b.data(),
+      TestPlanes::W, TestPlanes::H, storage);
+  EXPECT_EQ(storage->l.data(), image->Channels()[0]);
+  weak_ptr<TestPlanes> weak(storage);
+  storage.reset();
+  EXPECT_FALSE(weak.expired());
+  image.reset();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(LabImage, DerivedDataIsComputedOnce) {
+  TestPlanes planes;
+  shared_ptr<const LabImage> image = planes.Create();
+
+  shared_ptr<const LabImage> low = image->Downsampled(3);
+  EXPECT_EQ(low, image->Downsampled(3));
+  EXPECT_NE(low, image->Downsampled(2));
+  const int Wl = DownsampledSize(TestPlanes::W, 3);
+  const int Hl = DownsampledSize(TestPlanes::H, 3);
+  ASSERT_EQ(Wl, low->GetWidth());
+  ASSERT_EQ(Hl, low->GetHeight());
+  vector<uint8_t> expected(Wl*Hl);
+  DownsampleChannel(planes.b.data(), TestPlanes::W, TestPlanes::H, 3,
+                    expected.data());
+  EXPECT_EQ(expected, vector<uint8_t>(low->Channels()[2],
+                                      low->Channels()[2] + Wl*Hl));
+
+  shared_ptr<const SuperpixelGraph> graph = image->Superpixels(5, 10);
+  EXPECT_GT(graph->NumNodes(), 0);
+  EXPECT_EQ(graph, image->Superpixels(5, 10));
+  EXPECT_NE(graph, image->Superpixels(5, 20));
+
+  // Only the last parameters are cached
+  EXPECT_NE(low, image->Downsampled(3));
+  EXPECT_NE(graph, image->Superpixels(5, 10));
+}
+
+TEST(LabImage, ConcurrentRequestsShareTheResult) {
+  TestPlanes planes;
+  shared_ptr<const LabImage> image = planes.Create();
+  const int kThreads = 4;
+  vector<shared_ptr<const SuperpixelGraph>> graphs(kThreads);
+  vector<thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.push_back(thread([&, i] {
+      graphs[i] = image->Superpixels(4, 10);
+    }));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  for (int i = 1; i < kThreads; ++i) {
+    EXPECT_EQ(graphs[0], graphs[i]);
+  }
+}
+
+}
@@ -7,6 +7,9 @@
 
 #include <figtree.h>
 
+#include "stats.h"
+#include "trace.h"
+
 using namespace std;
 
 const double NORMAL_FACTOR = 1/(double)sqrt(2*M_PI);
@@ -106,12 +109,84 @@ T Median(vector<T>* v) {
 
 void MedianFilter(const vector<double>& v,
                   size_t hwsize, // half window size
-                  vector<double>* vfilt) {
+                  vector<double>* vfilt,
+                  vector<double>* window) {
+  vfilt->clear();
   for (size_t i = 0; i < v.size(); ++i) {
     const int wstart = max<int>(0, i - hwsize);
     const int wend = min<int>(v.size() - 1, i + hwsize);
-    vector<double> window(v.begin() + wstart, v.begin() + wend);
-    vfilt->push_back(Median<double>(&window));
+    window->assign(v.begin() + wstart, v.begin() + wend);
+    vfilt->push_back(Median<double>(window));
+  }
+}
+
+static void KDEFromSamples(const vector<double>& xis,
+                           bool median_filter,
+                           bool exact,
+                           vector<double>* target_prob);
+
+// Number of 8-bit values the probabilities are estimated for (see
+// ColorChannelKDE). ImageColorPDF indexes them by channel value, so this has
+// to cover 255 as well
+static const int kNumTargets = 256;
+
+// The gaussian kernel of ColorChannelKDE between an 8 bit target and an 8
+// bit sample only depends on their difference d (in [-255, 255]) because the
+// bandwidth is fixed, so it is tabulated once
+struct KernelTable {
+  KernelTable() {
+    const double h = EstimateBandwidth(0, 1);
+    for (int d = -255; d <= 255; ++d) {
+      values[d + 255] = GaussianKernel(d/128.0, 0, h);
+    }
+  }
+  double operator()(int d) const { return values[d + 255]; }
+  double values[511];
+};
+
+// Kernel density estimate of the 8-bit samples whose histogram is hist.
+// This is the same sum as UnivariateKDE, but there are at most 256 distinct
+// samples and the kernel is tabulated, so this is exact and cheaper than
+// the Gauss transform
+static void HistogramKDE(const double* hist,
+                         int nsamples,
+                         bool median_filter,
+                         vector<double>* target_prob,
+                         KDEScratch* scratch) {
+  LIBSEG_COUNT(kde_calls, 1);
+  LIBSEG_COUNT(kde_samples, nsamples);
+  static const KernelTable kernel;
+
+  target_prob->resize(kNumTargets);
+  if (nsamples == 0) {
+    // Uniform distribution, like FastUnivariateKDE
+    fill(target_prob->begin(), target_prob->end(), 1.0/kNumTargets);
+  } else {
+    int values[256];
+    int nvalues = 0;
+    for (int v = 0; v < 256; ++v) {
+      if (hist[v] > 0) {
+        values[nvalues++] = v;
+      }
+    }
+    const double w = 1/(double)nsamples;
+    for (int t = 0; t < kNumTargets; ++t) {
+      double prob = 0;
+      for (int k = 0; k < nvalues; ++k) {
+        prob += hist[values[k]] * kernel(t - values[k]);
+      }
+      (*target_prob)[t] = w * prob;
+    }
+  }
+
+  // TODO: Median filtering is useless (look at plot_densities)
+  if (median_filter) {
+    KDEScratch local;
+    if (scratch == NULL) {
+      scratch = &local;
+    }
+    MedianFilter(*target_prob, 5, &scratch->filtered, &scratch->window);
+    target_prob->swap(scratch->filtered);
   }
 }
 
@@ -120,7 +195,30 @@ void ColorChannelKDE(const uint8_t* data,
                      int W,
                      int H,
                      bool median_filter,
-                     std::vector<double>* target_prob) {
+                     std::vector<double>* target_prob,
+                     KDEScratch* scratch) {
+  LIBSEG_STAGE_TIMER(kde_ms);
+  LIBSEG_TRACE_SCOPE("ColorChannelKDE");
+  double hist[256] = {0};
+  int nsamples = 0;
+  for (int i = 0; i < W*H; ++i) {
+    if (mask[i]) {
+      hist[data[i]] += 1;
+      ++nsamples;
+    }
+  }
+
+  HistogramKDE(hist, nsamples, median_filter, target_prob, scratch);
+}
+
+void ExactColorChannelKDE(const uint8_t* data,
+                          const uint8_t* mask,
+                          int W,
+                          int H,
+                          bool median_filter,
+                          std::vector<double>* target_prob) {
+  LIBSEG_STAGE_TIMER(kde_ms);
+  LIBSEG_TRACE_SCOPE("ExactColorChannelKDE");
   vector<double> xis;
   for (int i = 0; i < W*H; ++i) {
     if (mask[i]) {
@@ -128,7 +226,7 @@ void ColorChannelKDE(const uint8_t* data,
     }
   }
 
-  ColorChannelKDE(xis, median_filter, target_prob);
+  KDEFromSamples(xis, median_filter, true, target_prob);
 }
 
 void ColorChannelKDE(const uint8_t* data,
@@ -137,21 +235,37 @@ void ColorChannelKDE(const uint8_t* data,
                      int W,
                      int H,
                      bool median_filter,
-                     std::vector<double>* target_prob) {
-  vector<double> xis;
+                     std::vector<double>* target_prob,
+                     KDEScratch* scratch) {
+  LIBSEG_STAGE_TIMER(kde_ms);
+  LIBSEG_TRACE_SCOPE("ColorChannelKDE");
+  double hist[256] = {0};
+  int nsamples = 0;
   for (const Scribble& s : scribbles) {
     if (s.background == background) {
       for (const Point2i& p : s.pixels) {
-        xis.push_back(data[W*p.y + p.x]);
+        hist[data[W*p.y + p.x]] += 1;
       }
+      nsamples += s.pixels.size();
     }
   }
-  ColorChannelKDE(xis, median_filter, target_prob);
+  HistogramKDE(hist, nsamples, median_filter, target_prob, scratch);
 }
 
 void ColorChannelKDE(const std::vector<double>& xis,
                      bool median_filter,
                      std::vector<double>* target_prob) {
+  LIBSEG_STAGE_TIMER(kde_ms);
+  LIBSEG_TRACE_SCOPE("ColorChannelKDE");
+  KDEFromSamples(xis, median_filter, false, target_prob);
+}
+
+static void KDEFromSamples(const vector<double>& xis,
+                           bool median_filter,
+                           bool exact,
+                           vector<double>* target_prob) {
+  LIBSEG_COUNT(kde_calls, 1);
+  LIBSEG_COUNT(kde_samples, xis.size());
   vector<double> weights(xis.size(), 1/(double)xis.size());
   vector<double> targets;
   //for (int i = 0; i < 255; ++i) {
@@ -165,16 +279,43 @@ void ColorChannelKDE(const std::vector<double>& xis,
   for (size_t i = 0; i < xis.size(); ++i) {
     nx[i] = (xis[i] - 128) / 128.0;
   }
-  for (int i = 0; i < 255; ++i) {
+  for (int i = 0; i < kNumTargets; ++i) {
     targets.push_back((i - 128)/128.0);
   }
-  //UnivariateKDE(nx, weights, targets, target_prob);
-  FastUnivariateKDE(nx, weights, targets, target_prob);
+  if (exact && !xis.empty()) {
+    target_prob->clear();
+    UnivariateKDE(nx, weights, targets, target_prob);
+  } else {
+    // This also handles the no sample case (uniform distribution)
+    FastUnivariateKDE(nx, weights, targets, target_prob);
+  }
 
   // TODO: Median filtering is useless (look at plot_densities)
   if (median_filter) {
-    vector<double> medfilt;
-    MedianFilter(*target_prob, 5, &medfilt);
+    vector<double> medfilt, window;
+    MedianFilter(*target_prob, 5, &medfilt, &window);
     *target_prob = medfilt;
   }
 }
+
+bool ColorChannelsKDE(const uint8_t* const* channels,
+                      const vector<Scribble>& scribbles,
+                      bool background,
+                      int W,
+                      int H,
+                      bool median_filter,
+                      vector<vector<double>>* probs,
+                      const CancelFlag* cancel,
+                      KDEScratch* scratch) {
+  probs->resize(3);
+  for (int i = 0; i < 3; ++i) {
+    // Each channel is a full KDE, so this is a natural checkpoint
+    if (IsCancelled(cancel)) {
+      return false;
+    }
+    (*probs)[i].clear();
+    ColorChannelKDE(channels[i], scribbles, background, W, H, median_filter,
+                    &(*probs)[i], scratch);
+  }
+  return !IsCancelled(cancel);
+}
@@ -37,4 +37,35 @@ TEST(FastUnivariateKDE, FastSlow) {
   }
 }
 
+TEST(ExactColorChannelKDE, MatchesColorChannelKDE) {
+  const int W = 16, H = 4;
+  vector<uint8_t> data(W*H), mask(W*H, 0);
+  for (int i = 0; i < W*H; ++i) {
+    data[i] = (uint8_t)(60 + 7*i);
+    mask[i] = (i % 3 == 0) ? 255 : 0;
+  }
+
+  vector<double> exact_prob, fast_prob;
+  ExactColorChannelKDE(data.data(), mask.data(), W, H, true, &exact_prob);
+  ColorChannelKDE(data.data(), mask.data(), W, H, true, &fast_prob);
+
+  ASSERT_EQ(exact_prob.size(), fast_prob.size());
+  for (size_t i = 0; i < exact_prob.size(); ++i) {
+    ASSERT_THAT(exact_prob[i], DoubleNear(fast_prob[i], 1e-2))
+      << "At index " << i;
+  }
+}
+
+
+TEST(ColorChannelKDE, CoversAllValues) {
+  // Samples at the top of the range
+  const int W = 4, H = 2;
+  vector<uint8_t> data(W*H, 255), mask(W*H, 255);
+  vector<double> prob;
+  ColorChannelKDE(data.data(), mask.data(), W, H, false, &prob);
+  ASSERT_EQ(256u, prob.size());
+  EXPECT_GT(prob[255], prob[254]);
+  EXPECT_GT(prob[255], prob[0]);
+}
+
 }
@@ -8,6 +8,8 @@
 
 #include "kde.h"
 #include "geodesic.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -43,6 +45,8 @@ void ImageColorPDF(uint8_t const* const* channels,
                    int W,
                    int H,
                    double* outimg) {
+  LIBSEG_STAGE_TIMER(pdf_ms);
+  LIBSEG_TRACE_SCOPE("ImageColorPDF");
   double prob_max = numeric_limits<double>::min();
   for (int i = 0; i < W*H; ++i) {
     // The probabilities at a given value are very low (< 0.030), which is
@@ -64,6 +68,8 @@ void ForegroundLikelihood(const double* P_cx_F,
                           int W,
                           int H,
                           double* likelihood) {
+  LIBSEG_STAGE_TIMER(likelihood_ms);
+  LIBSEG_TRACE_SCOPE("ForegroundLikelihood");
   for (int i = 0; i < W*H; ++i) {
     // Avoid division by zero
     if (P_cx_F[i] == 0 && P_cx_B[i] == 0) {
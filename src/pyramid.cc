@@ -0,0 +1,133 @@
+#include "pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <unordered_set>
+
+using namespace std;
+
+void DownsampleChannel(const uint8_t* in, int W, int H, int factor,
+                       uint8_t* out) {
+  const int Wl = DownsampledSize(W, factor);
+  const int Hl = DownsampledSize(H, factor);
+  vector<int> sums(Wl), counts(Wl);
+  for (int yl = 0; yl < Hl; ++yl) {
+    fill(sums.begin(), sums.end(), 0);
+    fill(counts.begin(), counts.end(), 0);
+    for (int y = yl*factor; y < min(H, (yl + 1)*factor); ++y) {
+      for (int x = 0; x < W; ++x) {
+        sums[x/factor] += in[y*W + x];
+        ++counts[x/factor];
+      }
+    }
+    for (int xl = 0; xl < Wl; ++xl) {
+      out[yl*Wl + xl] = (sums[xl] + counts[xl]/2) / counts[xl];
+    }
+  }
+}
+
+void DownsampleMask(const uint8_t* in, int W, int H, int factor,
+                    uint8_t* out) {
+  const int Wl = DownsampledSize(W, factor);
+  const int Hl = DownsampledSize(H, factor);
+  memset(out, 0, Wl*Hl);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      if (in[y*W + x]) {
+        out[(y/factor)*Wl + x/factor] = 255;
+      }
+    }
+  }
+}
+
+void DownsampleScribble(const Scribble& in, int factor, Scribble* out) {
+  out->background = in.background;
+  out->pixels.clear();
+  unordered_set<long long> seen;
+  for (const Point2i& p : in.pixels) {
+    const Point2i q(p.x/factor, p.y/factor);
+    if (seen.insert(((long long)q.y << 32) | (uint32_t)q.x).second) {
+      out->pixels.push_back(q);
+    }
+  }
+}
+
+void UpsampleNearest(const double* in, int Wl, int Hl, int W, int H,
+                     int factor, double* out) {
+  for (int y = 0; y < H; ++y) {
+    const double* row = in + (y/factor)*Wl;
+    for (int x = 0; x < W; ++x) {
+      out[y*W + x] = row[x/factor];
+    }
+  }
+}
+
+void JointBilateralUpsampleMask(const uint8_t* low_mask,
+                                const uint8_t* const* low_channels,
+                                int Wl, int Hl,
+                                const uint8_t* const* channels,
+                                int W, int H, int factor,
+                                double sigma_color,
+                                uint8_t* mask,
+                                uint8_t* band) {
+  // Color weights only depend on the squared color distance, so tabulate
+  // them (3 channels of at most 255 each)
+  vector<double> color_weight(3*255*255 + 1);
+  for (size_t d2 = 0; d2 < color_weight.size(); ++d2) {
+    color_weight[d2] = exp(-(double)d2 / (2*sigma_color*sigma_color));
+  }
+  // Spatial sigma of one low resolution pixel
+  const double sigma_space = factor;
+  // The spatial weight is separable, and along each axis it only depends on
+  // the position of the pixel in its low resolution pixel and on the offset
+  // (-1, 0 or 1) of the tap, so tabulate it too
+  vector<double> space_weight(3*factor);
+  for (int p = 0; p < factor; ++p) {
+    // Position in the low resolution image, relative to the pixel p is in
+    const double f = (p + 0.5)/factor - 0.5;
+    for (int d = -1; d <= 1; ++d) {
+      const double s = (d - f)*factor;
+      space_weight[3*p + d + 1] = exp(-s*s / (2*sigma_space*sigma_space));
+    }
+  }
+
+  for (int y = 0; y < H; ++y) {
+    const int yl = y/factor;
+    const double* wy = &space_weight[3*(y - yl*factor) + 1];
+    for (int x = 0; x < W; ++x) {
+      const int i = y*W + x;
+      const int xl = x/factor;
+      const double* wx = &space_weight[3*(x - xl*factor) + 1];
+      double wsum = 0, fgsum = 0;
+      bool has_fg = false, has_bg = false;
+      for (int ny = max(0, yl - 1); ny <= min(Hl - 1, yl + 1); ++ny) {
+        for (int nx = max(0, xl - 1); nx <= min(Wl - 1, xl + 1); ++nx) {
+          const int j = ny*Wl + nx;
+          const bool fg = low_mask[j] != 0;
+          has_fg = has_fg || fg;
+          has_bg = has_bg || !fg;
+          int d2 = 0;
+          for (int c = 0; c < 3; ++c) {
+            const int d = (int)channels[c][i] - (int)low_channels[c][j];
+            d2 += d*d;
+          }
+          const double w = wx[nx - xl]*wy[ny - yl]*color_weight[d2];
+          wsum += w;
+          if (fg) {
+            fgsum += w;
+          }
+        }
+      }
+      band[i] = (has_fg && has_bg) ? 1 : 0;
+      if (!band[i]) {
+        mask[i] = has_fg ? 255 : 0;
+      } else if (wsum > 0) {
+        mask[i] = (fgsum > 0.5*wsum) ? 255 : 0;
+      } else {
+        // All colors are too far, fall back to nearest neighbor
+        mask[i] = low_mask[yl*Wl + xl];
+      }
+    }
+  }
+}
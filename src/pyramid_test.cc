@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+
+#include "pyramid.h"
+
+using namespace std;
+
+namespace {
+
+TEST(Pyramid, DownsampleChannel) {
+  // 5x3 downsampled by 2 is 3x2, the last row and column are partial
+  const int W = 5, H = 3;
+  const uint8_t in[W*H] = {0, 2, 10, 10, 7,
+                           2, 4, 20, 20, 9,
+                           100, 100, 50, 50, 1};
+  uint8_t out[3*2];
+  DownsampleChannel(in, W, H, 2, out);
+  EXPECT_EQ(2, out[0]);
+  EXPECT_EQ(15, out[1]);
+  EXPECT_EQ(8, out[2]);
+  EXPECT_EQ(100, out[3]);
+  EXPECT_EQ(50, out[4]);
+  EXPECT_EQ(1, out[5]);
+}
+
+TEST(Pyramid, DownsampleScribbleRemovesDuplicates) {
+  Scribble s;
+  s.background = true;
+  for (int x = 0; x < 8; ++x) {
+    s.pixels.push_back(Point2i(x, 5));
+  }
+  Scribble low;
+  DownsampleScribble(s, 4, &low);
+  EXPECT_TRUE(low.background);
+  ASSERT_EQ(2u, low.pixels.size());
+  EXPECT_EQ(0, low.pixels[0].x);
+  EXPECT_EQ(1, low.pixels[1].x);
+  EXPECT_EQ(1, low.pixels[1].y);
+}
+
+TEST(Pyramid, JointBilateralUpsampleFollowsEdges) {
+  // An image with an edge at x = 7, which is in the middle of a downsampled
+  // pixel. The low res mask is foreground up to that pixel included.
+  const int W = 16, H = 4, factor = 4;
+  const int Wl = 4, Hl = 1;
+  vector<uint8_t> l(W*H), ab(W*H, 128);
+  for (int i = 0; i < W*H; ++i) {
+    l[i] = (i % W < 7) ? 30 : 220;
+  }
+  const uint8_t* channels[3] = {l.data(), ab.data(), ab.data()};
+  vector<uint8_t> low_l(Wl*Hl), low_ab(Wl*Hl);
+  DownsampleChannel(l.data(), W, H, factor, low_l.data());
+  DownsampleChannel(ab.data(), W, H, factor, low_ab.data());
+  const uint8_t* low_channels[3] = {low_l.data(), low_ab.data(),
+                                    low_ab.data()};
+  const uint8_t low_mask[Wl*Hl] = {255, 255, 0, 0};
+
+  vector<uint8_t> mask(W*H), band(W*H);
+  JointBilateralUpsampleMask(low_mask, low_channels, Wl, Hl, channels,
+                             W, H, factor, 10, mask.data(), band.data());
+  for (int x = 0; x < W; ++x) {
+    EXPECT_EQ((x < 7) ? 255 : 0, mask[x]) << "at " << x;
+  }
+  // Only the pixels near the boundary are uncertain
+  EXPECT_EQ(0, band[0]);
+  EXPECT_EQ(1, band[7]);
+  EXPECT_EQ(0, band[15]);
+}
+
+}
@@ -0,0 +1,460 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "encoding.h"
+
+using namespace std;
+
+static const char kRecordingMagic[8] = {'L', 'S', 'E', 'G', 'R', 'E', 'C',
+                                        'D'};
+static const uint32_t kRecordingVersion = 1;
+static const uint32_t kRecordingByteOrder = 0x01020304;
+
+namespace {
+
+class Writer {
+ public:
+  explicit Writer(vector<uint8_t>* bytes) : bytes_(bytes) {}
+
+  template<class T>
+  void Put(const T& value) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&value);
+    bytes_->insert(bytes_->end(), p, p + sizeof(T));
+  }
+
+  // LEB128 : 7 bits per byte, least significant first, the high bit set on
+  // all the bytes but the last
+  void PutVarint(uint64_t v) {
+    while (v >= 0x80) {
+      bytes_->push_back((uint8_t)(v | 0x80));
+      v >>= 7;
+    }
+    bytes_->push_back((uint8_t)v);
+  }
+
+  // Zigzag encoding, so that small negative values are short too
+  void PutSigned(int64_t v) {
+    PutVarint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+  }
+
+ private:
+  vector<uint8_t>* bytes_;
+};
+
+// The getters return false once the bytes are exhausted or invalid
+class Reader {
+ public:
+  Reader(const uint8_t* bytes, size_t size) : p_(bytes), end_(bytes + size) {}
+
+  template<class T>
+  bool Get(T* value) {
+    if ((size_t)(end_ - p_) < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+
+  bool GetVarint(uint64_t* value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) {
+        return false;
+      }
+      const uint8_t byte = *p_++;
+      v |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        *value = v;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool GetSigned(int64_t* value) {
+    uint64_t v;
+    if (!GetVarint(&v)) {
+      return false;
+    }
+    *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return true;
+  }
+
+  // A count of items taking at least min_bytes each
+  bool GetCount(size_t min_bytes, size_t* count) {
+    uint64_t n;
+    if (!GetVarint(&n) || n > (uint64_t)(end_ - p_) / min_bytes) {
+      return false;
+    }
+    *count = n;
+    return true;
+  }
+
+  bool GetString(string* s) {
+    size_t n;
+    if (!GetCount(1, &n)) {
+      return false;
+    }
+    s->assign(reinterpret_cast<const char*>(p_), n);
+    p_ += n;
+    return true;
+  }
+
+  bool AtEnd() const { return p_ == end_; }
+
+ private:
+  const uint8_t* p_;
+  const uint8_t* end_;
+};
+
+bool HasScribbles(RecordedEvent::Op op) {
+  return op == RecordedEvent::kScribbles;
+}
+
+bool HasArg(RecordedEvent::Op op) {
+  return op == RecordedEvent::kRemoveScribble
+      || op == RecordedEvent::kSetMaxUndoLevels;
+}
+
+bool GetScribble(int W, int H, Reader* in, Scribble* s) {
+  uint8_t background;
+  size_t npixels;
+  // Each pixel takes at least one byte per coordinate
+  if (!in->Get(&background) || background > 1 || !in->GetCount(2, &npixels)) {
+    return false;
+  }
+  s->background = background;
+  s->pixels.reserve(npixels);
+  int64_t x = 0, y = 0;
+  for (size_t i = 0; i < npixels; ++i) {
+    int64_t dx, dy;
+    if (!in->GetSigned(&dx) || !in->GetSigned(&dy)) {
+      return false;
+    }
+    x += dx;
+    y += dy;
+    if (x < 0 || x >= W || y < 0 || y >= H) {
+      return false;
+    }
+    s->pixels.push_back(Point2i(x, y));
+  }
+  return true;
+}
+
+// Same checks as DecodeMaskRLE, without allocating the mask
+bool IsValidMaskRLE(const vector<uint32_t>& runs, int W, int H) {
+  size_t r = 0;
+  for (int y = 0; y < H; ++y) {
+    int x = 0;
+    do {
+      if (r >= runs.size() || runs[r] > (uint32_t)(W - x)) {
+        return false;
+      }
+      x += runs[r++];
+    } while (x < W);
+  }
+  return r == runs.size();
+}
+
+}
+
+uint64_t ImageChecksum(const LabImage& image) {
+  const size_t N = (size_t)image.GetWidth()*image.GetHeight();
+  uint64_t hash = 14695981039346656037ULL;
+  for (int c = 0; c < 3; ++c) {
+    const uint8_t* plane = image.Channels()[c];
+    for (size_t i = 0; i < N; ++i) {
+      hash = (hash ^ plane[i]) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+void EncodeRecording(const SessionRecording& recording,
+                     vector<uint8_t>* bytes) {
+  bytes->assign(kRecordingMagic, kRecordingMagic + sizeof(kRecordingMagic));
+  Writer out(bytes);
+  out.Put(kRecordingVersion);
+  out.Put(kRecordingByteOrder);
+
+  out.PutVarint(recording.image.size());
+  bytes->insert(bytes->end(), recording.image.begin(), recording.image.end());
+  out.Put<int32_t>(recording.W);
+  out.Put<int32_t>(recording.H);
+  out.Put(recording.image_checksum);
+  out.Put<int32_t>(recording.preview_factor);
+  out.Put<int32_t>(recording.superpixel_size);
+  out.Put(recording.superpixel_compactness);
+  out.Put<int32_t>(recording.max_undo_levels);
+  out.Put(recording.scribble_cache_size);
+
+  out.PutVarint(recording.events.size());
+  for (const RecordedEvent& event : recording.events) {
+    out.Put<uint8_t>(event.op);
+    out.Put(event.ms);
+    if (HasArg(event.op)) {
+      out.PutVarint(event.arg);
+    }
+    if (HasScribbles(event.op)) {
+      out.PutVarint(event.scribbles.size());
+      for (const Scribble& s : event.scribbles) {
+        out.Put<uint8_t>(s.background);
+        out.PutVarint(s.pixels.size());
+        int x = 0, y = 0;
+        for (const Point2i& p : s.pixels) {
+          out.PutSigned(p.x - x);
+          out.PutSigned(p.y - y);
+          x = p.x;
+          y = p.y;
+        }
+      }
+    }
+  }
+
+  out.PutVarint(recording.final_mask.size());
+  for (uint32_t run : recording.final_mask) {
+    out.PutVarint(run);
+  }
+}
+
+bool DecodeRecording(const uint8_t* bytes, size_t size,
+                     SessionRecording* recording) {
+  if (size < sizeof(kRecordingMagic)
+      || memcmp(bytes, kRecordingMagic, sizeof(kRecordingMagic)) != 0) {
+    return false;
+  }
+  Reader in(bytes + sizeof(kRecordingMagic), size - sizeof(kRecordingMagic));
+  uint32_t version, byte_order;
+  if (!in.Get(&version) || !in.Get(&byte_order)
+      || version != kRecordingVersion || byte_order != kRecordingByteOrder) {
+    return false;
+  }
+
+  SessionRecording decoded;
+  int32_t W, H, preview_factor, superpixel_size, max_undo_levels;
+  if (!in.GetString(&decoded.image) || !in.Get(&W) || !in.Get(&H)
+      || !in.Get(&decoded.image_checksum) || !in.Get(&preview_factor)
+      || !in.Get(&superpixel_size)
+      || !in.Get(&decoded.superpixel_compactness)
+      || !in.Get(&max_undo_levels) || !in.Get(&decoded.scribble_cache_size)
+      || W <= 0 || H <= 0 || preview_factor < 1 || superpixel_size < 0
+      || max_undo_levels < 0 || preview_factor > max(W, H)
+      || (preview_factor > 1 && superpixel_size > 0)) {
+    return false;
+  }
+  decoded.W = W;
+  decoded.H = H;
+  decoded.preview_factor = preview_factor;
+  decoded.superpixel_size = superpixel_size;
+  decoded.max_undo_levels = max_undo_levels;
+
+  size_t nevents;
+  // An event takes at least its op and time
+  if (!in.GetCount(1 + sizeof(double), &nevents)) {
+    return false;
+  }
+  decoded.events.resize(nevents);
+  for (RecordedEvent& event : decoded.events) {
+    uint8_t op;
+    if (!in.Get(&op) || op < RecordedEvent::kScribbles
+        || op > RecordedEvent::kSetMaxUndoLevels || !in.Get(&event.ms)) {
+      return false;
+    }
+    event.op = static_cast<RecordedEvent::Op>(op);
+    if (HasArg(event.op)) {
+      uint64_t arg;
+      if (!in.GetVarint(&arg) || arg > 0x7fffffff) {
+        return false;
+      }
+      event.arg = arg;
+    }
+    if (HasScribbles(event.op)) {
+      size_t nscribbles;
+      if (!in.GetCount(2, &nscribbles)) {
+        return false;
+      }
+      event.scribbles.resize(nscribbles);
+      for (Scribble& s : event.scribbles) {
+        if (!GetScribble(W, H, &in, &s)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  size_t nruns;
+  if (!in.GetCount(1, &nruns)) {
+    return false;
+  }
+  decoded.final_mask.resize(nruns);
+  for (uint32_t& run : decoded.final_mask) {
+    uint64_t v;
+    if (!in.GetVarint(&v) || v > (uint64_t)W) {
+      return false;
+    }
+    run = v;
+  }
+  if (!in.AtEnd() || !IsValidMaskRLE(decoded.final_mask, W, H)) {
+    return false;
+  }
+  *recording = std::move(decoded);
+  return true;
+}
+
+bool SaveRecording(const SessionRecording& recording, const string& path) {
+  vector<uint8_t> bytes;
+  EncodeRecording(recording, &bytes);
+  ofstream out(path.c_str(), ios::binary);
+  out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  if (!out) {
+    LOG(ERROR) << "Failed to write " << path;
+    return false;
+  }
+  return true;
+}
+
+bool LoadRecording(const string& path, SessionRecording* recording) {
+  ifstream in(path.c_str(), ios::binary);
+  const vector<uint8_t> bytes((istreambuf_iterator<char>(in)),
+                              istreambuf_iterator<char>());
+  if (!DecodeRecording(bytes.data(), bytes.size(), recording)) {
+    LOG(ERROR) << path << " is not a valid recording";
+    return false;
+  }
+  return true;
+}
+
+unique_ptr<InteractiveMatter> NewReplayMatter(
+    const SessionRecording& recording,
+    const shared_ptr<const LabImage>& image,
+    string* error) {
+  if (image->GetWidth() != recording.W || image->GetHeight() != recording.H) {
+    *error = "The image is " + to_string(image->GetWidth()) + "x"
+        + to_string(image->GetHeight()) + ", the recording is "
+        + to_string(recording.W) + "x" + to_string(recording.H);
+    return nullptr;
+  }
+  if (ImageChecksum(*image) != recording.image_checksum) {
+    *error = "The image is not the recorded one";
+    return nullptr;
+  }
+  unique_ptr<InteractiveMatter> matter(new InteractiveMatter(image));
+  if (recording.preview_factor > 1) {
+    matter->SetPreviewFactor(recording.preview_factor);
+  }
+  if (recording.superpixel_size > 0) {
+    matter->SetSuperpixelSize(recording.superpixel_size,
+                              recording.superpixel_compactness);
+  }
+  if (recording.scribble_cache_size > 0) {
+    matter->SetScribbleCacheSize(recording.scribble_cache_size);
+  }
+  if (recording.max_undo_levels > 0) {
+    matter->SetMaxUndoLevels(recording.max_undo_levels);
+  }
+  return matter;
+}
+
+void ReplayRecording(const SessionRecording& recording,
+                     InteractiveMatter* matter,
+                     vector<double>* event_ms) {
+  if (event_ms) {
+    event_ms->clear();
+  }
+  for (const RecordedEvent& event : recording.events) {
+    const auto start = chrono::steady_clock::now();
+    switch (event.op) {
+      case RecordedEvent::kScribbles:
+        matter->AddScribbles(event.scribbles);
+        break;
+      case RecordedEvent::kUndo:
+        matter->Undo();
+        break;
+      case RecordedEvent::kRedo:
+        matter->Redo();
+        break;
+      case RecordedEvent::kRemoveScribble:
+        matter->RemoveScribble(event.arg);
+        break;
+      case RecordedEvent::kSetMaxUndoLevels:
+        matter->SetMaxUndoLevels(event.arg);
+        break;
+    }
+    if (event_ms) {
+      event_ms->push_back(chrono::duration<double, milli>(
+          chrono::steady_clock::now() - start).count());
+    }
+  }
+}
+
+InteractiveMatter::RecordScope::RecordScope(InteractiveMatter* matter,
+                                            RecordedEvent::Op op,
+                                            uint32_t arg)
+  : matter_(matter),
+    outermost_(matter->record_depth_++ == 0),
+    runs_ms_(matter->record_runs_ms_) {
+  if (outermost_ && matter_->recording_) {
+    event_.op = op;
+    event_.arg = arg;
+    start_ = chrono::steady_clock::now();
+  }
+}
+
+InteractiveMatter::RecordScope::~RecordScope() {
+  --matter_->record_depth_;
+  if (!outermost_ || !matter_->recording_
+      || (HasScribbles(event_.op) && event_.scribbles.empty())) {
+    return;
+  }
+  // The queued runs processed within the call are events of their own
+  event_.ms = chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start_).count()
+      - (matter_->record_runs_ms_ - runs_ms_);
+  matter_->recording_->events.push_back(event_);
+}
+
+void InteractiveMatter::RecordScope::SetScribbles(const Scribble* ss,
+                                                  size_t n) {
+  if (outermost_ && matter_->recording_) {
+    event_.scribbles.assign(ss, ss + n);
+  }
+}
+
+void InteractiveMatter::StartRecording(const string& image) {
+  WaitReady();
+  CHECK(scribbles.empty() && !HasPendingUpdate())
+    << "Recording must start before the first scribble";
+  recording_.reset(new SessionRecording);
+  recording_->image = image;
+  recording_->W = W;
+  recording_->H = H;
+  recording_->image_checksum = ImageChecksum(*image_);
+  recording_->preview_factor = preview_factor_;
+  recording_->superpixel_size = superpixel_size_;
+  recording_->superpixel_compactness = superpixel_compactness_;
+  recording_->max_undo_levels = max_undo_levels_;
+  recording_->scribble_cache_size = preview_ ? Preview()->cache_max_bytes_
+                                             : cache_max_bytes_;
+}
+
+bool InteractiveMatter::StopRecording(SessionRecording* recording) {
+  if (!recording_) {
+    return false;
+  }
+  {
+    UpdateScope update(this);
+    ProcessPending(chrono::steady_clock::time_point::max());
+  }
+  EncodeMaskRLE(final_mask.get(), W, H, &recording_->final_mask);
+  *recording = std::move(*recording_);
+  recording_.reset();
+  return true;
+}
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "api.h"
+#include "encoding.h"
+#include "recording.h"
+#include "test_images.h"
+
+using namespace std;
+
+namespace {
+
+// The two halves image with a darker square in the bright half
+class RecordingTest : public TwoHalvesTest {
+ protected:
+  RecordingTest() {
+    for (int y = 10; y < 16; ++y) {
+      for (int x = 28; x < 34; ++x) {
+        l[y*W + x] = 150;
+      }
+    }
+    image = LabImage::Create(l.data(), a.data(), b.data(), W, H);
+  }
+
+  // A session that goes through all the recorded calls
+  void Record(InteractiveMatter* matter, SessionRecording* recording) {
+    matter->StartRecording("two_halves.ppm");
+    EXPECT_TRUE(matter->IsRecording());
+    matter->AddScribble(Line(5, false));
+    Stroke stroke;
+    stroke.background = true;
+    stroke.radius = 1;
+    stroke.points.push_back(Point2i(W - 5, 2));
+    stroke.points.push_back(Point2i(W - 5, H - 3));
+    matter->AddStroke(stroke);
+    matter->AddScribbles({Line(30, false), Line(31, false), Line(25, true)});
+    // Time-bounded scribbles. The first one starts being processed right
+    // away, so they are processed as two runs
+    matter->AddScribble(Line(10, false), 0);
+    matter->AddScribble(Line(12, false), 0);
+    matter->ContinueUpdate(0);
+    matter->Undo();
+    matter->Redo();
+    matter->Undo();
+    matter->RemoveScribble(2);
+    matter->SetMaxUndoLevels(2);
+    matter->AddScribble(Line(35, true));
+    ASSERT_TRUE(matter->StopRecording(recording));
+    EXPECT_FALSE(matter->IsRecording());
+  }
+
+  shared_ptr<const LabImage> image;
+};
+
+TEST_F(RecordingTest, RecordsEvents) {
+  InteractiveMatter matter(image);
+  matter.SetMaxUndoLevels(5);
+  SessionRecording recording;
+  EXPECT_FALSE(matter.StopRecording(&recording));
+  Record(&matter, &recording);
+
+  EXPECT_EQ("two_halves.ppm", recording.image);
+  EXPECT_EQ(W, recording.W);
+  EXPECT_EQ(H, recording.H);
+  EXPECT_EQ(ImageChecksum(*image), recording.image_checksum);
+  EXPECT_EQ(5, recording.max_undo_levels);
+
+  // The stroke is recorded once, as its rasterized scribble, and the
+  // time-bounded scribbles as the runs they were processed in
+  const RecordedEvent::Op ops[] = {
+    RecordedEvent::kScribbles, RecordedEvent::kScribbles,
+    RecordedEvent::kScribbles, RecordedEvent::kScribbles,
+    RecordedEvent::kScribbles,
+    RecordedEvent::kUndo, RecordedEvent::kRedo, RecordedEvent::kUndo,
+    RecordedEvent::kRemoveScribble, RecordedEvent::kSetMaxUndoLevels,
+    RecordedEvent::kScribbles,
+  };
+  ASSERT_EQ(sizeof(ops)/sizeof(ops[0]), recording.events.size());
+  for (size_t i = 0; i < recording.events.size(); ++i) {
+    EXPECT_EQ(ops[i], recording.events[i].op) << "event " << i;
+    EXPECT_GE(recording.events[i].ms, 0);
+  }
+  EXPECT_EQ(1u, recording.events[1].scribbles.size());
+  EXPECT_TRUE(recording.events[1].scribbles[0].background);
+  EXPECT_EQ(3u, recording.events[2].scribbles.size());
+  EXPECT_EQ(1u, recording.events[3].scribbles.size());
+  EXPECT_EQ(1u, recording.events[4].scribbles.size());
+  EXPECT_EQ(2u, recording.events[8].arg);
+  EXPECT_EQ(2u, recording.events[9].arg);
+
+  vector<uint32_t> runs;
+  EncodeMaskRLE(matter.ForegroundMaskView(), W, H, &runs);
+  EXPECT_EQ(runs, recording.final_mask);
+
+  // Nothing is recorded after StopRecording
+  matter.AddScribble(Line(2, false));
+  EXPECT_FALSE(matter.StopRecording(&recording));
+}
+
+TEST_F(RecordingTest, EncodeDecode) {
+  InteractiveMatter matter(image);
+  SessionRecording recording;
+  Record(&matter, &recording);
+  vector<uint8_t> bytes;
+  EncodeRecording(recording, &bytes);
+
+  SessionRecording decoded;
+  ASSERT_TRUE(DecodeRecording(bytes.data(), bytes.size(), &decoded));
+  vector<uint8_t> reencoded;
+  EncodeRecording(decoded, &reencoded);
+  EXPECT_EQ(bytes, reencoded);
+  ASSERT_EQ(recording.events.size(), decoded.events.size());
+  for (size_t i = 0; i < recording.events.size(); ++i) {
+    const RecordedEvent& event = decoded.events[i];
+    EXPECT_EQ(recording.events[i].ms, event.ms);
+    ASSERT_EQ(recording.events[i].scribbles.size(), event.scribbles.size());
+    for (size_t j = 0; j < event.scribbles.size(); ++j) {
+      const Scribble& s = recording.events[i].scribbles[j];
+      EXPECT_EQ(s.background, event.scribbles[j].background);
+      ASSERT_EQ(s.pixels.size(), event.scribbles[j].pixels.size());
+      for (size_t k = 0; k < s.pixels.size(); ++k) {
+        EXPECT_EQ(s.pixels[k].x, event.scribbles[j].pixels[k].x);
+        EXPECT_EQ(s.pixels[k].y, event.scribbles[j].pixels[k].y);
+      }
+    }
+  }
+  // About 2 bytes per pixel for the lines
+  EXPECT_LT(bytes.size(), 1000u);
+
+  // Truncated, wrong magic, wrong version
+  SessionRecording untouched;
+  EXPECT_FALSE(DecodeRecording(bytes.data(), bytes.size() - 1, &untouched));
+  vector<uint8_t> corrupted(bytes);
+  corrupted[0] = 'X';
+  EXPECT_FALSE(DecodeRecording(corrupted.data(), corrupted.size(),
+                               &untouched));
+  corrupted = bytes;
+  corrupted[8] += 1;
+  EXPECT_FALSE(DecodeRecording(corrupted.data(), corrupted.size(),
+                               &untouched));
+  EXPECT_TRUE(untouched.events.empty());
+
+  // Modes a matter can't have
+  SessionRecording modes(recording);
+  modes.preview_factor = 2;
+  modes.superpixel_size = 4;
+  EncodeRecording(modes, &corrupted);
+  EXPECT_FALSE(DecodeRecording(corrupted.data(), corrupted.size(),
+                               &untouched));
+  modes.superpixel_size = 0;
+  modes.preview_factor = W + 1;
+  EncodeRecording(modes, &corrupted);
+  EXPECT_FALSE(DecodeRecording(corrupted.data(), corrupted.size(),
+                               &untouched));
+  modes.preview_factor = W;
+  EncodeRecording(modes, &corrupted);
+  EXPECT_TRUE(DecodeRecording(corrupted.data(), corrupted.size(),
+                              &untouched));
+}
+
+TEST_F(RecordingTest, ReplayReproducesMask) {
+  InteractiveMatter matter(image);
+  matter.SetMaxUndoLevels(5);
+  matter.SetScribbleCacheSize(1 << 20);
+  SessionRecording recording;
+  Record(&matter, &recording);
+
+  char path[] = "/tmp/libseg_recording_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  ASSERT_TRUE(SaveRecording(recording, path));
+  SessionRecording loaded;
+  ASSERT_TRUE(LoadRecording(path, &loaded));
+  unlink(path);
+  EXPECT_FALSE(LoadRecording(path, &loaded));
+
+  string error;
+  unique_ptr<InteractiveMatter> replay = NewReplayMatter(loaded, image,
+                                                         &error);
+  ASSERT_TRUE(replay != nullptr) << error;
+  vector<double> event_ms;
+  ReplayRecording(loaded, replay.get(), &event_ms);
+  EXPECT_EQ(loaded.events.size(), event_ms.size());
+  EXPECT_EQ(matter.NumScribbles(), replay->NumScribbles());
+
+  vector<uint8_t> expected(W*H);
+  ASSERT_TRUE(DecodeMaskRLE(loaded.final_mask, W, H, expected.data()));
+  EXPECT_EQ(expected, vector<uint8_t>(replay->ForegroundMaskView(),
+                                      replay->ForegroundMaskView() + W*H));
+}
+
+TEST_F(RecordingTest, ReplayRejectsOtherImage) {
+  InteractiveMatter matter(image);
+  SessionRecording recording;
+  Record(&matter, &recording);
+
+  vector<uint8_t> l(W*H, 100), ab(W*H, 128);
+  string error;
+  EXPECT_TRUE(NewReplayMatter(recording,
+                              LabImage::Create(l.data(), ab.data(), ab.data(),
+                                               W, H),
+                              &error) == nullptr);
+  EXPECT_FALSE(error.empty());
+  EXPECT_TRUE(NewReplayMatter(recording,
+                              LabImage::Create(l.data(), ab.data(), ab.data(),
+                                               W - 1, H),
+                              &error) == nullptr);
+}
+
+}
@@ -0,0 +1,49 @@
+#include "results.h"
+
+#include <atomic>
+
+using namespace std;
+
+// Results kept for recycling. Beyond that, released results are freed
+static const size_t kMaxPooledResults = 4;
+
+ResultsPublisher::ResultsPublisher() : version_(0), pool_(new Pool) {
+  // So that releasing results never allocates under the mutex
+  pool_->free.reserve(kMaxPooledResults);
+}
+
+shared_ptr<const Results> ResultsPublisher::Latest() const {
+  return atomic_load(&latest_);
+}
+
+shared_ptr<Results> ResultsPublisher::Acquire() {
+  unique_ptr<Results> r;
+  {
+    lock_guard<mutex> lock(pool_->mutex);
+    if (!pool_->free.empty()) {
+      r = move(pool_->free.back());
+      pool_->free.pop_back();
+    }
+  }
+  if (!r) {
+    r.reset(new Results);
+  }
+  const shared_ptr<Pool> pool = pool_;
+  // Called by whichever thread drops the last reference
+  return shared_ptr<Results>(r.release(), [pool](Results* released) {
+    unique_ptr<Results> owned(released);
+    {
+      lock_guard<mutex> lock(pool->mutex);
+      if (pool->free.size() < kMaxPooledResults) {
+        pool->free.push_back(move(owned));
+      }
+    }
+    // Results that don't fit in the pool are freed here, after unlocking, so
+    // that a reader freeing large planes doesn't hold up Acquire
+  });
+}
+
+void ResultsPublisher::Publish(const shared_ptr<Results>& r) {
+  r->version = ++version_;
+  atomic_store(&latest_, shared_ptr<const Results>(r));
+}
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "api.h"
+#include "results.h"
+#include "test_images.h"
+
+using namespace std;
+
+namespace {
+
+TEST(ResultsPublisher, RecyclesReleasedResults) {
+  ResultsPublisher publisher;
+  EXPECT_TRUE(publisher.Latest() == NULL);
+
+  shared_ptr<Results> r = publisher.Acquire();
+  const Results* r1 = r.get();
+  publisher.Publish(r);
+  EXPECT_EQ(1u, publisher.Latest()->version);
+
+  // r1 is the latest, so it can't be reused
+  r = publisher.Acquire();
+  const Results* r2 = r.get();
+  EXPECT_NE(r1, r2);
+  publisher.Publish(r);
+  EXPECT_EQ(2u, publisher.Latest()->version);
+
+  // Now nobody can get r1 anymore
+  shared_ptr<const Results> held = publisher.Latest();
+  r = publisher.Acquire();
+  EXPECT_EQ(r1, r.get());
+  publisher.Publish(r);
+  r.reset();
+
+  // r2 is held by a reader, r1 is the latest
+  r = publisher.Acquire();
+  EXPECT_NE(r1, r.get());
+  EXPECT_NE(r2, r.get());
+  EXPECT_EQ(r2, held.get());
+  EXPECT_EQ(2u, held->version);
+}
+
+TEST(ResultsPublisher, RecyclesResultsReleasedByReaders) {
+  ResultsPublisher publisher;
+  shared_ptr<Results> r = publisher.Acquire();
+  const Results* r1 = r.get();
+  r->mask.assign(16, 255);
+  publisher.Publish(r);
+  r.reset();
+
+  // A reader releases r1 on its own thread after the next publication
+  shared_ptr<const Results> held = publisher.Latest();
+  publisher.Publish(publisher.Acquire());
+  thread reader([&held] { held.reset(); });
+  reader.join();
+  r = publisher.Acquire();
+  EXPECT_EQ(r1, r.get());
+  EXPECT_EQ(vector<uint8_t>(16, 255), r->mask);
+}
+
+TEST(ResultsPublisher, ReadersOutliveThePublisher) {
+  shared_ptr<const Results> held;
+  {
+    ResultsPublisher publisher;
+    shared_ptr<Results> r = publisher.Acquire();
+    r->mask.assign(16, 1);
+    publisher.Publish(r);
+    held = publisher.Latest();
+  }
+  EXPECT_EQ(vector<uint8_t>(16, 1), held->mask);
+  held.reset();
+}
+
+// A SimpleMatter on the two halves image, scribbled with masks
+struct TestMatter : public TwoHalvesImage {
+  TestMatter() : bg(W*H, 0), fg(W*H, 0) {
+    matter.reset(new SimpleMatter(l.data(), a.data(), b.data(), W, H));
+  }
+
+  // Add the line at column x to the bg or fg mask
+  void Scribble(int x, bool background) {
+    for (const Point2i& p : Line(x, background).pixels) {
+      (background ? bg : fg)[p.y*W + p.x] = 1;
+    }
+    matter->UpdateMasks(bg.data(), fg.data());
+  }
+
+  vector<uint8_t> bg, fg;
+  unique_ptr<SimpleMatter> matter;
+};
+
+TEST(Results, PublishedAfterEachUpdate) {
+  TestMatter t;
+  SimpleMatter& matter = *t.matter;
+  EXPECT_TRUE(matter.LatestResults() == NULL);
+
+  matter.SetPublishResults(true);
+  shared_ptr<const Results> r0 = matter.LatestResults();
+  ASSERT_TRUE(r0 != NULL);
+  EXPECT_EQ((int)TestMatter::W, r0->W);
+  EXPECT_EQ((int)TestMatter::H, r0->H);
+  EXPECT_EQ(vector<uint8_t>(TestMatter::W*TestMatter::H, 0), r0->mask);
+
+  t.Scribble(2, true);
+  t.Scribble(TestMatter::W - 8, false);
+  shared_ptr<const Results> r = matter.LatestResults();
+  EXPECT_EQ(r0->version + 2, r->version);
+
+  const int N = TestMatter::W*TestMatter::H;
+  vector<uint8_t> mask(N);
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(mask, r->mask);
+  vector<double> v(N);
+  matter.GetForegroundDist(v.data());
+  EXPECT_EQ(v, r->fg_dist);
+  matter.GetBackgroundDist(v.data());
+  EXPECT_EQ(v, r->bg_dist);
+  matter.GetForegroundLikelihood(v.data());
+  EXPECT_EQ(v, r->fg_likelihood);
+  matter.GetBackgroundLikelihood(v.data());
+  EXPECT_EQ(v, r->bg_likelihood);
+
+  // Held results don't change
+  EXPECT_EQ(vector<uint8_t>(N, 0), r0->mask);
+  EXPECT_NE(r0->mask, r->mask);
+
+  matter.SetPublishResults(false);
+  EXPECT_TRUE(matter.LatestResults() == NULL);
+}
+
+TEST(Results, ConcurrentReadersSeeConsistentResults) {
+  TestMatter t;
+  t.matter->SetPublishResults(true);
+
+  // A torn read would mix the mask of one update with the distances of
+  // another
+  atomic<bool> stop(false);
+  atomic<int> ninconsistent(0), nreads(0);
+  vector<thread> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.push_back(thread([&] {
+      while (!stop) {
+        shared_ptr<const Results> r = t.matter->LatestResults();
+        for (size_t j = 0; j < r->mask.size(); ++j) {
+          const uint8_t expected = r->fg_dist[j] < r->bg_dist[j] ? 255 : 0;
+          if (r->mask[j] != expected) {
+            ++ninconsistent;
+            break;
+          }
+        }
+        ++nreads;
+      }
+    }));
+  }
+  for (int x = 0; x < 12; ++x) {
+    t.Scribble(x, true);
+    t.Scribble(TestMatter::W - 1 - x, false);
+  }
+  stop = true;
+  for (thread& r : readers) {
+    r.join();
+  }
+  EXPECT_EQ(0, ninconsistent);
+  EXPECT_GT(nreads, 0);
+  EXPECT_EQ(25u, t.matter->LatestResults()->version);
+}
+
+}
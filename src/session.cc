@@ -0,0 +1,392 @@
+#include "api.h"
+#include "session.h"
+
+#include <glog/logging.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Serializes the small (non-plane) sections
+class Writer {
+ public:
+  template<class T>
+  void Put(const T& v) {
+    const char* p = reinterpret_cast<const char*>(&v);
+    data.insert(data.end(), p, p + sizeof(T));
+  }
+
+  template<class T>
+  void PutArray(const T* v, size_t n) {
+    const char* p = reinterpret_cast<const char*>(v);
+    data.insert(data.end(), p, p + n*sizeof(T));
+  }
+
+  vector<char> data;
+};
+
+// Reads a small section, failing on out of bounds reads
+class Reader {
+ public:
+  Reader(const char* data, uint64_t size) : data(data), size(size), pos(0) {}
+
+  template<class T>
+  bool Get(T* v) {
+    return GetArray(v, 1);
+  }
+
+  template<class T>
+  bool GetArray(T* v, uint64_t n) {
+    if (n > (size - pos) / sizeof(T)) {
+      return false;
+    }
+    memcpy(v, data + pos, n*sizeof(T));
+    pos += n*sizeof(T);
+    return true;
+  }
+
+ private:
+  const char* data;
+  uint64_t size;
+  uint64_t pos;
+};
+
+struct PendingSection {
+  uint32_t id;
+  const void* data;
+  uint64_t size;
+};
+
+uint64_t Align(uint64_t offset) {
+  return (offset + kSessionAlignment - 1) / kSessionAlignment
+         * kSessionAlignment;
+}
+
+void PutColorModel(const vector<vector<double>>& probs, Writer* w) {
+  w->Put<uint32_t>(probs.size());
+  for (const vector<double>& channel : probs) {
+    w->Put<uint32_t>(channel.size());
+    w->PutArray(channel.data(), channel.size());
+  }
+}
+
+bool GetColorModel(Reader* r, vector<vector<double>>* probs) {
+  uint32_t nchannels;
+  if (!r->Get(&nchannels) || nchannels > 3) {
+    return false;
+  }
+  probs->resize(nchannels);
+  for (vector<double>& channel : *probs) {
+    uint32_t n;
+    // ImageColorPDF indexes the densities by channel value
+    if (!r->Get(&n) || n != 256) {
+      return false;
+    }
+    channel.resize(n);
+    if (!r->GetArray(channel.data(), n)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// With a mapped file, the plane is borrowed from the (private, writable)
+// mapping, otherwise it is copied out of the file content
+template<class T>
+Plane<T> LoadPlane(const SessionSection& s, char* data, bool map) {
+  if (map) {
+    return Plane<T>(reinterpret_cast<T*>(data + s.offset),
+                    PlaneDeleter<T>(false));
+  }
+  T* copy = new T[s.size / sizeof(T)];
+  memcpy(copy, data + s.offset, s.size);
+  return Plane<T>(copy);
+}
+
+// The whole file, either mapped or read in memory
+class SessionFile {
+ public:
+  SessionFile() : data_(NULL), size_(0), mapped_(false) {}
+  ~SessionFile() {
+    if (mapped_) {
+      munmap(data_, size_);
+    } else {
+      delete[] data_;
+    }
+  }
+
+  bool Open(const string& path, bool map) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+    if (ok) {
+      size_ = st.st_size;
+      if (map) {
+        void* p = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+        ok = p != MAP_FAILED;
+        if (ok) {
+          data_ = static_cast<char*>(p);
+          mapped_ = true;
+        }
+      } else {
+        data_ = new char[size_];
+        size_t nread = 0;
+        while (ok && nread < size_) {
+          const ssize_t n = read(fd, data_ + nread, size_ - nread);
+          ok = n > 0;
+          nread += ok ? n : 0;
+        }
+      }
+    }
+    close(fd);
+    return ok;
+  }
+
+  char* data() { return data_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  char* data_;
+  uint64_t size_;
+  bool mapped_;
+};
+
+}
+
+bool InteractiveMatter::SaveSession(const string& path) {
+  WaitReady();
+  ProcessPending(chrono::steady_clock::time_point::max());
+  const uint64_t N = (uint64_t)W*H;
+
+  Writer models, scribbles_section, groups_section;
+  PutColorModel(fg_probs_, &models);
+  PutColorModel(bg_probs_, &models);
+  scribbles_section.Put<uint32_t>(scribbles.size());
+  for (const Scribble& s : scribbles) {
+    scribbles_section.Put<uint32_t>(s.background);
+    scribbles_section.Put<uint32_t>(s.pixels.size());
+    for (const Point2i& p : s.pixels) {
+      scribbles_section.Put<int32_t>(p.x);
+      scribbles_section.Put<int32_t>(p.y);
+    }
+  }
+  groups_section.Put<uint32_t>(groups_.size());
+  for (const ScribbleGroup& g : groups_) {
+    groups_section.Put<uint32_t>(g.background);
+    groups_section.Put<uint32_t>(g.nscribbles);
+    groups_section.Put<int32_t>(g.seq);
+  }
+
+  const PendingSection pending[] = {
+    {kSectionLabL, channels[0], N},
+    {kSectionLabA, channels[1], N},
+    {kSectionLabB, channels[2], N},
+    {kSectionFinalMask, final_mask.get(), N},
+    {kSectionFgPdf, fg_pdf.get(), N*sizeof(double)},
+    {kSectionBgPdf, bg_pdf.get(), N*sizeof(double)},
+    {kSectionFgLikelihood, fg_likelihood.get(), N*sizeof(double)},
+    {kSectionBgLikelihood, bg_likelihood.get(), N*sizeof(double)},
+    {kSectionFgDist, fg_dist.get(), N*sizeof(double)},
+    {kSectionBgDist, bg_dist.get(), N*sizeof(double)},
+    {kSectionColorModels, models.data.data(), models.data.size()},
+    {kSectionScribbles, scribbles_section.data.data(),
+     scribbles_section.data.size()},
+    {kSectionGroups, groups_section.data.data(), groups_section.data.size()},
+  };
+  const uint32_t nsections = sizeof(pending) / sizeof(pending[0]);
+
+  SessionHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSessionMagic, sizeof(header.magic));
+  header.version = kSessionVersion;
+  header.byte_order = kSessionByteOrder;
+  header.W = W;
+  header.H = H;
+  header.flags = (fg_scribbled_ ? 1 : 0) | (bg_scribbled_ ? 2 : 0);
+  header.next_seq = next_seq_;
+  header.nsections = nsections;
+
+  vector<SessionSection> table(nsections);
+  uint64_t offset = sizeof(header) + nsections*sizeof(SessionSection);
+  for (uint32_t i = 0; i < nsections; ++i) {
+    offset = Align(offset);
+    table[i].id = pending[i].id;
+    table[i].reserved = 0;
+    table[i].offset = offset;
+    table[i].size = pending[i].size;
+    offset += pending[i].size;
+  }
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if (f == NULL) {
+    LOG(ERROR) << "Can't open " << path << " for writing";
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+         && fwrite(table.data(), sizeof(SessionSection), nsections, f)
+              == nsections;
+  const vector<char> zeros(kSessionAlignment, 0);
+  for (uint32_t i = 0; ok && i < nsections; ++i) {
+    const long pos = ftell(f);
+    ok = pos >= 0 && (uint64_t)pos <= table[i].offset
+      && fwrite(zeros.data(), 1, table[i].offset - pos, f)
+           == table[i].offset - pos
+      && fwrite(pending[i].data, 1, pending[i].size, f) == pending[i].size;
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    LOG(ERROR) << "Error writing session " << path;
+  }
+  return ok;
+}
+
+InteractiveMatter* InteractiveMatter::LoadSession(const string& path,
+                                                  bool map) {
+  shared_ptr<SessionFile> file(new SessionFile);
+  if (!file->Open(path, map)) {
+    LOG(ERROR) << "Can't read session " << path;
+    return NULL;
+  }
+  char* data = file->data();
+  SessionHeader header;
+  if (file->size() < sizeof(header)) {
+    LOG(ERROR) << path << " is not a session file";
+    return NULL;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kSessionMagic, sizeof(header.magic)) != 0
+      || header.byte_order != kSessionByteOrder) {
+    LOG(ERROR) << path << " is not a session file for this machine";
+    return NULL;
+  }
+  if (header.version > kSessionVersion) {
+    LOG(ERROR) << path << " has an unsupported version " << header.version;
+    return NULL;
+  }
+  if (header.W <= 0 || header.H <= 0
+      || header.nsections > (file->size() - sizeof(header))
+                            / sizeof(SessionSection)) {
+    LOG(ERROR) << path << " is corrupted";
+    return NULL;
+  }
+  const uint64_t N = (uint64_t)header.W*header.H;
+  const SessionSection* table =
+    reinterpret_cast<const SessionSection*>(data + sizeof(header));
+
+  // Returns the section with the given id and size (any size if 0), or NULL
+  auto find = [&](uint32_t id, uint64_t size) -> const SessionSection* {
+    for (uint32_t i = 0; i < header.nsections; ++i) {
+      const SessionSection& s = table[i];
+      if (s.id == id && s.offset % kSessionAlignment == 0
+          && s.offset <= file->size() && s.size <= file->size() - s.offset
+          && (size == 0 || s.size == size)) {
+        return &s;
+      }
+    }
+    return NULL;
+  };
+
+  const uint32_t plane_ids[] = {
+    kSectionLabL, kSectionLabA, kSectionLabB, kSectionFinalMask,
+    kSectionFgPdf, kSectionBgPdf, kSectionFgLikelihood, kSectionBgLikelihood,
+    kSectionFgDist, kSectionBgDist,
+  };
+  const SessionSection* planes[10];
+  for (int i = 0; i < 10; ++i) {
+    planes[i] = find(plane_ids[i], (i < 4) ? N : N*sizeof(double));
+    if (planes[i] == NULL) {
+      LOG(ERROR) << path << " is missing planes";
+      return NULL;
+    }
+  }
+
+  unique_ptr<InteractiveMatter> m(new InteractiveMatter(header.W, header.H));
+  const uint8_t* lab[3];
+  for (int c = 0; c < 3; ++c) {
+    lab[c] = reinterpret_cast<const uint8_t*>(data + planes[c]->offset);
+  }
+  m->image_ = map ? LabImage::Borrow(lab[0], lab[1], lab[2], header.W,
+                                     header.H, file)
+                  : LabImage::Create(lab[0], lab[1], lab[2], header.W,
+                                     header.H);
+  m->final_mask = LoadPlane<uint8_t>(*planes[3], data, map);
+  m->fg_pdf = LoadPlane<double>(*planes[4], data, map);
+  m->bg_pdf = LoadPlane<double>(*planes[5], data, map);
+  m->fg_likelihood = LoadPlane<double>(*planes[6], data, map);
+  m->bg_likelihood = LoadPlane<double>(*planes[7], data, map);
+  m->fg_dist = LoadPlane<double>(*planes[8], data, map);
+  m->bg_dist = LoadPlane<double>(*planes[9], data, map);
+  if (map) {
+    m->storage_ = file;
+  }
+  for (int c = 0; c < 3; ++c) {
+    m->channels[c] = m->image_->Channels()[c];
+  }
+
+  const SessionSection* models = find(kSectionColorModels, 0);
+  const SessionSection* scribbles = find(kSectionScribbles, 0);
+  const SessionSection* groups = find(kSectionGroups, 0);
+  if (models == NULL || scribbles == NULL || groups == NULL) {
+    LOG(ERROR) << path << " is missing sections";
+    return NULL;
+  }
+  Reader models_reader(data + models->offset, models->size);
+  bool ok = GetColorModel(&models_reader, &m->fg_probs_)
+    && GetColorModel(&models_reader, &m->bg_probs_);
+
+  Reader scribbles_reader(data + scribbles->offset, scribbles->size);
+  uint32_t nscribbles = 0;
+  ok = ok && scribbles_reader.Get(&nscribbles);
+  for (uint32_t i = 0; ok && i < nscribbles; ++i) {
+    uint32_t background = 0, npixels = 0;
+    ok = scribbles_reader.Get(&background) && scribbles_reader.Get(&npixels)
+      && npixels <= scribbles->size / (2*sizeof(int32_t));
+    Scribble s;
+    s.background = background != 0;
+    for (uint32_t j = 0; ok && j < npixels; ++j) {
+      int32_t xy[2];
+      ok = scribbles_reader.GetArray(xy, 2)
+        && xy[0] >= 0 && xy[0] < header.W && xy[1] >= 0 && xy[1] < header.H;
+      s.pixels.push_back(Point2i(xy[0], xy[1]));
+    }
+    m->scribbles.push_back(s);
+  }
+
+  Reader groups_reader(data + groups->offset, groups->size);
+  uint32_t ngroups = 0;
+  size_t ngrouped = 0;
+  ok = ok && groups_reader.Get(&ngroups);
+  for (uint32_t i = 0; ok && i < ngroups; ++i) {
+    uint32_t background = 0, n = 0;
+    int32_t seq = 0;
+    ok = groups_reader.Get(&background) && groups_reader.Get(&n)
+      && groups_reader.Get(&seq);
+    ScribbleGroup g;
+    g.background = background != 0;
+    g.nscribbles = n;
+    g.seq = seq;
+    m->groups_.push_back(g);
+    ngrouped += n;
+  }
+  if (!ok || ngrouped != m->scribbles.size()) {
+    LOG(ERROR) << path << " has corrupted scribbles";
+    return NULL;
+  }
+
+  m->fg_scribbled_ = (header.flags & 1) != 0;
+  m->bg_scribbled_ = (header.flags & 2) != 0;
+  m->next_seq_ = header.next_seq;
+  // The loaded mask is the reference for change tracking
+  m->ClearChanges();
+  return m.release();
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "api.h"
+#include "test_images.h"
+
+using namespace std;
+
+namespace {
+
+static vector<char> ReadFile(const string& path) {
+  ifstream f(path.c_str(), ios::binary);
+  return vector<char>(istreambuf_iterator<char>(f),
+                      istreambuf_iterator<char>());
+}
+
+class SessionTest : public ::testing::TestWithParam<bool>,
+                    public TwoHalvesImage {
+ protected:
+  SessionTest() {
+    char tmpl[] = "/tmp/libseg_session_XXXXXX";
+    const int fd = mkstemp(tmpl);
+    close(fd);
+    path = tmpl;
+  }
+
+  ~SessionTest() {
+    unlink(path.c_str());
+  }
+
+  string path;
+};
+
+TEST_P(SessionTest, SaveLoadResume) {
+  const bool map = GetParam();
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.AddScribble(Line(5, false));
+  matter.AddScribble(Line(W - 5, true));
+  ASSERT_TRUE(matter.SaveSession(path));
+  const vector<char> saved = ReadFile(path);
+
+  unique_ptr<InteractiveMatter> loaded(InteractiveMatter::LoadSession(path,
+                                                                      map));
+  ASSERT_TRUE(loaded != NULL);
+  EXPECT_EQ(W, loaded->GetWidth());
+  EXPECT_EQ(2, loaded->NumScribbles());
+  EXPECT_FALSE(loaded->HasChanges());
+  vector<uint8_t> expected(W*H), mask(W*H);
+  matter.GetForegroundMask(expected.data());
+  loaded->GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+  vector<double> expected_dist(W*H), dist(W*H);
+  matter.GetForegroundDist(expected_dist.data());
+  loaded->GetForegroundDist(dist.data());
+  EXPECT_EQ(expected_dist, dist);
+
+  // Both continue the same way, without touching the file
+  matter.AddScribble(Line(W/2 + 2, false));
+  loaded->AddScribble(Line(W/2 + 2, false));
+  matter.GetForegroundMask(expected.data());
+  loaded->GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+  ASSERT_TRUE(loaded->RemoveScribble(2));
+  EXPECT_EQ(2, loaded->NumScribbles());
+  EXPECT_EQ(saved, ReadFile(path));
+}
+
+INSTANTIATE_TEST_CASE_P(MapOrRead, SessionTest, ::testing::Bool());
+
+TEST_F(SessionTest, RejectsInvalidFiles) {
+  EXPECT_TRUE(InteractiveMatter::LoadSession("/nonexistent/session") == NULL);
+  {
+    ofstream f(path.c_str(), ios::binary);
+    f << "not a session file, but long enough to hold a header";
+  }
+  EXPECT_TRUE(InteractiveMatter::LoadSession(path) == NULL);
+
+  // Truncated
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+  matter.AddScribble(Line(5, false));
+  ASSERT_TRUE(matter.SaveSession(path));
+  ASSERT_EQ(0, truncate(path.c_str(), 8192));
+  EXPECT_TRUE(InteractiveMatter::LoadSession(path) == NULL);
+}
+
+}
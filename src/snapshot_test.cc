@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <set>
+#include <vector>
+
+#include "snapshot.h"
+
+using namespace std;
+
+namespace {
+
+TEST(TileSnapshot, SharesUnchangedTiles) {
+  const int W = 200;
+  const int H = 100;
+  vector<double> plane(W*H, 1);
+  TileSnapshot<double> s1, s2;
+  s1.Capture(plane.data(), W, H, NULL);
+  plane[W*70 + 150] = 2;
+  s2.Capture(plane.data(), W, H, &s1);
+
+  set<const void*> seen;
+  EXPECT_EQ(sizeof(double)*W*H, s1.CountBytes(&seen));
+  // Only the modified tile has been copied
+  const int ts = TileSnapshot<double>::kTileSize;
+  EXPECT_EQ(sizeof(double)*ts*(H - ts), s2.CountBytes(&seen));
+
+  vector<double> restored(W*H, 0);
+  s1.Restore(restored.data(), NULL);
+  EXPECT_EQ(1, restored[W*70 + 150]);
+  s2.Restore(restored.data(), &s1);
+  EXPECT_EQ(plane, restored);
+}
+
+}
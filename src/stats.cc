@@ -0,0 +1,34 @@
+#include "stats.h"
+
+#include <cstddef>
+
+#ifndef LIBSEG_NO_STATS
+
+namespace stats {
+
+static thread_local MatterStats* current = NULL;
+
+MatterStats* Current() {
+  return current;
+}
+
+ScopedCollector::ScopedCollector(MatterStats* stats)
+  : stats_(current == NULL ? stats : NULL) {
+  if (stats_) {
+    stats_->Reset();
+    current = stats_;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+ScopedCollector::~ScopedCollector() {
+  if (stats_) {
+    stats_->total_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start_).count();
+    current = NULL;
+  }
+}
+
+}  // namespace stats
+
+#endif
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+
+#include "geodesic.h"
+#include "kde.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace {
+
+#ifndef LIBSEG_NO_STATS
+
+TEST(Stats, NothingCollectedOutsideOfCollector) {
+  EXPECT_TRUE(stats::Current() == NULL);
+  vector<double> probs;
+  ColorChannelKDE(vector<double>{1, 2, 3}, false, &probs);
+  EXPECT_TRUE(stats::Current() == NULL);
+}
+
+TEST(Stats, OutermostCollectorOwnsTheStats) {
+  MatterStats outer, inner;
+  {
+    LIBSEG_COLLECT_STATS(&outer);
+    EXPECT_EQ(&outer, stats::Current());
+    {
+      LIBSEG_COLLECT_STATS(&inner);
+      EXPECT_EQ(&outer, stats::Current());
+      vector<double> probs;
+      ColorChannelKDE(vector<double>{1, 2, 3}, false, &probs);
+    }
+    EXPECT_EQ(&outer, stats::Current());
+  }
+  EXPECT_TRUE(stats::Current() == NULL);
+  EXPECT_EQ(1u, outer.kde_calls);
+  EXPECT_EQ(3u, outer.kde_samples);
+  EXPECT_GE(outer.total_ms, outer.kde_ms);
+  EXPECT_EQ(0u, inner.kde_calls);
+}
+
+TEST(Stats, CollectorResetsStats) {
+  MatterStats s;
+  s.kde_calls = 42;
+  LIBSEG_COLLECT_STATS(&s);
+  EXPECT_EQ(0u, s.kde_calls);
+}
+
+TEST(Stats, GeodesicCounters) {
+  // A ramp, so that some pixels get relaxed several times from the two
+  // sources
+  const int W = 16, H = 8;
+  vector<double> height(W*H);
+  for (int i = 0; i < W*H; ++i) {
+    height[i] = (i % W) * 0.1;
+  }
+  vector<double> dists(W*H);
+  vector<Point2i> sources{Point2i(0, 0), Point2i(W - 1, H - 1)};
+
+  MatterStats s;
+  {
+    LIBSEG_COLLECT_STATS(&s);
+    ASSERT_TRUE(GeodesicDistanceMap(sources, height.data(), W, H,
+                                    dists.data()));
+  }
+  EXPECT_EQ(s.geodesic_pushes, s.geodesic_pops);
+  EXPECT_EQ(sources.size() + s.geodesic_relaxations, s.geodesic_pushes);
+  // All but the last relaxation of each non-source pixel are stale
+  EXPECT_EQ(s.geodesic_relaxations - (W*H - sources.size()),
+            s.geodesic_stale_pops);
+}
+
+#endif
+
+}
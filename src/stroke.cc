@@ -0,0 +1,211 @@
+#include "stroke.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "trace.h"
+
+using namespace std;
+
+// Tolerance on the brush boundary, so that pixels exactly at radius of the
+// polyline are included despite rounding errors
+static const double kEpsilon = 1e-9;
+
+static bool SpanLess(const RowSpan& s1, const RowSpan& s2) {
+  return s1.y < s2.y || (s1.y == s2.y && s1.x0 < s2.x0);
+}
+
+static bool PixelLess(const Point2i& p1, const Point2i& p2) {
+  return p1.y < p2.y || (p1.y == p2.y && p1.x < p2.x);
+}
+
+static bool PixelEqual(const Point2i& p1, const Point2i& p2) {
+  return p1.x == p2.x && p1.y == p2.y;
+}
+
+// Intersect [lo, hi] with the x such that vmin <= slope*x + offset <= vmax
+static void IntersectLinear(double slope, double offset, double vmin,
+                            double vmax, double* lo, double* hi) {
+  if (slope == 0) {
+    if (offset < vmin - kEpsilon || offset > vmax + kEpsilon) {
+      *lo = numeric_limits<double>::max();
+      *hi = numeric_limits<double>::lowest();
+    }
+    return;
+  }
+  double x1 = (vmin - offset) / slope;
+  double x2 = (vmax - offset) / slope;
+  if (x1 > x2) {
+    swap(x1, x2);
+  }
+  *lo = max(*lo, x1);
+  *hi = min(*hi, x2);
+}
+
+// Extend [lo, hi] with the x of row y that are within r of the segment
+// [a, b]. As the brush shape is convex, this is an interval : the union of
+// the slices of the discs at both ends and of the rectangle in between
+static void SegmentRowSlice(const Point2i& a, const Point2i& b, double r,
+                            int y, double* lo, double* hi) {
+  const Point2i* ends[2] = {&a, &b};
+  for (const Point2i* p : ends) {
+    const double dy = y - p->y;
+    if (fabs(dy) <= r) {
+      const double w = sqrt(r*r - dy*dy);
+      *lo = min(*lo, p->x - w);
+      *hi = max(*hi, p->x + w);
+    }
+  }
+  if (a.x == b.x && a.y == b.y) {
+    return;
+  }
+  // With d = b - a and q = (x, y) - a, the rectangle is 0 <= q.d <= |d|^2 and
+  // |q x d| <= r*|d|
+  const double dx = b.x - a.x;
+  const double dy = b.y - a.y;
+  const double len2 = dx*dx + dy*dy;
+  const double qy = y - a.y;
+  double rlo = numeric_limits<double>::lowest();
+  double rhi = numeric_limits<double>::max();
+  IntersectLinear(dx, qy*dy - a.x*dx, 0, len2, &rlo, &rhi);
+  const double rlen = r*sqrt(len2);
+  IntersectLinear(dy, -qy*dx - a.x*dy, -rlen, rlen, &rlo, &rhi);
+  if (rlo <= rhi) {
+    *lo = min(*lo, rlo);
+    *hi = max(*hi, rhi);
+  }
+}
+
+// Sort spans and merge the ones that overlap or touch
+static void MergeSpans(vector<RowSpan>* spans) {
+  sort(spans->begin(), spans->end(), SpanLess);
+  size_t n = 0;
+  for (size_t i = 0; i < spans->size(); ++i) {
+    const RowSpan& s = (*spans)[i];
+    if (n > 0 && (*spans)[n - 1].y == s.y && s.x0 <= (*spans)[n - 1].x1) {
+      (*spans)[n - 1].x1 = max((*spans)[n - 1].x1, s.x1);
+    } else {
+      (*spans)[n++] = s;
+    }
+  }
+  spans->resize(n, RowSpan(0, 0, 0));
+}
+
+void RasterizeStroke(const Stroke& stroke, int W, int H,
+                     vector<RowSpan>* spans) {
+  LIBSEG_TRACE_SCOPE("RasterizeStroke");
+  spans->clear();
+  const vector<Point2i>& pts = stroke.points;
+  const int r = max(0, stroke.radius);
+  const size_t nsegments = pts.size() > 1 ? pts.size() - 1 : pts.size();
+  for (size_t i = 0; i < nsegments; ++i) {
+    const Point2i& a = pts[i];
+    const Point2i& b = pts[min(i + 1, pts.size() - 1)];
+    const int ymin = max(0, min(a.y, b.y) - r);
+    const int ymax = min(H - 1, max(a.y, b.y) + r);
+    for (int y = ymin; y <= ymax; ++y) {
+      double lo = numeric_limits<double>::max();
+      double hi = numeric_limits<double>::lowest();
+      SegmentRowSlice(a, b, r, y, &lo, &hi);
+      if (lo > hi) {
+        continue;
+      }
+      const int x0 = max(0, (int)ceil(lo - kEpsilon));
+      const int x1 = min(W, (int)floor(hi + kEpsilon) + 1);
+      if (x0 < x1) {
+        spans->push_back(RowSpan(y, x0, x1));
+      }
+    }
+  }
+  MergeSpans(spans);
+}
+
+size_t SpansArea(const vector<RowSpan>& spans) {
+  size_t area = 0;
+  for (const RowSpan& s : spans) {
+    area += s.x1 - s.x0;
+  }
+  return area;
+}
+
+size_t RemoveScribbledPixels(const vector<Scribble>& scribbles,
+                             bool background,
+                             vector<RowSpan>* spans) {
+  if (spans->empty()) {
+    return 0;
+  }
+  // The scribbled pixels that fall in a span
+  vector<Point2i> hits;
+  for (const Scribble& s : scribbles) {
+    if (s.background != background) {
+      continue;
+    }
+    for (const Point2i& p : s.pixels) {
+      // The last span starting at or before p
+      vector<RowSpan>::const_iterator it =
+        upper_bound(spans->begin(), spans->end(), RowSpan(p.y, p.x, p.x),
+                    SpanLess);
+      if (it == spans->begin()) {
+        continue;
+      }
+      --it;
+      if (it->y == p.y && p.x < it->x1) {
+        hits.push_back(p);
+      }
+    }
+  }
+  if (hits.empty()) {
+    return 0;
+  }
+  sort(hits.begin(), hits.end(), PixelLess);
+  hits.erase(unique(hits.begin(), hits.end(), PixelEqual), hits.end());
+
+  // Split the spans around the hits. Both are sorted the same way
+  vector<RowSpan> remaining;
+  size_t h = 0;
+  for (const RowSpan& s : *spans) {
+    int x0 = s.x0;
+    while (h < hits.size() && hits[h].y == s.y && hits[h].x < s.x1) {
+      if (hits[h].x > x0) {
+        remaining.push_back(RowSpan(s.y, x0, hits[h].x));
+      }
+      x0 = hits[h].x + 1;
+      ++h;
+    }
+    if (x0 < s.x1) {
+      remaining.push_back(RowSpan(s.y, x0, s.x1));
+    }
+  }
+  spans->swap(remaining);
+  return hits.size();
+}
+
+void SpansToPixels(const vector<RowSpan>& spans, vector<Point2i>* pixels) {
+  pixels->reserve(pixels->size() + SpansArea(spans));
+  for (const RowSpan& s : spans) {
+    for (int x = s.x0; x < s.x1; ++x) {
+      pixels->push_back(Point2i(x, s.y));
+    }
+  }
+}
+
+void StrokeToScribble(const Stroke& stroke, int W, int H, Scribble* s) {
+  vector<RowSpan> spans;
+  RasterizeStroke(stroke, W, H, &spans);
+  s->background = stroke.background;
+  s->pixels.clear();
+  SpansToPixels(spans, &s->pixels);
+}
+
+void DeduplicateScribble(int W, int H, Scribble* s) {
+  vector<Point2i>& pixels = s->pixels;
+  pixels.erase(remove_if(pixels.begin(), pixels.end(),
+                         [W, H](const Point2i& p) {
+                           return p.x < 0 || p.x >= W || p.y < 0 || p.y >= H;
+                         }),
+               pixels.end());
+  sort(pixels.begin(), pixels.end(), PixelLess);
+  pixels.erase(unique(pixels.begin(), pixels.end(), PixelEqual),
+               pixels.end());
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+
+#include "api.h"
+#include "stroke.h"
+
+using namespace std;
+
+namespace {
+
+// Reference rasterization : test every pixel against every segment
+vector<uint8_t> BruteForceStroke(const Stroke& stroke, int W, int H) {
+  vector<uint8_t> mask(W*H, 0);
+  const vector<Point2i>& pts = stroke.points;
+  const double r2 = stroke.radius*stroke.radius;
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      for (size_t i = 0; i < pts.size(); ++i) {
+        const Point2i& a = pts[i];
+        const Point2i& b = pts[min(i + 1, pts.size() - 1)];
+        const double dx = b.x - a.x, dy = b.y - a.y;
+        const double len2 = dx*dx + dy*dy;
+        double t = 0;
+        if (len2 > 0) {
+          t = ((x - a.x)*dx + (y - a.y)*dy) / len2;
+          t = max(0.0, min(1.0, t));
+        }
+        const double ex = x - (a.x + t*dx), ey = y - (a.y + t*dy);
+        if (ex*ex + ey*ey <= r2 + 1e-9) {
+          mask[y*W + x] = 1;
+        }
+      }
+    }
+  }
+  return mask;
+}
+
+vector<uint8_t> SpansToMask(const vector<RowSpan>& spans, int W, int H) {
+  vector<uint8_t> mask(W*H, 0);
+  for (const RowSpan& s : spans) {
+    for (int x = s.x0; x < s.x1; ++x) {
+      mask[s.y*W + x] = 1;
+    }
+  }
+  return mask;
+}
+
+// Sorted, disjoint and not touching
+void ExpectCanonical(const vector<RowSpan>& spans) {
+  for (size_t i = 0; i < spans.size(); ++i) {
+    EXPECT_LT(spans[i].x0, spans[i].x1);
+    if (i > 0 && spans[i].y == spans[i - 1].y) {
+      EXPECT_LT(spans[i - 1].x1, spans[i].x0);
+    } else if (i > 0) {
+      EXPECT_LT(spans[i - 1].y, spans[i].y);
+    }
+  }
+}
+
+TEST(Stroke, SinglePointIsADisc) {
+  Stroke stroke;
+  stroke.radius = 2;
+  stroke.points.push_back(Point2i(5, 5));
+  vector<RowSpan> spans;
+  RasterizeStroke(stroke, 10, 10, &spans);
+  ASSERT_EQ(5u, spans.size());
+  EXPECT_EQ(3, spans[0].y);
+  EXPECT_EQ(5, spans[0].x0);
+  EXPECT_EQ(6, spans[0].x1);
+  EXPECT_EQ(5, spans[2].y);
+  EXPECT_EQ(3, spans[2].x0);
+  EXPECT_EQ(8, spans[2].x1);
+  EXPECT_EQ(13u, SpansArea(spans));
+}
+
+TEST(Stroke, MatchesBruteForce) {
+  const int W = 40, H = 30;
+  Stroke stroke;
+  stroke.radius = 3;
+  stroke.points = {Point2i(2, 3), Point2i(20, 10), Point2i(20, 25),
+                   Point2i(7, 17), Point2i(35, 4), Point2i(35, 4)};
+  vector<RowSpan> spans;
+  RasterizeStroke(stroke, W, H, &spans);
+  ExpectCanonical(spans);
+  EXPECT_EQ(BruteForceStroke(stroke, W, H), SpansToMask(spans, W, H));
+
+  stroke.radius = 0;
+  RasterizeStroke(stroke, W, H, &spans);
+  ExpectCanonical(spans);
+  EXPECT_EQ(BruteForceStroke(stroke, W, H), SpansToMask(spans, W, H));
+}
+
+TEST(Stroke, ClippedToImage) {
+  const int W = 16, H = 12;
+  Stroke stroke;
+  stroke.radius = 4;
+  stroke.points = {Point2i(-5, -3), Point2i(8, 6), Point2i(30, 6)};
+  vector<RowSpan> spans;
+  RasterizeStroke(stroke, W, H, &spans);
+  ExpectCanonical(spans);
+  for (const RowSpan& s : spans) {
+    EXPECT_GE(s.y, 0);
+    EXPECT_LT(s.y, H);
+    EXPECT_GE(s.x0, 0);
+    EXPECT_LE(s.x1, W);
+  }
+  EXPECT_EQ(BruteForceStroke(stroke, W, H), SpansToMask(spans, W, H));
+
+  // Entirely outside
+  stroke.points = {Point2i(-10, -10), Point2i(-10, 50)};
+  RasterizeStroke(stroke, W, H, &spans);
+  EXPECT_TRUE(spans.empty());
+}
+
+TEST(Stroke, NegativeRadiusIsALine) {
+  const int W = 16, H = 12;
+  Stroke stroke;
+  stroke.points = {Point2i(2, 3), Point2i(12, 8)};
+  vector<RowSpan> line, spans;
+  RasterizeStroke(stroke, W, H, &line);
+  EXPECT_FALSE(line.empty());
+  stroke.radius = -3;
+  RasterizeStroke(stroke, W, H, &spans);
+  EXPECT_EQ(SpansToMask(line, W, H), SpansToMask(spans, W, H));
+}
+
+TEST(Stroke, RemoveScribbledPixels) {
+  vector<RowSpan> spans = {RowSpan(1, 0, 5), RowSpan(2, 2, 4),
+                           RowSpan(2, 6, 8)};
+  Scribble fg, bg;
+  fg.background = false;
+  fg.pixels = {Point2i(0, 1), Point2i(3, 1), Point2i(3, 1), Point2i(7, 2),
+               Point2i(5, 2), Point2i(9, 9)};
+  bg.background = true;
+  bg.pixels = {Point2i(2, 1)};
+  vector<Scribble> scribbles = {fg, bg};
+
+  EXPECT_EQ(3u, RemoveScribbledPixels(scribbles, false, &spans));
+  ASSERT_EQ(4u, spans.size());
+  EXPECT_EQ(1, spans[0].x0);
+  EXPECT_EQ(3, spans[0].x1);
+  EXPECT_EQ(4, spans[1].x0);
+  EXPECT_EQ(5, spans[1].x1);
+  EXPECT_EQ(2, spans[2].x0);
+  EXPECT_EQ(4, spans[2].x1);
+  EXPECT_EQ(6, spans[3].x0);
+  EXPECT_EQ(7, spans[3].x1);
+  EXPECT_EQ(6u, SpansArea(spans));
+}
+
+TEST(Stroke, DeduplicateScribble) {
+  Scribble s;
+  s.pixels = {Point2i(3, 1), Point2i(1, 1), Point2i(3, 1), Point2i(-1, 0),
+              Point2i(0, 4), Point2i(2, 0)};
+  DeduplicateScribble(4, 4, &s);
+  ASSERT_EQ(3u, s.pixels.size());
+  EXPECT_EQ(2, s.pixels[0].x);
+  EXPECT_EQ(0, s.pixels[0].y);
+  EXPECT_EQ(1, s.pixels[1].x);
+  EXPECT_EQ(3, s.pixels[2].x);
+}
+
+TEST(Stroke, InteractiveMatterDropsConflicts) {
+  const int W = 20, H = 10;
+  vector<uint8_t> l(W*H), a(W*H, 128), b(W*H, 128);
+  for (int i = 0; i < W*H; ++i) {
+    l[i] = (i % W) < W/2 ? 50 : 200;
+  }
+  InteractiveMatter matter(l.data(), a.data(), b.data(), W, H);
+
+  Stroke fg;
+  fg.radius = 1;
+  fg.points = {Point2i(15, 2), Point2i(15, 7)};
+  size_t nconflicts = 42;
+  const size_t nfg = matter.AddStroke(fg, &nconflicts);
+  EXPECT_EQ(0u, nconflicts);
+  EXPECT_EQ(20u, nfg);
+
+  // Crosses the fg stroke on row 5
+  Stroke bg;
+  bg.background = true;
+  bg.radius = 0;
+  bg.points = {Point2i(0, 5), Point2i(W + 5, 5)};
+  EXPECT_EQ((size_t)W - 3, matter.AddStroke(bg, &nconflicts));
+  EXPECT_EQ(3u, nconflicts);
+  EXPECT_EQ(2, matter.NumScribbles());
+
+  // Entirely covered by the fg stroke
+  Stroke covered;
+  covered.background = true;
+  covered.points = {Point2i(15, 3)};
+  EXPECT_EQ(0u, matter.AddStroke(covered, &nconflicts));
+  EXPECT_EQ(1u, nconflicts);
+  EXPECT_EQ(2, matter.NumScribbles());
+}
+
+}
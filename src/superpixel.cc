@@ -0,0 +1,247 @@
+#include "superpixel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+#include <glog/logging.h>
+
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+
+// Number of k-means iterations, 10 is enough for most images according to
+// the SLIC paper
+static const int kSLICIterations = 10;
+
+struct Center {
+  double l, a, b, x, y;
+};
+
+// Merge the connected components smaller than min_size into a neighboring
+// component and relabel them consecutively
+static int EnforceConnectivity(int W, int H, int min_size,
+                               vector<int32_t>* labels) {
+  const int dx[4] = {-1, 0, 1, 0};
+  const int dy[4] = {0, -1, 0, 1};
+  vector<int32_t> out(W*H, -1);
+  vector<int> component;
+  int nlabels = 0;
+  for (int start = 0; start < W*H; ++start) {
+    if (out[start] >= 0) {
+      continue;
+    }
+    // A component adjacent to the start pixel and already relabeled, to
+    // merge into if this one is too small
+    int adjacent = -1;
+    const int sx = start % W, sy = start / W;
+    for (int k = 0; k < 4; ++k) {
+      const int x = sx + dx[k], y = sy + dy[k];
+      if (x >= 0 && x < W && y >= 0 && y < H && out[y*W + x] >= 0) {
+        adjacent = out[y*W + x];
+      }
+    }
+    component.clear();
+    component.push_back(start);
+    out[start] = nlabels;
+    for (size_t c = 0; c < component.size(); ++c) {
+      const int px = component[c] % W, py = component[c] / W;
+      for (int k = 0; k < 4; ++k) {
+        const int x = px + dx[k], y = py + dy[k];
+        if (x < 0 || x >= W || y < 0 || y >= H) {
+          continue;
+        }
+        const int i = y*W + x;
+        if (out[i] < 0 && (*labels)[i] == (*labels)[start]) {
+          out[i] = nlabels;
+          component.push_back(i);
+        }
+      }
+    }
+    if ((int)component.size() < min_size && adjacent >= 0) {
+      for (int i : component) {
+        out[i] = adjacent;
+      }
+    } else {
+      ++nlabels;
+    }
+  }
+  labels->swap(out);
+  return nlabels;
+}
+
+static void BuildAdjacency(SuperpixelGraph* graph) {
+  const int W = graph->W, H = graph->H;
+  const vector<int32_t>& labels = graph->labels;
+  vector<vector<int>> neighbors(graph->NumNodes());
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      const int l = labels[y*W + x];
+      if (x + 1 < W && labels[y*W + x + 1] != l) {
+        neighbors[l].push_back(labels[y*W + x + 1]);
+        neighbors[labels[y*W + x + 1]].push_back(l);
+      }
+      if (y + 1 < H && labels[(y + 1)*W + x] != l) {
+        neighbors[l].push_back(labels[(y + 1)*W + x]);
+        neighbors[labels[(y + 1)*W + x]].push_back(l);
+      }
+    }
+  }
+  graph->offsets.assign(1, 0);
+  graph->adjacency.clear();
+  for (vector<int>& n : neighbors) {
+    sort(n.begin(), n.end());
+    n.erase(unique(n.begin(), n.end()), n.end());
+    graph->adjacency.insert(graph->adjacency.end(), n.begin(), n.end());
+    graph->offsets.push_back(graph->adjacency.size());
+  }
+}
+
+void ComputeSLIC(const uint8_t* const* channels, int W, int H,
+                 int region_size, double compactness,
+                 SuperpixelGraph* graph) {
+  CHECK_GT(region_size, 0);
+  const int S = region_size;
+  graph->W = W;
+  graph->H = H;
+
+  // Initial centers on a regular grid
+  vector<Center> centers;
+  for (int y = S/2; y < H + S/2; y += S) {
+    for (int x = S/2; x < W + S/2; x += S) {
+      const int cx = min(x, W - 1), cy = min(y, H - 1);
+      const int i = cy*W + cx;
+      Center c = {(double)channels[0][i], (double)channels[1][i],
+                  (double)channels[2][i], (double)cx, (double)cy};
+      centers.push_back(c);
+    }
+  }
+
+  vector<int32_t>& labels = graph->labels;
+  labels.assign(W*H, 0);
+  vector<double> best(W*H);
+  // Spatial distances are normalized by S and weighted by compactness
+  const double spatial_weight = (compactness*compactness) / (S*S);
+  for (int iter = 0; iter < kSLICIterations; ++iter) {
+    fill(best.begin(), best.end(), numeric_limits<double>::max());
+    for (size_t k = 0; k < centers.size(); ++k) {
+      const Center& c = centers[k];
+      const int x0 = max(0, (int)c.x - S), x1 = min(W, (int)c.x + S + 1);
+      const int y0 = max(0, (int)c.y - S), y1 = min(H, (int)c.y + S + 1);
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+          const int i = y*W + x;
+          const double dl = channels[0][i] - c.l;
+          const double da = channels[1][i] - c.a;
+          const double db = channels[2][i] - c.b;
+          const double dx = x - c.x, dy = y - c.y;
+          const double d = dl*dl + da*da + db*db
+                         + spatial_weight*(dx*dx + dy*dy);
+          if (d < best[i]) {
+            best[i] = d;
+            labels[i] = k;
+          }
+        }
+      }
+    }
+
+    // Move the centers to the mean of their pixels
+    vector<Center> sums(centers.size(), Center());
+    vector<int> counts(centers.size(), 0);
+    for (int y = 0; y < H; ++y) {
+      for (int x = 0; x < W; ++x) {
+        const int i = y*W + x;
+        Center& s = sums[labels[i]];
+        s.l += channels[0][i];
+        s.a += channels[1][i];
+        s.b += channels[2][i];
+        s.x += x;
+        s.y += y;
+        ++counts[labels[i]];
+      }
+    }
+    for (size_t k = 0; k < centers.size(); ++k) {
+      if (counts[k] > 0) {
+        const double n = counts[k];
+        Center c = {sums[k].l/n, sums[k].a/n, sums[k].b/n, sums[k].x/n,
+                    sums[k].y/n};
+        centers[k] = c;
+      }
+    }
+  }
+
+  const int nlabels = EnforceConnectivity(W, H, max(1, S*S/4), &labels);
+  graph->sizes.assign(nlabels, 0);
+  for (int32_t l : labels) {
+    ++graph->sizes[l];
+  }
+  BuildAdjacency(graph);
+}
+
+void SuperpixelMeans(const SuperpixelGraph& graph, const double* values,
+                     vector<double>* means) {
+  means->assign(graph.NumNodes(), 0);
+  for (int i = 0; i < graph.W*graph.H; ++i) {
+    (*means)[graph.labels[i]] += values[i];
+  }
+  for (int n = 0; n < graph.NumNodes(); ++n) {
+    (*means)[n] /= graph.sizes[n];
+  }
+}
+
+bool GraphGeodesicDistanceMap(const SuperpixelGraph& graph,
+                              const vector<Point2i>& sources,
+                              const vector<double>& height,
+                              double* dists,
+                              const CancelFlag* cancel) {
+  LIBSEG_STAGE_TIMER(geodesic_ms);
+  LIBSEG_TRACE_SCOPE("GraphGeodesicDistanceMap");
+  typedef pair<double, int> Entry;
+  priority_queue<Entry, vector<Entry>, greater<Entry>> Q;
+  vector<double> node_dists(graph.NumNodes(),
+                            numeric_limits<double>::max());
+  for (const Point2i& p : sources) {
+    const int n = graph.labels[p.y*graph.W + p.x];
+    if (node_dists[n] != 0) {
+      node_dists[n] = 0;
+      Q.push(Entry(0, n));
+    }
+  }
+  if (IsCancelled(cancel)) {
+    return false;
+  }
+  LIBSEG_COUNT(geodesic_pushes, Q.size());
+  LIBSEG_STATS(uint64_t npops = 0);
+  LIBSEG_STATS(uint64_t nstale = 0);
+  LIBSEG_STATS(uint64_t nrelaxed = 0);
+  while (!Q.empty()) {
+    const Entry e = Q.top();
+    Q.pop();
+    const int u = e.second;
+    LIBSEG_STATS(++npops);
+    if (e.first > node_dists[u]) {
+      // Stale entry, u has been reached by a shorter path since
+      LIBSEG_STATS(++nstale);
+      continue;
+    }
+    for (int k = graph.offsets[u]; k < graph.offsets[u + 1]; ++k) {
+      const int v = graph.adjacency[k];
+      const double d = node_dists[u] + fabs(height[v] - height[u]);
+      if (d < node_dists[v]) {
+        node_dists[v] = d;
+        Q.push(Entry(d, v));
+        LIBSEG_STATS(++nrelaxed);
+      }
+    }
+  }
+  LIBSEG_COUNT(geodesic_pops, npops);
+  LIBSEG_COUNT(geodesic_stale_pops, nstale);
+  LIBSEG_COUNT(geodesic_relaxations, nrelaxed);
+  LIBSEG_COUNT(geodesic_pushes, nrelaxed);
+  for (int i = 0; i < graph.W*graph.H; ++i) {
+    dists[i] = node_dists[graph.labels[i]];
+  }
+  return true;
+}
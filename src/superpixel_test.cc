@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <vector>
+
+#include "superpixel.h"
+
+using namespace std;
+
+namespace {
+
+// A W*H lab image with a dark left part and a bright right part, the edge
+// not being aligned with the superpixel grid
+class SuperpixelTest : public ::testing::Test {
+ protected:
+  static const int W = 50;
+  static const int H = 40;
+  static const int kEdge = 23;
+
+  SuperpixelTest() : l(W*H), ab(W*H, 128) {
+    for (int i = 0; i < W*H; ++i) {
+      l[i] = (i % W < kEdge) ? 40 : 200;
+    }
+    channels[0] = l.data();
+    channels[1] = channels[2] = ab.data();
+  }
+
+  vector<uint8_t> l, ab;
+  const uint8_t* channels[3];
+};
+
+TEST_F(SuperpixelTest, SLICFollowsEdges) {
+  SuperpixelGraph graph;
+  ComputeSLIC(channels, W, H, 10, 10, &graph);
+  EXPECT_GT(graph.NumNodes(), 10);
+  EXPECT_LT(graph.NumNodes(), 40);
+
+  int total = 0;
+  for (int size : graph.sizes) {
+    total += size;
+  }
+  EXPECT_EQ(W*H, total);
+
+  // No superpixel straddles the edge
+  vector<int> side(graph.NumNodes(), -1);
+  for (int i = 0; i < W*H; ++i) {
+    const int s = (i % W < kEdge) ? 0 : 1;
+    const int n = graph.labels[i];
+    if (side[n] == -1) {
+      side[n] = s;
+    }
+    ASSERT_EQ(side[n], s) << "superpixel " << n;
+  }
+
+  // The adjacency is symmetric
+  for (int u = 0; u < graph.NumNodes(); ++u) {
+    for (int k = graph.offsets[u]; k < graph.offsets[u + 1]; ++k) {
+      const int v = graph.adjacency[k];
+      const auto begin = graph.adjacency.begin() + graph.offsets[v];
+      const auto end = graph.adjacency.begin() + graph.offsets[v + 1];
+      EXPECT_NE(end, find(begin, end, u));
+    }
+  }
+}
+
+TEST_F(SuperpixelTest, GraphGeodesicDistance) {
+  SuperpixelGraph graph;
+  ComputeSLIC(channels, W, H, 10, 10, &graph);
+  // Height is 0 on the left and 1 on the right
+  vector<double> height(W*H);
+  for (int i = 0; i < W*H; ++i) {
+    height[i] = (i % W < kEdge) ? 0 : 1;
+  }
+  vector<double> means;
+  SuperpixelMeans(graph, height.data(), &means);
+
+  vector<double> dists(W*H);
+  const vector<Point2i> sources{Point2i(2, 20)};
+  ASSERT_TRUE(GraphGeodesicDistanceMap(graph, sources, means, dists.data()));
+  for (int i = 0; i < W*H; ++i) {
+    EXPECT_DOUBLE_EQ((i % W < kEdge) ? 0 : 1, dists[i]);
+  }
+}
+
+}
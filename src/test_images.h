@@ -0,0 +1,40 @@
+#ifndef _LIBMATTING_TEST_IMAGES_H_
+#define _LIBMATTING_TEST_IMAGES_H_
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Test images shared by the *_test.cc files.
+
+// A W*H lab image with a dark left half and a bright right half
+struct TwoHalvesImage {
+  enum { W = 40, H = 30 };
+
+  TwoHalvesImage() : l(W*H), a(W*H, 128), b(W*H, 128) {
+    for (int y = 0; y < H; ++y) {
+      for (int x = 0; x < W; ++x) {
+        l[y*W + x] = (x < W/2) ? 40 : 200;
+      }
+    }
+  }
+
+  // A vertical line scribble at column x
+  static Scribble Line(int x, bool background) {
+    Scribble s;
+    s.background = background;
+    for (int y = 5; y < H - 5; ++y) {
+      s.pixels.push_back(Point2i(x, y));
+    }
+    return s;
+  }
+
+  std::vector<uint8_t> l, a, b;
+};
+
+class TwoHalvesTest : public ::testing::Test, public TwoHalvesImage {
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace trace {
+
+namespace internal {
+atomic<bool> enabled(false);
+}
+
+namespace {
+
+// Per-thread capacity, about 1.5MB per recording thread
+const size_t kMaxEvents = 1 << 16;
+
+struct Event {
+  const char* name;
+  double ts_us;
+  // Negative for instant events
+  double dur_us;
+};
+
+// Only the owner thread writes events. Readers see the first count events
+// once they have loaded count, and hold the registry mutex so that no new
+// recording starts, which would let the owner overwrite them.
+struct ThreadBuffer {
+  explicit ThreadBuffer(int tid)
+    : tid(tid), epoch(0), count(0), dropped(0) {}
+
+  const int tid;
+  // Protected by the registry mutex
+  string name;
+  // Allocated by the first recorded event
+  unique_ptr<Event[]> events;
+  // Recording the events belong to. The owner resets the buffer when it
+  // sees a new recording started
+  atomic<unsigned> epoch;
+  atomic<size_t> count;
+  atomic<size_t> dropped;
+};
+
+// The buffer of a thread that exits goes to free, and is taken over by the
+// next thread that records. Its events are still written until then, and
+// the new owner appends to them. So there are only as many buffers as
+// threads recording at the same time, and the tid of a buffer can stand for
+// several threads that ran one after the other.
+struct Registry {
+  mutex m;
+  vector<shared_ptr<ThreadBuffer>> buffers;
+  vector<ThreadBuffer*> free;
+  // Only changed with m held
+  atomic<unsigned> epoch;
+  Registry() : epoch(1) {}
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+// Hands the buffer of its thread back to the registry when the thread exits
+struct BufferOwner {
+  BufferOwner() : buffer(NULL) {}
+
+  ~BufferOwner() {
+    if (buffer) {
+      Registry& registry = GetRegistry();
+      lock_guard<mutex> lock(registry.m);
+      registry.free.push_back(buffer);
+    }
+  }
+
+  ThreadBuffer* buffer;
+};
+
+thread_local ThreadBuffer* thread_buffer = NULL;
+thread_local BufferOwner buffer_owner;
+
+ThreadBuffer* GetThreadBuffer() {
+  if (thread_buffer == NULL) {
+    Registry& registry = GetRegistry();
+    lock_guard<mutex> lock(registry.m);
+    if (!registry.free.empty()) {
+      thread_buffer = registry.free.back();
+      registry.free.pop_back();
+      thread_buffer->name.clear();
+    } else {
+      registry.buffers.emplace_back(
+          new ThreadBuffer((int)registry.buffers.size() + 1));
+      thread_buffer = registry.buffers.back().get();
+    }
+    buffer_owner.buffer = thread_buffer;
+  }
+  return thread_buffer;
+}
+
+void Record(const char* name, double ts_us, double dur_us) {
+  ThreadBuffer* buf = GetThreadBuffer();
+  if (!buf->events) {
+    buf->events.reset(new Event[kMaxEvents]);
+  }
+  const unsigned epoch = GetRegistry().epoch.load(memory_order_acquire);
+  if (buf->epoch.load(memory_order_relaxed) != epoch) {
+    buf->count.store(0, memory_order_relaxed);
+    buf->dropped.store(0, memory_order_relaxed);
+    buf->epoch.store(epoch, memory_order_release);
+  }
+  const size_t n = buf->count.load(memory_order_relaxed);
+  if (n == kMaxEvents) {
+    buf->dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  Event& e = buf->events[n];
+  e.name = name;
+  e.ts_us = ts_us;
+  e.dur_us = dur_us;
+  buf->count.store(n + 1, memory_order_release);
+}
+
+chrono::steady_clock::time_point Origin() {
+  static const chrono::steady_clock::time_point origin =
+      chrono::steady_clock::now();
+  return origin;
+}
+
+void WriteEscaped(ostream& out, const string& s) {
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if ((unsigned char)c < 0x20) {
+      out << ' ';
+    } else {
+      out << c;
+    }
+  }
+}
+
+}  // namespace
+
+void Start() {
+  // So that the origin is before any event
+  Origin();
+  Registry& registry = GetRegistry();
+  lock_guard<mutex> lock(registry.m);
+  registry.epoch.fetch_add(1, memory_order_release);
+  internal::enabled.store(true, memory_order_relaxed);
+}
+
+void Stop() {
+  internal::enabled.store(false, memory_order_relaxed);
+}
+
+void SetThreadName(const string& name) {
+  ThreadBuffer* buf = GetThreadBuffer();
+  lock_guard<mutex> lock(GetRegistry().m);
+  buf->name = name;
+}
+
+double internal::NowMicros() {
+  return chrono::duration<double, micro>(
+      chrono::steady_clock::now() - Origin()).count();
+}
+
+void internal::RecordComplete(const char* name, double start_us,
+                              double end_us) {
+  Record(name, start_us, end_us - start_us);
+}
+
+void Instant(const char* name) {
+  Record(name, internal::NowMicros(), -1);
+}
+
+void WriteJSON(ostream& out) {
+  Registry& registry = GetRegistry();
+  lock_guard<mutex> lock(registry.m);
+  const unsigned epoch = registry.epoch.load(memory_order_acquire);
+  const int pid = (int)getpid();
+  size_t dropped = 0;
+  const ios::fmtflags flags = out.flags();
+  const streamsize precision = out.precision(3);
+  out << fixed;
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+  auto separator = [&]() -> ostream& {
+    out << (first ? "  " : ",\n  ");
+    first = false;
+    return out;
+  };
+  for (const shared_ptr<ThreadBuffer>& buf : registry.buffers) {
+    if (!buf->name.empty()) {
+      separator() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": "
+                  << pid << ", \"tid\": " << buf->tid
+                  << ", \"args\": {\"name\": \"";
+      WriteEscaped(out, buf->name);
+      out << "\"}}";
+    }
+    if (buf->epoch.load(memory_order_acquire) != epoch) {
+      continue;
+    }
+    const size_t n = buf->count.load(memory_order_acquire);
+    dropped += buf->dropped.load(memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+      const Event& e = buf->events[i];
+      separator() << "{\"name\": \"" << e.name
+                  << "\", \"cat\": \"libseg\", \"pid\": " << pid
+                  << ", \"tid\": " << buf->tid << ", \"ts\": " << e.ts_us;
+      if (e.dur_us < 0) {
+        out << ", \"ph\": \"i\", \"s\": \"t\"}";
+      } else {
+        out << ", \"ph\": \"X\", \"dur\": " << e.dur_us << "}";
+      }
+    }
+  }
+  out << "\n], \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+bool WriteJSON(const string& filename) {
+  ofstream out(filename.c_str());
+  if (!out) {
+    return false;
+  }
+  WriteJSON(out);
+  return (bool)out;
+}
+
+size_t NumDropped() {
+  Registry& registry = GetRegistry();
+  lock_guard<mutex> lock(registry.m);
+  const unsigned epoch = registry.epoch.load(memory_order_acquire);
+  size_t dropped = 0;
+  for (const shared_ptr<ThreadBuffer>& buf : registry.buffers) {
+    if (buf->epoch.load(memory_order_acquire) == epoch) {
+      dropped += buf->dropped.load(memory_order_relaxed);
+    }
+  }
+  return dropped;
+}
+
+}  // namespace trace
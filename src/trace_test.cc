@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "api.h"
+#include "test_images.h"
+#include "trace.h"
+
+using namespace std;
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+namespace {
+
+#ifndef LIBSEG_NO_TRACE
+
+string TraceJSON() {
+  stringstream ss;
+  trace::WriteJSON(ss);
+  return ss.str();
+}
+
+TEST(Trace, RecordsOnlyWhileEnabled) {
+  trace::Start();
+  {
+    LIBSEG_TRACE_SCOPE("RecordedScope");
+    LIBSEG_TRACE_INSTANT("RecordedInstant");
+  }
+  trace::Stop();
+  {
+    LIBSEG_TRACE_SCOPE("NotRecordedScope");
+  }
+  const string json = TraceJSON();
+  EXPECT_THAT(json, HasSubstr("{\"displayTimeUnit\": \"ms\", "
+                              "\"traceEvents\": ["));
+  EXPECT_THAT(json, HasSubstr("\"name\": \"RecordedScope\""));
+  EXPECT_THAT(json, HasSubstr("\"ph\": \"X\", \"dur\": "));
+  EXPECT_THAT(json, HasSubstr("\"name\": \"RecordedInstant\""));
+  EXPECT_THAT(json, HasSubstr("\"ph\": \"i\""));
+  EXPECT_THAT(json, Not(HasSubstr("NotRecordedScope")));
+
+  // A new recording drops the previous events
+  trace::Start();
+  trace::Stop();
+  EXPECT_THAT(TraceJSON(), Not(HasSubstr("RecordedScope")));
+}
+
+TEST(Trace, EventsOfOtherThreads) {
+  trace::Start();
+  thread t([] {
+    trace::SetThreadName("helper \"thread\"");
+    LIBSEG_TRACE_SCOPE("HelperScope");
+  });
+  t.join();
+  trace::Stop();
+  const string json = TraceJSON();
+  EXPECT_THAT(json, HasSubstr("\"name\": \"HelperScope\""));
+  EXPECT_THAT(json, HasSubstr("\"args\": {\"name\": \"helper \\\"thread\\\"\"}"));
+}
+
+TEST(Trace, ReusesBuffersOfExitedThreads) {
+  trace::Start();
+  for (int i = 0; i < 8; ++i) {
+    thread t([] {
+      LIBSEG_TRACE_SCOPE("ShortLivedScope");
+    });
+    t.join();
+  }
+  trace::Stop();
+  // All the events are written, from a single buffer
+  const string json = TraceJSON();
+  vector<string> tids;
+  const string name = "\"name\": \"ShortLivedScope\"";
+  for (size_t pos = json.find(name); pos != string::npos;
+       pos = json.find(name, pos + 1)) {
+    const size_t tid = json.find("\"tid\": ", pos);
+    tids.push_back(json.substr(tid, json.find(',', tid) - tid));
+  }
+  ASSERT_EQ(8u, tids.size());
+  for (const string& tid : tids) {
+    EXPECT_EQ(tids[0], tid);
+  }
+}
+
+TEST(Trace, DropsEventsThatDontFit) {
+  trace::Start();
+  for (int i = 0; i < (1 << 16) + 10; ++i) {
+    LIBSEG_TRACE_INSTANT("Spam");
+  }
+  trace::Stop();
+  EXPECT_EQ(10u, trace::NumDropped());
+  EXPECT_THAT(TraceJSON(), HasSubstr("\"dropped_events\": 10"));
+}
+
+TEST(Trace, PipelineStages) {
+  TwoHalvesImage img;
+  InteractiveMatter matter(img.l.data(), img.a.data(), img.b.data(),
+                           TwoHalvesImage::W, TwoHalvesImage::H);
+
+  trace::Start();
+  matter.AddScribble(TwoHalvesImage::Line(5, false));
+  trace::Stop();
+  const string json = TraceJSON();
+  EXPECT_THAT(json, HasSubstr("InteractiveMatter::AddScribbles"));
+  EXPECT_THAT(json, HasSubstr("ColorChannelKDE"));
+  EXPECT_THAT(json, HasSubstr("GeodesicPropagation::Run"));
+  EXPECT_THAT(json, HasSubstr("Matter::UpdateFinalMask"));
+}
+
+#endif
+
+}
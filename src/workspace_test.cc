@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "api.h"
+
+using namespace std;
+
+// Replace the global allocation functions to count the allocations made by
+// the calling thread while an AllocationCounter is alive
+namespace {
+thread_local size_t* allocations = NULL;
+
+// Not inlined in the delete operators, otherwise gcc warns about free being
+// called on pointers returned by new
+__attribute__((noinline)) void Release(void* p) {
+  free(p);
+}
+}
+
+void* operator new(size_t size) {
+  if (allocations) {
+    ++*allocations;
+  }
+  void* p = malloc(size == 0 ? 1 : size);
+  if (!p) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  Release(p);
+}
+
+void operator delete[](void* p) noexcept {
+  Release(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  Release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  Release(p);
+}
+
+namespace {
+
+class AllocationCounter {
+ public:
+  AllocationCounter() : count_(0) {
+    allocations = &count_;
+  }
+  ~AllocationCounter() {
+    allocations = NULL;
+  }
+  size_t count() const { return count_; }
+
+ private:
+  size_t count_;
+};
+
+// A two-tone image with some noise, so that the color models have a few
+// distinct values
+struct TestImage {
+  TestImage(int W, int H) : W(W), H(H), l(W*H), a(W*H), b(W*H) {
+    unsigned rng = 12345;
+    for (int y = 0; y < H; ++y) {
+      for (int x = 0; x < W; ++x) {
+        rng = rng*1103515245 + 12345;
+        const int noise = (rng >> 16) % 8;
+        const bool inside = x > W/4 && x < 3*W/4 && y > H/4 && y < 3*H/4;
+        l[y*W + x] = (inside ? 200 : 50) + noise;
+        a[y*W + x] = (inside ? 100 : 140) + noise;
+        b[y*W + x] = 128 + noise;
+      }
+    }
+  }
+  int W, H;
+  vector<uint8_t> l, a, b;
+};
+
+Scribble HorizontalScribble(int x0, int x1, int y, bool background) {
+  Scribble s;
+  s.background = background;
+  for (int x = x0; x < x1; ++x) {
+    s.pixels.push_back(Point2i(x, y));
+  }
+  return s;
+}
+
+TEST(Workspace, SimpleMatterUpdateDoesNotAllocate) {
+  const int W = 64, H = 48;
+  TestImage img(W, H);
+  SimpleMatter matter(img.l.data(), img.a.data(), img.b.data(), W, H);
+
+  vector<uint8_t> bg(W*H, 0), fg(W*H, 0);
+  for (int x = 2; x < W - 2; ++x) {
+    bg[2*W + x] = 1;
+    fg[(H/2)*W + x/2 + W/4] = 1;
+  }
+  // Warm up the workspace
+  matter.UpdateMasks(bg.data(), fg.data());
+  vector<uint8_t> expected(W*H);
+  matter.GetForegroundMask(expected.data());
+
+  // Same number of samples, different pixels
+  bg[2*W + 2] = 0;
+  bg[(H - 3)*W + 2] = 1;
+  size_t count;
+  {
+    AllocationCounter counter;
+    matter.UpdateMasks(bg.data(), fg.data());
+    count = counter.count();
+  }
+  EXPECT_EQ(0u, count);
+  vector<uint8_t> mask(W*H);
+  matter.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+}
+
+TEST(Workspace, InteractiveMatterOnlyAllocatesForTheScribble) {
+  const int W = 64, H = 48;
+  TestImage img(W, H);
+  InteractiveMatter matter(img.l.data(), img.a.data(), img.b.data(), W, H);
+
+  // Warm up with a few scribbles of both classes
+  for (int i = 0; i < 3; ++i) {
+    matter.AddScribble(HorizontalScribble(W/3, 2*W/3, H/2 + i, false));
+    matter.AddScribble(HorizontalScribble(2, W - 2, 2 + i, true));
+  }
+
+  // Storing the scribble is one allocation for its pixels. The scribbles and
+  // groups vectors and the sources in the workspace have room left after the
+  // warm up, so they don't grow
+  const Scribble s = HorizontalScribble(2, W - 2, H - 3, true);
+  size_t count;
+  {
+    AllocationCounter counter;
+    matter.AddScribble(s);
+    count = counter.count();
+  }
+  EXPECT_EQ(1u, count);
+  EXPECT_EQ(7, matter.NumScribbles());
+}
+
+TEST(Workspace, SharedBetweenMatters) {
+  const int W = 32, H = 24;
+  TestImage img(W, H);
+  vector<uint8_t> bg(W*H, 0), fg(W*H, 0);
+  for (int x = 1; x < W - 1; ++x) {
+    bg[W + x] = 1;
+  }
+  fg[(H/2)*W + W/2] = 1;
+
+  SimpleMatter reference(img.l.data(), img.a.data(), img.b.data(), W, H);
+  reference.UpdateMasks(bg.data(), fg.data());
+  vector<uint8_t> expected(W*H);
+  reference.GetForegroundMask(expected.data());
+
+  Workspace ws;
+  SimpleMatter m1(img.l.data(), img.a.data(), img.b.data(), W, H);
+  SimpleMatter m2(img.l.data(), img.a.data(), img.b.data(), W, H);
+  m1.SetWorkspace(&ws);
+  m2.SetWorkspace(&ws);
+  m1.UpdateMasks(bg.data(), fg.data());
+  m2.UpdateMasks(bg.data(), fg.data());
+
+  vector<uint8_t> mask(W*H);
+  m1.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+  m2.GetForegroundMask(mask.data());
+  EXPECT_EQ(expected, mask);
+}
+
+}
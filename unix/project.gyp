@@ -25,7 +25,10 @@
     {
       'target_name' : 'miniglog',
       'type': 'static_library',
-      'cflags': [],
+      # Linked in the shared library
+      'cflags': [
+        '-fPIC',
+      ],
       'sources': [
         '<(SRCDIR)/third_party/miniglog/glog/logging.cc'
       ],
@@ -74,17 +77,36 @@
       'type': 'static_library',
       'sources':[
         '<(SRCDIR)/api.cc',
+        '<(SRCDIR)/async.cc',
+        '<(SRCDIR)/c_api.cc',
+        '<(SRCDIR)/color_model.cc',
+        '<(SRCDIR)/contour.cc',
+        '<(SRCDIR)/encoding.cc',
         '<(SRCDIR)/kde.cc',
         '<(SRCDIR)/geodesic.cc',
+        '<(SRCDIR)/image.cc',
         '<(SRCDIR)/matting.cc',
+        '<(SRCDIR)/pyramid.cc',
+        '<(SRCDIR)/recording.cc',
+        '<(SRCDIR)/results.cc',
+        '<(SRCDIR)/session.cc',
+        '<(SRCDIR)/stats.cc',
+        '<(SRCDIR)/stroke.cc',
+        '<(SRCDIR)/superpixel.cc',
+        '<(SRCDIR)/trace.cc',
       ],
       'include_dirs':[
         '<(FIGTREE)/include/figtree/',
       ],
+      'cflags': [
+        '-pthread',
+        '-fPIC',
+      ],
       'direct_dependent_settings': {
         'libraries': [
           '-L<(FIGTREE)/unix/',
           '-lfigtree',
+          '-lpthread',
         ]
       },
       'export_dependent_settings': [
@@ -94,6 +116,15 @@
         'miniglog',
       ]
     },
+    {
+      # The C API (libseg_c.h) as a shared library, for FFI consumers. It is
+      # compiled in libmatting, which gyp links whole into shared libraries
+      'target_name' : 'seg',
+      'type': 'shared_library',
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
     {
       'target_name' : 'main',
       'type' : 'executable',
@@ -155,6 +186,124 @@
       ]
     },
 
+    {
+      'target_name' : 'benchmarks',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/synthetic.cc',
+        'tools/benchmarks.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
+    {
+      'target_name' : 'evaluate',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/synthetic.cc',
+        'tools/evaluate.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
+
+    {
+      'target_name' : 'segment_batch',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/netpbm.cc',
+        'tools/segment_batch.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'cflags': [
+        '-pthread',
+      ],
+      'ldflags': [
+        '-pthread',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
+
+    {
+      'target_name' : 'segment_server',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/protocol.cc',
+        'tools/segment_server.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'cflags': [
+        '-pthread',
+      ],
+      'ldflags': [
+        '-pthread',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
+    {
+      'target_name' : 'segment_load',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/protocol.cc',
+        'tools/synthetic.cc',
+        'tools/segment_load.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'cflags': [
+        '-pthread',
+      ],
+      'ldflags': [
+        '-pthread',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
+
+    {
+      'target_name' : 'segment_replay',
+      'type' : 'executable',
+      'sources':[
+        'tools/flags.cc',
+        'tools/netpbm.cc',
+        'tools/segment_replay.cc',
+      ],
+      'include_dirs': [
+        'tools',
+      ],
+      'cflags': [
+        '-pthread',
+      ],
+      'ldflags': [
+        '-pthread',
+      ],
+      'dependencies' : [
+        'libmatting',
+      ]
+    },
 
     {
       'target_name' : 'tests',
@@ -162,6 +311,22 @@
       'sources':[
         '<(SRCDIR)/kde_test.cc',
         '<(SRCDIR)/geodesic_test.cc',
+        '<(SRCDIR)/image_test.cc',
+        '<(SRCDIR)/api_test.cc',
+        '<(SRCDIR)/c_api_test.cc',
+        '<(SRCDIR)/color_model_test.cc',
+        '<(SRCDIR)/snapshot_test.cc',
+        '<(SRCDIR)/encoding_test.cc',
+        '<(SRCDIR)/contour_test.cc',
+        '<(SRCDIR)/pyramid_test.cc',
+        '<(SRCDIR)/results_test.cc',
+        '<(SRCDIR)/superpixel_test.cc',
+        '<(SRCDIR)/recording_test.cc',
+        '<(SRCDIR)/session_test.cc',
+        '<(SRCDIR)/stats_test.cc',
+        '<(SRCDIR)/stroke_test.cc',
+        '<(SRCDIR)/trace_test.cc',
+        '<(SRCDIR)/workspace_test.cc',
       ],
       'dependencies' : [
         'gtest_mock',
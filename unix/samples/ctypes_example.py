@@ -0,0 +1,115 @@
+"""Segments a synthetic image through the C API (libseg_c.h) with ctypes.
+
+No data is copied at the boundary : the planes passed to the library are
+views of the NumPy arrays (with their strides), and the results are written
+directly into NumPy arrays.
+
+Usage (from unix/, after building the 'seg' target) :
+  ./run.sh python samples/ctypes_example.py [path/to/libseg.so]
+"""
+import ctypes
+import sys
+
+import numpy as np
+
+LIBSEG_C_API_VERSION = 1
+LIBSEG_OK = 0
+LIBSEG_SIMPLE_MATTER = 0
+
+
+class Plane(ctypes.Structure):
+    _fields_ = [
+        ('data', ctypes.c_void_p),
+        ('width', ctypes.c_int),
+        ('height', ctypes.c_int),
+        ('row_stride', ctypes.c_ssize_t),
+        ('pixel_stride', ctypes.c_ssize_t),
+    ]
+
+
+def plane(arr):
+    """A libseg_plane viewing the 2D array arr, without copying it"""
+    assert arr.ndim == 2
+    return Plane(arr.ctypes.data, arr.shape[1], arr.shape[0],
+                 arr.strides[0], arr.strides[1])
+
+
+class LibsegError(Exception):
+    pass
+
+
+def load(path):
+    lib = ctypes.CDLL(path)
+    lib.libseg_api_version.restype = ctypes.c_int
+    lib.libseg_last_error.restype = ctypes.c_char_p
+    lib.libseg_matter_free.restype = None
+    lib.libseg_matter_free.argtypes = [ctypes.c_void_p]
+    plane_p = ctypes.POINTER(Plane)
+    signatures = {
+        'libseg_matter_new': [ctypes.c_int, plane_p, plane_p, plane_p,
+                              ctypes.POINTER(ctypes.c_void_p)],
+        'libseg_matter_update_masks': [ctypes.c_void_p, plane_p, plane_p],
+        'libseg_matter_get_mask': [ctypes.c_void_p, plane_p],
+        'libseg_matter_get_dist': [ctypes.c_void_p, ctypes.c_int, plane_p],
+    }
+    for name, argtypes in signatures.items():
+        f = getattr(lib, name)
+        f.argtypes = argtypes
+        f.restype = ctypes.c_int
+    version = lib.libseg_api_version()
+    if version != LIBSEG_C_API_VERSION:
+        raise LibsegError('Expected C API version %d, got %d'
+                          % (LIBSEG_C_API_VERSION, version))
+    return lib
+
+
+def check(lib, status):
+    if status != LIBSEG_OK:
+        raise LibsegError(lib.libseg_last_error().decode())
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else 'out/Default/lib/libseg.so'
+    lib = load(path)
+
+    # An interleaved H x W x 3 lab image : a bright disc on a dark background
+    H, W = 120, 160
+    yy, xx = np.mgrid[0:H, 0:W]
+    inside = (xx - W/2)**2 + (yy - H/2)**2 < 40**2
+    lab = np.empty((H, W, 3), dtype=np.uint8)
+    lab[..., 0] = np.where(inside, 200, 60)
+    lab[..., 1] = np.where(inside, 110, 140)
+    lab[..., 2] = 128
+    lab[..., 0] += np.random.randint(0, 8, (H, W)).astype(np.uint8)
+
+    # The channels are strided views of the interleaved array
+    l, a, b = (plane(lab[..., c]) for c in range(3))
+    matter = ctypes.c_void_p()
+    check(lib, lib.libseg_matter_new(LIBSEG_SIMPLE_MATTER, l, a, b,
+                                     ctypes.byref(matter)))
+    try:
+        bg = np.zeros((H, W), dtype=np.uint8)
+        bg[5, 5:W - 5] = 1
+        fg = np.zeros((H, W), dtype=np.uint8)
+        fg[H//2, W//2 - 20:W//2 + 20] = 1
+        check(lib, lib.libseg_matter_update_masks(matter, plane(bg),
+                                                  plane(fg)))
+
+        mask = np.empty((H, W), dtype=np.uint8)
+        check(lib, lib.libseg_matter_get_mask(matter, plane(mask)))
+        # Any plane works as output, here every other column of a wider array
+        fg_dist = np.zeros((H, 2*W), dtype=np.float64)
+        check(lib, lib.libseg_matter_get_dist(matter, 0,
+                                              plane(fg_dist[:, ::2])))
+
+        iou = (np.logical_and(mask > 0, inside).sum()
+               / float(np.logical_or(mask > 0, inside).sum()))
+        print('Foreground pixels : %d, IoU with the disc : %.3f'
+              % ((mask > 0).sum(), iou))
+        print('Max fg distance : %.3f' % fg_dist[:, ::2].max())
+    finally:
+        lib.libseg_matter_free(matter)
+
+
+if __name__ == '__main__':
+    main()
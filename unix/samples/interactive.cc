@@ -11,6 +11,7 @@
 #include "cvutils.h"
 
 #include "api.h"
+#include "async.h"
 
 using boost::scoped_ptr;
 using boost::scoped_array;
@@ -25,8 +26,9 @@ enum DrawMode {
 };
 DrawMode draw_mode = DRAW_BG;
 bool drawing = false;
-scoped_ptr<Scribble> current_scribble;
-scoped_ptr<InteractiveMatter> matter;
+scoped_ptr<Stroke> current_stroke;
+// Updates run on the matter's worker thread so the UI never blocks on them
+scoped_ptr<AsyncInteractiveMatter> matter;
 
 // Used to track cursor movements between two MOUSEMOVE events. For example
 // on OSX, it seems the MOUSEMOVE events have a somewhat important interval
@@ -41,7 +43,6 @@ static void DrawScribbleCircle(int x, int y) {
   for (int dx = -radius; dx <=radius; ++dx) {
     for (int dy = -radius; dy <=radius; ++dy) {
       if ((dx*dx + dy*dy) <= rr) {
-        current_scribble->pixels.push_back(::Point2i(x + dx, y + dy));
         if (draw_mode == DRAW_FG) {
           fg_layer.at<uint8_t>(y + dy, x + dx) = 255;
         } else {
@@ -60,21 +61,27 @@ static void OnMouse(int event, int x, int y, int, void*) {
   if (event == EVENT_LBUTTONDOWN) {
     drawing = true;
     draw_mode = DRAW_FG;
-    current_scribble.reset(new Scribble);
-    current_scribble->background = false;
+    current_stroke.reset(new Stroke);
+    current_stroke->background = false;
+    current_stroke->radius = SCRIBLE_RADIUS;
+    current_stroke->points.push_back(::Point2i(x, y));
     x_prev = x;
     y_prev = y;
   } else if (event == EVENT_RBUTTONDOWN) {
     drawing = true;
     draw_mode = DRAW_BG;
-    current_scribble.reset(new Scribble);
-    current_scribble->background = true;
+    current_stroke.reset(new Stroke);
+    current_stroke->background = true;
+    current_stroke->radius = SCRIBLE_RADIUS;
+    current_stroke->points.push_back(::Point2i(x, y));
     x_prev = x;
     y_prev = y;
   } else if (event == EVENT_MOUSEMOVE && drawing) {
     if (x_prev != -1 && y_prev != -1) {
-      // Draw scribbles on a line between (x_prev, y_prev) and (x,y), spaced
-      // by SCRIBBLE_RADIUS
+      // The stroke only needs the cursor positions, the library rasterizes
+      // it. The circles drawn on a line between (x_prev, y_prev) and (x,y),
+      // spaced by SCRIBBLE_RADIUS, are for display
+      current_stroke->points.push_back(::Point2i(x, y));
       const int d[2] = { x - x_prev, y - y_prev };
       const float len = Length(d);
       const float nsteps = len / (float)SCRIBLE_RADIUS;
@@ -90,14 +97,9 @@ static void OnMouse(int event, int x, int y, int, void*) {
       y_prev = y;
     }
   } else if (event == EVENT_LBUTTONUP || event == EVENT_RBUTTONUP) {
-    if (current_scribble->pixels.size() > 0) {
-      LOG(INFO) << "-- Adding scribble";
-      matter->AddScribble(*current_scribble);
-      LOG(INFO) << "-- done";
-    } else {
-      LOG(INFO) << "-- Ignoring empty scribble";
-    }
-    current_scribble.reset();
+    LOG(INFO) << "-- Queuing stroke";
+    matter->AddStroke(*current_stroke);
+    current_stroke.reset();
     drawing = false;
     x_prev = -1;
     y_prev = -1;
@@ -141,26 +143,17 @@ int main(int argc, char** argv) {
   lab.push_back(cv::Mat(H, W, CV_8U, lab_b.get()));
   cv::split(img_lab, lab);
 
-  matter.reset(new InteractiveMatter(lab_l.get(), lab_a.get(), lab_b.get(),
-                                     W, H));
-
-  scoped_array<double> fg_likelihood(new double[W*H]);
-  cv::Mat fg_likelihood_mat(H, W, CV_64F, fg_likelihood.get());
-  fg_likelihood_mat.setTo(0);
-  scoped_array<double> bg_likelihood(new double[W*H]);
-  cv::Mat bg_likelihood_mat(H, W, CV_64F, bg_likelihood.get());
-  bg_likelihood_mat.setTo(0);
-
-  scoped_array<double> fg_dist(new double[W*H]);
-  Mat fg_dist_mat(H, W, CV_64F, fg_dist.get());
-  fg_dist_mat.setTo(0);
-  scoped_array<double> bg_dist(new double[W*H]);
-  Mat bg_dist_mat(H, W, CV_64F, bg_dist.get());
-  bg_dist_mat.setTo(0);
+  matter.reset(new AsyncInteractiveMatter(lab_l.get(), lab_a.get(),
+                                          lab_b.get(), W, H));
 
-  scoped_array<uint8_t> final_mask(new uint8_t[W*H]);
-  cv::Mat final_mask_mat(H, W, CV_8UC1, final_mask.get());
-  final_mask_mat.setTo(0);
+  // Views of the displayed results, which are kept alive by shown. Blank
+  // until the first results are published
+  shared_ptr<const Results> shown;
+  Mat fg_likelihood_mat(H, W, CV_64F, Scalar::all(0));
+  Mat bg_likelihood_mat(H, W, CV_64F, Scalar::all(0));
+  Mat fg_dist_mat(H, W, CV_64F, Scalar::all(0));
+  Mat bg_dist_mat(H, W, CV_64F, Scalar::all(0));
+  Mat final_mask_mat(H, W, CV_8UC1, Scalar::all(0));
 
   int nscribbles = matter->NumScribbles();
 
@@ -186,14 +179,23 @@ int main(int argc, char** argv) {
     }
     imshow("img", disp_img);
 
-    // Refresh images from matter if something has changed
+    // Refresh images from matter if a new mask is ready
     if (matter->NumScribbles() != nscribbles) {
       LOG(INFO) << "Refreshing from matter";
-      matter->GetForegroundLikelihood(fg_likelihood.get());
-      matter->GetBackgroundLikelihood(bg_likelihood.get());
-      matter->GetForegroundDist(fg_dist.get());
-      matter->GetBackgroundDist(bg_dist.get());
-      matter->GetForegroundMask(final_mask.get());
+      // Show everything from the same results so the displayed images are
+      // consistent. The published results are never modified, so the
+      // matrices can wrap their planes
+      shown = matter->LatestResults();
+      fg_likelihood_mat = Mat(H, W, CV_64F,
+                              const_cast<double*>(shown->fg_likelihood.data()));
+      bg_likelihood_mat = Mat(H, W, CV_64F,
+                              const_cast<double*>(shown->bg_likelihood.data()));
+      fg_dist_mat = Mat(H, W, CV_64F,
+                        const_cast<double*>(shown->fg_dist.data()));
+      bg_dist_mat = Mat(H, W, CV_64F,
+                        const_cast<double*>(shown->bg_dist.data()));
+      final_mask_mat = Mat(H, W, CV_8UC1,
+                           const_cast<uint8_t*>(shown->mask.data()));
       nscribbles = matter->NumScribbles();
     }
     ImageSC<double>(fg_likelihood_mat, "fg_likelihood", false, false);
@@ -220,8 +222,8 @@ int main(int argc, char** argv) {
       LOG(INFO) << "Reset";
       fg_layer.setTo(0);
       bg_layer.setTo(0);
-      matter.reset(new InteractiveMatter(lab_l.get(), lab_a.get(),
-                                         lab_b.get(), W, H));
+      matter.reset(new AsyncInteractiveMatter(lab_l.get(), lab_a.get(),
+                                              lab_b.get(), W, H));
     }
   }
 }
@@ -29,8 +29,6 @@ DrawMode draw_mode = DRAW_BG;
 bool drawing = false;
 scoped_ptr<SimpleMatter> matter;
 
-bool changed = true;
-
 // Used to track cursor movements between two MOUSEMOVE events. For example
 // on OSX, it seems the MOUSEMOVE events have a somewhat important interval
 // between them
@@ -64,7 +62,6 @@ static void UpdateMatter() {
   CHECK(fg_layer.isContinuous());
   CHECK(bg_layer.isContinuous());
   matter->UpdateMasks(bg_layer.ptr<uint8_t>(), fg_layer.ptr<uint8_t>());
-  changed = true;
   LOG(INFO) << "-- done";
 }
 
@@ -145,24 +142,6 @@ int main(int argc, char** argv) {
   matter.reset(new SimpleMatter(lab_l.get(), lab_a.get(), lab_b.get(),
                                 W, H));
 
-  scoped_array<double> fg_likelihood(new double[W*H]);
-  cv::Mat fg_likelihood_mat(H, W, CV_64F, fg_likelihood.get());
-  fg_likelihood_mat.setTo(0);
-  scoped_array<double> bg_likelihood(new double[W*H]);
-  cv::Mat bg_likelihood_mat(H, W, CV_64F, bg_likelihood.get());
-  bg_likelihood_mat.setTo(0);
-
-  scoped_array<double> fg_dist(new double[W*H]);
-  Mat fg_dist_mat(H, W, CV_64F, fg_dist.get());
-  fg_dist_mat.setTo(0);
-  scoped_array<double> bg_dist(new double[W*H]);
-  Mat bg_dist_mat(H, W, CV_64F, bg_dist.get());
-  bg_dist_mat.setTo(0);
-
-  scoped_array<uint8_t> final_mask(new uint8_t[W*H]);
-  cv::Mat final_mask_mat(H, W, CV_8UC1, final_mask.get());
-  final_mask_mat.setTo(0);
-
   Mat result(img.rows, img.cols, img.type(), Scalar::all(0));
 
   while (true) {
@@ -185,16 +164,18 @@ int main(int argc, char** argv) {
     }
     imshow("img", disp_img);
 
-    // Refresh images from matter if something has changed
-    if (changed) {
-      LOG(INFO) << "Refreshing from matter";
-      matter->GetForegroundLikelihood(fg_likelihood.get());
-      matter->GetBackgroundLikelihood(bg_likelihood.get());
-      matter->GetForegroundDist(fg_dist.get());
-      matter->GetBackgroundDist(bg_dist.get());
-      matter->GetForegroundMask(final_mask.get());
-      changed = false;
-    }
+    // The matter is only updated from this thread, so display its results
+    // directly instead of copying them
+    Mat fg_likelihood_mat(H, W, CV_64F,
+        const_cast<double*>(matter->ForegroundLikelihoodView()));
+    Mat bg_likelihood_mat(H, W, CV_64F,
+        const_cast<double*>(matter->BackgroundLikelihoodView()));
+    Mat fg_dist_mat(H, W, CV_64F,
+        const_cast<double*>(matter->ForegroundDistView()));
+    Mat bg_dist_mat(H, W, CV_64F,
+        const_cast<double*>(matter->BackgroundDistView()));
+    Mat final_mask_mat(H, W, CV_8UC1,
+        const_cast<uint8_t*>(matter->ForegroundMaskView()));
     ImageSC<double>(fg_likelihood_mat, "fg_likelihood", false, false);
     ImageSC<double>(bg_likelihood_mat, "bg_likelihood", false, false);
 
@@ -0,0 +1,439 @@
+// Stage-level benchmarks on synthetic images. This doesn't depend on OpenCV
+// so it can run on headless machines.
+//
+// Usage :
+//   benchmarks [--sizes=0.3,1,4,12,50] [--coverage=0.001,0.01,0.05]
+//              [--stages=kde,pdf,...] [--repeat=3] [--seed=1]
+//              [--format=table|csv|json]
+//
+// sizes are in megapixels and coverage is the fraction of the image pixels
+// covered by scribbles (half foreground, half background).
+//
+// Each (size, coverage, stage) combination runs in its own forked process so
+// that the reported peak memory (the max resident set size of the process)
+// only accounts for that stage.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "flags.h"
+#include "geodesic.h"
+#include "kde.h"
+#include "matting.h"
+#include "synthetic.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Config {
+  Config()
+    : sizes({0.3, 1, 4, 12, 50}),
+      coverages({0.001, 0.01, 0.05}),
+      stages({"kde", "pdf", "likelihood", "geodesic", "final_mask",
+              "update_masks", "add_scribble"}),
+      repeat(3),
+      seed(1),
+      format("table") {}
+
+  vector<double> sizes;
+  vector<double> coverages;
+  vector<string> stages;
+  int repeat;
+  unsigned seed;
+  string format;
+};
+
+struct Result {
+  string stage;
+  int W, H;
+  double coverage;
+  // Per-repeat wall-clock time of the stage, in milliseconds
+  vector<double> times_ms;
+  // Peak resident set size of the benchmark process, and the part of it
+  // that was reached while running the stage (the rest being the synthetic
+  // image and the stage inputs)
+  long peak_rss_kb;
+  long stage_rss_kb;
+  bool ok;
+};
+
+// Inputs shared by the stages. Each stage only computes the ones it needs.
+struct Inputs {
+  SyntheticImage img;
+  vector<Scribble> fg_scribbles, bg_scribbles, scribbles;
+  vector<uint8_t> fg_mask, bg_mask;
+  unique_ptr<double[]> fg_pdf, bg_pdf, fg_likelihood, bg_likelihood;
+  unique_ptr<double[]> fg_dist, bg_dist;
+};
+
+long MaxRSSKb() {
+  struct rusage usage;
+  CHECK_EQ(getrusage(RUSAGE_SELF, &usage), 0);
+  // Linux reports ru_maxrss in kilobytes
+  return usage.ru_maxrss;
+}
+
+void Usage(const char* prog) {
+  cerr << "Usage : " << prog << " [--sizes=0.3,1,4,12,50]"
+       << " [--coverage=0.001,0.01,0.05] [--stages=kde,pdf,likelihood,"
+       << "geodesic,final_mask,update_masks,add_scribble] [--repeat=3]"
+       << " [--seed=1] [--format=table|csv|json]" << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--sizes", &value)) {
+      SplitDoubles(value, &config->sizes);
+    } else if (ParseFlag(argv[i], "--coverage", &value)) {
+      SplitDoubles(value, &config->coverages);
+    } else if (ParseFlag(argv[i], "--stages", &value)) {
+      SplitList(value, &config->stages);
+    } else if (ParseFlag(argv[i], "--repeat", &value)) {
+      config->repeat = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--seed", &value)) {
+      config->seed = (unsigned)atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--format", &value)) {
+      config->format = value;
+    } else {
+      return false;
+    }
+  }
+  return config->format == "table" || config->format == "csv" ||
+         config->format == "json";
+}
+
+// 4:3 image with about megapixels * 1e6 pixels
+void ImageSize(double megapixels, int* W, int* H) {
+  *W = max(4, (int)round(sqrt(megapixels*1e6*4.0/3.0)));
+  *H = max(3, (int)round(megapixels*1e6 / *W));
+}
+
+// Inputs of a stage, computed (untimed) by running the previous stages
+enum Need {
+  NEED_PDF = 1,
+  NEED_LIKELIHOOD = 2,
+  NEED_DIST = 4,
+};
+
+int StageNeeds(const string& stage) {
+  if (stage == "likelihood") {
+    return NEED_PDF;
+  } else if (stage == "geodesic") {
+    return NEED_LIKELIHOOD;
+  } else if (stage == "final_mask") {
+    return NEED_DIST;
+  }
+  return 0;
+}
+
+void Prepare(int needs, Inputs* in) {
+  SyntheticImage& img = in->img;
+  const int W = img.W, H = img.H;
+  const uint8_t* channels[3] = { img.l.data(), img.a.data(), img.b.data() };
+  if (needs & (NEED_PDF | NEED_LIKELIHOOD | NEED_DIST)) {
+    in->fg_pdf.reset(new double[W*H]);
+    in->bg_pdf.reset(new double[W*H]);
+    ImageColorPDF(channels, in->fg_mask.data(), W, H, in->fg_pdf.get());
+    ImageColorPDF(channels, in->bg_mask.data(), W, H, in->bg_pdf.get());
+  }
+  if (needs & (NEED_LIKELIHOOD | NEED_DIST)) {
+    in->fg_likelihood.reset(new double[W*H]);
+    in->bg_likelihood.reset(new double[W*H]);
+    ForegroundLikelihood(in->fg_pdf.get(), in->bg_pdf.get(), W, H,
+                         in->fg_likelihood.get());
+    ForegroundLikelihood(in->bg_pdf.get(), in->fg_pdf.get(), W, H,
+                         in->bg_likelihood.get());
+  }
+  if (needs & NEED_DIST) {
+    in->fg_dist.reset(new double[W*H]);
+    in->bg_dist.reset(new double[W*H]);
+    GeodesicDistanceMap(in->fg_scribbles, false, in->fg_likelihood.get(),
+                        W, H, in->fg_dist.get());
+    GeodesicDistanceMap(in->bg_scribbles, true, in->bg_likelihood.get(),
+                        W, H, in->bg_dist.get());
+  }
+}
+
+double ElapsedMs(const steady_clock::time_point& start) {
+  return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+// Runs one stage repeat times and returns the per-repeat times. The
+// per-repeat setup (e.g. creating a new matter) is excluded from the timings
+bool RunStage(const string& stage, int repeat, Inputs* in,
+              vector<double>* times_ms) {
+  SyntheticImage& img = in->img;
+  const int W = img.W, H = img.H;
+  const uint8_t* channels[3] = { img.l.data(), img.a.data(), img.b.data() };
+
+  if (stage == "kde") {
+    for (int r = 0; r < repeat; ++r) {
+      vector<double> probs;
+      const auto start = steady_clock::now();
+      ColorChannelKDE(img.l.data(), in->fg_mask.data(), W, H, true, &probs);
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "pdf") {
+    unique_ptr<double[]> pdf(new double[W*H]);
+    for (int r = 0; r < repeat; ++r) {
+      const auto start = steady_clock::now();
+      ImageColorPDF(channels, in->fg_mask.data(), W, H, pdf.get());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "likelihood") {
+    unique_ptr<double[]> likelihood(new double[W*H]);
+    for (int r = 0; r < repeat; ++r) {
+      const auto start = steady_clock::now();
+      ForegroundLikelihood(in->fg_pdf.get(), in->bg_pdf.get(), W, H,
+                           likelihood.get());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "geodesic") {
+    unique_ptr<double[]> dist(new double[W*H]);
+    for (int r = 0; r < repeat; ++r) {
+      const auto start = steady_clock::now();
+      GeodesicDistanceMap(in->fg_scribbles, false, in->fg_likelihood.get(),
+                          W, H, dist.get());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "final_mask") {
+    unique_ptr<uint8_t[]> mask(new uint8_t[W*H]);
+    for (int r = 0; r < repeat; ++r) {
+      const auto start = steady_clock::now();
+      FinalForegroundMask(in->fg_dist.get(), in->bg_dist.get(), W, H,
+                          mask.get());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "update_masks") {
+    for (int r = 0; r < repeat; ++r) {
+      SimpleMatter matter(img.l.data(), img.a.data(), img.b.data(), W, H);
+      const auto start = steady_clock::now();
+      matter.UpdateMasks(in->bg_mask.data(), in->fg_mask.data());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else if (stage == "add_scribble") {
+    // Time the last scribble, added to a matter that already has all the
+    // others. That is the latency a user sees when drawing a new stroke
+    CHECK(!in->scribbles.empty());
+    for (int r = 0; r < repeat; ++r) {
+      InteractiveMatter matter(img.l.data(), img.a.data(), img.b.data(),
+                               W, H);
+      for (size_t i = 0; i + 1 < in->scribbles.size(); ++i) {
+        matter.AddScribble(in->scribbles[i]);
+      }
+      const auto start = steady_clock::now();
+      matter.AddScribble(in->scribbles.back());
+      times_ms->push_back(ElapsedMs(start));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Runs in the forked child
+void RunChild(const Config& config, const string& stage, int W, int H,
+              double coverage, int fd) {
+  Inputs in;
+  MakeSyntheticImage(W, H, config.seed, 8, &in.img);
+  MakeSyntheticScribbles(in.img, false, coverage/2, config.seed + 1,
+                         &in.fg_scribbles);
+  MakeSyntheticScribbles(in.img, true, coverage/2, config.seed + 2,
+                         &in.bg_scribbles);
+  ScribblesToMask(in.fg_scribbles, W, H, &in.fg_mask);
+  ScribblesToMask(in.bg_scribbles, W, H, &in.bg_mask);
+  // Interleave foreground and background scribbles like a user would
+  for (size_t i = 0; i < max(in.fg_scribbles.size(), in.bg_scribbles.size());
+       ++i) {
+    if (i < in.bg_scribbles.size()) {
+      in.scribbles.push_back(in.bg_scribbles[i]);
+    }
+    if (i < in.fg_scribbles.size()) {
+      in.scribbles.push_back(in.fg_scribbles[i]);
+    }
+  }
+
+  Prepare(StageNeeds(stage), &in);
+
+  const long rss_before = MaxRSSKb();
+  vector<double> times_ms;
+  const bool ok = RunStage(stage, config.repeat, &in, &times_ms);
+  // Message : ok, peak rss, rss before the stage, nrepeat, times
+  stringstream msg;
+  msg << ok << " " << MaxRSSKb() << " " << rss_before << " "
+      << times_ms.size();
+  for (double t : times_ms) {
+    msg << " " << t;
+  }
+  const string s = msg.str();
+  CHECK_EQ(write(fd, s.c_str(), s.size()), (ssize_t)s.size());
+}
+
+bool RunForked(const Config& config, const string& stage, int W, int H,
+               double coverage, Result* result) {
+  result->stage = stage;
+  result->W = W;
+  result->H = H;
+  result->coverage = coverage;
+  result->ok = false;
+  result->peak_rss_kb = result->stage_rss_kb = 0;
+
+  int fds[2];
+  CHECK_EQ(pipe(fds), 0);
+  const pid_t pid = fork();
+  CHECK_GE(pid, 0);
+  if (pid == 0) {
+    close(fds[0]);
+    RunChild(config, stage, W, H, coverage, fds[1]);
+    close(fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+  string msg;
+  char buf[256];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+    msg.append(buf, n);
+  }
+  close(fds[0]);
+  int status;
+  CHECK_EQ(waitpid(pid, &status, 0), pid);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    LOG(ERROR) << "Stage " << stage << " crashed on " << W << "x" << H;
+    return false;
+  }
+
+  stringstream ss(msg);
+  int ok = 0;
+  long rss_before = 0;
+  size_t ntimes = 0;
+  ss >> ok >> result->peak_rss_kb >> rss_before >> ntimes;
+  for (size_t i = 0; i < ntimes; ++i) {
+    double t;
+    ss >> t;
+    result->times_ms.push_back(t);
+  }
+  result->stage_rss_kb = max(0L, result->peak_rss_kb - rss_before);
+  result->ok = ok && !ss.fail();
+  return result->ok;
+}
+
+double Median(vector<double> v) {
+  sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return (n % 2 == 1) ? v[n/2] : 0.5*(v[n/2 - 1] + v[n/2]);
+}
+
+double Min(const vector<double>& v) {
+  return *min_element(v.begin(), v.end());
+}
+
+// Throughput in pixels per second, based on the median time
+double PixelsPerSecond(const Result& r) {
+  const double median = Median(r.times_ms);
+  return (median > 0) ? (double)r.W*r.H / (median/1000.0) : 0;
+}
+
+void PrintTable(const vector<Result>& results) {
+  printf("%-13s %11s %9s %10s %10s %10s %11s %11s\n", "stage", "size",
+         "coverage", "min_ms", "median_ms", "Mpx/s", "peak_MB", "stage_MB");
+  for (const Result& r : results) {
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", r.W, r.H);
+    printf("%-13s %11s %9.4f %10.2f %10.2f %10.2f %11.1f %11.1f\n",
+           r.stage.c_str(), size, r.coverage, Min(r.times_ms),
+           Median(r.times_ms), PixelsPerSecond(r)/1e6,
+           r.peak_rss_kb/1024.0, r.stage_rss_kb/1024.0);
+  }
+}
+
+void PrintCSV(const vector<Result>& results) {
+  printf("stage,width,height,pixels,coverage,repeat,min_ms,median_ms,"
+         "pixels_per_second,peak_rss_kb,stage_rss_kb\n");
+  for (const Result& r : results) {
+    printf("%s,%d,%d,%ld,%g,%zu,%.4f,%.4f,%.0f,%ld,%ld\n",
+           r.stage.c_str(), r.W, r.H, (long)r.W*r.H, r.coverage,
+           r.times_ms.size(), Min(r.times_ms), Median(r.times_ms),
+           PixelsPerSecond(r), r.peak_rss_kb, r.stage_rss_kb);
+  }
+}
+
+void PrintJSON(const Config& config, const vector<Result>& results) {
+  printf("{\n  \"version\": 1,\n  \"repeat\": %d,\n  \"seed\": %u,\n"
+         "  \"results\": [\n", config.repeat, config.seed);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    printf("    {\"stage\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"pixels\": %ld, \"coverage\": %g, \"times_ms\": [",
+           r.stage.c_str(), r.W, r.H, (long)r.W*r.H, r.coverage);
+    for (size_t j = 0; j < r.times_ms.size(); ++j) {
+      printf("%s%.4f", (j == 0) ? "" : ", ", r.times_ms[j]);
+    }
+    printf("], \"min_ms\": %.4f, \"median_ms\": %.4f, "
+           "\"pixels_per_second\": %.0f, \"peak_rss_kb\": %ld, "
+           "\"stage_rss_kb\": %ld}%s\n",
+           Min(r.times_ms), Median(r.times_ms), PixelsPerSecond(r),
+           r.peak_rss_kb, r.stage_rss_kb,
+           (i + 1 < results.size()) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  vector<Result> results;
+  bool all_ok = true;
+  for (double mp : config.sizes) {
+    int W, H;
+    ImageSize(mp, &W, &H);
+    for (double coverage : config.coverages) {
+      for (const string& stage : config.stages) {
+        Result result;
+        if (RunForked(config, stage, W, H, coverage, &result)) {
+          results.push_back(result);
+        } else {
+          LOG(ERROR) << "Failed to run stage " << stage;
+          all_ok = false;
+        }
+        // Progress on stderr, so that stdout stays machine-readable
+        cerr << "." << flush;
+      }
+    }
+  }
+  cerr << endl;
+
+  if (config.format == "json") {
+    PrintJSON(config, results);
+  } else if (config.format == "csv") {
+    PrintCSV(results);
+  } else {
+    PrintTable(results);
+  }
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,453 @@
+// Speed versus accuracy evaluation of the approximate modes.
+//
+// Runs the reference pipeline (exact KDE with UnivariateKDE and exact
+// Dijkstra on the pixels) and each alternative mode on the same synthetic
+// inputs, and reports for each mode :
+// - time_ms : median wall-clock time of the whole update
+// - iou : intersection over union of the foreground with the reference mask
+// - boundary_f : F-measure of the mask boundary against the reference one,
+//   a boundary pixel matching if there is one of the other boundary within
+//   --boundary-tolerance pixels (chessboard distance)
+// - max_dist_error : max absolute difference of the geodesic distances (fg
+//   and bg) with the reference, over the pixels where both are finite
+// - max_likelihood_error : same for the foreground likelihood, which is where
+//   the KDE approximation shows
+// - truth_iou : intersection over union with the synthetic ground truth
+//
+// The interactive mode adds the scribbles one class run at a time, and each
+// update only revisits the pixels currently labeled as the other class. The
+// first scribble of a class sees no model for the other one, so its
+// likelihood is 1 and its distance 0 everywhere, and the later scribbles of
+// that class never get back to most of the image. Its masks are not
+// comparable with the reference, which uses all the scribbles at once, so
+// only its time is reported.
+//
+// Usage :
+//   evaluate [--sizes=0.1,0.3] [--coverage=0.01] [--modes=fast_kde,...]
+//            [--repeat=3] [--seed=1] [--boundary-tolerance=2]
+//            [--format=table|json]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "flags.h"
+#include "geodesic.h"
+#include "kde.h"
+#include "matting.h"
+#include "synthetic.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Config {
+  Config()
+    : sizes({0.1, 0.3}),
+      coverages({0.01}),
+      modes({"fast_kde", "interactive", "preview2", "preview4",
+             "superpixel8", "superpixel16"}),
+      repeat(3),
+      seed(1),
+      boundary_tolerance(2),
+      format("table") {}
+
+  vector<double> sizes;
+  vector<double> coverages;
+  vector<string> modes;
+  int repeat;
+  unsigned seed;
+  int boundary_tolerance;
+  string format;
+};
+
+struct Inputs {
+  SyntheticImage img;
+  vector<Scribble> scribbles;
+  vector<uint8_t> fg_mask, bg_mask;
+};
+
+// What a mode produces, all W*H
+struct Outputs {
+  vector<uint8_t> mask;
+  vector<double> fg_dist, bg_dist;
+  vector<double> fg_likelihood;
+};
+
+typedef function<void(Inputs*, Outputs*)> ModeFunction;
+
+struct Result {
+  string mode;
+  int W, H;
+  double coverage;
+  double time_ms;
+  // Reference time / time
+  double speedup;
+  double iou;
+  double boundary_f;
+  double max_dist_error;
+  double max_likelihood_error;
+  double truth_iou;
+  // Whether the accuracy columns (iou to truth_iou) are meaningful
+  bool accuracy;
+};
+
+void CopyResults(const Matter& matter, int W, int H, Outputs* out) {
+  const int N = W*H;
+  out->mask.assign(matter.ForegroundMaskView(),
+                   matter.ForegroundMaskView() + N);
+  out->fg_dist.assign(matter.ForegroundDistView(),
+                      matter.ForegroundDistView() + N);
+  out->bg_dist.assign(matter.BackgroundDistView(),
+                      matter.BackgroundDistView() + N);
+  out->fg_likelihood.assign(matter.ForegroundLikelihoodView(),
+                            matter.ForegroundLikelihoodView() + N);
+}
+
+// The reference pipeline, without any approximation
+void RunReference(Inputs* in, Outputs* out) {
+  SyntheticImage& img = in->img;
+  const int W = img.W, H = img.H, N = W*H;
+  const uint8_t* channels[3] = { img.l.data(), img.a.data(), img.b.data() };
+
+  vector<vector<double>> fg_probs(3), bg_probs(3);
+  for (int i = 0; i < 3; ++i) {
+    ExactColorChannelKDE(channels[i], in->fg_mask.data(), W, H, true,
+                         &fg_probs[i]);
+    ExactColorChannelKDE(channels[i], in->bg_mask.data(), W, H, true,
+                         &bg_probs[i]);
+  }
+  vector<double> fg_pdf(N), bg_pdf(N), bg_likelihood(N);
+  ImageColorPDF(channels, fg_probs, W, H, fg_pdf.data());
+  ImageColorPDF(channels, bg_probs, W, H, bg_pdf.data());
+  out->fg_likelihood.resize(N);
+  ForegroundLikelihood(fg_pdf.data(), bg_pdf.data(), W, H,
+                       out->fg_likelihood.data());
+  ForegroundLikelihood(bg_pdf.data(), fg_pdf.data(), W, H,
+                       bg_likelihood.data());
+
+  out->fg_dist.resize(N);
+  out->bg_dist.resize(N);
+  GeodesicDistanceMap(in->fg_mask.data(), out->fg_likelihood.data(), W, H,
+                      out->fg_dist.data());
+  GeodesicDistanceMap(in->bg_mask.data(), bg_likelihood.data(), W, H,
+                      out->bg_dist.data());
+  out->mask.resize(N);
+  FinalForegroundMask(out->fg_dist.data(), out->bg_dist.data(), W, H,
+                      out->mask.data());
+}
+
+// SimpleMatter, with the given preview factor and superpixel size
+ModeFunction SimpleMatterMode(int preview_factor, int superpixel_size) {
+  return [=](Inputs* in, Outputs* out) {
+    SyntheticImage& img = in->img;
+    SimpleMatter matter(img.l.data(), img.a.data(), img.b.data(), img.W,
+                        img.H);
+    if (preview_factor > 1) {
+      matter.SetPreviewFactor(preview_factor);
+    }
+    if (superpixel_size > 0) {
+      matter.SetSuperpixelSize(superpixel_size);
+    }
+    matter.UpdateMasks(in->bg_mask.data(), in->fg_mask.data());
+    CopyResults(matter, img.W, img.H, out);
+  };
+}
+
+// InteractiveMatter, adding the scribbles in order. Only timed (see the top
+// of the file)
+void RunInteractive(Inputs* in, Outputs* out) {
+  SyntheticImage& img = in->img;
+  InteractiveMatter matter(img.l.data(), img.a.data(), img.b.data(), img.W,
+                           img.H);
+  matter.AddScribbles(in->scribbles);
+  CopyResults(matter, img.W, img.H, out);
+}
+
+// accuracy is set to whether the outputs of the mode can be compared with
+// the reference
+bool GetMode(const string& name, ModeFunction* mode, bool* accuracy) {
+  *accuracy = true;
+  if (name == "fast_kde") {
+    *mode = SimpleMatterMode(1, 0);
+  } else if (name == "interactive") {
+    *mode = RunInteractive;
+    *accuracy = false;
+  } else if (name.compare(0, 7, "preview") == 0 && name.size() > 7) {
+    *mode = SimpleMatterMode(atoi(name.c_str() + 7), 0);
+  } else if (name.compare(0, 10, "superpixel") == 0 && name.size() > 10) {
+    *mode = SimpleMatterMode(1, atoi(name.c_str() + 10));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double Median(vector<double> v) {
+  sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return (n % 2 == 1) ? v[n/2] : 0.5*(v[n/2 - 1] + v[n/2]);
+}
+
+// Runs mode repeat times, keeping the outputs of the last run. Returns the
+// median time
+double TimeMode(const ModeFunction& mode, int repeat, Inputs* in,
+                Outputs* out) {
+  vector<double> times_ms;
+  for (int r = 0; r < repeat; ++r) {
+    const auto start = steady_clock::now();
+    mode(in, out);
+    times_ms.push_back(
+        duration<double, milli>(steady_clock::now() - start).count());
+  }
+  return Median(times_ms);
+}
+
+double IoU(const vector<uint8_t>& m1, const vector<uint8_t>& m2) {
+  size_t intersection = 0, union_ = 0;
+  for (size_t i = 0; i < m1.size(); ++i) {
+    intersection += (m1[i] && m2[i]);
+    union_ += (m1[i] || m2[i]);
+  }
+  return (union_ == 0) ? 1 : intersection / (double)union_;
+}
+
+// Foreground pixels with a 4-connected background neighbor or on the image
+// border
+void Boundary(const vector<uint8_t>& mask, int W, int H,
+              vector<uint8_t>* boundary) {
+  boundary->assign(W*H, 0);
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      const int i = y*W + x;
+      if (!mask[i]) {
+        continue;
+      }
+      (*boundary)[i] = (x == 0 || x == W - 1 || y == 0 || y == H - 1
+                        || !mask[i - 1] || !mask[i + 1]
+                        || !mask[i - W] || !mask[i + W]) ? 1 : 0;
+    }
+  }
+}
+
+// Fraction of the boundary pixels of b1 that have a boundary pixel of b2
+// within tolerance
+double BoundaryMatch(const vector<uint8_t>& b1, const vector<uint8_t>& b2,
+                     int W, int H, int tolerance) {
+  size_t total = 0, matched = 0;
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      if (!b1[y*W + x]) {
+        continue;
+      }
+      ++total;
+      bool found = false;
+      for (int v = max(0, y - tolerance);
+           v <= min(H - 1, y + tolerance) && !found; ++v) {
+        for (int u = max(0, x - tolerance);
+             u <= min(W - 1, x + tolerance) && !found; ++u) {
+          found = b2[v*W + u] != 0;
+        }
+      }
+      matched += found;
+    }
+  }
+  return (total == 0) ? 1 : matched / (double)total;
+}
+
+double BoundaryF(const vector<uint8_t>& mask, const vector<uint8_t>& ref,
+                 int W, int H, int tolerance) {
+  vector<uint8_t> b, bref;
+  Boundary(mask, W, H, &b);
+  Boundary(ref, W, H, &bref);
+  const double precision = BoundaryMatch(b, bref, W, H, tolerance);
+  const double recall = BoundaryMatch(bref, b, W, H, tolerance);
+  return (precision + recall == 0) ? 0
+       : 2*precision*recall / (precision + recall);
+}
+
+double MaxFiniteError(const vector<double>& v1, const vector<double>& v2) {
+  const double inf = numeric_limits<double>::max();
+  double err = 0;
+  for (size_t i = 0; i < v1.size(); ++i) {
+    if (v1[i] < inf && v2[i] < inf) {
+      err = max(err, fabs(v1[i] - v2[i]));
+    }
+  }
+  return err;
+}
+
+void Evaluate(const string& name, double time_ms, double ref_time_ms,
+              const Outputs& out, const Outputs& ref, const Inputs& in,
+              double coverage, int tolerance, bool accuracy, Result* r) {
+  const int W = in.img.W, H = in.img.H;
+  r->mode = name;
+  r->W = W;
+  r->H = H;
+  r->coverage = coverage;
+  r->time_ms = time_ms;
+  r->speedup = (time_ms > 0) ? ref_time_ms / time_ms : 0;
+  r->accuracy = accuracy;
+  if (!accuracy) {
+    return;
+  }
+  r->iou = IoU(out.mask, ref.mask);
+  r->boundary_f = BoundaryF(out.mask, ref.mask, W, H, tolerance);
+  r->max_dist_error = max(MaxFiniteError(out.fg_dist, ref.fg_dist),
+                          MaxFiniteError(out.bg_dist, ref.bg_dist));
+  r->max_likelihood_error = MaxFiniteError(out.fg_likelihood,
+                                           ref.fg_likelihood);
+  r->truth_iou = IoU(out.mask, in.img.truth);
+}
+
+void Usage(const char* prog) {
+  cerr << "Usage : " << prog << " [--sizes=0.1,0.3] [--coverage=0.01]"
+       << " [--modes=fast_kde,interactive,preview2,preview4,superpixel8,"
+       << "superpixel16] [--repeat=3] [--seed=1] [--boundary-tolerance=2]"
+       << " [--format=table|json]" << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--sizes", &value)) {
+      SplitDoubles(value, &config->sizes);
+    } else if (ParseFlag(argv[i], "--coverage", &value)) {
+      SplitDoubles(value, &config->coverages);
+    } else if (ParseFlag(argv[i], "--modes", &value)) {
+      SplitList(value, &config->modes);
+    } else if (ParseFlag(argv[i], "--repeat", &value)) {
+      config->repeat = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--seed", &value)) {
+      config->seed = (unsigned)atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--boundary-tolerance", &value)) {
+      config->boundary_tolerance = max(0, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--format", &value)) {
+      config->format = value;
+    } else {
+      return false;
+    }
+  }
+  for (const string& name : config->modes) {
+    ModeFunction mode;
+    bool accuracy;
+    if (!GetMode(name, &mode, &accuracy)) {
+      cerr << "Unknown mode : " << name << endl;
+      return false;
+    }
+  }
+  return config->format == "table" || config->format == "json";
+}
+
+void PrintTable(const vector<Result>& results) {
+  printf("%-13s %11s %9s %10s %8s %8s %8s %10s %10s %9s\n", "mode", "size",
+         "coverage", "time_ms", "speedup", "iou", "bound_f", "dist_err",
+         "lik_err", "truth_iou");
+  for (const Result& r : results) {
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", r.W, r.H);
+    printf("%-13s %11s %9.4f %10.2f %8.2f ", r.mode.c_str(), size,
+           r.coverage, r.time_ms, r.speedup);
+    if (r.accuracy) {
+      printf("%8.4f %8.4f %10.4g %10.4g %9.4f\n", r.iou, r.boundary_f,
+             r.max_dist_error, r.max_likelihood_error, r.truth_iou);
+    } else {
+      printf("%8s %8s %10s %10s %9s\n", "-", "-", "-", "-", "-");
+    }
+  }
+}
+
+void PrintJSON(const Config& config, const vector<Result>& results) {
+  printf("{\n  \"version\": 1,\n  \"repeat\": %d,\n  \"seed\": %u,\n"
+         "  \"boundary_tolerance\": %d,\n  \"results\": [\n", config.repeat,
+         config.seed, config.boundary_tolerance);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    printf("    {\"mode\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"coverage\": %g, \"time_ms\": %.4f, \"speedup\": %.4f",
+           r.mode.c_str(), r.W, r.H, r.coverage, r.time_ms, r.speedup);
+    if (r.accuracy) {
+      printf(", \"iou\": %.6f, \"boundary_f\": %.6f, "
+             "\"max_dist_error\": %.6g, \"max_likelihood_error\": %.6g, "
+             "\"truth_iou\": %.6f", r.iou, r.boundary_f, r.max_dist_error,
+             r.max_likelihood_error, r.truth_iou);
+    }
+    printf("}%s\n", (i + 1 < results.size()) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  vector<Result> results;
+  for (double mp : config.sizes) {
+    const int W = max(4, (int)round(sqrt(mp*1e6*4.0/3.0)));
+    const int H = max(3, (int)round(mp*1e6 / W));
+    for (double coverage : config.coverages) {
+      Inputs in;
+      MakeSyntheticImage(W, H, config.seed, 8, &in.img);
+      vector<Scribble> fg, bg;
+      MakeSyntheticScribbles(in.img, false, coverage/2, config.seed + 1, &fg);
+      MakeSyntheticScribbles(in.img, true, coverage/2, config.seed + 2, &bg);
+      ScribblesToMask(fg, W, H, &in.fg_mask);
+      ScribblesToMask(bg, W, H, &in.bg_mask);
+      // Alternate foreground and background strokes, starting with the
+      // foreground like in the samples. This only matters for the timing of
+      // the interactive mode (see the top of the file)
+      for (size_t i = 0; i < max(fg.size(), bg.size()); ++i) {
+        if (i < fg.size()) {
+          in.scribbles.push_back(fg[i]);
+        }
+        if (i < bg.size()) {
+          in.scribbles.push_back(bg[i]);
+        }
+      }
+
+      Outputs ref;
+      const double ref_ms = TimeMode(RunReference, config.repeat, &in, &ref);
+      Result r;
+      Evaluate("reference", ref_ms, ref_ms, ref, ref, in, coverage,
+               config.boundary_tolerance, true, &r);
+      results.push_back(r);
+
+      for (const string& name : config.modes) {
+        ModeFunction mode;
+        bool accuracy;
+        CHECK(GetMode(name, &mode, &accuracy));
+        Outputs out;
+        const double ms = TimeMode(mode, config.repeat, &in, &out);
+        Evaluate(name, ms, ref_ms, out, ref, in, coverage,
+                 config.boundary_tolerance, accuracy, &r);
+        results.push_back(r);
+        // Progress on stderr, so that stdout stays machine-readable
+        cerr << "." << flush;
+      }
+    }
+  }
+  cerr << endl;
+
+  if (config.format == "json") {
+    PrintJSON(config, results);
+  } else {
+    PrintTable(results);
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+#include "flags.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+bool ParseFlag(const char* arg, const char* name, string* value) {
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+    *value = arg + len + 1;
+    return true;
+  }
+  return false;
+}
+
+void SplitList(const string& s, vector<string>* out) {
+  out->clear();
+  stringstream ss(s);
+  string item;
+  while (getline(ss, item, ',')) {
+    if (!item.empty()) {
+      out->push_back(item);
+    }
+  }
+}
+
+void SplitDoubles(const string& s, vector<double>* out) {
+  vector<string> items;
+  SplitList(s, &items);
+  out->clear();
+  for (const string& item : items) {
+    out->push_back(atof(item.c_str()));
+  }
+}
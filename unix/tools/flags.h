@@ -0,0 +1,18 @@
+#ifndef _LIBMATTING_TOOLS_FLAGS_H_
+#define _LIBMATTING_TOOLS_FLAGS_H_
+
+#include <string>
+#include <vector>
+
+// Minimal command line parsing shared by the tools, which take
+// --name=value flags
+
+// If arg is --name=value (name includes the dashes), set value and return
+// true
+bool ParseFlag(const char* arg, const char* name, std::string* value);
+
+// Split a comma-separated list, skipping empty items
+void SplitList(const std::string& s, std::vector<std::string>* out);
+void SplitDoubles(const std::string& s, std::vector<double>* out);
+
+#endif
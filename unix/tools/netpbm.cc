@@ -0,0 +1,157 @@
+#include "netpbm.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+
+using namespace std;
+
+namespace {
+
+struct FileCloser {
+  void operator()(FILE* f) const { fclose(f); }
+};
+typedef unique_ptr<FILE, FileCloser> File;
+
+// Skip whitespace and comments, then read an unsigned integer
+bool ReadHeaderInt(FILE* f, int* value) {
+  int c = fgetc(f);
+  while (c != EOF && (isspace(c) || c == '#')) {
+    if (c == '#') {
+      while (c != EOF && c != '\n') {
+        c = fgetc(f);
+      }
+    }
+    c = fgetc(f);
+  }
+  if (c == EOF || !isdigit(c)) {
+    return false;
+  }
+  long v = 0;
+  while (c != EOF && isdigit(c)) {
+    v = 10*v + (c - '0');
+    if (v > (1 << 24)) {
+      return false;
+    }
+    c = fgetc(f);
+  }
+  // A single whitespace separates the header from the samples
+  if (c == EOF || !isspace(c)) {
+    return false;
+  }
+  *value = (int)v;
+  return true;
+}
+
+}
+
+bool ReadNetpbm(const string& path, RawImage* img, string* error) {
+  File f(fopen(path.c_str(), "rb"));
+  if (!f) {
+    *error = "Can't open " + path;
+    return false;
+  }
+  char magic[2];
+  if (fread(magic, 1, 2, f.get()) != 2 || magic[0] != 'P'
+      || (magic[1] != '5' && magic[1] != '6')) {
+    *error = path + " is not a binary PGM or PPM file";
+    return false;
+  }
+  int W, H, maxval;
+  if (!ReadHeaderInt(f.get(), &W) || !ReadHeaderInt(f.get(), &H)
+      || !ReadHeaderInt(f.get(), &maxval) || W <= 0 || H <= 0
+      || maxval <= 0 || maxval > 255) {
+    *error = path + " has an invalid or unsupported header";
+    return false;
+  }
+  img->W = W;
+  img->H = H;
+  img->channels = (magic[1] == '5') ? 1 : 3;
+  const size_t n = (size_t)W*H*img->channels;
+  img->data.resize(n);
+  if (fread(img->data.data(), 1, n, f.get()) != n) {
+    *error = path + " is truncated";
+    return false;
+  }
+  if (maxval < 255) {
+    for (uint8_t& v : img->data) {
+      v = (uint8_t)(min<int>(v, maxval) * 255 / maxval);
+    }
+  }
+  return true;
+}
+
+bool ReadRaw(const string& path, int W, int H, int channels, RawImage* img,
+             string* error) {
+  File f(fopen(path.c_str(), "rb"));
+  if (!f) {
+    *error = "Can't open " + path;
+    return false;
+  }
+  img->W = W;
+  img->H = H;
+  img->channels = channels;
+  const size_t n = (size_t)W*H*channels;
+  img->data.resize(n);
+  if (fread(img->data.data(), 1, n, f.get()) != n
+      || fgetc(f.get()) != EOF) {
+    *error = path + " is not " + to_string(W) + "x" + to_string(H) + "x"
+             + to_string(channels) + " bytes";
+    return false;
+  }
+  return true;
+}
+
+bool WriteNetpbm(const string& path, const RawImage& img, string* error) {
+  File f(fopen(path.c_str(), "wb"));
+  if (!f) {
+    *error = "Can't create " + path;
+    return false;
+  }
+  fprintf(f.get(), "P%c\n%d %d\n255\n", (img.channels == 1) ? '5' : '6',
+          img.W, img.H);
+  const size_t n = (size_t)img.W*img.H*img.channels;
+  if (fwrite(img.data.data(), 1, n, f.get()) != n || fflush(f.get()) != 0) {
+    *error = "Failed to write " + path;
+    return false;
+  }
+  return true;
+}
+
+void RGBToLab(const RawImage& rgb, vector<uint8_t> lab[3]) {
+  static const struct Linear {
+    Linear() {
+      for (int v = 0; v < 256; ++v) {
+        const double c = v / 255.0;
+        values[v] = (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+      }
+    }
+    double values[256];
+  } linear;
+  auto f = [](double t) {
+    return (t > 0.008856) ? cbrt(t) : 7.787*t + 16/116.0;
+  };
+  auto to8 = [](double v) {
+    return (uint8_t)min(255.0, max(0.0, round(v)));
+  };
+
+  const int N = rgb.W*rgb.H;
+  for (int c = 0; c < 3; ++c) {
+    lab[c].resize(N);
+  }
+  for (int i = 0; i < N; ++i) {
+    const uint8_t* px = rgb.data.data() + i*rgb.channels;
+    const double r = linear.values[px[0]];
+    const double g = linear.values[px[rgb.channels == 3 ? 1 : 0]];
+    const double b = linear.values[px[rgb.channels == 3 ? 2 : 0]];
+    const double X = (0.412453*r + 0.357580*g + 0.180423*b) / 0.950456;
+    const double Y = 0.212671*r + 0.715160*g + 0.072169*b;
+    const double Z = (0.019334*r + 0.119193*g + 0.950227*b) / 1.088754;
+    const double L = (Y > 0.008856) ? 116*cbrt(Y) - 16 : 903.3*Y;
+    lab[0][i] = to8(L * 255 / 100);
+    lab[1][i] = to8(500*(f(X) - f(Y)) + 128);
+    lab[2][i] = to8(200*(f(Y) - f(Z)) + 128);
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef _LIBMATTING_TOOLS_NETPBM_H_
+#define _LIBMATTING_TOOLS_NETPBM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Minimal image file I/O for the headless tools : binary PGM (P5) and PPM
+// (P6) files with a maxval of at most 255, and raw files (no header) whose
+// size is given by the caller. Plus the conversion of the images read to the
+// lab planes of the matters.
+struct RawImage {
+  RawImage() : W(0), H(0), channels(0) {}
+  int W, H;
+  // 1 (gray) or 3 (RGB), interleaved
+  int channels;
+  std::vector<uint8_t> data;
+};
+
+// Read a PGM or PPM file. Samples are rescaled to [0, 255] if maxval is
+// lower. Returns false and sets error on failure.
+bool ReadNetpbm(const std::string& path, RawImage* img, std::string* error);
+
+// Read a file of exactly W*H*channels bytes
+bool ReadRaw(const std::string& path, int W, int H, int channels,
+             RawImage* img, std::string* error);
+
+// Write img as PGM (1 channel) or PPM (3 channels)
+bool WriteNetpbm(const std::string& path, const RawImage& img,
+                 std::string* error);
+
+// sRGB (or gray, for 1 channel) to the 8 bit lab of OpenCV's COLOR_RGB2Lab,
+// which the samples use : D65 white point, L scaled to [0, 255], a and b
+// offset by 128. Each lab[c] is resized to rgb.W*rgb.H.
+void RGBToLab(const RawImage& rgb, std::vector<uint8_t> lab[3]);
+
+#endif
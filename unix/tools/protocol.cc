@@ -0,0 +1,82 @@
+#include "protocol.h"
+
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+bool WriteAll(int fd, const void* data, size_t n) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (n > 0) {
+    const ssize_t written = send(fd, p, n, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    p += written;
+    n -= written;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void* data, size_t n) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  while (n > 0) {
+    const ssize_t nread = recv(fd, p, n, 0);
+    if (nread < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nread <= 0) {
+      return false;
+    }
+    p += nread;
+    n -= nread;
+  }
+  return true;
+}
+
+}
+
+bool SendMessage(int fd, const vector<uint8_t>& payload) {
+  const uint32_t size = payload.size();
+  return WriteAll(fd, &size, sizeof(size))
+      && WriteAll(fd, payload.data(), payload.size());
+}
+
+bool ReceiveMessage(int fd, vector<uint8_t>* payload) {
+  uint32_t size;
+  if (!ReadAll(fd, &size, sizeof(size)) || size > kMaxMessageSize) {
+    return false;
+  }
+  payload->resize(size);
+  return ReadAll(fd, payload->data(), size);
+}
+
+int ConnectUnixSocket(const string& path, string* error) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    *error = "Socket path too long : " + path;
+    return -1;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    *error = string("socket : ") + strerror(errno);
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    *error = "Can't connect to " + path + " : " + strerror(errno);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,135 @@
+#ifndef _LIBMATTING_TOOLS_PROTOCOL_H_
+#define _LIBMATTING_TOOLS_PROTOCOL_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Protocol of segment_server, over a Unix domain stream socket. A client
+// sends requests and reads the response of each before sending the next one.
+//
+// Each message is a uint32_t payload size followed by the payload. A request
+// payload starts with its uint8_t RequestType, a response with a uint8_t
+// ResponseStatus. On kStatusError, the rest of the response is the error
+// message. Values are in the byte order of the machine, as both ends run on
+// it. Arrays are a uint32_t count followed by the items.
+//
+// The fields that follow the type of each request, and the ones of its
+// successful response, are listed below.
+enum RequestType {
+  // int32_t W, H then the W*H L, a and b planes (uint8_t)
+  // => uint64_t session id
+  kRequestCreate = 1,
+  // uint64_t session, uint8_t background, int32_t radius, int32_t x, y
+  // array of the stroke points (see stroke.h)
+  // => uint32_t pixels added, uint32_t pixels dropped as conflicts, double
+  //    time spent updating the matter in ms
+  kRequestStroke = 2,
+  // uint64_t session
+  // => int32_t W, H, uint32_t array of the mask runs (see EncodeMaskRLE)
+  kRequestGetMask = 3,
+  // uint64_t session
+  // => uint8_t full. If full, the mask as for kRequestGetMask, otherwise
+  //    the int32_t y, x0, x1 array of the spans that flipped since the
+  //    previous kRequestGetDelta (or since the creation, when the mask was
+  //    all background). A full mask is sent when the server can't tell, e.g.
+  //    after the session has been evicted.
+  kRequestGetDelta = 4,
+  // uint64_t session => nothing
+  kRequestClose = 5,
+  // => uint64_t number of sessions, resident sessions, bytes used by the
+  //    resident sessions, memory budget in bytes, evictions, reloads
+  kRequestStats = 6,
+};
+
+enum ResponseStatus {
+  kStatusOk = 0,
+  kStatusError = 1,
+};
+
+// Larger messages are rejected
+static const uint32_t kMaxMessageSize = 256 << 20;
+
+// Builds a message payload
+class MessageWriter {
+ public:
+  // head is the request type or the response status
+  explicit MessageWriter(uint8_t head) : data_(1, head) {}
+
+  template<class T>
+  void Put(const T& value) {
+    PutBytes(&value, sizeof(T));
+  }
+
+  void PutBytes(const void* bytes, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(bytes);
+    data_.insert(data_.end(), p, p + n);
+  }
+
+  template<class T>
+  void PutArray(const std::vector<T>& items) {
+    Put<uint32_t>(items.size());
+    PutBytes(items.data(), sizeof(T)*items.size());
+  }
+
+  const std::vector<uint8_t>& data() const { return data_; }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+// Reads the fields of a payload. The getters return false once the payload
+// is exhausted.
+class MessageReader {
+ public:
+  explicit MessageReader(const std::vector<uint8_t>& data)
+    : data_(data), pos_(0) {}
+
+  template<class T>
+  bool Get(T* value) {
+    return GetBytes(value, sizeof(T));
+  }
+
+  bool GetBytes(void* bytes, size_t n) {
+    if (n > data_.size() - pos_) {
+      return false;
+    }
+    memcpy(bytes, data_.data() + pos_, n);
+    pos_ += n;
+    return true;
+  }
+
+  template<class T>
+  bool GetArray(std::vector<T>* items) {
+    uint32_t n;
+    if (!Get(&n) || n > (data_.size() - pos_) / sizeof(T)) {
+      return false;
+    }
+    items->resize(n);
+    return GetBytes(items->data(), sizeof(T)*n);
+  }
+
+  // The bytes left, as a string
+  std::string Rest() {
+    const std::string rest(data_.begin() + pos_, data_.end());
+    pos_ = data_.size();
+    return rest;
+  }
+
+ private:
+  const std::vector<uint8_t>& data_;
+  size_t pos_;
+};
+
+// Blocking I/O of whole messages. Return false on errors, and for
+// ReceiveMessage when the peer closed the connection or sent a message
+// larger than kMaxMessageSize.
+bool SendMessage(int fd, const std::vector<uint8_t>& payload);
+bool ReceiveMessage(int fd, std::vector<uint8_t>* payload);
+
+// Connect to the server listening at path. Returns the socket, or -1 and
+// sets error.
+int ConnectUnixSocket(const std::string& path, std::string* error);
+
+#endif
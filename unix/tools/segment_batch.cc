@@ -0,0 +1,487 @@
+// Headless batch segmentation, as a scriptable throughput baseline that
+// doesn't depend on OpenCV.
+//
+// Each job is an RGB image (PPM, or PGM for a gray image) with its
+// background and foreground scribble masks (PGM, non-zero for the scribbled
+// pixels). It is segmented with a SimpleMatter and the foreground mask is
+// written as a PGM (255 for foreground). Jobs are listed either :
+// - with --dir : each NAME.ppm or NAME.pgm of the directory that has a
+//   NAME.bg.pgm and a NAME.fg.pgm next to it. The mask goes to
+//   OUT/NAME.mask.pgm if --out=OUT is given, and is not written otherwise
+// - with --manifest : one job per line, as whitespace separated
+//   "image bg_mask fg_mask [output]" paths. Empty lines and lines starting
+//   with # are skipped
+// Files ending in .raw have no header : interleaved RGB for the images and
+// one byte per pixel for the masks, of the size given by --raw-size=WxH.
+//
+// The jobs go through a pipeline of stages that run on their own threads :
+// read (the files), convert (RGB to lab, --convert-threads), segment
+// (--threads) and write. At most --queue jobs wait between two stages, which
+// bounds the memory use whatever the number of jobs. At the end, the
+// throughput and the utilization of each stage (the fraction of the wall
+// time its threads were busy) are reported. The most utilized stage is the
+// bottleneck.
+//
+// Usage :
+//   segment_batch (--dir=DIR | --manifest=FILE) [--out=DIR]
+//                 [--raw-size=WxH] [--threads=N] [--convert-threads=1]
+//                 [--queue=4] [--preview-factor=1] [--superpixel-size=0]
+//                 [--format=table|json]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "flags.h"
+#include "netpbm.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Config {
+  Config()
+    : raw_W(0), raw_H(0),
+      threads(max(1u, thread::hardware_concurrency())),
+      convert_threads(1),
+      queue(4),
+      preview_factor(1),
+      superpixel_size(0),
+      format("table") {}
+
+  string dir, manifest, out;
+  int raw_W, raw_H;
+  int threads;
+  int convert_threads;
+  int queue;
+  int preview_factor;
+  int superpixel_size;
+  string format;
+};
+
+struct Job {
+  string image_path, bg_path, fg_path, out_path;
+  RawImage rgb, bg, fg;
+  vector<uint8_t> lab[3];
+  vector<uint8_t> mask;
+  // Set by the first stage that fails, the next ones skip the job
+  string error;
+};
+
+typedef unique_ptr<Job> JobPtr;
+
+// A FIFO of at most capacity items. Push blocks while it is full, Pop
+// blocks while it is empty and returns false once it is closed and drained.
+template<class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity),
+                                           closed_(false) {}
+
+  void Push(T item) {
+    unique_lock<mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+    items_.push_back(move(item));
+    not_empty_.notify_one();
+  }
+
+  bool Pop(T* item) {
+    unique_lock<mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+    if (items_.empty()) {
+      return false;
+    }
+    *item = move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    lock_guard<mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  bool closed_;
+  deque<T> items_;
+  mutex mutex_;
+  condition_variable not_full_, not_empty_;
+};
+
+typedef BoundedQueue<JobPtr> JobQueue;
+
+struct StageStats {
+  StageStats(const string& name, int nthreads)
+    : name(name), nthreads(nthreads), busy_ns(0), nitems(0) {}
+
+  string name;
+  int nthreads;
+  atomic<int64_t> busy_ns;
+  atomic<int> nitems;
+};
+
+// Run process on each job of in (or, without in, on the jobs it creates)
+// from stats->nthreads threads and pass them to out. out is closed once all
+// the threads are done.
+class Stage {
+ public:
+  typedef function<void(Job*)> Process;
+
+  Stage(StageStats* stats, JobQueue* in, JobQueue* out,
+        const Process& process)
+    : stats_(stats), in_(in), out_(out), process_(process),
+      running_(stats->nthreads) {
+    for (int i = 0; i < stats->nthreads; ++i) {
+      threads_.push_back(thread(&Stage::Run, this));
+    }
+  }
+
+  void Join() {
+    for (thread& t : threads_) {
+      t.join();
+    }
+  }
+
+ private:
+  void Run() {
+    JobPtr job;
+    while (in_->Pop(&job)) {
+      if (job->error.empty()) {
+        const auto start = steady_clock::now();
+        process_(job.get());
+        stats_->busy_ns += duration_cast<nanoseconds>(
+            steady_clock::now() - start).count();
+        ++stats_->nitems;
+      }
+      if (out_) {
+        out_->Push(move(job));
+      }
+    }
+    if (--running_ == 0 && out_) {
+      out_->Close();
+    }
+  }
+
+  StageStats* stats_;
+  JobQueue* in_;
+  JobQueue* out_;
+  Process process_;
+  atomic<int> running_;
+  vector<thread> threads_;
+};
+
+bool EndsWith(const string& s, const string& suffix) {
+  return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool ReadImageFile(const string& path, int channels, const Config& config,
+                   RawImage* img, string* error) {
+  if (EndsWith(path, ".raw")) {
+    if (config.raw_W <= 0 || config.raw_H <= 0) {
+      *error = path + " : raw files need --raw-size";
+      return false;
+    }
+    return ReadRaw(path, config.raw_W, config.raw_H, channels, img, error);
+  }
+  return ReadNetpbm(path, img, error);
+}
+
+void ReadJob(const Config& config, Job* job) {
+  if (!ReadImageFile(job->image_path, 3, config, &job->rgb, &job->error)
+      || !ReadImageFile(job->bg_path, 1, config, &job->bg, &job->error)
+      || !ReadImageFile(job->fg_path, 1, config, &job->fg, &job->error)) {
+    return;
+  }
+  for (const RawImage* mask : {&job->bg, &job->fg}) {
+    if (mask->channels != 1 || mask->W != job->rgb.W
+        || mask->H != job->rgb.H) {
+      job->error = job->image_path + " : the masks must be single channel "
+                   "images of the image size";
+      return;
+    }
+  }
+}
+
+void ConvertJob(Job* job) {
+  RGBToLab(job->rgb, job->lab);
+  // Not needed anymore, don't keep it around in the queues
+  vector<uint8_t>().swap(job->rgb.data);
+}
+
+void SegmentJob(const Config& config, Job* job) {
+  const int W = job->rgb.W;
+  const int H = job->rgb.H;
+  SimpleMatter matter(job->lab[0].data(), job->lab[1].data(),
+                      job->lab[2].data(), W, H);
+  if (config.preview_factor > 1) {
+    matter.SetPreviewFactor(config.preview_factor);
+  } else if (config.superpixel_size > 0) {
+    matter.SetSuperpixelSize(config.superpixel_size);
+  }
+  matter.UpdateMasks(job->bg.data.data(), job->fg.data.data());
+  job->mask.resize(W*H);
+  matter.GetForegroundMask(job->mask.data());
+}
+
+void WriteJob(Job* job) {
+  if (job->out_path.empty()) {
+    return;
+  }
+  RawImage out;
+  out.W = job->rgb.W;
+  out.H = job->rgb.H;
+  out.channels = 1;
+  out.data.swap(job->mask);
+  WriteNetpbm(job->out_path, out, &job->error);
+}
+
+bool ListDir(const Config& config, vector<JobPtr>* jobs) {
+  DIR* dir = opendir(config.dir.c_str());
+  if (dir == NULL) {
+    cerr << "Can't open directory " << config.dir << endl;
+    return false;
+  }
+  vector<string> names;
+  while (dirent* entry = readdir(dir)) {
+    names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  sort(names.begin(), names.end());
+
+  for (const string& name : names) {
+    string stem;
+    for (const char* ext : {".ppm", ".pgm", ".raw"}) {
+      if (EndsWith(name, ext)) {
+        stem = name.substr(0, name.size() - 4);
+      }
+    }
+    // Skip the masks themselves
+    if (stem.empty() || EndsWith(stem, ".bg") || EndsWith(stem, ".fg")
+        || EndsWith(stem, ".mask")) {
+      continue;
+    }
+    const string ext = name.substr(name.size() - 4);
+    const string mask_ext = (ext == ".raw") ? ".raw" : ".pgm";
+    const string bg = stem + ".bg" + mask_ext;
+    const string fg = stem + ".fg" + mask_ext;
+    if (!binary_search(names.begin(), names.end(), bg)
+        || !binary_search(names.begin(), names.end(), fg)) {
+      continue;
+    }
+    JobPtr job(new Job);
+    job->image_path = config.dir + "/" + name;
+    job->bg_path = config.dir + "/" + bg;
+    job->fg_path = config.dir + "/" + fg;
+    if (!config.out.empty()) {
+      job->out_path = config.out + "/" + stem + ".mask.pgm";
+    }
+    jobs->push_back(move(job));
+  }
+  return true;
+}
+
+bool ReadManifest(const Config& config, vector<JobPtr>* jobs) {
+  ifstream in(config.manifest.c_str());
+  if (!in) {
+    cerr << "Can't open manifest " << config.manifest << endl;
+    return false;
+  }
+  string line;
+  int lineno = 0;
+  while (getline(in, line)) {
+    ++lineno;
+    stringstream ss(line);
+    vector<string> fields;
+    string field;
+    while (ss >> field) {
+      fields.push_back(field);
+    }
+    if (fields.empty() || fields[0][0] == '#') {
+      continue;
+    }
+    if (fields.size() < 3 || fields.size() > 4) {
+      cerr << config.manifest << ":" << lineno << " : expected "
+           << "\"image bg_mask fg_mask [output]\"" << endl;
+      return false;
+    }
+    JobPtr job(new Job);
+    job->image_path = fields[0];
+    job->bg_path = fields[1];
+    job->fg_path = fields[2];
+    if (fields.size() == 4) {
+      job->out_path = fields[3];
+    }
+    jobs->push_back(move(job));
+  }
+  return true;
+}
+
+void Usage(const char* prog) {
+  cerr << "Usage : " << prog << " (--dir=DIR | --manifest=FILE) [--out=DIR]"
+       << " [--raw-size=WxH] [--threads=N] [--convert-threads=1]"
+       << " [--queue=4]"
+       << " [--preview-factor=1] [--superpixel-size=0]"
+       << " [--format=table|json]" << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--dir", &value)) {
+      config->dir = value;
+    } else if (ParseFlag(argv[i], "--manifest", &value)) {
+      config->manifest = value;
+    } else if (ParseFlag(argv[i], "--out", &value)) {
+      config->out = value;
+    } else if (ParseFlag(argv[i], "--raw-size", &value)) {
+      if (sscanf(value.c_str(), "%dx%d", &config->raw_W,
+                 &config->raw_H) != 2) {
+        return false;
+      }
+    } else if (ParseFlag(argv[i], "--threads", &value)) {
+      config->threads = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--convert-threads", &value)) {
+      config->convert_threads = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--queue", &value)) {
+      config->queue = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--preview-factor", &value)) {
+      config->preview_factor = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--superpixel-size", &value)) {
+      config->superpixel_size = max(0, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--format", &value)) {
+      config->format = value;
+    } else {
+      return false;
+    }
+  }
+  if (config->dir.empty() == config->manifest.empty()) {
+    cerr << "Exactly one of --dir and --manifest is needed" << endl;
+    return false;
+  }
+  if (config->preview_factor > 1 && config->superpixel_size > 0) {
+    cerr << "The preview and superpixel modes can't be combined" << endl;
+    return false;
+  }
+  return config->format == "table" || config->format == "json";
+}
+
+double Utilization(const StageStats& s, double wall_s) {
+  return (wall_s > 0) ? s.busy_ns * 1e-9 / (wall_s * s.nthreads) : 0;
+}
+
+double MsPerImage(const StageStats& s) {
+  return (s.nitems > 0) ? s.busy_ns * 1e-6 / s.nitems : 0;
+}
+
+void PrintTable(const vector<unique_ptr<StageStats>>& stages, int nimages,
+                int nfailed, double wall_s) {
+  printf("images %d, failed %d, wall %.3f s, %.2f images/s\n", nimages,
+         nfailed, wall_s, (wall_s > 0) ? (nimages - nfailed) / wall_s : 0);
+  printf("%-10s %8s %8s %10s %12s %12s\n", "stage", "threads", "images",
+         "busy_s", "utilization", "ms/image");
+  for (const unique_ptr<StageStats>& s : stages) {
+    printf("%-10s %8d %8d %10.3f %11.1f%% %12.2f\n", s->name.c_str(),
+           s->nthreads, s->nitems.load(), s->busy_ns * 1e-9,
+           100 * Utilization(*s, wall_s), MsPerImage(*s));
+  }
+}
+
+void PrintJSON(const vector<unique_ptr<StageStats>>& stages, int nimages,
+               int nfailed, double wall_s) {
+  printf("{\n  \"version\": 1,\n  \"images\": %d,\n  \"failed\": %d,\n"
+         "  \"wall_s\": %.6f,\n  \"images_per_s\": %.6f,\n  \"stages\": [\n",
+         nimages, nfailed, wall_s,
+         (wall_s > 0) ? (nimages - nfailed) / wall_s : 0);
+  for (size_t i = 0; i < stages.size(); ++i) {
+    const StageStats& s = *stages[i];
+    printf("    {\"stage\": \"%s\", \"threads\": %d, \"images\": %d, "
+           "\"busy_s\": %.6f, \"utilization\": %.6f, "
+           "\"ms_per_image\": %.6f}%s\n", s.name.c_str(), s.nthreads,
+           s.nitems.load(), s.busy_ns * 1e-9, Utilization(s, wall_s),
+           MsPerImage(s), (i + 1 < stages.size()) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+  vector<JobPtr> jobs;
+  if (!(config.dir.empty() ? ReadManifest(config, &jobs)
+                           : ListDir(config, &jobs))) {
+    return 1;
+  }
+  if (jobs.empty()) {
+    cerr << "No jobs" << endl;
+    return 1;
+  }
+
+  vector<unique_ptr<StageStats>> stages;
+  stages.emplace_back(new StageStats("read", 1));
+  stages.emplace_back(new StageStats("convert", config.convert_threads));
+  stages.emplace_back(new StageStats("segment", config.threads));
+  stages.emplace_back(new StageStats("write", 1));
+  // Jobs flow from pending through the 4 stages to done
+  JobQueue pending(config.queue), read(config.queue), converted(config.queue),
+      segmented(config.queue), done(jobs.size());
+
+  const int nimages = jobs.size();
+  const auto start = steady_clock::now();
+  Stage read_stage(stages[0].get(), &pending, &read,
+                   [&](Job* job) { ReadJob(config, job); });
+  Stage convert_stage(stages[1].get(), &read, &converted, ConvertJob);
+  Stage segment_stage(stages[2].get(), &converted, &segmented,
+                      [&](Job* job) { SegmentJob(config, job); });
+  Stage write_stage(stages[3].get(), &segmented, &done, WriteJob);
+  for (JobPtr& job : jobs) {
+    pending.Push(move(job));
+  }
+  pending.Close();
+  read_stage.Join();
+  convert_stage.Join();
+  segment_stage.Join();
+  write_stage.Join();
+  const double wall_s = duration<double>(steady_clock::now() - start).count();
+
+  int nfailed = 0;
+  JobPtr job;
+  while (done.Pop(&job)) {
+    if (!job->error.empty()) {
+      cerr << job->error << endl;
+      ++nfailed;
+    }
+  }
+  if (config.format == "json") {
+    PrintJSON(stages, nimages, nfailed, wall_s);
+  } else {
+    PrintTable(stages, nimages, nfailed, wall_s);
+  }
+  return (nfailed > 0) ? 2 : 0;
+}
@@ -0,0 +1,511 @@
+// Load generator for segment_server. Measures the latency of the requests
+// as seen by the clients, under concurrency.
+//
+// --clients threads each open their own connection and create their share
+// of --sessions, on synthetic images (see synthetic.h) of --size. Then each
+// client sends --strokes strokes per session, alternating foreground and
+// background ones, going round-robin over its sessions so that they are all
+// active at once (which makes the server evict and reload them when they
+// don't fit in its memory budget). With --delta=1, each stroke is followed
+// by a kRequestGetDelta, as a client mirroring the mask would do, and the
+// mirrored masks are checked against the server's at the end. With
+// --shared=1, each stroke is also followed by a kRequestGetMask on a session
+// of another client, so that requests on a session race with its eviction
+// and reload.
+//
+// Reports the p50, p90, p99 and max latency of each request type, the
+// throughput of the strokes and the eviction counters of the server.
+//
+// Usage :
+//   segment_load --socket=PATH [--clients=4] [--sessions=16] [--strokes=20]
+//                [--size=320x240] [--radius=3] [--delta=1] [--shared=0]
+//                [--seed=1] [--format=table|json]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "encoding.h"
+#include "flags.h"
+#include "protocol.h"
+#include "synthetic.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Config {
+  Config()
+    : clients(4), sessions(16), strokes(20), W(320), H(240), radius(3),
+      delta(true), shared(false), seed(1), format("table") {}
+
+  string socket_path;
+  int clients;
+  int sessions;
+  int strokes;
+  int W, H;
+  int radius;
+  bool delta;
+  bool shared;
+  unsigned seed;
+  string format;
+};
+
+// A session of a client
+struct ClientSession {
+  ClientSession() : index(0), id(0) {}
+
+  // In [0, --sessions)
+  int index;
+  SyntheticImage img;
+  // Each as the two end points of a stroke
+  vector<pair<Point2i, Point2i>> fg_strokes, bg_strokes;
+  uint64_t id;
+  // Mirror of the server mask, kept up to date from the deltas
+  vector<uint8_t> mask;
+};
+
+// Latencies of the requests, in ms, per request name
+typedef map<string, vector<double>> Latencies;
+
+// Send request and wait for the response. Returns the fields of a
+// successful response, or false and sets error.
+bool Call(int fd, const MessageWriter& request, vector<uint8_t>* response,
+          string* error) {
+  if (!SendMessage(fd, request.data()) || !ReceiveMessage(fd, response)
+      || response->empty()) {
+    *error = "Connection to the server lost";
+    return false;
+  }
+  const uint8_t status = (*response)[0];
+  response->erase(response->begin());
+  if (status != kStatusOk) {
+    *error = "Server error : " + string(response->begin(), response->end());
+    return false;
+  }
+  return true;
+}
+
+// Time a call and record its latency under name
+bool TimedCall(int fd, const MessageWriter& request, const string& name,
+               vector<uint8_t>* response, Latencies* latencies,
+               string* error) {
+  const auto start = steady_clock::now();
+  const bool ok = Call(fd, request, response, error);
+  (*latencies)[name].push_back(
+      duration<double, milli>(steady_clock::now() - start).count());
+  return ok;
+}
+
+void MakeStrokes(const SyntheticImage& img, bool background, int n,
+                 unsigned seed, vector<pair<Point2i, Point2i>>* strokes) {
+  // MakeSyntheticScribbles makes strokes of up to W/10 pixels
+  const double coverage = 1.5*(n + 1)*max(2, img.W/10)
+      / (double)(img.W*img.H);
+  vector<Scribble> scribbles;
+  MakeSyntheticScribbles(img, background, coverage, seed, &scribbles);
+  CHECK(!scribbles.empty());
+  for (int i = 0; i < n; ++i) {
+    const Scribble& s = scribbles[i % scribbles.size()];
+    strokes->push_back(make_pair(s.pixels.front(), s.pixels.back()));
+  }
+}
+
+// Apply a kRequestGetDelta response to mask
+bool ApplyDelta(const vector<uint8_t>& response, int W, int H,
+                vector<uint8_t>* mask) {
+  MessageReader reader(response);
+  uint8_t full;
+  if (!reader.Get(&full)) {
+    return false;
+  }
+  if (full) {
+    int32_t mW, mH;
+    vector<uint32_t> runs;
+    return reader.Get(&mW) && reader.Get(&mH) && reader.GetArray(&runs)
+        && mW == W && mH == H && DecodeMaskRLE(runs, W, H, mask->data());
+  }
+  vector<int32_t> yxx;
+  if (!reader.GetArray(&yxx) || yxx.size() % 3 != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < yxx.size(); i += 3) {
+    const int y = yxx[i], x0 = yxx[i + 1], x1 = yxx[i + 2];
+    if (y < 0 || y >= H || x0 < 0 || x1 > W || x0 > x1) {
+      return false;
+    }
+    for (int x = x0; x < x1; ++x) {
+      (*mask)[y*W + x] ^= 255;
+    }
+  }
+  return true;
+}
+
+// Shared by the client threads
+struct Run {
+  Run() : ready(0), nmismatches(0) {}
+
+  mutex lock;
+  condition_variable all_ready;
+  int ready;
+  // Of all the sessions, by index
+  vector<uint64_t> ids;
+  // Of the strokes phase
+  steady_clock::time_point start, end;
+  Latencies latencies;
+  vector<string> errors;
+  int nmismatches;
+};
+
+class Client {
+ public:
+  Client(const Config& config, int index, Run* run)
+    : config_(config), index_(index), run_(run), fd_(-1), nmismatches_(0) {}
+
+  ~Client() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  void Main() {
+    string error;
+    bool ok = Setup(&error) && SendStrokes(&error);
+    if (config_.shared) {
+      // The others use the sessions of this client until they are done
+      WaitForOthers(2);
+    }
+    if (!ok || !Finish(&error)) {
+      lock_guard<mutex> lock(run_->lock);
+      run_->errors.push_back(error);
+    }
+    lock_guard<mutex> lock(run_->lock);
+    for (const auto& named : latencies_) {
+      vector<double>& all = run_->latencies[named.first];
+      all.insert(all.end(), named.second.begin(), named.second.end());
+    }
+    run_->nmismatches += nmismatches_;
+  }
+
+ private:
+  bool Setup(string* error) {
+    fd_ = ConnectUnixSocket(config_.socket_path, error);
+    if (fd_ < 0) {
+      WaitForOthers(1);
+      return false;
+    }
+    for (int i = index_; i < config_.sessions; i += config_.clients) {
+      sessions_.emplace_back();
+      ClientSession& s = sessions_.back();
+      s.index = i;
+      const unsigned seed = config_.seed + 1000*i;
+      MakeSyntheticImage(config_.W, config_.H, seed, 10, &s.img);
+      MakeStrokes(s.img, false, (config_.strokes + 1)/2, seed + 1,
+                  &s.fg_strokes);
+      MakeStrokes(s.img, true, config_.strokes/2, seed + 2, &s.bg_strokes);
+      s.mask.assign(config_.W*config_.H, 0);
+    }
+    for (ClientSession& s : sessions_) {
+      MessageWriter request(kRequestCreate);
+      request.Put<int32_t>(s.img.W);
+      request.Put<int32_t>(s.img.H);
+      for (int c = 0; c < 3; ++c) {
+        request.PutBytes(s.img.channel(c), s.img.W*s.img.H);
+      }
+      vector<uint8_t> response;
+      if (!TimedCall(fd_, request, "create", &response, &latencies_, error)
+          || !MessageReader(response).Get(&s.id)) {
+        WaitForOthers(1);
+        return false;
+      }
+    }
+    {
+      lock_guard<mutex> lock(run_->lock);
+      for (const ClientSession& s : sessions_) {
+        run_->ids[s.index] = s.id;
+      }
+    }
+    WaitForOthers(1);
+    return true;
+  }
+
+  // Wait until all the clients are done with the phase : 1 to start the
+  // strokes of all the clients at the same time, 2 for the end of the
+  // strokes
+  void WaitForOthers(int phase) {
+    unique_lock<mutex> lock(run_->lock);
+    if (++run_->ready == phase*config_.clients) {
+      if (phase == 1) {
+        run_->start = steady_clock::now();
+      }
+      run_->all_ready.notify_all();
+    }
+    run_->all_ready.wait(lock, [this, phase] {
+      return run_->ready >= phase*config_.clients;
+    });
+  }
+
+  bool SendStrokes(string* error) {
+    vector<uint8_t> response;
+    for (int i = 0; i < config_.strokes; ++i) {
+      const bool background = (i % 2 == 1);
+      for (ClientSession& s : sessions_) {
+        const pair<Point2i, Point2i>& ends =
+            (background ? s.bg_strokes : s.fg_strokes)[i/2];
+        MessageWriter request(kRequestStroke);
+        request.Put(s.id);
+        request.Put<uint8_t>(background);
+        request.Put<int32_t>(config_.radius);
+        request.PutArray(vector<int32_t>{ends.first.x, ends.first.y,
+                                         ends.second.x, ends.second.y});
+        if (!TimedCall(fd_, request, "stroke", &response, &latencies_,
+                       error)) {
+          return false;
+        }
+        if (config_.shared) {
+          // The next session belongs to the next client
+          MessageWriter mask(kRequestGetMask);
+          mask.Put(run_->ids[(s.index + 1) % config_.sessions]);
+          if (!TimedCall(fd_, mask, "mask", &response, &latencies_, error)) {
+            return false;
+          }
+        }
+        if (!config_.delta) {
+          continue;
+        }
+        MessageWriter delta(kRequestGetDelta);
+        delta.Put(s.id);
+        if (!TimedCall(fd_, delta, "delta", &response, &latencies_, error)) {
+          return false;
+        }
+        if (!ApplyDelta(response, s.img.W, s.img.H, &s.mask)) {
+          *error = "Invalid delta";
+          return false;
+        }
+      }
+    }
+    lock_guard<mutex> lock(run_->lock);
+    run_->end = max(run_->end, steady_clock::now());
+    return true;
+  }
+
+  // Check the mirrored masks and close the sessions
+  bool Finish(string* error) {
+    vector<uint8_t> response;
+    for (ClientSession& s : sessions_) {
+      if (config_.delta) {
+        MessageWriter request(kRequestGetMask);
+        request.Put(s.id);
+        if (!Call(fd_, request, &response, error)) {
+          return false;
+        }
+        MessageReader reader(response);
+        int32_t W, H;
+        vector<uint32_t> runs;
+        vector<uint8_t> mask(s.img.W*s.img.H);
+        if (!reader.Get(&W) || !reader.Get(&H) || !reader.GetArray(&runs)
+            || !DecodeMaskRLE(runs, s.img.W, s.img.H, mask.data())) {
+          *error = "Invalid mask";
+          return false;
+        }
+        nmismatches_ += (mask != s.mask);
+      }
+      MessageWriter request(kRequestClose);
+      request.Put(s.id);
+      if (!Call(fd_, request, &response, error)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Config& config_;
+  const int index_;
+  Run* run_;
+  int fd_;
+  vector<ClientSession> sessions_;
+  Latencies latencies_;
+  int nmismatches_;
+};
+
+bool GetServerStats(const string& socket_path, vector<uint64_t>* stats) {
+  string error;
+  const int fd = ConnectUnixSocket(socket_path, &error);
+  if (fd < 0) {
+    return false;
+  }
+  vector<uint8_t> response;
+  const bool ok = Call(fd, MessageWriter(kRequestStats), &response, &error);
+  close(fd);
+  MessageReader reader(response);
+  stats->resize(6);
+  for (uint64_t& v : *stats) {
+    if (!ok || !reader.Get(&v)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Nearest-rank percentile of sorted values
+double Percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const size_t rank = (size_t)ceil(p / 100 * sorted.size());
+  return sorted[min(sorted.size() - 1, max<size_t>(rank, 1) - 1)];
+}
+
+void Usage(const char* argv0) {
+  cerr << "Usage : " << argv0 << " --socket=PATH [--clients=4]"
+       << " [--sessions=16] [--strokes=20] [--size=320x240] [--radius=3]"
+       << " [--delta=1] [--shared=0] [--seed=1] [--format=table|json]"
+       << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--socket", &value)) {
+      config->socket_path = value;
+    } else if (ParseFlag(argv[i], "--clients", &value)) {
+      config->clients = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--sessions", &value)) {
+      config->sessions = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--strokes", &value)) {
+      config->strokes = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--size", &value)) {
+      if (sscanf(value.c_str(), "%dx%d", &config->W, &config->H) != 2
+          || config->W < 20 || config->H < 20) {
+        return false;
+      }
+    } else if (ParseFlag(argv[i], "--radius", &value)) {
+      config->radius = max(0, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--delta", &value)) {
+      config->delta = atoi(value.c_str()) != 0;
+    } else if (ParseFlag(argv[i], "--shared", &value)) {
+      config->shared = atoi(value.c_str()) != 0;
+    } else if (ParseFlag(argv[i], "--seed", &value)) {
+      config->seed = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--format", &value)) {
+      config->format = value;
+    } else {
+      return false;
+    }
+  }
+  return !config->socket_path.empty()
+      && (config->format == "table" || config->format == "json");
+}
+
+const char* const kServerStatNames[] = {
+  "sessions", "resident", "resident_bytes", "max_bytes", "evictions",
+  "reloads"
+};
+
+void PrintTable(const Config& config, Latencies* latencies, double wall_s,
+                const vector<uint64_t>& server) {
+  const size_t nstrokes = (*latencies)["stroke"].size();
+  printf("clients %d, sessions %d, strokes %zu, wall %.3f s, "
+         "%.1f strokes/s\n", config.clients, config.sessions, nstrokes,
+         wall_s, (wall_s > 0) ? nstrokes / wall_s : 0);
+  printf("%-8s %8s %10s %10s %10s %10s\n", "request", "count", "p50_ms",
+         "p90_ms", "p99_ms", "max_ms");
+  for (auto& named : *latencies) {
+    vector<double>& v = named.second;
+    sort(v.begin(), v.end());
+    printf("%-8s %8zu %10.3f %10.3f %10.3f %10.3f\n", named.first.c_str(),
+           v.size(), Percentile(v, 50), Percentile(v, 90),
+           Percentile(v, 99), v.empty() ? 0 : v.back());
+  }
+  if (!server.empty()) {
+    printf("server :");
+    for (size_t i = 0; i < server.size(); ++i) {
+      printf(" %s %llu", kServerStatNames[i],
+             (unsigned long long)server[i]);
+    }
+    printf("\n");
+  }
+}
+
+void PrintJSON(const Config& config, Latencies* latencies, double wall_s,
+               const vector<uint64_t>& server) {
+  const size_t nstrokes = (*latencies)["stroke"].size();
+  printf("{\n  \"version\": 1,\n  \"clients\": %d,\n  \"sessions\": %d,\n"
+         "  \"strokes\": %zu,\n  \"wall_s\": %.6f,\n"
+         "  \"strokes_per_s\": %.6f,\n  \"latencies_ms\": {\n",
+         config.clients, config.sessions, nstrokes, wall_s,
+         (wall_s > 0) ? nstrokes / wall_s : 0);
+  size_t i = 0;
+  for (auto& named : *latencies) {
+    vector<double>& v = named.second;
+    sort(v.begin(), v.end());
+    printf("    \"%s\": {\"count\": %zu, \"p50\": %.6f, \"p90\": %.6f, "
+           "\"p99\": %.6f, \"max\": %.6f}%s\n", named.first.c_str(),
+           v.size(), Percentile(v, 50), Percentile(v, 90), Percentile(v, 99),
+           v.empty() ? 0 : v.back(),
+           (++i < latencies->size()) ? "," : "");
+  }
+  printf("  },\n  \"server\": {");
+  for (size_t i = 0; i < server.size(); ++i) {
+    printf("%s\"%s\": %llu", (i > 0) ? ", " : "", kServerStatNames[i],
+           (unsigned long long)server[i]);
+  }
+  printf("}\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+  config.clients = min(config.clients, config.sessions);
+
+  Run run;
+  run.ids.resize(config.sessions);
+  vector<unique_ptr<Client>> clients;
+  vector<thread> threads;
+  for (int i = 0; i < config.clients; ++i) {
+    clients.emplace_back(new Client(config, i, &run));
+    threads.push_back(thread(&Client::Main, clients.back().get()));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  const double wall_s = duration<double>(run.end - run.start).count();
+  for (const string& error : run.errors) {
+    cerr << error << endl;
+  }
+  if (run.nmismatches > 0) {
+    cerr << run.nmismatches << " mirrored masks differ from the server's"
+         << endl;
+  }
+
+  // The evictions and reloads are the ones since the server started
+  vector<uint64_t> server;
+  if (!GetServerStats(config.socket_path, &server)) {
+    server.clear();
+  }
+  if (config.format == "json") {
+    PrintJSON(config, &run.latencies, wall_s, server);
+  } else {
+    PrintTable(config, &run.latencies, wall_s, server);
+  }
+  return (run.errors.empty() && run.nmismatches == 0) ? 0 : 2;
+}
@@ -0,0 +1,286 @@
+// Deterministic replay of recorded interactive sessions (see recording.h),
+// to track the update latency users actually experience across versions,
+// and to reproduce the slow updates reported with a recording.
+//
+// Each recording is replayed on its image with the recorded modes, one call
+// at a time, and the time of each update (scribbles added by one call) is
+// compared with the recorded one. The final mask is compared with the
+// recorded mask, a difference meaning that the segmentation changed.
+//
+// The image is the one named by the recording, relative to the directory of
+// the recording if it isn't found as is, or --image. It is either a session
+// file (.lseg, see InteractiveMatter::SaveSession), whose lab planes are used
+// as is, or a PPM/PGM converted as segment_batch does. Recordings are only
+// replayed on the exact image they were made on.
+//
+// Reports, for each recording and for all of them, the p50, p99 and max
+// update latency as recorded and as replayed (over --repeat replays), and
+// the number of pixels whose label differs. Exits with 2 on any error or
+// difference.
+//
+// Usage :
+//   segment_replay --recordings=A.lrec,B.lrec [--image=PATH] [--repeat=1]
+//                  [--format=table|json]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "encoding.h"
+#include "flags.h"
+#include "netpbm.h"
+#include "recording.h"
+
+using namespace std;
+
+namespace {
+
+struct Config {
+  Config() : repeat(1), format("table") {}
+
+  vector<string> recordings;
+  string image;
+  int repeat;
+  string format;
+};
+
+struct Result {
+  Result() : nevents(0), mismatched(0) {}
+
+  string path;
+  size_t nevents;
+  // Time of the updates, sorted
+  vector<double> recorded_ms, replayed_ms;
+  // Pixels whose label differs from the recorded mask, in the worst replay
+  uint64_t mismatched;
+  // Set if the recording couldn't be replayed
+  string error;
+};
+
+bool EndsWith(const string& s, const string& suffix) {
+  return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool Exists(const string& path) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f) {
+    fclose(f);
+  }
+  return f != NULL;
+}
+
+// The path of the image of the recording at recording_path
+string ImagePath(const Config& config, const string& recording_path,
+                 const string& image) {
+  if (!config.image.empty()) {
+    return config.image;
+  }
+  const size_t slash = recording_path.rfind('/');
+  if (Exists(image) || image.empty() || image[0] == '/'
+      || slash == string::npos) {
+    return image;
+  }
+  return recording_path.substr(0, slash + 1) + image;
+}
+
+shared_ptr<const LabImage> LoadImage(const string& path, string* error) {
+  if (EndsWith(path, ".lseg")) {
+    unique_ptr<InteractiveMatter> session(
+        InteractiveMatter::LoadSession(path));
+    if (!session) {
+      *error = "Can't load the session " + path;
+      return nullptr;
+    }
+    return session->GetImage();
+  }
+  RawImage rgb;
+  if (!ReadNetpbm(path, &rgb, error)) {
+    return nullptr;
+  }
+  vector<uint8_t> lab[3];
+  RGBToLab(rgb, lab);
+  return LabImage::Create(lab[0].data(), lab[1].data(), lab[2].data(),
+                          rgb.W, rgb.H);
+}
+
+uint64_t CountMismatches(const SessionRecording& recording,
+                         const InteractiveMatter& matter) {
+  const int W = recording.W, H = recording.H;
+  vector<uint8_t> expected(W*H);
+  CHECK(DecodeMaskRLE(recording.final_mask, W, H, expected.data()));
+  const uint8_t* mask = matter.ForegroundMaskView();
+  uint64_t n = 0;
+  for (int i = 0; i < W*H; ++i) {
+    n += (expected[i] != 0) != (mask[i] != 0);
+  }
+  return n;
+}
+
+void Replay(const Config& config, const string& path, Result* result) {
+  result->path = path;
+  SessionRecording recording;
+  if (!LoadRecording(path, &recording)) {
+    result->error = path + " is not a valid recording";
+    return;
+  }
+  result->nevents = recording.events.size();
+  const string image_path = ImagePath(config, path, recording.image);
+  const shared_ptr<const LabImage> image = LoadImage(image_path,
+                                                     &result->error);
+  if (!image) {
+    return;
+  }
+  for (int r = 0; r < config.repeat; ++r) {
+    string error;
+    unique_ptr<InteractiveMatter> matter = NewReplayMatter(recording, image,
+                                                           &error);
+    if (!matter) {
+      result->error = path + " : " + error + " (" + image_path + ")";
+      return;
+    }
+    // Don't time the background precomputations
+    matter->Ready().wait();
+    vector<double> event_ms;
+    ReplayRecording(recording, matter.get(), &event_ms);
+    for (size_t i = 0; i < recording.events.size(); ++i) {
+      if (recording.events[i].op == RecordedEvent::kScribbles) {
+        result->replayed_ms.push_back(event_ms[i]);
+      }
+    }
+    result->mismatched = max(result->mismatched,
+                             CountMismatches(recording, *matter));
+  }
+  for (const RecordedEvent& event : recording.events) {
+    if (event.op == RecordedEvent::kScribbles) {
+      result->recorded_ms.push_back(event.ms);
+    }
+  }
+  sort(result->recorded_ms.begin(), result->recorded_ms.end());
+  sort(result->replayed_ms.begin(), result->replayed_ms.end());
+}
+
+// Nearest-rank percentile of sorted values
+double Percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const size_t rank = (size_t)ceil(p / 100 * sorted.size());
+  return sorted[min(sorted.size() - 1, max<size_t>(rank, 1) - 1)];
+}
+
+double Max(const vector<double>& sorted) {
+  return sorted.empty() ? 0 : sorted.back();
+}
+
+// All the results as one
+Result Total(const vector<Result>& results) {
+  Result total;
+  total.path = "all";
+  for (const Result& r : results) {
+    total.nevents += r.nevents;
+    total.recorded_ms.insert(total.recorded_ms.end(), r.recorded_ms.begin(),
+                             r.recorded_ms.end());
+    total.replayed_ms.insert(total.replayed_ms.end(), r.replayed_ms.begin(),
+                             r.replayed_ms.end());
+    total.mismatched += r.mismatched;
+  }
+  sort(total.recorded_ms.begin(), total.recorded_ms.end());
+  sort(total.replayed_ms.begin(), total.replayed_ms.end());
+  return total;
+}
+
+void Usage(const char* argv0) {
+  cerr << "Usage : " << argv0 << " --recordings=A.lrec,B.lrec"
+       << " [--image=PATH] [--repeat=1] [--format=table|json]" << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--recordings", &value)) {
+      SplitList(value, &config->recordings);
+    } else if (ParseFlag(argv[i], "--image", &value)) {
+      config->image = value;
+    } else if (ParseFlag(argv[i], "--repeat", &value)) {
+      config->repeat = max(1, atoi(value.c_str()));
+    } else if (ParseFlag(argv[i], "--format", &value)) {
+      config->format = value;
+    } else {
+      return false;
+    }
+  }
+  return !config->recordings.empty()
+      && (config->format == "table" || config->format == "json");
+}
+
+void PrintTable(const vector<Result>& results) {
+  printf("%-24s %7s %8s %9s %9s %9s %9s %9s %9s %10s\n", "recording",
+         "events", "updates", "rec_p50", "rec_p99", "rec_max", "p50_ms",
+         "p99_ms", "max_ms", "mismatched");
+  for (const Result& r : results) {
+    printf("%-24s %7zu %8zu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %10llu\n",
+           r.path.c_str(), r.nevents, r.recorded_ms.size(),
+           Percentile(r.recorded_ms, 50), Percentile(r.recorded_ms, 99),
+           Max(r.recorded_ms), Percentile(r.replayed_ms, 50),
+           Percentile(r.replayed_ms, 99), Max(r.replayed_ms),
+           (unsigned long long)r.mismatched);
+  }
+}
+
+void PrintJSON(const vector<Result>& results, int repeat) {
+  printf("{\n  \"version\": 1,\n  \"repeat\": %d,\n  \"recordings\": [\n",
+         repeat);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    printf("    {\"recording\": \"%s\", \"events\": %zu, \"updates\": %zu, "
+           "\"recorded_ms\": {\"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f}, "
+           "\"replayed_ms\": {\"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f}, "
+           "\"mismatched\": %llu}%s\n", r.path.c_str(), r.nevents,
+           r.recorded_ms.size(), Percentile(r.recorded_ms, 50),
+           Percentile(r.recorded_ms, 99), Max(r.recorded_ms),
+           Percentile(r.replayed_ms, 50), Percentile(r.replayed_ms, 99),
+           Max(r.replayed_ms), (unsigned long long)r.mismatched,
+           (i + 1 < results.size()) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+  vector<Result> results(config.recordings.size());
+  bool ok = true;
+  for (size_t i = 0; i < config.recordings.size(); ++i) {
+    Replay(config, config.recordings[i], &results[i]);
+    if (!results[i].error.empty()) {
+      cerr << results[i].error << endl;
+      ok = false;
+    } else if (results[i].mismatched > 0) {
+      cerr << results[i].path << " : " << results[i].mismatched
+           << " pixels differ from the recorded mask" << endl;
+      ok = false;
+    }
+  }
+  if (results.size() > 1) {
+    results.push_back(Total(results));
+  }
+  if (config.format == "json") {
+    PrintJSON(results, config.repeat);
+  } else {
+    PrintTable(results);
+  }
+  return ok ? 0 : 2;
+}
@@ -0,0 +1,559 @@
+// Segmentation daemon. Hosts InteractiveMatter sessions for the local
+// processes (e.g. of a web tier) that connect to its Unix domain socket,
+// see protocol.h for the requests : create a session, add a stroke, fetch
+// the mask or the changes since the last fetch, close the session.
+//
+// The sessions are kept in memory within --max-memory-mb, as accounted by
+// Matter::MemoryUsage plus the image. Beyond that, the least recently used
+// sessions are evicted : saved to a session file in --snapshot-dir (see
+// InteractiveMatter::SaveSession) and freed. The next request on an evicted
+// session loads it back, memory-mapped so that only the pages it touches are
+// read, and gets the same results as if it had stayed in memory. The files
+// are removed once loaded back, when the session is closed and when the
+// server stops (on SIGINT or SIGTERM).
+//
+// Each connection is served by its own thread. Requests on different
+// sessions run concurrently, the ones on the same session one at a time.
+//
+// Usage :
+//   segment_server --socket=PATH [--snapshot-dir=/tmp]
+//                  [--max-memory-mb=512]
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "api.h"
+#include "encoding.h"
+#include "flags.h"
+#include "image.h"
+#include "protocol.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Config {
+  Config() : snapshot_dir("/tmp"), max_memory_mb(512) {}
+
+  string socket_path;
+  string snapshot_dir;
+  int max_memory_mb;
+};
+
+struct Session {
+  Session(uint64_t id, const string& snapshot_path)
+    : id(id), snapshot_path(snapshot_path), has_snapshot(false),
+      delta_full(false), bytes(0), pins(0), in_lru(false), closed(false) {}
+
+  ~Session() {
+    if (has_snapshot) {
+      unlink(snapshot_path.c_str());
+    }
+  }
+
+  const uint64_t id;
+  const string snapshot_path;
+
+  // Guards matter, has_snapshot and delta_full. Taken before the cache
+  // mutex when both are held
+  mutex lock;
+  // NULL while evicted
+  unique_ptr<InteractiveMatter> matter;
+  bool has_snapshot;
+  // The next kRequestGetDelta must send the whole mask, as the changes
+  // tracked by matter don't start from the previous one
+  bool delta_full;
+
+  // Guarded by the cache mutex. bytes is what the session accounts for in
+  // the cache, 0 while evicted. A session is pinned while a request or an
+  // eviction uses it, and is only picked for eviction when not pinned. Until
+  // it is closed, the accounting of a session is only changed with its lock
+  // held, so that it matches matter
+  size_t bytes;
+  int pins;
+  bool in_lru;
+  list<Session*>::iterator lru_pos;
+  bool closed;
+};
+
+typedef shared_ptr<Session> SessionPtr;
+
+struct CacheStats {
+  uint64_t sessions, resident, resident_bytes, max_bytes;
+  uint64_t evictions, reloads;
+};
+
+class SessionCache {
+ public:
+  SessionCache(const string& snapshot_dir, size_t max_bytes)
+    : snapshot_dir_(snapshot_dir), max_bytes_(max_bytes), next_id_(1),
+      resident_bytes_(0), evictions_(0), reloads_(0) {}
+
+  // Add a session for the image and return its id
+  uint64_t Create(const shared_ptr<const LabImage>& image) {
+    unique_ptr<InteractiveMatter> matter(new InteractiveMatter(image));
+    const size_t bytes = Bytes(*matter);
+    vector<SessionPtr> victims;
+    uint64_t id;
+    {
+      lock_guard<mutex> lock(mutex_);
+      id = next_id_++;
+      ostringstream path;
+      path << snapshot_dir_ << "/segment_server." << getpid() << "." << id
+           << ".lseg";
+      SessionPtr s(new Session(id, path.str()));
+      s->matter = move(matter);
+      sessions_[id] = s;
+      Account(s.get(), bytes);
+      PickVictims(&victims);
+    }
+    Evict(victims);
+    return id;
+  }
+
+  // Run f on the session, loading it back first if it was evicted. Returns
+  // false and sets error if there is no such session or it can't be loaded.
+  bool With(uint64_t id, const function<void(Session*)>& f, string* error) {
+    SessionPtr s;
+    {
+      lock_guard<mutex> lock(mutex_);
+      auto it = sessions_.find(id);
+      if (it == sessions_.end()) {
+        *error = "No session " + to_string(id);
+        return false;
+      }
+      s = it->second;
+      ++s->pins;
+    }
+    size_t bytes = 0;
+    bool reloaded = false;
+    vector<SessionPtr> victims;
+    {
+      lock_guard<mutex> lock(s->lock);
+      if (!s->matter) {
+        s->matter.reset(InteractiveMatter::LoadSession(s->snapshot_path));
+        if (s->matter) {
+          // The mapping stays valid, and the next eviction writes a new file
+          unlink(s->snapshot_path.c_str());
+          s->has_snapshot = false;
+          s->delta_full = true;
+          reloaded = true;
+        }
+      }
+      if (s->matter) {
+        f(s.get());
+        bytes = Bytes(*s->matter);
+      } else {
+        *error = "Can't load the snapshot of session " + to_string(id);
+      }
+      lock_guard<mutex> cache_lock(mutex_);
+      --s->pins;
+      reloads_ += reloaded;
+      if (bytes > 0 && !s->closed) {
+        Account(s.get(), bytes);
+        PickVictims(&victims);
+      }
+    }
+    Evict(victims);
+    return bytes > 0;
+  }
+
+  bool Close(uint64_t id) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+      return false;
+    }
+    Session* s = it->second.get();
+    s->closed = true;
+    Account(s, 0);
+    // The snapshot is removed with the last reference to the session
+    sessions_.erase(it);
+    return true;
+  }
+
+  CacheStats Stats() {
+    lock_guard<mutex> lock(mutex_);
+    CacheStats stats;
+    stats.sessions = sessions_.size();
+    stats.resident = lru_.size();
+    stats.resident_bytes = resident_bytes_;
+    stats.max_bytes = max_bytes_;
+    stats.evictions = evictions_;
+    stats.reloads = reloads_;
+    return stats;
+  }
+
+ private:
+  static size_t Bytes(const InteractiveMatter& matter) {
+    return matter.MemoryUsage()
+        + 3*(size_t)matter.GetWidth()*matter.GetHeight();
+  }
+
+  // Set the bytes accounted for s, moving it to the front of the LRU list
+  // if it is resident (bytes > 0) and removing it otherwise. Called with
+  // mutex_ held.
+  void Account(Session* s, size_t bytes) {
+    resident_bytes_ += bytes;
+    resident_bytes_ -= s->bytes;
+    s->bytes = bytes;
+    if (s->in_lru) {
+      lru_.erase(s->lru_pos);
+      s->in_lru = false;
+    }
+    if (bytes > 0) {
+      lru_.push_front(s);
+      s->lru_pos = lru_.begin();
+      s->in_lru = true;
+    }
+  }
+
+  // Take the least recently used unpinned sessions out of the cache until
+  // it fits in max_bytes_, pinning them for Evict. Called with mutex_ held.
+  void PickVictims(vector<SessionPtr>* victims) {
+    auto it = lru_.end();
+    while (resident_bytes_ > max_bytes_ && it != lru_.begin()) {
+      Session* s = *--it;
+      if (s->pins > 0) {
+        continue;
+      }
+      ++s->pins;
+      victims->push_back(sessions_[s->id]);
+      it = lru_.erase(it);
+      s->in_lru = false;
+      resident_bytes_ -= s->bytes;
+      s->bytes = 0;
+    }
+  }
+
+  // Save the victims to their snapshot and free them. A request that ran on
+  // a victim since it was picked has put it back in the cache, and it is
+  // then kept. Closed victims are left to be freed with their last
+  // reference.
+  void Evict(const vector<SessionPtr>& victims) {
+    for (const SessionPtr& s : victims) {
+      lock_guard<mutex> lock(s->lock);
+      {
+        lock_guard<mutex> cache_lock(mutex_);
+        if (s->in_lru || !s->matter || s->closed) {
+          --s->pins;
+          continue;
+        }
+      }
+      size_t bytes = 0;
+      if (s->matter->SaveSession(s->snapshot_path)) {
+        s->matter.reset();
+        s->has_snapshot = true;
+      } else {
+        LOG(ERROR) << "Can't write " << s->snapshot_path
+                   << ", keeping session " << s->id << " in memory";
+        unlink(s->snapshot_path.c_str());
+        bytes = Bytes(*s->matter);
+      }
+      lock_guard<mutex> cache_lock(mutex_);
+      --s->pins;
+      if (bytes == 0) {
+        ++evictions_;
+      } else if (!s->closed) {
+        Account(s.get(), bytes);
+      }
+    }
+  }
+
+  const string snapshot_dir_;
+  const size_t max_bytes_;
+
+  mutex mutex_;
+  map<uint64_t, SessionPtr> sessions_;
+  uint64_t next_id_;
+  // The resident sessions, most recently used first
+  list<Session*> lru_;
+  size_t resident_bytes_;
+  uint64_t evictions_, reloads_;
+};
+
+vector<uint8_t> ErrorResponse(const string& message) {
+  MessageWriter response(kStatusError);
+  response.PutBytes(message.data(), message.size());
+  return response.data();
+}
+
+void PutMask(const InteractiveMatter& matter, MessageWriter* response) {
+  vector<uint32_t> runs;
+  matter.GetForegroundMaskRLE(&runs);
+  response->Put<int32_t>(matter.GetWidth());
+  response->Put<int32_t>(matter.GetHeight());
+  response->PutArray(runs);
+}
+
+vector<uint8_t> HandleCreate(SessionCache* cache, MessageReader* request) {
+  int32_t W, H;
+  if (!request->Get(&W) || !request->Get(&H) || W <= 0 || H <= 0
+      || (uint64_t)W*H > kMaxMessageSize / 3) {
+    return ErrorResponse("Invalid image size");
+  }
+  vector<uint8_t> lab[3];
+  for (int c = 0; c < 3; ++c) {
+    lab[c].resize(W*H);
+    if (!request->GetBytes(lab[c].data(), W*H)) {
+      return ErrorResponse("Truncated image");
+    }
+  }
+  const uint64_t id = cache->Create(
+      LabImage::Create(lab[0].data(), lab[1].data(), lab[2].data(), W, H));
+  MessageWriter response(kStatusOk);
+  response.Put(id);
+  return response.data();
+}
+
+vector<uint8_t> HandleStroke(SessionCache* cache, uint64_t id,
+                             MessageReader* request) {
+  uint8_t background;
+  int32_t radius;
+  vector<int32_t> xy;
+  if (!request->Get(&background) || !request->Get(&radius)
+      || !request->GetArray(&xy) || radius < 0 || xy.size() % 2 != 0) {
+    return ErrorResponse("Invalid stroke");
+  }
+  MessageWriter response(kStatusOk);
+  string error;
+  const bool found = cache->With(id, [&](Session* s) {
+    // Nothing beyond the image plus the radius is drawn, and bounding the
+    // coordinates keeps RasterizeStroke from overflowing
+    const int W = s->matter->GetWidth(), H = s->matter->GetHeight();
+    Stroke stroke;
+    stroke.background = background != 0;
+    stroke.radius = min<int32_t>(radius, max(W, H));
+    for (size_t i = 0; i < xy.size(); i += 2) {
+      stroke.points.push_back(
+          Point2i(min(max(xy[i], -stroke.radius), W - 1 + stroke.radius),
+                  min(max(xy[i + 1], -stroke.radius),
+                      H - 1 + stroke.radius)));
+    }
+    const auto start = steady_clock::now();
+    size_t nconflicts;
+    const size_t npixels = s->matter->AddStroke(stroke, &nconflicts);
+    response.Put<uint32_t>(npixels);
+    response.Put<uint32_t>(nconflicts);
+    response.Put<double>(
+        duration<double, milli>(steady_clock::now() - start).count());
+  }, &error);
+  return found ? response.data() : ErrorResponse(error);
+}
+
+vector<uint8_t> HandleGetDelta(SessionCache* cache, uint64_t id) {
+  MessageWriter response(kStatusOk);
+  string error;
+  const bool found = cache->With(id, [&](Session* s) {
+    response.Put<uint8_t>(s->delta_full);
+    if (s->delta_full) {
+      PutMask(*s->matter, &response);
+      s->delta_full = false;
+    } else {
+      vector<RowSpan> spans;
+      s->matter->GetChangedSpans(&spans);
+      vector<int32_t> yxx;
+      for (const RowSpan& span : spans) {
+        yxx.push_back(span.y);
+        yxx.push_back(span.x0);
+        yxx.push_back(span.x1);
+      }
+      response.PutArray(yxx);
+    }
+    s->matter->ClearChanges();
+  }, &error);
+  return found ? response.data() : ErrorResponse(error);
+}
+
+vector<uint8_t> Handle(SessionCache* cache,
+                       const vector<uint8_t>& payload) {
+  MessageReader request(payload);
+  uint8_t type;
+  if (!request.Get(&type)) {
+    return ErrorResponse("Empty request");
+  }
+  if (type == kRequestCreate) {
+    return HandleCreate(cache, &request);
+  }
+  if (type == kRequestStats) {
+    const CacheStats stats = cache->Stats();
+    MessageWriter response(kStatusOk);
+    for (uint64_t v : {stats.sessions, stats.resident, stats.resident_bytes,
+                       stats.max_bytes, stats.evictions, stats.reloads}) {
+      response.Put(v);
+    }
+    return response.data();
+  }
+
+  // The other requests are on a session
+  uint64_t id;
+  if (!request.Get(&id)) {
+    return ErrorResponse("Missing session id");
+  }
+  switch (type) {
+    case kRequestStroke:
+      return HandleStroke(cache, id, &request);
+    case kRequestGetMask: {
+      MessageWriter response(kStatusOk);
+      string error;
+      const bool found = cache->With(id, [&](Session* s) {
+        PutMask(*s->matter, &response);
+      }, &error);
+      return found ? response.data() : ErrorResponse(error);
+    }
+    case kRequestGetDelta:
+      return HandleGetDelta(cache, id);
+    case kRequestClose:
+      return cache->Close(id) ? MessageWriter(kStatusOk).data()
+                              : ErrorResponse("No session " + to_string(id));
+    default:
+      return ErrorResponse("Unknown request type " + to_string(type));
+  }
+}
+
+void Serve(SessionCache* cache, int fd, atomic<bool>* done) {
+  vector<uint8_t> request;
+  while (ReceiveMessage(fd, &request)) {
+    if (!SendMessage(fd, Handle(cache, request))) {
+      break;
+    }
+  }
+  *done = true;
+}
+
+struct Connection {
+  int fd;
+  thread server;
+  unique_ptr<atomic<bool>> done;
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void OnStopSignal(int) {
+  stop_requested = 1;
+}
+
+int Listen(const string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    cerr << "Socket path too long : " << path << endl;
+    return -1;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // Remove the socket of a previous run
+  unlink(path.c_str());
+  if (fd < 0
+      || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(fd, 64) != 0) {
+    cerr << "Can't listen on " << path << " : " << strerror(errno) << endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+void Usage(const char* argv0) {
+  cerr << "Usage : " << argv0 << " --socket=PATH [--snapshot-dir=/tmp]"
+       << " [--max-memory-mb=512]" << endl;
+}
+
+bool ParseArgs(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--socket", &value)) {
+      config->socket_path = value;
+    } else if (ParseFlag(argv[i], "--snapshot-dir", &value)) {
+      config->snapshot_dir = value;
+    } else if (ParseFlag(argv[i], "--max-memory-mb", &value)) {
+      config->max_memory_mb = max(0, atoi(value.c_str()));
+    } else {
+      return false;
+    }
+  }
+  return !config->socket_path.empty();
+}
+
+}
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseArgs(argc, argv, &config)) {
+    Usage(argv[0]);
+    return 1;
+  }
+  const int listen_fd = Listen(config.socket_path);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  signal(SIGINT, OnStopSignal);
+  signal(SIGTERM, OnStopSignal);
+  LOG(INFO) << "Listening on " << config.socket_path;
+
+  SessionCache cache(config.snapshot_dir,
+                     (size_t)config.max_memory_mb << 20);
+  list<Connection> connections;
+  while (!stop_requested) {
+    // Wake up periodically to check for stop_requested
+    pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    // Reap the finished connections
+    for (auto it = connections.begin(); it != connections.end();) {
+      if (*it->done) {
+        it->server.join();
+        close(it->fd);
+        it = connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    connections.emplace_back();
+    Connection& c = connections.back();
+    c.fd = fd;
+    c.done.reset(new atomic<bool>(false));
+    c.server = thread(Serve, &cache, fd, c.done.get());
+  }
+
+  LOG(INFO) << "Stopping";
+  close(listen_fd);
+  unlink(config.socket_path.c_str());
+  for (Connection& c : connections) {
+    shutdown(c.fd, SHUT_RDWR);
+    c.server.join();
+    close(c.fd);
+  }
+  return 0;
+}
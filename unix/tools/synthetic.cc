@@ -0,0 +1,134 @@
+#include "synthetic.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+// Small deterministic generator, so that results don't depend on the
+// standard library implementation
+class Rng {
+ public:
+  explicit Rng(unsigned seed) : state_(seed*2654435761u + 1) {}
+
+  uint32_t Next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+
+  // Uniform in [0, 1)
+  double Uniform() {
+    return (Next() >> 8) / 16777216.0;
+  }
+
+  // Approximately normal, mean 0 and standard deviation 1
+  double Normal() {
+    double s = 0;
+    for (int i = 0; i < 12; ++i) {
+      s += Uniform();
+    }
+    return s - 6;
+  }
+
+ private:
+  uint32_t state_;
+};
+
+uint8_t Clamp(double v) {
+  return (uint8_t)max(0.0, min(255.0, v + 0.5));
+}
+
+}
+
+void MakeSyntheticImage(int W, int H, unsigned seed, double noise,
+                        SyntheticImage* img) {
+  Rng rng(seed);
+  img->W = W;
+  img->H = H;
+  img->l.resize(W*H);
+  img->a.resize(W*H);
+  img->b.resize(W*H);
+  img->truth.resize(W*H);
+
+  const double cx = W*(0.45 + 0.1*rng.Uniform());
+  const double cy = H*(0.45 + 0.1*rng.Uniform());
+  const double rx = W*0.3, ry = H*0.3;
+  // Holes in the foreground
+  const int kHoles = 3;
+  double hx[kHoles], hy[kHoles], hr[kHoles];
+  for (int k = 0; k < kHoles; ++k) {
+    const double angle = 2*M_PI*k/kHoles;
+    hx[k] = cx + 0.5*rx*cos(angle);
+    hy[k] = cy + 0.5*ry*sin(angle);
+    hr[k] = 0.12*min(rx, ry);
+  }
+  // Texture period, relative to the image size so that the image looks the
+  // same at all resolutions
+  const double period = max(W, H) / 20.0;
+
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      const double ex = (x - cx)/rx, ey = (y - cy)/ry;
+      bool fg = ex*ex + ey*ey < 1;
+      for (int k = 0; k < kHoles && fg; ++k) {
+        const double dx = x - hx[k], dy = y - hy[k];
+        fg = dx*dx + dy*dy >= hr[k]*hr[k];
+      }
+      const double texture = sin(x/period)*cos(y/period);
+      const int i = y*W + x;
+      img->truth[i] = fg ? 255 : 0;
+      if (fg) {
+        img->l[i] = Clamp(150 + 30*texture + noise*rng.Normal());
+        img->a[i] = Clamp(150 + 10*texture);
+        img->b[i] = Clamp(140);
+      } else {
+        img->l[i] = Clamp(90 + 40*texture + noise*rng.Normal());
+        img->a[i] = Clamp(120 + 10*texture);
+        img->b[i] = Clamp(110 + 20*texture);
+      }
+    }
+  }
+}
+
+void MakeSyntheticScribbles(const SyntheticImage& img, bool background,
+                            double coverage, unsigned seed,
+                            vector<Scribble>* scribbles) {
+  Rng rng(seed);
+  const int W = img.W, H = img.H;
+  const uint8_t label = background ? 0 : 255;
+  scribbles->clear();
+  const long target = max(1L, (long)(coverage*W*H));
+  long total = 0;
+  // Stroke length and number of attempts, so that this always terminates
+  const int length = max(2, W/10);
+  for (int attempt = 0; attempt < 100000 && total < target; ++attempt) {
+    const int y = rng.Next() % H;
+    const int x0 = rng.Next() % W;
+    Scribble s;
+    s.background = background;
+    for (int x = x0; x < min(W, x0 + length) && total < target; ++x) {
+      if (img.truth[y*W + x] != label) {
+        break;
+      }
+      s.pixels.push_back(Point2i(x, y));
+      ++total;
+    }
+    if (!s.pixels.empty()) {
+      scribbles->push_back(s);
+    }
+  }
+}
+
+void ScribblesToMask(const vector<Scribble>& scribbles, int W, int H,
+                     vector<uint8_t>* mask) {
+  mask->assign(W*H, 0);
+  for (const Scribble& s : scribbles) {
+    for (const Point2i& p : s.pixels) {
+      (*mask)[p.y*W + p.x] = 255;
+    }
+  }
+}
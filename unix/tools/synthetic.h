@@ -0,0 +1,41 @@
+#ifndef _LIBMATTING_TOOLS_SYNTHETIC_H_
+#define _LIBMATTING_TOOLS_SYNTHETIC_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Deterministic synthetic test images for the benchmarks and evaluation
+// tools, so that they don't depend on image files or OpenCV.
+//
+// The image is a lab image with a foreground ellipse (with a few holes) over
+// a textured background. Both have different but overlapping color
+// distributions and some noise, so the matting has actual work to do.
+struct SyntheticImage {
+  int W, H;
+  std::vector<uint8_t> l, a, b;
+  // Ground truth, 255 for foreground
+  std::vector<uint8_t> truth;
+
+  uint8_t* channel(int i) {
+    return (i == 0) ? l.data() : ((i == 1) ? a.data() : b.data());
+  }
+};
+
+// noise is the standard deviation of the noise added to the l channel
+void MakeSyntheticImage(int W, int H, unsigned seed, double noise,
+                        SyntheticImage* img);
+
+// Horizontal strokes inside the foreground (or background) of the ground
+// truth, covering about coverage * W * H pixels in total, one scribble per
+// stroke
+void MakeSyntheticScribbles(const SyntheticImage& img, bool background,
+                            double coverage, unsigned seed,
+                            std::vector<Scribble>* scribbles);
+
+// Rasterize the scribbles in a W*H mask (255 where scribbled)
+void ScribblesToMask(const std::vector<Scribble>& scribbles, int W, int H,
+                     std::vector<uint8_t>* mask);
+
+#endif